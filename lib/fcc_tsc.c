@@ -0,0 +1,89 @@
+/*
+ * lib/fcc_tsc.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runtime for programs compiled with -finstrument-functions-rdtsc.
+ *
+ * Link this file into the program alongside the code generated by fcc.
+ * Each instrumented function has a timing record in the fcc_tsc section,
+ * the bounds of which are provided by the linker. When the program exits,
+ * a flat profile of the records, sorted by exclusive cycles, is printed
+ * to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Cycles spent in the callees of the running function. */
+unsigned long long __fcc_tsc_child;
+
+struct tsc_record {
+	union {
+		const char              *name;
+		unsigned long long      pad;
+	} fn;
+	unsigned long long      calls;
+	unsigned long long      incl;
+	unsigned long long      excl;
+};
+
+extern struct tsc_record __start_fcc_tsc[] __attribute__((weak));
+extern struct tsc_record __stop_fcc_tsc[] __attribute__((weak));
+
+static int record_cmp(const void *a, const void *b)
+{
+	const struct tsc_record *r = a, *s = b;
+
+	if (r->excl != s->excl)
+		return r->excl < s->excl ? 1 : -1;
+	return 0;
+}
+
+/* tsc_report: print the flat profile of all timed functions */
+static void __attribute__((destructor)) tsc_report(void)
+{
+	struct tsc_record *recs;
+	unsigned long long total;
+	size_t n, i;
+
+	if (!__start_fcc_tsc || __stop_fcc_tsc <= __start_fcc_tsc)
+		return;
+
+	n = __stop_fcc_tsc - __start_fcc_tsc;
+	if (!(recs = malloc(n * sizeof *recs)))
+		return;
+	for (i = 0; i < n; ++i)
+		recs[i] = __start_fcc_tsc[i];
+	qsort(recs, n, sizeof *recs, record_cmp);
+
+	total = 0;
+	for (i = 0; i < n; ++i)
+		total += recs[i].excl;
+
+	fprintf(stderr, "%6s %16s %16s %12s %12s  %s\n", "%time", "self",
+	        "total", "calls", "self/call", "name");
+	for (i = 0; i < n; ++i) {
+		if (!recs[i].calls)
+			continue;
+		fprintf(stderr, "%6.2f %16llu %16llu %12llu %12llu  %s\n",
+		        total ? 100.0 * recs[i].excl / total : 0.0,
+		        recs[i].excl, recs[i].incl, recs[i].calls,
+		        recs[i].excl / recs[i].calls, recs[i].fn.name);
+	}
+	free(recs);
+}
@@ -21,20 +21,44 @@
 #include "asg.h"
 #include "error.h"
 
+/*
+ * split_init:
+ * Remove the initializers from the declarators in `ast`, appending
+ * statements which perform them to `init`.
+ */
+static struct ast_node *split_init(struct ast_node *ast,
+                                   struct graph_node **init)
+{
+	if (ast->tag == EXPR_ASSIGN) {
+		*init = asg_append(*init, create_statement(ast));
+		return ast_copy(ast->left);
+	}
+
+	if (ast->tag == EXPR_COMMA) {
+		ast->left = split_init(ast->left, init);
+		ast->right = split_init(ast->right, init);
+	}
+
+	return ast;
+}
+
 /*
  * create_declaration:
- * Create a graph node representing a declaration of variable(s).
+ * Create a graph node representing a declaration of variable(s),
+ * followed by the statements initializing any of them.
  */
 struct graph_node *create_declaration(struct ast_node *ast)
 {
 	struct asg_node_statement *s;
+	struct graph_node *init;
 
+	init = NULL;
 	s = malloc(sizeof *s);
 	s->type = ASG_NODE_DECLARATION;
 	s->next = NULL;
-	s->ast = ast;
+	s->ast = split_init(ast, &init);
 
-	return (struct graph_node *)s;
+	return asg_append((struct graph_node *)s, init);
 }
 
 /*
@@ -71,6 +95,7 @@ struct graph_node *create_conditional(struct ast_node *cond,
 	c->cond = cond;
 	c->succ = success;
 	c->fail = failure;
+	c->prof = -1;
 
 	return (struct graph_node *)c;
 }
@@ -95,6 +120,7 @@ struct graph_node *create_for_loop(struct ast_node *init,
 	f->cond = cond;
 	f->post = post;
 	f->body = body;
+	f->prof = -1;
 
 	return (struct graph_node *)f;
 }
@@ -118,6 +144,7 @@ struct graph_node *create_while_loop(int while_type,
 	w->next = NULL;
 	w->cond = cond;
 	w->body = body;
+	w->prof = -1;
 
 	return (struct graph_node *)w;
 }
@@ -139,6 +166,57 @@ struct graph_node *create_return(struct ast_node *retval)
 	return (struct graph_node *)r;
 }
 
+/*
+ * create_switch:
+ * Create a graph node representing a switch statement which
+ * dispatches on the value of `expr` to the labels within `body`.
+ */
+struct graph_node *create_switch(struct ast_node *expr,
+                                 struct graph_node *body)
+{
+	struct asg_node_switch *s;
+
+	s = malloc(sizeof *s);
+	s->type = ASG_NODE_SWITCH;
+	s->next = NULL;
+	s->expr = expr;
+	s->body = body;
+
+	return (struct graph_node *)s;
+}
+
+/*
+ * create_case:
+ * Create a graph node representing a case label with constant `value`,
+ * or a default label if `value` is NULL.
+ */
+struct graph_node *create_case(struct ast_node *value)
+{
+	struct asg_node_case *c;
+
+	c = malloc(sizeof *c);
+	c->type = ASG_NODE_CASE;
+	c->next = NULL;
+	c->value = value;
+
+	return (struct graph_node *)c;
+}
+
+/*
+ * create_break:
+ * Create a graph node representing a break statement.
+ */
+struct graph_node *create_break(void)
+{
+	struct graph_node *b;
+
+	b = malloc(sizeof *b);
+	b->type = ASG_NODE_BREAK;
+	b->next = NULL;
+
+	return b;
+}
+
 /*
  * asg_append:
  * Append node `n` to the end of the ASG starting at `head`.
@@ -155,13 +233,141 @@ struct graph_node *asg_append(struct graph_node *head, struct graph_node *n)
 	for (curr = head; curr->next; curr = curr->next)
 		;
 
-	if (curr->type == ASG_NODE_RETURN)
+	/* A case label makes the code following a jump reachable again. */
+	if ((curr->type == ASG_NODE_RETURN || curr->type == ASG_NODE_BREAK)
+	    && n && n->type != ASG_NODE_CASE)
 		warning_unreachable(n);
 
 	curr->next = n;
 	return head;
 }
 
+/*
+ * asg_copy:
+ * Create a deep copy of the ASG starting at `g`,
+ * including all of the expressions within it.
+ */
+struct graph_node *asg_copy(struct graph_node *g)
+{
+	struct asg_node_conditional *c;
+	struct asg_node_statement *s;
+	struct asg_node_switch *sw;
+	struct asg_node_return *r;
+	struct asg_node_while *w;
+	struct asg_node_for *f;
+	struct graph_node *n;
+
+	if (!g)
+		return NULL;
+
+	switch (g->type) {
+	case ASG_NODE_DECLARATION:
+	case ASG_NODE_STATEMENT:
+		s = (struct asg_node_statement *)g;
+		n = g->type == ASG_NODE_STATEMENT
+		    ? create_statement(ast_copy(s->ast))
+		    : create_declaration(ast_copy(s->ast));
+		break;
+	case ASG_NODE_CONDITIONAL:
+		c = (struct asg_node_conditional *)g;
+		n = create_conditional(ast_copy(c->cond), asg_copy(c->succ),
+		                       asg_copy(c->fail));
+		((struct asg_node_conditional *)n)->prof = c->prof;
+		break;
+	case ASG_NODE_FOR:
+		f = (struct asg_node_for *)g;
+		n = create_for_loop(ast_copy(f->init), ast_copy(f->cond),
+		                    ast_copy(f->post), asg_copy(f->body));
+		((struct asg_node_for *)n)->prof = f->prof;
+		break;
+	case ASG_NODE_WHILE:
+	case ASG_NODE_DO_WHILE:
+		w = (struct asg_node_while *)g;
+		n = create_while_loop(g->type, ast_copy(w->cond),
+		                      asg_copy(w->body));
+		((struct asg_node_while *)n)->prof = w->prof;
+		break;
+	case ASG_NODE_RETURN:
+		r = (struct asg_node_return *)g;
+		n = create_return(ast_copy(r->retval));
+		break;
+	case ASG_NODE_SWITCH:
+		sw = (struct asg_node_switch *)g;
+		n = create_switch(ast_copy(sw->expr), asg_copy(sw->body));
+		break;
+	case ASG_NODE_CASE:
+		n = create_case(ast_copy(((struct asg_node_case *)g)->value));
+		break;
+	case ASG_NODE_BREAK:
+		n = create_break();
+		break;
+	default:
+		return NULL;
+	}
+
+	n->next = asg_copy(g->next);
+	return n;
+}
+
+static int ast_cost(struct ast_node *ast)
+{
+	if (!ast)
+		return 0;
+
+	return 1 + ast_cost(ast->left) + ast_cost(ast->right);
+}
+
+/*
+ * asg_cost:
+ * Estimate the size of the code generated for the ASG `g`.
+ */
+int asg_cost(struct graph_node *g)
+{
+	struct asg_node_conditional *c;
+	struct asg_node_switch *s;
+	struct asg_node_for *f;
+	struct asg_node_while *w;
+	int cost;
+
+	for (cost = 0; g; g = g->next) {
+		switch (g->type) {
+		case ASG_NODE_DECLARATION:
+			break;
+		case ASG_NODE_STATEMENT:
+			cost += ast_cost(((struct asg_node_statement *)g)->ast);
+			break;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			cost += 1 + ast_cost(c->cond) + asg_cost(c->succ)
+			        + asg_cost(c->fail);
+			break;
+		case ASG_NODE_FOR:
+			f = (struct asg_node_for *)g;
+			cost += 2 + ast_cost(f->init) + ast_cost(f->cond)
+			        + ast_cost(f->post) + asg_cost(f->body);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			w = (struct asg_node_while *)g;
+			cost += 2 + ast_cost(w->cond) + asg_cost(w->body);
+			break;
+		case ASG_NODE_RETURN:
+			cost += ast_cost(((struct asg_node_return *)g)->retval);
+			break;
+		case ASG_NODE_SWITCH:
+			s = (struct asg_node_switch *)g;
+			cost += 4 + ast_cost(s->expr) + asg_cost(s->body);
+			break;
+		case ASG_NODE_CASE:
+		case ASG_NODE_BREAK:
+			cost += 1;
+			break;
+		}
+	}
+
+	return cost;
+}
+
 /*
  * Functions to print out ASGs.
  */
@@ -231,6 +437,35 @@ static void print_asg_return(struct graph_node *g)
 		print_ast(stdout, r->retval);
 }
 
+static void print_asg_switch(struct graph_node *g)
+{
+	struct asg_node_switch *s = (struct asg_node_switch *)g;
+
+	printf("\x1B[1;32m=============SWITCH=============\x1B[0;37m\n");
+	print_ast(stdout, s->expr);
+	printf("\x1B[1;32m===============BODY=============\x1B[0;37m\n");
+	print_asg(s->body);
+	printf("\x1B[1;32m============ENDSWITCH===========\x1B[0;37m\n\n");
+}
+
+static void print_asg_case(struct graph_node *g)
+{
+	struct asg_node_case *c = (struct asg_node_case *)g;
+
+	if (c->value) {
+		printf("\x1B[1;32m==============CASE==============\x1B[0;37m\n");
+		print_ast(stdout, c->value);
+	} else {
+		printf("\x1B[1;32m=============DEFAULT============\x1B[0;37m\n");
+	}
+}
+
+static void print_asg_break(struct graph_node *g)
+{
+	printf("\x1B[1;32m==============BREAK=============\x1B[0;37m\n");
+	(void)g;
+}
+
 static void (*print_asg_node[])(struct graph_node *) = {
 	[ASG_NODE_DECLARATION] = print_asg_statement,
 	[ASG_NODE_STATEMENT] = print_asg_statement,
@@ -238,7 +473,10 @@ static void (*print_asg_node[])(struct graph_node *) = {
 	[ASG_NODE_FOR] = print_asg_for_loop,
 	[ASG_NODE_WHILE] = print_asg_while_loop,
 	[ASG_NODE_DO_WHILE] = print_asg_do_while_loop,
-	[ASG_NODE_RETURN] = print_asg_return
+	[ASG_NODE_RETURN] = print_asg_return,
+	[ASG_NODE_SWITCH] = print_asg_switch,
+	[ASG_NODE_CASE] = print_asg_case,
+	[ASG_NODE_BREAK] = print_asg_break
 };
 
 void print_asg(struct graph_node *graph)
@@ -28,7 +28,10 @@ enum {
 	ASG_NODE_FOR,
 	ASG_NODE_WHILE,
 	ASG_NODE_DO_WHILE,
-	ASG_NODE_RETURN
+	ASG_NODE_RETURN,
+	ASG_NODE_SWITCH,
+	ASG_NODE_CASE,
+	ASG_NODE_BREAK
 };
 
 struct graph_node {
@@ -48,6 +51,7 @@ struct asg_node_conditional {
 	struct ast_node *cond;
 	struct graph_node *succ;
 	struct graph_node *fail;
+	int prof;               /* first profile counter, or -1 */
 };
 
 struct asg_node_for {
@@ -57,6 +61,7 @@ struct asg_node_for {
 	struct ast_node *cond;
 	struct ast_node *post;
 	struct graph_node *body;
+	int prof;
 };
 
 struct asg_node_while {
@@ -64,6 +69,7 @@ struct asg_node_while {
 	struct graph_node *next;
 	struct ast_node *cond;
 	struct graph_node *body;
+	int prof;
 };
 
 struct asg_node_return {
@@ -72,6 +78,20 @@ struct asg_node_return {
 	struct ast_node *retval;
 };
 
+struct asg_node_switch {
+	int type;
+	struct graph_node *next;
+	struct ast_node *expr;
+	struct graph_node *body;
+};
+
+/* A case or default (if `value` is NULL) label within a switch body. */
+struct asg_node_case {
+	int type;
+	struct graph_node *next;
+	struct ast_node *value;
+};
+
 struct graph_node *create_declaration(struct ast_node *ast);
 struct graph_node *create_statement(struct ast_node *ast);
 struct graph_node *create_conditional(struct ast_node *cond,
@@ -85,8 +105,14 @@ struct graph_node *create_while_loop(int while_type,
                                      struct ast_node *cond,
                                      struct graph_node *body);
 struct graph_node *create_return(struct ast_node *retval);
+struct graph_node *create_switch(struct ast_node *expr,
+                                 struct graph_node *body);
+struct graph_node *create_case(struct ast_node *value);
+struct graph_node *create_break(void);
 
 struct graph_node *asg_append(struct graph_node *head, struct graph_node *n);
+struct graph_node *asg_copy(struct graph_node *g);
+int asg_cost(struct graph_node *g);
 
 void print_asg(struct graph_node *graph);
 
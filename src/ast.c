@@ -21,7 +21,9 @@
 #include <string.h>
 
 #include "ast.h"
+#include "builtin.h"
 #include "error.h"
+#include "simplify.h"
 #include "symtab.h"
 #include "types.h"
 
@@ -90,7 +92,6 @@ struct ast_node *create_node(int tag, char *lexeme)
 }
 
 static void check_expr_type(struct ast_node *expr);
-static int combine_constants(int op, struct ast_node *lhs, struct ast_node *rhs);
 
 /*
  * create_expr:
@@ -110,11 +111,6 @@ struct ast_node *create_expr(int expr, struct ast_node *lhs, struct ast_node *rh
 		return lhs;
 	}
 
-	if (lhs->tag == NODE_CONSTANT && (!rhs || rhs->tag == NODE_CONSTANT)) {
-		if (combine_constants(expr, lhs, rhs))
-			return lhs;
-	}
-
 	n = malloc(sizeof *n);
 	n->tag = expr;
 	n->sym = NULL;
@@ -122,18 +118,26 @@ struct ast_node *create_expr(int expr, struct ast_node *lhs, struct ast_node *rh
 	n->right = rhs;
 	check_expr_type(n);
 
+	/* Constant expressions are folded as soon as their type is known. */
+	if (lhs->tag == NODE_CONSTANT && (!rhs || rhs->tag == NODE_CONSTANT))
+		return simplify_fold(n);
+
+	if (expr == EXPR_FUNC)
+		return builtin_fold(n);
+
 	return n;
 }
 
 /*
  * free_tree:
  * Free all nodes in the abstract syntax tree starting at root.
+ * The names of identifiers belong to their symbols, and are not freed.
  */
 void free_tree(struct ast_node *root)
 {
 	switch (root->tag) {
-	case NODE_IDENTIFIER:
 	case NODE_STRLIT:
+	case NODE_MEMBER:
 		free(root->lexeme);
 		break;
 	}
@@ -145,6 +149,57 @@ void free_tree(struct ast_node *root)
 	free(root);
 }
 
+/*
+ * ast_copy:
+ * Create a deep copy of the abstract syntax tree starting at `root`.
+ * Identifiers in the copy refer to the same symbols as the original.
+ */
+struct ast_node *ast_copy(struct ast_node *root)
+{
+	struct ast_node *n;
+
+	if (!root)
+		return NULL;
+
+	n = malloc(sizeof *n);
+	memcpy(n, root, sizeof *n);
+
+	if (root->tag == NODE_STRLIT || root->tag == NODE_MEMBER)
+		n->lexeme = strdup(root->lexeme);
+
+	n->left = ast_copy(root->left);
+	n->right = ast_copy(root->right);
+
+	return n;
+}
+
+/* ast_equal: check if `a` and `b` are the same expression */
+int ast_equal(struct ast_node *a, struct ast_node *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	if (a->tag != b->tag ||
+	    a->expr_flags.type_flags != b->expr_flags.type_flags)
+		return 0;
+
+	if (FLAGS_TYPE(a->expr_flags.type_flags) == TYPE_STRUCT &&
+	    a->expr_flags.extra != b->expr_flags.extra)
+		return 0;
+
+	switch (a->tag) {
+	case NODE_CONSTANT:
+		return a->value == b->value;
+	case NODE_IDENTIFIER:
+	case NODE_STRLIT:
+	case NODE_MEMBER:
+		return strcmp(a->lexeme, b->lexeme) == 0;
+	default:
+		return ast_equal(a->left, b->left) &&
+		       ast_equal(a->right, b->right);
+	}
+}
+
 /*
  * ast_decl_set_type:
  * Set the types of all identifiers in AST declaration statement
@@ -189,9 +244,38 @@ int ast_decl_set_type(struct ast_node *root, struct type_information *type)
 			return 1;
 	}
 
+	if (root->tag == EXPR_ASSIGN) {
+		if (FLAGS_TYPE(root->left->expr_flags.type_flags) != TYPE_STRUCT
+		    || FLAGS_IS_PTR(root->left->expr_flags.type_flags)) {
+			fprintf(stderr, "\x1B[1;31merror:\x1B[0;37m "
+			        "initializer given for non-struct %s\n",
+			        root->left->lexeme);
+			return 1;
+		}
+		memcpy(&root->expr_flags, &root->left->expr_flags,
+		       sizeof root->expr_flags);
+	}
+
 	return 0;
 }
 
+/*
+ * ast_zero_init:
+ * Create a node initializing the variable declared by `decl` to `zero`.
+ * Its type is checked once that of the declaration is known.
+ */
+struct ast_node *ast_zero_init(struct ast_node *decl, struct ast_node *zero)
+{
+	struct ast_node *n;
+
+	n = calloc(1, sizeof *n);
+	n->tag = EXPR_ASSIGN;
+	n->left = decl;
+	n->right = zero;
+
+	return n;
+}
+
 /*
  * ast_cast:
  * Cast the expression `expr` to the type specified by `type_flags`.
@@ -207,34 +291,188 @@ int ast_cast(struct ast_node *expr, struct type_information *type)
 
 	if (FLAGS_IS_PTR(type->type_flags)) {
 		/* A pointer type can be cast to any other pointer type. */
-		if (FLAGS_IS_PTR(expr_flags)) {
-			memcpy(&expr->expr_flags, type, sizeof *type);
-			return 0;
-		}
+		if (FLAGS_IS_PTR(expr_flags))
+			goto cast;
 
 		/* An integer type can be cast to any pointer type. */
-		if (FLAGS_IS_INTEGER(expr_flags)) {
-			memcpy(&expr->expr_flags, type, sizeof *type);
-			return 0;
-		}
+		if (FLAGS_IS_INTEGER(expr_flags))
+			goto cast;
 	} else if (FLAGS_IS_INTEGER(type->type_flags)) {
 		/* A pointer can be cast to an integer type. */
-		if (FLAGS_IS_PTR(expr_flags)) {
-			memcpy(&expr->expr_flags, type, sizeof *type);
-			return 0;
-		}
+		if (FLAGS_IS_PTR(expr_flags))
+			goto cast;
 
 		/* An integer type can be cast to another integer type. */
-		if (FLAGS_IS_INTEGER(expr_flags)) {
-			memcpy(&expr->expr_flags, type, sizeof *type);
-			return 0;
-		}
+		if (FLAGS_IS_INTEGER(expr_flags))
+			goto cast;
 	} else if (FLAGS_TYPE(type->type_flags) == TYPE_VOID) {
-		memcpy(&expr->expr_flags, type, sizeof *type);
-		return 0;
+		goto cast;
 	}
 
 	return 1;
+
+cast:
+	memcpy(&expr->expr_flags, type, sizeof *type);
+	/* The value of a constant is converted to its new type. */
+	if (expr->tag == NODE_CONSTANT)
+		expr->value = simplify_const(expr->value, type);
+	return 0;
+}
+
+static int is_lvalue(struct ast_node *expr);
+
+/* has_side_effects: check if evaluating `expr` can modify anything */
+static int has_side_effects(struct ast_node *expr)
+{
+	if (!expr)
+		return 0;
+
+	if (expr->tag == EXPR_ASSIGN || expr->tag == EXPR_FUNC)
+		return 1;
+
+	return has_side_effects(expr->left) || has_side_effects(expr->right);
+}
+
+/* Temporaries created while parsing the current function. */
+static struct ast_node *temporaries = NULL;
+static int temporary_count = 0;
+
+/*
+ * new_temporary:
+ * Create a local variable of the type of `expr` which is declared
+ * at the start of the function currently being parsed.
+ */
+static struct ast_node *new_temporary(struct ast_node *expr)
+{
+	struct ast_node *t;
+	char *name;
+
+	/* A dot cannot appear in a C identifier, so the name is unique. */
+	name = malloc(24);
+	sprintf(name, "addr.%d", temporary_count++);
+
+	t = calloc(1, sizeof *t);
+	t->tag = NODE_IDENTIFIER;
+	t->lexeme = name;
+	memcpy(&t->expr_flags, &expr->expr_flags, sizeof t->expr_flags);
+
+	if (temporaries)
+		temporaries = create_expr(EXPR_COMMA, temporaries, ast_copy(t));
+	else
+		temporaries = ast_copy(t);
+
+	return t;
+}
+
+/*
+ * ast_temporaries:
+ * Return the declarations of the temporaries created since the
+ * last call, or NULL if there are none.
+ */
+struct ast_node *ast_temporaries(void)
+{
+	struct ast_node *decls;
+
+	decls = temporaries;
+	temporaries = NULL;
+	return decls;
+}
+
+/*
+ * lvalue_address:
+ * Rewrite `lhs`, an lvalue with side effects, to access its object through
+ * a temporary holding the object's address, and return the assignment of
+ * that address to the temporary.
+ */
+static struct ast_node *lvalue_address(struct ast_node *lhs)
+{
+	struct ast_node *t, *asg;
+
+	/* A member is found through the address of its struct. */
+	if (lhs->tag == EXPR_MEMBER && is_lvalue(lhs->left))
+		return lvalue_address(lhs->left);
+
+	if (lhs->tag != EXPR_DEREFERENCE) {
+		error_assign_type(lhs);
+		exit(1);
+	}
+
+	t = new_temporary(lhs->left);
+	asg = create_expr(EXPR_ASSIGN, t, lhs->left);
+	lhs->left = ast_copy(t);
+
+	return asg;
+}
+
+/*
+ * update:
+ * Create the assignment `lhs = lhs op rhs`, whose value is that of `lhs`
+ * before the assignment if `postfix` is set. As `lhs` is read and written,
+ * an lvalue with side effects is first reduced to one without.
+ */
+static struct ast_node *update(int op, struct ast_node *lhs,
+                               struct ast_node *rhs, int postfix)
+{
+	struct ast_node *addr, *asg;
+
+	if (!is_lvalue(lhs)) {
+		error_assign_type(lhs);
+		exit(1);
+	}
+
+	addr = has_side_effects(lhs) ? lvalue_address(lhs) : NULL;
+	asg = create_expr(EXPR_ASSIGN, lhs,
+	                  create_expr(op, ast_copy(lhs), rhs));
+	if (postfix)
+		asg = create_expr(EXPR_POSTFIX, asg, NULL);
+
+	return addr ? create_expr(EXPR_COMMA, addr, asg) : asg;
+}
+
+/*
+ * ast_compound_assign:
+ * Create the assignment `lhs = lhs op rhs` performed by compound assignment
+ * `lhs op= rhs`.
+ */
+struct ast_node *ast_compound_assign(int op, struct ast_node *lhs,
+                                     struct ast_node *rhs)
+{
+	return update(op, lhs, rhs, 0);
+}
+
+/*
+ * ast_increment:
+ * Create the assignment which adds one to, or for `op` EXPR_SUB subtracts
+ * one from, `expr`. The value of a `postfix` increment or decrement is that
+ * of `expr` before it is updated.
+ */
+struct ast_node *ast_increment(struct ast_node *expr, int op, int postfix)
+{
+	return update(op, expr, create_node(NODE_CONSTANT, "1"), postfix);
+}
+
+/*
+ * ast_discard_value:
+ * Return expression `expr`, whose value is not used, without the postfix
+ * increments and decrements which would keep the previous value of their
+ * operands.
+ */
+struct ast_node *ast_discard_value(struct ast_node *expr)
+{
+	struct ast_node *asg;
+
+	if (expr->tag == EXPR_POSTFIX) {
+		asg = expr->left;
+		free(expr);
+		return asg;
+	}
+
+	if (expr->tag == EXPR_COMMA) {
+		expr->left = ast_discard_value(expr->left);
+		expr->right = ast_discard_value(expr->right);
+	}
+
+	return expr;
 }
 
 /* char_const_val: convert character constant string to integer value */
@@ -307,7 +545,8 @@ static void pointer_additive_scale(struct ast_node *expr)
 	} else {
 		tmp = calloc(1, sizeof *tmp);
 		tmp->tag = NODE_CONSTANT;
-		tmp->expr_flags.type_flags = TYPE_INT | QUAL_UNSIGNED;
+		/* Signed, so that negative offsets are sign extended. */
+		tmp->expr_flags.type_flags = TYPE_INT;
 		tmp->expr_flags.extra = NULL;
 		tmp->value = ptr_size;
 
@@ -374,6 +613,15 @@ static void check_assign_type(struct ast_node *expr)
 		return;
 	}
 
+	/* A struct can be copied from any other object of the same type. */
+	if (FLAGS_TYPE(lhs_flags) == TYPE_STRUCT && lhs_flags == rhs_flags &&
+	    expr->left->expr_flags.extra == expr->right->expr_flags.extra &&
+	    is_lvalue(expr->right)) {
+		memcpy(&expr->expr_flags, &expr->left->expr_flags,
+		       sizeof expr->expr_flags);
+		return;
+	}
+
 err_incompatible:
 	error_incompatible_op_types(expr);
 	exit(1);
@@ -539,6 +787,7 @@ static void check_additive_type(struct ast_node *expr)
 		if (FLAGS_IS_INTEGER(rhs_flags) &&
 		    FLAGS_TYPE(lhs_flags) != TYPE_VOID) {
 			expr->expr_flags.type_flags = lhs_flags;
+			expr->expr_flags.extra = expr->left->expr_flags.extra;
 			pointer_additive_scale(expr);
 			return;
 		} else {
@@ -550,6 +799,7 @@ static void check_additive_type(struct ast_node *expr)
 		if (expr->tag == EXPR_ADD && FLAGS_IS_INTEGER(lhs_flags) &&
 		    FLAGS_TYPE(rhs_flags) != TYPE_VOID) {
 			expr->expr_flags.type_flags = rhs_flags;
+			expr->expr_flags.extra = expr->right->expr_flags.extra;
 			pointer_additive_scale(expr);
 			return;
 		} else {
@@ -666,6 +916,9 @@ static void check_func_type(struct ast_node *expr)
 {
 	memcpy(&expr->expr_flags, &expr->left->expr_flags,
 	       sizeof expr->expr_flags);
+	/* The value of a call is the function's return type. */
+	expr->expr_flags.type_flags &= ~(PROPERTY_FUNC | PROPERTY_STATIC);
+	builtin_check_call(expr);
 }
 
 static void check_member_type(struct ast_node *expr)
@@ -695,6 +948,76 @@ static void check_member_type(struct ast_node *expr)
 	memcpy(&expr->expr_flags, &m->type, sizeof m->type);
 }
 
+/*
+ * check_conditional_type:
+ * Check the condition of a conditional expression, or the two operands from
+ * which it chooses, and set the type of its value. A string literal operand
+ * is a `char *`.
+ */
+static void check_conditional_type(struct ast_node *expr)
+{
+	unsigned int lhs_flags, rhs_flags;
+	const unsigned int char_star = TYPE_CHAR | (1 << 24);
+
+	lhs_flags = expr->left->expr_flags.type_flags;
+
+	if (expr->tag == EXPR_COND) {
+		if (!FLAGS_IS_INTEGER(lhs_flags) && !FLAGS_IS_PTR(lhs_flags))
+			goto err_incompatible;
+		memcpy(&expr->expr_flags, &expr->right->expr_flags,
+		       sizeof expr->expr_flags);
+		return;
+	}
+
+	rhs_flags = expr->right->expr_flags.type_flags;
+	if (FLAGS_TYPE(lhs_flags) == TYPE_STRLIT)
+		lhs_flags = char_star;
+	if (FLAGS_TYPE(rhs_flags) == TYPE_STRLIT)
+		rhs_flags = char_star;
+
+	expr->expr_flags.extra = NULL;
+	if (FLAGS_IS_PTR(lhs_flags)) {
+		if (!FLAGS_IS_INTEGER(rhs_flags) && !FLAGS_IS_PTR(rhs_flags))
+			goto err_incompatible;
+		expr->expr_flags.type_flags = lhs_flags;
+		expr->expr_flags.extra = expr->left->expr_flags.extra;
+		return;
+	}
+	if (FLAGS_IS_PTR(rhs_flags)) {
+		if (!FLAGS_IS_INTEGER(lhs_flags))
+			goto err_incompatible;
+		expr->expr_flags.type_flags = rhs_flags;
+		expr->expr_flags.extra = expr->right->expr_flags.extra;
+		return;
+	}
+	if (FLAGS_IS_INTEGER(lhs_flags) && FLAGS_IS_INTEGER(rhs_flags)) {
+		expr->expr_flags.type_flags = integer_type_convert(lhs_flags,
+		                                                   rhs_flags);
+		return;
+	}
+	/* Both operands can be calls of void functions. */
+	if (FLAGS_TYPE(lhs_flags) == TYPE_VOID &&
+	    FLAGS_TYPE(rhs_flags) == TYPE_VOID) {
+		expr->expr_flags.type_flags = TYPE_VOID;
+		return;
+	}
+
+err_incompatible:
+	error_incompatible_op_types(expr);
+	exit(1);
+}
+
+/*
+ * check_postfix_type:
+ * The value of a postfix increment or decrement has the type of the object
+ * updated by its assignment.
+ */
+static void check_postfix_type(struct ast_node *expr)
+{
+	memcpy(&expr->expr_flags, &expr->left->left->expr_flags,
+	       sizeof expr->expr_flags);
+}
+
 static void (*expr_type_func[])(struct ast_node *) = {
 	[EXPR_ASSIGN]           = check_assign_type,
 	[EXPR_LOGICAL_OR]       = check_boolean_type,
@@ -722,7 +1045,10 @@ static void (*expr_type_func[])(struct ast_node *) = {
 	[EXPR_NOT]              = check_bitop_type,
 	[EXPR_LOGICAL_NOT]      = check_boolean_type,
 	[EXPR_FUNC]             = check_func_type,
-	[EXPR_MEMBER]           = check_member_type
+	[EXPR_MEMBER]           = check_member_type,
+	[EXPR_COND]             = check_conditional_type,
+	[EXPR_CHOICE]           = check_conditional_type,
+	[EXPR_POSTFIX]          = check_postfix_type
 };
 
 /*
@@ -742,85 +1068,6 @@ static void check_expr_type(struct ast_node *expr)
 	}
 }
 
-/*
- * combine_constants:
- * Perform an operation on two constant values.
- * Store result in `lhs` and free `rhs`.
- */
-static int combine_constants(int op, struct ast_node *lhs, struct ast_node *rhs)
-{
-	switch (op) {
-	case EXPR_LOGICAL_OR:
-		lhs->value = lhs->value || rhs->value;
-		break;
-	case EXPR_LOGICAL_AND:
-		lhs->value = lhs->value && rhs->value;
-		break;
-	case EXPR_OR:
-		lhs->value |= rhs->value;
-		break;
-	case EXPR_XOR:
-		lhs->value ^= rhs->value;
-		break;
-	case EXPR_AND:
-		lhs->value &= rhs->value;
-		break;
-	case EXPR_EQ:
-		lhs->value = lhs->value == rhs->value;
-		break;
-	case EXPR_NE:
-		lhs->value = lhs->value != rhs->value;
-		break;
-	case EXPR_LT:
-		lhs->value = lhs->value < rhs->value;
-		break;
-	case EXPR_GT:
-		lhs->value = lhs->value > rhs->value;
-		break;
-	case EXPR_LE:
-		lhs->value = lhs->value <= rhs->value;
-		break;
-	case EXPR_GE:
-		lhs->value = lhs->value >= rhs->value;
-		break;
-	case EXPR_LSHIFT:
-		lhs->value <<= rhs->value;
-		break;
-	case EXPR_RSHIFT:
-		lhs->value >>= rhs->value;
-		break;
-	case EXPR_ADD:
-		lhs->value += rhs->value;
-		break;
-	case EXPR_SUB:
-		lhs->value -= rhs->value;
-		break;
-	case EXPR_MULT:
-		lhs->value *= rhs->value;
-		break;
-	case EXPR_DIV:
-		lhs->value /= rhs->value;
-		break;
-	case EXPR_MOD:
-		lhs->value %= rhs->value;
-		break;
-	case EXPR_UNARY_MINUS:
-		lhs->value = -lhs->value;
-		break;
-	case EXPR_NOT:
-		lhs->value = ~lhs->value;
-		break;
-	case EXPR_LOGICAL_NOT:
-		lhs->value = !lhs->value;
-		break;
-	default:
-		return 0;
-	}
-
-	free(rhs);
-	return 1;
-}
-
 static void print_type(FILE *f, struct ast_node *expr)
 {
 	unsigned int flags;
@@ -880,7 +1127,10 @@ static char *expr_names[] = {
 	[EXPR_NOT]              = "NOT",
 	[EXPR_LOGICAL_NOT]      = "LOGICAL_NOT",
 	[EXPR_FUNC]             = "FUNCTION_CALL",
-	[EXPR_MEMBER]           = "MEMBER"
+	[EXPR_MEMBER]           = "MEMBER",
+	[EXPR_COND]             = "CONDITIONAL",
+	[EXPR_CHOICE]           = "CHOICE",
+	[EXPR_POSTFIX]          = "POSTFIX"
 };
 
 static void print_ast_depth(FILE *f, struct ast_node *root,
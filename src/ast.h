@@ -55,7 +55,10 @@ enum {
 	EXPR_NOT,
 	EXPR_LOGICAL_NOT,
 	EXPR_FUNC,
-	EXPR_MEMBER
+	EXPR_MEMBER,
+	EXPR_COND,
+	EXPR_CHOICE,
+	EXPR_POSTFIX
 };
 
 #define TAG_IS_UNARY(tag) \
@@ -83,9 +86,17 @@ struct ast_node *create_node(int tag, char *lexeme);
 struct ast_node *create_expr(int expr, struct ast_node *lhs, struct ast_node *rhs);
 
 void free_tree(struct ast_node *root);
+struct ast_node *ast_copy(struct ast_node *root);
+int ast_equal(struct ast_node *a, struct ast_node *b);
 
 int ast_decl_set_type(struct ast_node *root, struct type_information *type);
+struct ast_node *ast_zero_init(struct ast_node *decl, struct ast_node *zero);
 int ast_cast(struct ast_node *expr, struct type_information *type);
+struct ast_node *ast_compound_assign(int op, struct ast_node *lhs,
+                                     struct ast_node *rhs);
+struct ast_node *ast_increment(struct ast_node *expr, int op, int postfix);
+struct ast_node *ast_discard_value(struct ast_node *expr);
+struct ast_node *ast_temporaries(void);
 
 #include <stdio.h>
 
@@ -0,0 +1,579 @@
+/*
+ * src/branch.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Branch optimization.
+ *
+ * The blocks of a translated function are separated by its labels, and are
+ * rewritten until none of the following apply:
+ *
+ * - A jump to a block which only jumps again is sent to the final target.
+ *   A conditional jump to a block starting with a conditional jump on the
+ *   same flags goes straight to wherever the second one leads.
+ * - Jumps to the next instruction, unreferenced labels and unreachable
+ *   code are removed.
+ * - A conditional jump over an unconditional one is inverted, so that the
+ *   block it skipped to falls through.
+ * - Identical instructions ending two blocks which continue at the same
+ *   label are kept in only one of them; the other jumps to that copy.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "branch.h"
+
+/* Conditional jumps are followed through at most this many blocks. */
+#define BRANCH_MAX_HOPS 16
+
+static struct x86_instruction *branch_inst(struct x86_sequence *seq,
+                                           size_t i)
+{
+	return (struct x86_instruction *)seq->seq.data + i;
+}
+
+/* branch_is_direct: check if `inst` is a jump to a label */
+static int branch_is_direct(struct x86_instruction *inst)
+{
+	return x86_is_jump(inst->instruction) &&
+	       inst->op1.type == X86_OPERAND_LABEL;
+}
+
+/* branch_ends_block: check if control never passes `inst` */
+static int branch_ends_block(struct x86_instruction *inst)
+{
+	return inst->instruction == X86_JMP || inst->instruction == X86_RET;
+}
+
+/* branch_cond: return the canonical form of conditional jump `jcc` */
+static int branch_cond(int jcc)
+{
+	switch (jcc) {
+	case X86_JZ:
+		return X86_JE;
+	case X86_JNZ:
+		return X86_JNE;
+	case X86_JC:
+		return X86_JB;
+	default:
+		return jcc;
+	}
+}
+
+/* branch_invert: return the jump taken when `jcc` is not */
+static int branch_invert(int jcc)
+{
+	switch (branch_cond(jcc)) {
+	case X86_JE:
+		return X86_JNE;
+	case X86_JNE:
+		return X86_JE;
+	case X86_JG:
+		return X86_JLE;
+	case X86_JGE:
+		return X86_JL;
+	case X86_JL:
+		return X86_JGE;
+	case X86_JLE:
+		return X86_JG;
+	case X86_JA:
+		return X86_JBE;
+	case X86_JAE:
+		return X86_JB;
+	case X86_JB:
+		return X86_JAE;
+	default:
+		return X86_JA;
+	}
+}
+
+/*
+ * branch_labels:
+ * Fill `pos` with the index of each label in the function, and `refs` with
+ * the number of jumps to it. Labels in jump tables are always referenced.
+ */
+static void branch_labels(struct x86_sequence *seq, int *pos, int *refs)
+{
+	struct x86_jump_table *t;
+	struct x86_instruction *in;
+	size_t i;
+	int j;
+
+	for (j = 0; j < seq->label; ++j) {
+		pos[j] = -1;
+		refs[j] = 0;
+	}
+
+	for (i = 0; i < seq->seq.nmembs; ++i) {
+		in = branch_inst(seq, i);
+		if (in->instruction == X86_LABEL)
+			pos[in->lnum] = i;
+		else if (branch_is_direct(in))
+			refs[in->op1.label]++;
+	}
+
+	VECTOR_ITER(&seq->tables, t) {
+		for (j = 0; j < t->ntargets; ++j)
+			refs[t->targets[j]]++;
+	}
+}
+
+/* branch_first: return the first instruction from `i` which is not a label */
+static size_t branch_first(struct x86_sequence *seq, size_t i)
+{
+	while (i < seq->seq.nmembs &&
+	       branch_inst(seq, i)->instruction == X86_LABEL)
+		++i;
+	return i;
+}
+
+/* branch_follows: check if `label` is placed right after instruction `i` */
+static int branch_follows(struct x86_sequence *seq, size_t i, int label)
+{
+	struct x86_instruction *in;
+
+	for (++i; i < seq->seq.nmembs; ++i) {
+		in = branch_inst(seq, i);
+		if (in->instruction != X86_LABEL)
+			break;
+		if (in->lnum == label)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * branch_rebuild:
+ * Remove the instructions marked in `drop` from the function, and insert
+ * the labels in `before` ahead of the instructions at their indices.
+ */
+static void branch_rebuild(struct x86_sequence *seq, char *drop, int *before)
+{
+	struct x86_instruction *insts, label;
+	struct vector old;
+	size_t i, body;
+
+	label.instruction = X86_LABEL;
+	label.size = 0;
+
+	old = seq->seq;
+	insts = old.data;
+	body = 0;
+	vector_init(&seq->seq, sizeof (struct x86_instruction));
+	for (i = 0; i < old.nmembs; ++i) {
+		if (i == seq->body)
+			body = seq->seq.nmembs;
+		if (before && before[i] != -1) {
+			label.lnum = before[i];
+			vector_append(&seq->seq, &label);
+		}
+		if (!drop || !drop[i])
+			vector_append(&seq->seq, insts + i);
+	}
+	seq->body = body;
+	vector_destroy(&old);
+}
+
+/* branch_canonical: return the first of the labels placed with `label` */
+static int branch_canonical(struct x86_sequence *seq, int *pos, int label)
+{
+	size_t i;
+
+	if (pos[label] == -1)
+		return label;
+
+	for (i = pos[label]; i > seq->body; --i) {
+		if (branch_inst(seq, i - 1)->instruction != X86_LABEL)
+			break;
+	}
+	return branch_inst(seq, i)->lnum;
+}
+
+/*
+ * branch_target:
+ * Follow the jump at index `j` through blocks which only jump again, and
+ * return the label it should go to. If it should go to the instruction
+ * after a conditional jump which has no label, one is allocated in `after`.
+ */
+static int branch_target(struct x86_sequence *seq, size_t j, int *pos,
+                         int *after)
+{
+	struct x86_instruction *jump, *in;
+	int label, hops;
+	size_t k;
+
+	jump = branch_inst(seq, j);
+	label = jump->op1.label;
+
+	for (hops = 0; hops < BRANCH_MAX_HOPS; ++hops) {
+		label = branch_canonical(seq, pos, label);
+		if (pos[label] == -1)
+			break;
+		k = branch_first(seq, pos[label]);
+		if (k == seq->seq.nmembs)
+			break;
+
+		in = branch_inst(seq, k);
+		if (!branch_is_direct(in) || in->op1.label == label)
+			break;
+		if (in->instruction == X86_JMP) {
+			label = in->op1.label;
+			continue;
+		}
+		if (!x86_is_cond_jump(jump->instruction))
+			break;
+
+		/* Nothing between the jumps changes the flags. */
+		if (branch_cond(in->instruction) ==
+		    branch_cond(jump->instruction)) {
+			label = in->op1.label;
+			continue;
+		}
+		if (branch_invert(in->instruction) !=
+		    branch_cond(jump->instruction))
+			break;
+
+		if (k + 1 < seq->seq.nmembs &&
+		    branch_inst(seq, k + 1)->instruction == X86_LABEL) {
+			label = branch_inst(seq, k + 1)->lnum;
+			continue;
+		}
+		if (k + 1 < seq->seq.nmembs) {
+			if (after[k + 1] == -1)
+				after[k + 1] = seq->label++;
+			label = after[k + 1];
+		}
+		break;
+	}
+
+	/* Jumps around a cycle of blocks are left alone. */
+	return hops == BRANCH_MAX_HOPS ? jump->op1.label : label;
+}
+
+/*
+ * branch_thread:
+ * Send jumps to blocks which only jump again to their final targets, and
+ * jumps to any of a group of labels to the first of them.
+ * Return 1 if any jump was changed.
+ */
+static int branch_thread(struct x86_sequence *seq)
+{
+	struct x86_jump_table *t;
+	struct x86_instruction *in;
+	int *pos, *refs, *after, changed, label, j;
+	size_t i;
+
+	pos = malloc(seq->label * sizeof *pos);
+	refs = malloc(seq->label * sizeof *refs);
+	after = malloc((seq->seq.nmembs + 1) * sizeof *after);
+	branch_labels(seq, pos, refs);
+	for (i = 0; i <= seq->seq.nmembs; ++i)
+		after[i] = -1;
+
+	changed = 0;
+	for (i = seq->body; i < seq->seq.nmembs; ++i) {
+		in = branch_inst(seq, i);
+		if (!branch_is_direct(in))
+			continue;
+		label = branch_target(seq, i, pos, after);
+		if (label != in->op1.label) {
+			in->op1.label = label;
+			changed = 1;
+		}
+	}
+
+	VECTOR_ITER(&seq->tables, t) {
+		for (j = 0; j < t->ntargets; ++j) {
+			label = branch_canonical(seq, pos, t->targets[j]);
+			if (label != t->targets[j]) {
+				t->targets[j] = label;
+				changed = 1;
+			}
+		}
+	}
+
+	if (changed)
+		branch_rebuild(seq, NULL, after);
+	free(pos);
+	free(refs);
+	free(after);
+	return changed;
+}
+
+/*
+ * branch_simplify:
+ * Remove unreachable code, unreferenced labels and jumps to the next
+ * instruction, and invert conditional jumps over unconditional ones.
+ * Return 1 if anything was changed.
+ */
+static int branch_simplify(struct x86_sequence *seq)
+{
+	struct x86_instruction *in, *next;
+	int *pos, *refs, changed, dead;
+	size_t i, n;
+	char *drop;
+
+	n = seq->seq.nmembs;
+	pos = malloc(seq->label * sizeof *pos);
+	refs = malloc(seq->label * sizeof *refs);
+	drop = calloc(n, 1);
+	branch_labels(seq, pos, refs);
+
+	changed = dead = 0;
+	for (i = seq->body; i < n; ++i) {
+		in = branch_inst(seq, i);
+		if (in->instruction == X86_LABEL) {
+			if (!refs[in->lnum]) {
+				drop[i] = 1;
+				continue;
+			}
+			dead = 0;
+		}
+		if (dead) {
+			drop[i] = 1;
+			continue;
+		}
+		dead = branch_ends_block(in);
+
+		if (!branch_is_direct(in))
+			continue;
+		if (branch_follows(seq, i, in->op1.label)) {
+			refs[in->op1.label]--;
+			drop[i] = 1;
+			dead = 0;
+			continue;
+		}
+
+		/* jcc A; jmp B; A: becomes jncc B; A: */
+		if (!x86_is_cond_jump(in->instruction) || i + 1 == n)
+			continue;
+		next = branch_inst(seq, i + 1);
+		if (next->instruction == X86_JMP &&
+		    next->op1.type == X86_OPERAND_LABEL &&
+		    branch_follows(seq, i + 1, in->op1.label)) {
+			refs[in->op1.label]--;
+			in->instruction = branch_invert(in->instruction);
+			in->op1.label = next->op1.label;
+			drop[++i] = 1;
+		}
+	}
+
+	for (i = 0; i < n; ++i)
+		changed |= drop[i];
+	if (changed)
+		branch_rebuild(seq, drop, NULL);
+	free(pos);
+	free(refs);
+	free(drop);
+	return changed;
+}
+
+static int branch_same_operand(struct x86_operand *a, struct x86_operand *b)
+{
+	if (a->type != b->type)
+		return 0;
+
+	switch (a->type) {
+	case X86_OPERAND_GPR:
+		return a->gpr == b->gpr;
+	case X86_OPERAND_CONSTANT:
+	case X86_OPERAND_UCONSTANT:
+		return a->constant == b->constant;
+	case X86_OPERAND_LABEL:
+	case X86_OPERAND_RIP_LABEL:
+	case X86_OPERAND_STRING:
+		return a->label == b->label;
+	case X86_OPERAND_FUNC:
+		return strcmp(a->func, b->func) == 0;
+	case X86_OPERAND_OFFSET:
+		return a->offset.off == b->offset.off &&
+		       a->offset.gpr == b->offset.gpr;
+	case X86_OPERAND_JUMP_TABLE:
+		return a->table.label == b->table.label &&
+		       a->table.gpr == b->table.gpr;
+	case X86_OPERAND_INDEX:
+		return a->index.base == b->index.base &&
+		       a->index.index == b->index.index &&
+		       a->index.scale == b->index.scale &&
+		       a->index.disp == b->index.disp;
+	case X86_OPERAND_XMM:
+		return a->xmm == b->xmm;
+	case X86_OPERAND_COUNTER:
+		return a->counter == b->counter;
+	case X86_OPERAND_SYMBOL:
+		return strcmp(a->sym.name, b->sym.name) == 0 &&
+		       a->sym.off == b->sym.off;
+	default:
+		return 0;
+	}
+}
+
+static int branch_same(struct x86_instruction *a, struct x86_instruction *b)
+{
+	int n;
+
+	if (a->instruction != b->instruction || a->size != b->size)
+		return 0;
+
+	switch (a->instruction) {
+	case X86_LABEL:
+	case X86_NAMED_LABEL:
+		return 0;
+	}
+
+	n = x86_operand_count(a);
+	return (n < 1 || branch_same_operand(&a->op1, &b->op1)) &&
+	       (n < 2 || branch_same_operand(&a->op2, &b->op2)) &&
+	       (n < 3 || branch_same_operand(&a->op3, &b->op3));
+}
+
+/*
+ * branch_tail:
+ * Return the number of identical instructions ending at indices `a` and
+ * `b`, which end blocks continuing at the same label.
+ */
+static size_t branch_tail(struct x86_sequence *seq, size_t a, size_t b)
+{
+	size_t k, lo, hi;
+
+	lo = a < b ? a : b;
+	hi = a < b ? b : a;
+	for (k = 0; k <= lo - seq->body; ++k) {
+		/* The later tail may not reach back past the earlier one. */
+		if (hi - k <= lo + 1)
+			break;
+		if (!branch_same(branch_inst(seq, a - k),
+		                 branch_inst(seq, b - k)))
+			break;
+	}
+	return k;
+}
+
+/*
+ * branch_merge_jump:
+ * Find the block ending in another path to the label targeted by the jump
+ * at index `j` whose tail is longest in common with the jump's own block.
+ * Set `end` to its last instruction and return the length of the tail.
+ */
+static size_t branch_merge_jump(struct x86_sequence *seq, size_t j,
+                                int *pos, size_t *end)
+{
+	struct x86_instruction *jump, *in;
+	size_t i, k, best;
+	int label;
+
+	jump = branch_inst(seq, j);
+	label = jump->op1.label;
+	if (pos[label] == -1 || j == seq->body)
+		return 0;
+
+	best = 0;
+
+	/* The block falling through to the label keeps its instructions. */
+	i = pos[label];
+	while (i > seq->body &&
+	       branch_inst(seq, i - 1)->instruction == X86_LABEL)
+		--i;
+	if (i > seq->body && !branch_ends_block(branch_inst(seq, i - 1)) &&
+	    (best = branch_tail(seq, j - 1, i - 1)))
+		*end = i - 1;
+
+	for (i = seq->body + 1; i < seq->seq.nmembs; ++i) {
+		in = branch_inst(seq, i);
+		if (i == j || in->instruction != X86_JMP ||
+		    in->op1.type != X86_OPERAND_LABEL ||
+		    in->op1.label != label)
+			continue;
+		k = branch_tail(seq, j - 1, i - 1);
+		if (k > best) {
+			best = k;
+			*end = i - 1;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * branch_merge:
+ * Replace the tail of a block which is identical to that of another block
+ * continuing at the same label with a jump to the other's copy.
+ * Return 1 if a tail was merged.
+ */
+static int branch_merge(struct x86_sequence *seq)
+{
+	struct x86_instruction *in;
+	int *pos, *refs, *before, label;
+	size_t i, j, k, end, start;
+	char *drop;
+
+	pos = malloc(seq->label * sizeof *pos);
+	refs = malloc(seq->label * sizeof *refs);
+	branch_labels(seq, pos, refs);
+
+	k = 0;
+	for (j = seq->body; j < seq->seq.nmembs; ++j) {
+		in = branch_inst(seq, j);
+		if (in->instruction != X86_JMP ||
+		    in->op1.type != X86_OPERAND_LABEL)
+			continue;
+		if ((k = branch_merge_jump(seq, j, pos, &end)))
+			break;
+	}
+	free(pos);
+	free(refs);
+	if (!k)
+		return 0;
+
+	drop = calloc(seq->seq.nmembs, 1);
+	before = malloc(seq->seq.nmembs * sizeof *before);
+	for (i = 0; i < seq->seq.nmembs; ++i)
+		before[i] = -1;
+
+	start = end + 1 - k;
+	if (branch_inst(seq, start - 1)->instruction == X86_LABEL) {
+		label = branch_inst(seq, start - 1)->lnum;
+	} else {
+		label = seq->label++;
+		before[start] = label;
+	}
+	for (i = j - k; i < j; ++i)
+		drop[i] = 1;
+	branch_inst(seq, j)->op1.label = label;
+
+	branch_rebuild(seq, drop, before);
+	free(drop);
+	free(before);
+	return 1;
+}
+
+/*
+ * branch_optimize:
+ * Simplify the control flow of translated function `seq`.
+ */
+void branch_optimize(struct x86_sequence *seq)
+{
+	int changed;
+
+	do {
+		changed = branch_thread(seq);
+		changed |= branch_simplify(seq);
+		if (!changed)
+			changed = branch_merge(seq);
+	} while (changed);
+}
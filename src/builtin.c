@@ -0,0 +1,241 @@
+/*
+ * src/builtin.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtin.h"
+#include "error.h"
+#include "symtab.h"
+#include "types.h"
+
+static const struct {
+	const char      *name;
+	const char      *libname;       /* function called if not expanded */
+	unsigned int    type;           /* return type */
+	int             argc;
+} builtins[NUM_BUILTINS] = {
+	[BUILTIN_MEMCPY] = {
+		"__builtin_memcpy", "memcpy", TYPE_VOID | (1 << 24), 3
+	},
+	[BUILTIN_MEMSET] = {
+		"__builtin_memset", "memset", TYPE_VOID | (1 << 24), 3
+	},
+	[BUILTIN_STRLEN] = {
+		"__builtin_strlen", "strlen", TYPE_INT | QUAL_UNSIGNED, 1
+	},
+	[BUILTIN_STRCMP] = {
+		"__builtin_strcmp", "strcmp", TYPE_INT, 2
+	}
+};
+
+/* builtin_init: declare all builtin functions */
+void builtin_init(void)
+{
+	struct type_information type;
+	int i;
+
+	for (i = 0; i < NUM_BUILTINS; ++i) {
+		type.type_flags = builtins[i].type;
+		type.extra = NULL;
+		symtab_add_func((char *)builtins[i].name, &type, NULL);
+	}
+}
+
+/* builtin_find: return the builtin function called `name`, or -1 */
+int builtin_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NUM_BUILTINS; ++i) {
+		if (strcmp(builtins[i].name, name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * builtin_call_name:
+ * Return the name of the function to call for a call to function `name`.
+ */
+const char *builtin_call_name(const char *name)
+{
+	int b;
+
+	b = builtin_find(name);
+	return b == -1 ? name : builtins[b].libname;
+}
+
+static int num_args(struct ast_node *args)
+{
+	if (!args)
+		return 0;
+	else if (args->tag == EXPR_COMMA)
+		return num_args(args->left) + num_args(args->right);
+	else
+		return 1;
+}
+
+/* nth_arg: return argument `n` of argument list `args` */
+static struct ast_node *nth_arg(struct ast_node *args, int n)
+{
+	int nleft;
+
+	while (args->tag == EXPR_COMMA) {
+		nleft = num_args(args->left);
+		if (n < nleft) {
+			args = args->left;
+		} else {
+			args = args->right;
+			n -= nleft;
+		}
+	}
+
+	return args;
+}
+
+/* call_builtin: return the builtin function which is `func`, or -1 */
+static int call_builtin(struct ast_node *func)
+{
+	if (func->tag != NODE_IDENTIFIER)
+		return -1;
+
+	return builtin_find(func->lexeme);
+}
+
+/*
+ * builtin_check_call:
+ * Check that a call to a builtin function has the right number of arguments.
+ */
+void builtin_check_call(struct ast_node *call)
+{
+	int b;
+
+	if ((b = call_builtin(call->left)) == -1)
+		return;
+
+	if (num_args(call->right) != builtins[b].argc) {
+		error_builtin_args(builtins[b].name, builtins[b].argc);
+		exit(1);
+	}
+}
+
+/*
+ * strlit_value:
+ * Decode the contents of string literal `lexeme`, which must be freed.
+ */
+static char *strlit_value(const char *lexeme)
+{
+	char *s, *out;
+
+	s = out = malloc(strlen(lexeme));
+	for (++lexeme; *lexeme != '"'; ++lexeme) {
+		if (*lexeme != '\\') {
+			*out++ = *lexeme;
+			continue;
+		}
+
+		switch (*++lexeme) {
+		case 'n':
+			*out++ = '\n';
+			break;
+		case 't':
+			*out++ = '\t';
+			break;
+		case '0':
+			*out++ = '\0';
+			break;
+		default:
+			*out++ = *lexeme;
+			break;
+		}
+	}
+	*out = '\0';
+
+	return s;
+}
+
+/*
+ * builtin_fold:
+ * If `call` is a call to a builtin function whose result is known at
+ * compile time, return a constant with that value. Otherwise, return `call`.
+ */
+struct ast_node *builtin_fold(struct ast_node *call)
+{
+	struct ast_node *n, *lhs, *rhs;
+	char *a, *b;
+	int val;
+
+	switch (call_builtin(call->left)) {
+	case BUILTIN_STRLEN:
+		lhs = call->right;
+		if (lhs->tag != NODE_STRLIT)
+			return call;
+
+		a = strlit_value(lhs->lexeme);
+		val = strlen(a);
+		free(a);
+		break;
+	case BUILTIN_STRCMP:
+		lhs = nth_arg(call->right, 0);
+		rhs = nth_arg(call->right, 1);
+		if (lhs->tag != NODE_STRLIT || rhs->tag != NODE_STRLIT)
+			return call;
+
+		a = strlit_value(lhs->lexeme);
+		b = strlit_value(rhs->lexeme);
+		val = strcmp(a, b);
+		val = val < 0 ? -1 : val > 0;
+		free(a);
+		free(b);
+		break;
+	default:
+		return call;
+	}
+
+	n = create_node(NODE_CONSTANT, "0");
+	n->value = val;
+	n->expr_flags.type_flags = call->expr_flags.type_flags;
+	return n;
+}
+
+/*
+ * builtin_expands:
+ * If the call to `func` with arguments `args` is expanded inline, return
+ * the builtin function called. Otherwise, return -1.
+ * Copies and fills of a constant size are expanded.
+ */
+int builtin_expands(struct ast_node *func, struct ast_node *args)
+{
+	int b;
+
+	switch ((b = call_builtin(func))) {
+	case BUILTIN_MEMSET:
+		if (nth_arg(args, 1)->tag != NODE_CONSTANT)
+			return -1;
+		/* fall through */
+	case BUILTIN_MEMCPY:
+		if (nth_arg(args, 2)->tag != NODE_CONSTANT ||
+		    nth_arg(args, 2)->value < 0)
+			return -1;
+		return b;
+	default:
+		return -1;
+	}
+}
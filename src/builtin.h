@@ -0,0 +1,45 @@
+/*
+ * src/builtin.h
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FCC_BUILTIN_H
+#define FCC_BUILTIN_H
+
+#include "ast.h"
+
+/*
+ * Functions from the C library which the compiler knows about. Calls to
+ * them are folded to constants or expanded inline where possible, and are
+ * otherwise made to the library function itself.
+ */
+enum {
+	BUILTIN_MEMCPY,
+	BUILTIN_MEMSET,
+	BUILTIN_STRLEN,
+	BUILTIN_STRCMP,
+	NUM_BUILTINS
+};
+
+void builtin_init(void);
+int builtin_find(const char *name);
+const char *builtin_call_name(const char *name);
+
+void builtin_check_call(struct ast_node *call);
+struct ast_node *builtin_fold(struct ast_node *call);
+int builtin_expands(struct ast_node *func, struct ast_node *args);
+
+#endif /* FCC_BUILTIN_H */
@@ -52,6 +52,8 @@ static inline int op_binary(int expr_tag)
 	case EXPR_MULT:
 	case EXPR_DIV:
 	case EXPR_MOD:
+	case EXPR_COND:
+	case EXPR_CHOICE:
 		return 1;
 	default:
 		return 0;
@@ -83,7 +85,9 @@ static char *op_sym[] = {
 	[EXPR_UNARY_PLUS]       = "+",
 	[EXPR_UNARY_MINUS]      = "-",
 	[EXPR_NOT]              = "~",
-	[EXPR_LOGICAL_NOT]      = "!"
+	[EXPR_LOGICAL_NOT]      = "!",
+	[EXPR_COND]             = "?:",
+	[EXPR_CHOICE]           = "?:"
 };
 
 /*
@@ -207,6 +211,38 @@ void error_struct_member(struct ast_node *expr)
 	fprintf(stderr, "\x1B[0;37m' has no member `%s'\n", expr->right->lexeme);
 }
 
+void error_case_constant(struct ast_node *expr)
+{
+	PUTERR("case label does not reduce to an integer constant\n");
+	(void)expr;
+}
+
+void error_case_duplicate(int value)
+{
+	PUTERR("duplicate case value `%d'\n", value);
+}
+
+void error_case_default(void)
+{
+	PUTERR("multiple default labels in one switch\n");
+}
+
+void error_case_outside(int is_default)
+{
+	PUTERR("%s label not within a switch statement\n",
+	       is_default ? "default" : "case");
+}
+
+void error_break_outside(void)
+{
+	PUTERR("break statement not within loop or switch\n");
+}
+
+void error_builtin_args(const char *name, int argc)
+{
+	PUTERR("`%s' takes %d argument%s\n", name, argc, argc == 1 ? "" : "s");
+}
+
 void warning_imcompatible_ptr_assn(struct ast_node *expr)
 {
 	PUTWARN("assignment from incompatible pointer type: `\x1B[1;35m");
@@ -253,3 +289,16 @@ void warning_unused(const char *fname, const char *vname)
 {
 	PUTWARN("unused variable `%s' in function `%s'\n", vname, fname);
 }
+
+void warning_profile_missing(const char *file)
+{
+	fprintf(stderr, "\x1B[1;37m%s:\x1B[1;35m warning:\x1B[0;37m "
+	        "profile file `%s' not found\n", fcc_filename, file);
+}
+
+void warning_profile_mismatch(const char *file)
+{
+	fprintf(stderr, "\x1B[1;37m%s:\x1B[1;35m warning:\x1B[0;37m "
+	        "profile file `%s' does not match the source\n",
+	        fcc_filename, file);
+}
@@ -33,6 +33,12 @@ void error_struct_undefined(const char *name);
 void error_not_struct(struct ast_node *expr);
 void error_struct_pointer(struct ast_node *expr);
 void error_struct_member(struct ast_node *expr);
+void error_case_constant(struct ast_node *expr);
+void error_case_duplicate(int value);
+void error_case_default(void);
+void error_case_outside(int is_default);
+void error_break_outside(void);
+void error_builtin_args(const char *name, int argc);
 
 void warning_imcompatible_ptr_assn(struct ast_node *expr);
 void warning_imcompatible_ptr_cmp(struct ast_node *expr);
@@ -41,5 +47,7 @@ void warning_int_assign(struct ast_node *expr);
 void warning_ptr_assign(struct ast_node *expr);
 void warning_unreachable(struct graph_node *statement);
 void warning_unused(const char *fname, const char *vname);
+void warning_profile_missing(const char *file);
+void warning_profile_mismatch(const char *file);
 
 #endif /* FCC_ERROR_H */
@@ -17,43 +17,160 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "builtin.h"
 #include "fcc.h"
 #include "gen.h"
 #include "parse.h"
+#include "profile.h"
 #include "scan.h"
+#include "sched.h"
 #include "symtab.h"
 
 char *fcc_filename;
 yyscan_t fcc_scanner;
 
+unsigned int fcc_flags = FFLAG_INLINE | FFLAG_SIBLING_CALLS |
+                         FFLAG_TREE_VECTORIZE | FFLAG_SCHEDULE_INSNS |
+                         FFLAG_LOOP_PATTERNS | FFLAG_IF_CONVERSION;
+
+/* Maximum size of a function body which can be inlined. */
+int fcc_inline_limit = 24;
+
+/* Maximum growth of a function from unrolling its loops. */
+int fcc_unroll_limit = 192;
+
+int fcc_m64 = 0;
+
+static struct {
+	const char *name;
+	unsigned int flag;
+} flag_names[] = {
+	{ "function-sections", FFLAG_FUNCTION_SECTIONS },
+	{ "if-conversion", FFLAG_IF_CONVERSION },
+	{ "inline", FFLAG_INLINE },
+	{ "instrument-functions-rdtsc", FFLAG_INSTRUMENT_RDTSC },
+	{ "omit-frame-pointer", FFLAG_OMIT_FRAME_POINTER },
+	{ "optimize-sibling-calls", FFLAG_SIBLING_CALLS },
+	{ "profile-generate", FFLAG_PROFILE_GENERATE },
+	{ "profile-use", FFLAG_PROFILE_USE },
+	{ "regparm", FFLAG_REGPARM },
+	{ "sched-verbose", FFLAG_SCHED_VERBOSE },
+	{ "schedule-insns2", FFLAG_SCHEDULE_INSNS },
+	{ "temps-verbose", FFLAG_TEMPS_VERBOSE },
+	{ "tree-loop-distribute-patterns", FFLAG_LOOP_PATTERNS },
+	{ "tree-vectorize", FFLAG_TREE_VECTORIZE },
+	{ "unroll-loops", FFLAG_UNROLL_LOOPS }
+};
+
 void output_filename(void);
 
+/*
+ * parse_flag:
+ * Parse a single -f option. Return 0 if it was recognized, 1 otherwise.
+ */
+static int parse_flag(const char *opt)
+{
+	size_t i;
+	int on;
+
+	if (strncmp(opt, "inline-limit=", 13) == 0) {
+		fcc_inline_limit = atoi(opt + 13);
+		return 0;
+	}
+	if (strncmp(opt, "unroll-limit=", 13) == 0) {
+		fcc_unroll_limit = atoi(opt + 13);
+		return 0;
+	}
+
+	on = strncmp(opt, "no-", 3) != 0;
+	if (!on)
+		opt += 3;
+
+	for (i = 0; i < sizeof flag_names / sizeof *flag_names; ++i) {
+		if (strcmp(opt, flag_names[i].name) == 0) {
+			if (on)
+				fcc_flags |= flag_names[i].flag;
+			else
+				fcc_flags &= ~flag_names[i].flag;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [OPTION]... FILE\n", progname);
+}
+
 int main(int argc, char **argv)
 {
 	FILE *f;
+	char *file;
+	int i;
+
+	file = NULL;
+	for (i = 1; i < argc; ++i) {
+		if (strncmp(argv[i], "-f", 2) == 0) {
+			if (parse_flag(argv[i] + 2) != 0) {
+				fprintf(stderr, "%s: unrecognized option `%s'\n",
+				        argv[0], argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-m32") == 0) {
+			fcc_m64 = 0;
+		} else if (strcmp(argv[i], "-m64") == 0) {
+			fcc_m64 = 1;
+		} else if (strncmp(argv[i], "-mtune=", 7) == 0) {
+			if (sched_tune(argv[i] + 7) != 0) {
+				fprintf(stderr, "%s: unrecognized option `%s'\n",
+				        argv[0], argv[i]);
+				return 1;
+			}
+		} else if (!file) {
+			file = argv[i];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
-	if (argc != 2) {
-		fprintf(stderr, "usage: %s FILE\n", argv[0]);
+	if (!file) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	if (strcmp(argv[1], "-") == 0) {
+	if (strcmp(file, "-") == 0) {
 		f = stdin;
-	} else if (!(f = fopen(argv[1], "r"))) {
-		perror(argv[1]);
+	} else if (!(f = fopen(file, "r"))) {
+		perror(file);
 		return 1;
 	}
 
-	fcc_filename = f == stdin ? "<stdin>" : argv[1];
+	fcc_filename = f == stdin ? "<stdin>" : file;
+
+	/* Every call must reach its callee to be counted. */
+	if (fcc_flags & FFLAG_PROFILE_GENERATE)
+		fcc_flags &= ~FFLAG_INLINE;
+
+	/* A function's exit must be timed before it returns to its caller. */
+	if (fcc_flags & FFLAG_INSTRUMENT_RDTSC)
+		fcc_flags &= ~FFLAG_SIBLING_CALLS;
+
 	yylex_init(&fcc_scanner);
 	yyset_in(f, fcc_scanner);
 	symtab_init();
+	builtin_init();
+	profile_init();
 	begin_translation_unit();
 
 	yyparse(fcc_scanner);
 	output_filename();
+	profile_finish();
 
 	free_translation_unit();
 	yylex_destroy(fcc_scanner);
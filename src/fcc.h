@@ -22,6 +22,38 @@
 extern char *fcc_filename;
 extern void *fcc_scanner;
 
+/*
+ * Optimization flags, enabled with -f<name> and disabled with -fno-<name>.
+ */
+#define FFLAG_INLINE            (1 << 0)
+#define FFLAG_SIBLING_CALLS     (1 << 1)
+#define FFLAG_REGPARM           (1 << 2)
+#define FFLAG_TREE_VECTORIZE    (1 << 3)
+#define FFLAG_PROFILE_GENERATE  (1 << 4)
+#define FFLAG_PROFILE_USE       (1 << 5)
+#define FFLAG_INSTRUMENT_RDTSC  (1 << 6)
+#define FFLAG_FUNCTION_SECTIONS (1 << 7)
+#define FFLAG_OMIT_FRAME_POINTER (1 << 8)
+#define FFLAG_SCHEDULE_INSNS    (1 << 9)
+#define FFLAG_SCHED_VERBOSE     (1 << 10)
+#define FFLAG_LOOP_PATTERNS     (1 << 11)
+#define FFLAG_TEMPS_VERBOSE     (1 << 12)
+#define FFLAG_IF_CONVERSION     (1 << 13)
+#define FFLAG_UNROLL_LOOPS      (1 << 14)
+
+extern unsigned int fcc_flags;
+extern int fcc_inline_limit;
+extern int fcc_unroll_limit;
+
+/*
+ * Target machine, selected with -m32 (the default) or -m64.
+ * In 64-bit mode, x86-64 code following the System V ABI is generated.
+ */
+extern int fcc_m64;
+
+/* Size of a pointer or general purpose register on the target. */
+#define FCC_WORD_SIZE           (fcc_m64 ? 8 : 4)
+
 #define ALIGN(x, a)             __ALIGN_MASK(x, (a) - 1)
 #define __ALIGN_MASK(x, mask)   (((x) + (mask)) & ~(mask))
 #define ALIGNED(x, a)           (((x) & ((a) - 1)) == 0)
@@ -68,12 +68,17 @@ struct type_information {
 %token TOKEN_ID TOKEN_CONSTANT TOKEN_STRLIT TOKEN_SIZEOF
 %token TOKEN_INT TOKEN_CHAR TOKEN_VOID TOKEN_SIGNED TOKEN_UNSIGNED
 %token TOKEN_IF TOKEN_ELSE TOKEN_FOR TOKEN_DO TOKEN_WHILE TOKEN_BREAK TOKEN_CONTINUE TOKEN_RETURN
-%token TOKEN_STRUCT
+%token TOKEN_SWITCH TOKEN_CASE TOKEN_DEFAULT
+%token TOKEN_STRUCT TOKEN_STATIC
 %token TOKEN_AND TOKEN_OR TOKEN_EQ TOKEN_NEQ TOKEN_GE TOKEN_LE
 %token TOKEN_LSHIFT TOKEN_RSHIFT TOKEN_INC TOKEN_DEC TOKEN_PTR
+%token TOKEN_ADD_ASSIGN TOKEN_SUB_ASSIGN TOKEN_MUL_ASSIGN TOKEN_DIV_ASSIGN
+%token TOKEN_MOD_ASSIGN TOKEN_LEFT_ASSIGN TOKEN_RIGHT_ASSIGN
+%token TOKEN_AND_ASSIGN TOKEN_XOR_ASSIGN TOKEN_OR_ASSIGN
 
 %start translation_unit
 
+%type <type> function_specifiers
 %type <type> type_specifier
 %type <type> type_specifiers
 %type <type> type_name
@@ -85,14 +90,18 @@ struct type_information {
 %type <type> struct_declaration_list
 
 %type <value> unary_op
+%type <value> assign_op
 
 %type <node> direct_declarator
 %type <node> declarator_list
+%type <node> init_declarator
 %type <node> declarator
 %type <node> parameter_list
 %type <node> parameter_declaration
 %type <node> expr
 %type <node> assign_expr
+%type <node> conditional_expr
+%type <node> for_cond
 %type <node> logical_or_expr
 %type <node> logical_and_expr
 %type <node> or_expr
@@ -118,6 +127,7 @@ struct type_information {
 %type <graph> statement
 %type <graph> expression_statement
 %type <graph> conditional_statement
+%type <graph> labeled_statement
 %type <graph> iteration_statement
 %type <graph> jump_statement
 
@@ -136,8 +146,15 @@ extern_decl
 	;
 
 function_def
-	: type_specifiers { symtab_new_scope(); } declarator
-	{ symtab_add_func($3->lexeme, &$1, $3->left); }
+	: function_specifiers { symtab_new_scope(); } declarator {
+		struct symbol *s;
+
+		/* A pointer return type is part of the declarator. */
+		$1.type_flags |= $3->sym->flags.type_flags & 0xFF000000;
+		s = symtab_add_func($3->lexeme, &$1, $3->left);
+		/* The function's name is also declared within its own scope. */
+		$3->sym->flags = s->flags;
+	}
 	statement_block_noscope {
 		translate_function($3->lexeme, $3->left, $5);
 		/* print_asg($5); */
@@ -146,6 +163,15 @@ function_def
 	}
 	;
 
+/* Return type of a function, optionally declared static. */
+function_specifiers
+	: type_specifiers
+	| TOKEN_STATIC type_specifiers {
+		$$ = $2;
+		$$.type_flags |= PROPERTY_STATIC;
+	}
+	;
+
 type_specifiers
 	: type_specifier
 	| type_specifiers type_specifier {
@@ -268,6 +294,7 @@ block_item
 
 statement
 	: statement_block
+	| labeled_statement
 	| expression_statement
 	| conditional_statement
 	| iteration_statement
@@ -276,7 +303,7 @@ statement
 
 expression_statement
 	: ';' { $$ = NULL; }
-	| expr ';' { $$ = create_statement($1); }
+	| expr ';' { $$ = create_statement(ast_discard_value($1)); }
 	;
 
 conditional_statement
@@ -286,6 +313,22 @@ conditional_statement
 	| TOKEN_IF '(' expr ')' statement {
 		$$ = create_conditional($3, $5, NULL);
 	}
+	| TOKEN_SWITCH '(' expr ')' statement {
+		$$ = create_switch($3, $5);
+	}
+	;
+
+labeled_statement
+	: TOKEN_CASE logical_or_expr ':' statement {
+		if ($2->tag != NODE_CONSTANT) {
+			error_case_constant($2);
+			exit(1);
+		}
+		$$ = asg_append(create_case($2), $4);
+	}
+	| TOKEN_DEFAULT ':' statement {
+		$$ = asg_append(create_case(NULL), $3);
+	}
 	;
 
 iteration_statement
@@ -296,19 +339,26 @@ iteration_statement
 		$$ = create_while_loop(ASG_NODE_DO_WHILE, $5, $2);
 	}
 	/* | TOKEN_FOR '(' declaration expression_statement expr ')' statement */
-	| TOKEN_FOR '(' expression_statement expression_statement expr ')' statement {
-		$$ = create_for_loop(((struct asg_node_statement *)$3)->ast,
-		                     ((struct asg_node_statement *)$4)->ast,
-		                     $5, $7);
+	| TOKEN_FOR '(' expression_statement for_cond expr ')' statement {
+		/* Empty expression statements have no graph node. */
+		$$ = create_for_loop($3 ? ((struct asg_node_statement *)$3)->ast
+		                        : NULL,
+		                     $4, ast_discard_value($5), $7);
 	}
 	;
 
+/* The value of a loop condition is used, unlike that of a statement. */
+for_cond
+	: ';' { $$ = NULL; }
+	| expr ';'
+	;
+
 jump_statement
 /* 	: TOKEN_CONTINUE ';' */
-/* 	| TOKEN_BREAK ';' */
-	: TOKEN_RETURN ';' { $$ = create_return(NULL); }
+	: TOKEN_BREAK ';' { $$ = create_break(); }
+	| TOKEN_RETURN ';' { $$ = create_return(NULL); }
 	| TOKEN_RETURN expr ';' { $$ = create_return($2); }
-/* 	; */
+	;
 
 declaration
 	: declaration_specifiers declarator_list ';' {
@@ -334,12 +384,24 @@ declaration_specifiers
 	;
 
 declarator_list
-	: declarator
-	| declarator ',' declarator_list {
+	: init_declarator
+	| init_declarator ',' declarator_list {
 		$$ = create_expr(EXPR_COMMA, $1, $3);
 	}
 	;
 
+/* Structs can be zero-initialized when they are declared. */
+init_declarator
+	: declarator
+	| declarator '=' '{' logical_or_expr '}' {
+		if ($4->tag != NODE_CONSTANT || $4->value != 0) {
+			yyerror(scanner, "only zero initializers are supported");
+			exit(1);
+		}
+		$$ = ast_zero_init($1, $4);
+	}
+	;
+
 /* how many levels of indirection are you on? */
 pointer
 	: '*' pointer { $$.type_flags = $2.type_flags + 1; }
@@ -353,9 +415,20 @@ expr
 	;
 
 assign_expr
-	: logical_or_expr
+	: conditional_expr
 	| unary_expr assign_op assign_expr {
-		$$ = create_expr(EXPR_ASSIGN, $1, $3);
+		if ($2 == EXPR_ASSIGN)
+			$$ = create_expr(EXPR_ASSIGN, $1, $3);
+		else
+			$$ = ast_compound_assign($2, $1, $3);
+	}
+	;
+
+conditional_expr
+	: logical_or_expr
+	| logical_or_expr '?' expr ':' conditional_expr {
+		$$ = create_expr(EXPR_COND, $1,
+		                 create_expr(EXPR_CHOICE, $3, $5));
 	}
 	;
 
@@ -457,8 +530,8 @@ cast_expr
 
 unary_expr
 	: postfix_expr
-	/* | TOKEN_INC unary_expr */
-	/* | TOKEN_DEC unary_expr */
+	| TOKEN_INC unary_expr { $$ = ast_increment($2, EXPR_ADD, 0); }
+	| TOKEN_DEC unary_expr { $$ = ast_increment($2, EXPR_SUB, 0); }
 	| unary_op cast_expr { $$ = create_expr($1, $2, NULL); }
 	/* | TOKEN_SIZEOF unary_expr */
 	/* | TOKEN_SIZEOF '(' type_specifiers ')' */
@@ -480,8 +553,8 @@ postfix_expr
 		                 create_expr(EXPR_DEREFERENCE, $1, NULL),
 		                 create_node(NODE_MEMBER, yyget_text(scanner)));
 	}
-	| postfix_expr TOKEN_INC
-	| postfix_expr TOKEN_DEC
+	| postfix_expr TOKEN_INC { $$ = ast_increment($1, EXPR_ADD, 1); }
+	| postfix_expr TOKEN_DEC { $$ = ast_increment($1, EXPR_SUB, 1); }
 	| postfix_expr '(' ')' { $$ = create_expr(EXPR_FUNC, $1, NULL); }
 	| postfix_expr '(' argument_list ')' {
 		$$ = create_expr(EXPR_FUNC, $1, $3);
@@ -508,7 +581,17 @@ unary_op
 	;
 
 assign_op
-	: '='
+	: '=' { $$ = EXPR_ASSIGN; }
+	| TOKEN_ADD_ASSIGN { $$ = EXPR_ADD; }
+	| TOKEN_SUB_ASSIGN { $$ = EXPR_SUB; }
+	| TOKEN_MUL_ASSIGN { $$ = EXPR_MULT; }
+	| TOKEN_DIV_ASSIGN { $$ = EXPR_DIV; }
+	| TOKEN_MOD_ASSIGN { $$ = EXPR_MOD; }
+	| TOKEN_LEFT_ASSIGN { $$ = EXPR_LSHIFT; }
+	| TOKEN_RIGHT_ASSIGN { $$ = EXPR_RSHIFT; }
+	| TOKEN_AND_ASSIGN { $$ = EXPR_AND; }
+	| TOKEN_XOR_ASSIGN { $$ = EXPR_XOR; }
+	| TOKEN_OR_ASSIGN { $$ = EXPR_OR; }
 	;
 
 argument_list
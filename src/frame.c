@@ -0,0 +1,510 @@
+/*
+ * src/frame.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stack frame layout.
+ *
+ * The statements of a function are numbered in program order, and each local
+ * variable is given a live range spanning the statements which reference it.
+ * A local whose value is carried around a loop has its range widened to cover
+ * the whole loop. Locals with disjoint ranges are then packed into shared
+ * stack slots, and the slots are ordered by their estimated reference counts
+ * per byte so that the hottest are closest to the base pointer.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include "fcc.h"
+#include "frame.h"
+#include "types.h"
+
+/* Each level of loop nesting is assumed to run this many times more. */
+#define FRAME_LOOP_SHIFT        3
+#define FRAME_MAX_DEPTH         6
+
+struct frame_ref {
+	int pos;                        /* statement referencing the local */
+	int kill;                       /* loop whose body assigns it, or -1 */
+};
+
+struct frame_var {
+	struct local    *l;
+	size_t          size;
+	size_t          align;
+	int             decl;           /* statement declaring the local */
+	int             first;          /* live range of the local */
+	int             last;
+	int             addressed;      /* address of the local is taken */
+	int             in_frame;       /* local needs a stack slot */
+	unsigned long   weight;         /* estimated number of references */
+	struct vector   refs;
+};
+
+struct frame_loop {
+	int start;
+	int end;
+};
+
+struct frame_slot {
+	size_t          size;
+	size_t          align;
+	unsigned long   weight;
+	int             first;          /* earliest declared local in the slot */
+	struct vector   vars;
+};
+
+struct frame_state {
+	struct local_vars       *locals;
+	struct frame_var        *vars;
+	struct vector           loops;
+	int                     pos;
+	int                     loop;   /* loop whose body is being read */
+	int                     depth;
+};
+
+static struct frame_var *frame_var(struct frame_state *st, const char *name)
+{
+	struct local *l;
+
+	if (!(l = local_find(st->locals, name)))
+		return NULL;
+
+	return &st->vars[l - (struct local *)st->locals->locals.data];
+}
+
+/*
+ * frame_ref:
+ * Record a reference to `name` in the current statement. If `kill` is not
+ * -1, the reference is an assignment of a new value directly within the body
+ * of loop `kill`.
+ */
+static void frame_ref(struct frame_state *st, const char *name, int kill)
+{
+	struct frame_var *v;
+	struct frame_ref r;
+	int depth;
+
+	if (!(v = frame_var(st, name)))
+		return;
+
+	r.pos = st->pos;
+	r.kill = kill;
+	vector_append(&v->refs, &r);
+
+	if (st->pos < v->first)
+		v->first = st->pos;
+	if (st->pos > v->last)
+		v->last = st->pos;
+
+	depth = st->depth < FRAME_MAX_DEPTH ? st->depth : FRAME_MAX_DEPTH;
+	v->weight += 1UL << (depth * FRAME_LOOP_SHIFT);
+}
+
+/*
+ * frame_expr:
+ * Record the references to locals in `ast`. `top` is set if `ast` is
+ * evaluated as a statement of its own, in which case a plain assignment to
+ * a local overwrites its previous value.
+ */
+static void frame_expr(struct frame_state *st, struct ast_node *ast, int top)
+{
+	struct frame_var *v;
+
+	if (!ast)
+		return;
+
+	switch (ast->tag) {
+	case NODE_IDENTIFIER:
+		frame_ref(st, ast->lexeme, -1);
+		return;
+	case EXPR_COMMA:
+		frame_expr(st, ast->left, top);
+		frame_expr(st, ast->right, top);
+		return;
+	case EXPR_ASSIGN:
+		if (top && ast->left->tag == NODE_IDENTIFIER) {
+			frame_expr(st, ast->right, 0);
+			frame_ref(st, ast->left->lexeme, st->loop);
+			return;
+		}
+		break;
+	case EXPR_ADDRESS:
+		if (ast->left->tag == NODE_IDENTIFIER &&
+		    (v = frame_var(st, ast->left->lexeme)))
+			v->addressed = 1;
+		break;
+	default:
+		break;
+	}
+
+	frame_expr(st, ast->left, 0);
+	frame_expr(st, ast->right, 0);
+}
+
+static void frame_decl(struct frame_state *st, struct ast_node *decl)
+{
+	struct frame_var *v;
+
+	if (decl->tag == NODE_IDENTIFIER) {
+		if ((v = frame_var(st, decl->lexeme)) && v->decl == -1)
+			v->decl = st->pos;
+	} else {
+		frame_decl(st, decl->left);
+		frame_decl(st, decl->right);
+	}
+}
+
+static void frame_walk(struct frame_state *st, struct graph_node *g);
+
+/*
+ * frame_body:
+ * Walk the body of a loop spanning statements from `start`. Return the index
+ * of the loop.
+ */
+static int frame_body(struct frame_state *st, struct graph_node *body,
+                      struct ast_node *post, int start)
+{
+	struct frame_loop loop;
+	int index, outer;
+
+	index = st->loops.nmembs;
+	loop.start = start;
+	loop.end = start;
+	vector_append(&st->loops, &loop);
+
+	outer = st->loop;
+	st->loop = index;
+	++st->depth;
+	frame_walk(st, body);
+	if (post) {
+		++st->pos;
+		frame_expr(st, post, 0);
+	}
+	--st->depth;
+	st->loop = outer;
+
+	((struct frame_loop *)st->loops.data)[index].end = st->pos;
+	return index;
+}
+
+static void frame_walk(struct frame_state *st, struct graph_node *g)
+{
+	struct asg_node_conditional *c;
+	struct asg_node_statement *s;
+	struct asg_node_return *r;
+	struct asg_node_while *w;
+	struct asg_node_for *f;
+	struct frame_loop *loop;
+	int outer, start, index;
+
+	for (; g; g = g->next) {
+		++st->pos;
+		switch (g->type) {
+		case ASG_NODE_DECLARATION:
+			s = (struct asg_node_statement *)g;
+			frame_decl(st, s->ast);
+			break;
+		case ASG_NODE_STATEMENT:
+			s = (struct asg_node_statement *)g;
+			frame_expr(st, s->ast, 1);
+			break;
+		case ASG_NODE_RETURN:
+			r = (struct asg_node_return *)g;
+			frame_expr(st, r->retval, 0);
+			break;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			frame_expr(st, c->cond, 0);
+			outer = st->loop;
+			st->loop = -1;
+			frame_walk(st, c->succ);
+			frame_walk(st, c->fail);
+			st->loop = outer;
+			break;
+		case ASG_NODE_SWITCH:
+			frame_expr(st, ((struct asg_node_switch *)g)->expr, 0);
+			outer = st->loop;
+			st->loop = -1;
+			frame_walk(st, ((struct asg_node_switch *)g)->body);
+			st->loop = outer;
+			break;
+		case ASG_NODE_FOR:
+			f = (struct asg_node_for *)g;
+			frame_expr(st, f->init, 1);
+			++st->pos;
+			start = st->pos;
+			++st->depth;
+			frame_expr(st, f->cond, 0);
+			--st->depth;
+			frame_body(st, f->body, f->post, start);
+			break;
+		case ASG_NODE_WHILE:
+			w = (struct asg_node_while *)g;
+			start = st->pos;
+			++st->depth;
+			frame_expr(st, w->cond, 0);
+			--st->depth;
+			frame_body(st, w->body, NULL, start);
+			break;
+		case ASG_NODE_DO_WHILE:
+			w = (struct asg_node_while *)g;
+			index = frame_body(st, w->body, NULL, st->pos);
+			++st->pos;
+			++st->depth;
+			frame_expr(st, w->cond, 0);
+			--st->depth;
+			loop = (struct frame_loop *)st->loops.data + index;
+			loop->end = st->pos;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * frame_carried:
+ * Check if the value of `v` may be carried from one iteration of loop
+ * `index` to the next, or out of the loop from an earlier iteration.
+ */
+static int frame_carried(struct frame_var *v, struct frame_loop *loop,
+                         int index)
+{
+	struct frame_ref *r;
+
+	/* A local declared within a loop starts afresh in each iteration. */
+	if (v->decl >= loop->start && v->decl <= loop->end)
+		return 0;
+
+	VECTOR_ITER(&v->refs, r) {
+		if (r->pos >= loop->start && r->pos <= loop->end)
+			return v->last > loop->end || r->kill != index;
+	}
+	return 0;
+}
+
+/*
+ * frame_extend:
+ * Widen the live ranges of locals in `vars` to cover the loops around which
+ * their values are carried.
+ */
+static void frame_extend(struct frame_var *vars, size_t nvars,
+                         struct vector *loops)
+{
+	struct frame_loop *loop;
+	struct frame_var *v;
+	int changed;
+
+	do {
+		changed = 0;
+		for (v = vars; v < vars + nvars; ++v) {
+			if (!v->in_frame)
+				continue;
+			VECTOR_ITER(loops, loop) {
+				if (v->first <= loop->start &&
+				    v->last >= loop->end)
+					continue;
+				if (!frame_carried(v, loop,
+				                   loop - (struct frame_loop *)
+				                          loops->data))
+					continue;
+				if (loop->start < v->first)
+					v->first = loop->start;
+				if (loop->end > v->last)
+					v->last = loop->end;
+				changed = 1;
+			}
+		}
+	} while (changed);
+}
+
+static int frame_overlaps(struct frame_var *vars, struct frame_slot *s,
+                          struct frame_var *v)
+{
+	int *i;
+
+	VECTOR_ITER(&s->vars, i) {
+		if (vars[*i].first <= v->last && v->first <= vars[*i].last)
+			return 1;
+	}
+	return 0;
+}
+
+/* Sort order of variables; heaviest first. */
+static struct frame_var *sort_vars;
+
+static int var_cmp(const void *a, const void *b)
+{
+	const struct frame_var *v = &sort_vars[*(const int *)a];
+	const struct frame_var *w = &sort_vars[*(const int *)b];
+
+	if (v->weight != w->weight)
+		return v->weight < w->weight ? 1 : -1;
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * slot_cmp:
+ * Order slots by weight per byte, so that a large struct does not push the
+ * locals after it out of short displacements. Smaller slots come first among
+ * those of equal density, and then those of earlier declared locals.
+ */
+static int slot_cmp(const void *a, const void *b)
+{
+	const struct frame_slot *s = a, *t = b;
+	unsigned long long sw, tw;
+
+	sw = (unsigned long long)s->weight * t->size;
+	tw = (unsigned long long)t->weight * s->size;
+	if (sw != tw)
+		return sw < tw ? 1 : -1;
+	if (s->size != t->size)
+		return s->size < t->size ? -1 : 1;
+	return s->first - t->first;
+}
+
+/*
+ * frame_color:
+ * Assign each local in `vars` to a stack slot shared only with locals of
+ * compatible size and alignment whose live ranges do not overlap its own.
+ */
+static void frame_color(struct frame_var *vars, size_t nvars,
+                        struct vector *slots)
+{
+	struct frame_slot *s, new;
+	int *order, i, n, found;
+
+	order = malloc(nvars * sizeof *order);
+	for (i = n = 0; i < (int)nvars; ++i) {
+		if (vars[i].in_frame)
+			order[n++] = i;
+	}
+	sort_vars = vars;
+	qsort(order, n, sizeof *order, var_cmp);
+
+	for (i = 0; i < n; ++i) {
+		found = 0;
+		VECTOR_ITER(slots, s) {
+			if (vars[order[i]].size <= s->size &&
+			    vars[order[i]].align <= s->align &&
+			    !frame_overlaps(vars, s, &vars[order[i]])) {
+				found = 1;
+				break;
+			}
+		}
+		if (!found) {
+			new.size = vars[order[i]].size;
+			new.align = vars[order[i]].align;
+			new.weight = 0;
+			new.first = order[i];
+			vector_init(&new.vars, sizeof (int));
+			vector_append(slots, &new);
+			s = (struct frame_slot *)slots->data +
+			    slots->nmembs - 1;
+		}
+		s->weight += vars[order[i]].weight;
+		if (order[i] < s->first)
+			s->first = order[i];
+		vector_append(&s->vars, &order[i]);
+	}
+	free(order);
+}
+
+/*
+ * frame_layout:
+ * Assign stack offsets to the local variables of the function with body `g`.
+ * The first `nparams` entries of `locals` are its parameters, the first `nreg`
+ * of which are passed in registers and stored in the frame. Return the number
+ * of bytes of the frame used by locals.
+ */
+size_t frame_layout(struct local_vars *locals, int nparams, int nreg,
+                    struct graph_node *g)
+{
+	struct frame_state st;
+	struct frame_slot *s;
+	struct frame_var *v;
+	struct vector slots;
+	size_t nvars, nbytes;
+	int *i;
+
+	nvars = locals->locals.nmembs;
+	st.locals = locals;
+	st.vars = malloc((nvars ? nvars : 1) * sizeof *st.vars);
+	st.pos = 0;
+	st.loop = -1;
+	st.depth = 0;
+	vector_init(&st.loops, sizeof (struct frame_loop));
+
+	for (v = st.vars; v < st.vars + nvars; ++v) {
+		v->l = (struct local *)locals->locals.data + (v - st.vars);
+		v->decl = -1;
+		v->first = INT_MAX;
+		v->last = -1;
+		v->addressed = 0;
+		v->weight = 0;
+		vector_init(&v->refs, sizeof (struct frame_ref));
+
+		/* Stack parameters live in the caller's frame. */
+		if (!(v->l->flags & LFLAGS_USED) ||
+		    (v - st.vars >= nreg && v - st.vars < nparams)) {
+			v->in_frame = 0;
+			continue;
+		}
+		v->in_frame = 1;
+		if (v - st.vars < nreg) {
+			/* Register parameters are stored in whole words. */
+			v->size = FCC_WORD_SIZE;
+			v->align = FCC_WORD_SIZE;
+			v->first = 0;
+		} else {
+			v->size = type_size(&v->l->type);
+			v->align = type_align(&v->l->type);
+		}
+	}
+
+	frame_walk(&st, g);
+
+	for (v = st.vars; v < st.vars + nvars; ++v) {
+		if (v->addressed || v->first > v->last) {
+			v->first = 0;
+			v->last = st.pos;
+		}
+	}
+	frame_extend(st.vars, nvars, &st.loops);
+
+	vector_init(&slots, sizeof (struct frame_slot));
+	frame_color(st.vars, nvars, &slots);
+	qsort(slots.data, slots.nmembs, slots.size, slot_cmp);
+
+	nbytes = 0;
+	VECTOR_ITER(&slots, s) {
+		nbytes = ALIGN(nbytes, s->align) + s->size;
+		VECTOR_ITER(&s->vars, i)
+			st.vars[*i].l->offset = -((int)nbytes);
+		vector_destroy(&s->vars);
+	}
+	vector_destroy(&slots);
+
+	for (v = st.vars; v < st.vars + nvars; ++v)
+		vector_destroy(&v->refs);
+	vector_destroy(&st.loops);
+	free(st.vars);
+
+	return nbytes;
+}
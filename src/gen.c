@@ -24,16 +24,31 @@
 #include "ast.h"
 #include "error.h"
 #include "fcc.h"
+#include "frame.h"
 #include "gen.h"
+#include "idiom.h"
+#include "ifconv.h"
+#include "inline.h"
+#include "ir.h"
 #include "local.h"
+#include "profile.h"
+#include "simplify.h"
+#include "symtab.h"
 #include "types.h"
+#include "unroll.h"
+#include "uthash.h"
 #include "vector.h"
 #include "x86.h"
 
-#define SECTION_TEXT 0
-#define SECTION_DATA 1
+#define SECTION_TEXT    0
+#define SECTION_RODATA  1
+#define SECTION_STR     2
+#define SECTION_DATA    3
+#define SECTION_BSS     4
+#define SECTION_FINI    5
+#define SECTION_TSC     6
 
-#define NUM_SECTIONS 2
+#define NUM_SECTIONS 7
 
 struct section {
 	size_t size;
@@ -41,53 +56,132 @@ struct section {
 	char *buf;
 };
 
+/*
+ * String literals are placed in a mergeable section, so that the linker
+ * can combine identical strings across translation units.
+ * The timing records of all functions are gathered into a single section,
+ * whose bounds the linker provides to the runtime as __start_fcc_tsc and
+ * __stop_fcc_tsc.
+ */
 static char *section_names[] = {
-	[SECTION_TEXT] = "text",
-	[SECTION_DATA] = "data"
+	[SECTION_TEXT] = ".text",
+	[SECTION_RODATA] = ".rodata",
+	[SECTION_STR] = ".rodata.str1.1,\"aMS\",@progbits,1",
+	[SECTION_DATA] = ".data",
+	[SECTION_BSS] = ".bss",
+	[SECTION_FINI] = ".fini_array",
+	[SECTION_TSC] = "fcc_tsc,\"aw\""
 };
 
 static struct section sections[NUM_SECTIONS];
 
+/* Label of a string literal in the translation unit's string pool. */
+struct string_label {
+	char            *lexeme;
+	int             label;
+	UT_hash_handle  hh;
+};
+
+static struct string_label *strings = NULL;
+static int nstrings = 0;
+
+/*
+ * The text of a function compiled with profile feedback, held back until
+ * all functions can be ordered by the number of calls made to them.
+ */
+struct function_text {
+	long long       count;
+	size_t          order;  /* position of the function in the source */
+	struct section  text;
+};
+
+static struct vector functions;
+
+static void buf_init(struct section *s)
+{
+	s->size = 0x1000;
+	s->len = 0;
+	s->buf = malloc(s->size);
+	s->buf[0] = '\0';
+}
+
 void begin_translation_unit(void)
 {
 	size_t i;
 
-	for (i = 0; i < NUM_SECTIONS; ++i) {
-		sections[i].size = 0x1000;
-		sections[i].len = 0;
-		sections[i].buf = malloc(sections[i].size);
-		sections[i].buf[0] = '\0';
-	}
+	for (i = 0; i < NUM_SECTIONS; ++i)
+		buf_init(&sections[i]);
+	vector_init(&functions, sizeof (struct function_text));
 }
 
 void free_translation_unit(void)
 {
+	struct string_label *s, *tmp;
 	size_t i;
 
 	for (i = 0; i < NUM_SECTIONS; ++i)
 		free(sections[i].buf);
+	vector_destroy(&functions);
+
+	HASH_ITER(hh, strings, s, tmp) {
+		HASH_DEL(strings, s);
+		free(s->lexeme);
+		free(s);
+	}
 }
 
-/* section_grow: double the buffer size of section `section` */
-static inline void section_grow(int section)
+/*
+ * buf_write:
+ * Write `len` bytes of `str` to section buffer `s`, ensuring size.
+ */
+static void buf_write(struct section *s, const char *str, size_t len)
 {
-	sections[section].size <<= 1;
-	sections[section].buf = realloc(sections[section].buf,
-	                                sections[section].size);
+	while (s->len + len >= s->size) {
+		s->size <<= 1;
+		s->buf = realloc(s->buf, s->size);
+	}
+
+	memcpy(s->buf + s->len, str, len);
+	s->len += len;
+	s->buf[s->len] = '\0';
+}
+
+/* section_write: write `len` bytes of `s` to section `section` */
+static void section_write(int section, const char *s, size_t len)
+{
+	buf_write(&sections[section], s, len);
+}
+
+static void section_puts(int section, const char *s)
+{
+	section_write(section, s, strlen(s));
 }
 
 /*
- * section_write:
- * Write `len` bytes of `s` to section specified by `section`,
- * ensuring size.
+ * gen_string_label:
+ * Return the number of the label of string literal `lexeme`, adding it to
+ * the string pool if it has not been used before.
  */
-static void section_write(int section, const char *s, size_t len)
+int gen_string_label(const char *lexeme)
 {
-	if (sections[section].len + len >= sections[section].size)
-		section_grow(section);
+	struct string_label *s;
+	char buf[32];
+
+	HASH_FIND_STR(strings, lexeme, s);
+	if (s)
+		return s->label;
+
+	s = malloc(sizeof *s);
+	s->lexeme = strdup(lexeme);
+	s->label = nstrings++;
+	HASH_ADD_KEYPTR(hh, strings, s->lexeme, strlen(s->lexeme), s);
 
-	strncpy(sections[section].buf + sections[section].len, s, len);
-	sections[section].len += len;
+	snprintf(buf, sizeof buf, ".Lstr%d:\n\t.string ", s->label);
+	section_puts(SECTION_STR, buf);
+	section_puts(SECTION_STR, lexeme);
+	section_puts(SECTION_STR, "\n");
+
+	return s->label;
 }
 
 static void check_usage(struct local_vars *locals, struct ast_node *ast)
@@ -97,6 +191,8 @@ static void check_usage(struct local_vars *locals, struct ast_node *ast)
 	} else if (ast->tag == NODE_IDENTIFIER) {
 		local_mark_used(locals, ast->lexeme);
 	} else {
+		if (ast->tag == EXPR_ADDRESS && ast->left->tag == NODE_IDENTIFIER)
+			local_mark_addressed(locals, ast->left->lexeme);
 		check_usage(locals, ast->left);
 		check_usage(locals, ast->right);
 	}
@@ -152,65 +248,325 @@ static void scan_locals(struct local_vars *locals, struct graph_node *g)
 	case ASG_NODE_RETURN:
 		check_usage(locals, ((struct asg_node_return *)g)->retval);
 		break;
+	case ASG_NODE_SWITCH:
+		check_usage(locals, ((struct asg_node_switch *)g)->expr);
+		scan_locals(locals, ((struct asg_node_switch *)g)->body);
+		break;
 	}
 	scan_locals(locals, g->next);
 }
 
 static size_t read_locals(const char *fname,
                           struct local_vars *locals,
-                          struct ast_node *params,
+                          struct ast_node *params, int nreg,
                           struct graph_node *g)
 {
 	size_t nbytes, size;
 	struct local *l;
-	int nparams, lstart;
+	int nparams, poff, i;
 
 	if (params)
 		add_locals(locals, params);
 
 	nparams = locals->locals.nmembs;
-	lstart = (nparams << 2) + 4;
 	scan_locals(locals, g);
-	nbytes = 0;
+	i = 0;
+
+	/* Parameters start above the saved base pointer and return address. */
+	poff = 2 * FCC_WORD_SIZE;
 
 	VECTOR_ITER(&locals->locals, l) {
-		if (nparams) {
-			l->offset = lstart - (nparams << 2);
-			--nparams;
+		if (i < nparams) {
+			/* Register parameters are laid out with the locals. */
+			if (i++ < nreg)
+				continue;
+			/* Structs are passed by value in whole words. */
+			l->offset = poff;
+			poff += ALIGN(type_size(&l->type), FCC_WORD_SIZE);
 			continue;
 		}
 
-		if (!(l->flags & LFLAGS_USED)) {
+		if (!(l->flags & LFLAGS_USED))
 			warning_unused(fname, l->name);
-			continue;
-		}
+	}
+	nbytes = frame_layout(locals, nparams, nreg, g);
+
+	/* The x86-64 ABI keeps the stack 16-byte aligned at calls. */
+	size = fcc_m64 ? 16 : 4;
+	if (!ALIGNED(nbytes, size))
+		nbytes = ALIGN(nbytes, size);
 
-		size = type_size(&l->type);
-		if (!ALIGNED(nbytes, size))
-			nbytes = ALIGN(nbytes, size);
+	return nbytes;
+}
 
-		nbytes += size;
-		l->offset = -((int)nbytes);
+/*
+ * write_jump_tables:
+ * Write the jump tables used by function `x86` to the rodata section.
+ */
+static void write_jump_tables(struct x86_sequence *x86)
+{
+	struct x86_jump_table *t;
+	char buf[64];
+	size_t len;
+	int i;
+
+	VECTOR_ITER(&x86->tables, t) {
+		len = snprintf(buf, sizeof buf, ".align 4\n.L%d:\n", t->label);
+		section_write(SECTION_RODATA, buf, len);
+		for (i = 0; i < t->ntargets; ++i) {
+			/* 64-bit tables hold offsets, for RIP-relative access. */
+			if (fcc_m64)
+				len = snprintf(buf, sizeof buf,
+				               "\t.long .L%d-.L%d\n",
+				               t->targets[i], t->label);
+			else
+				len = snprintf(buf, sizeof buf,
+				               "\t.long .L%d\n",
+				               t->targets[i]);
+			section_write(SECTION_RODATA, buf, len);
+		}
 	}
-	if (!ALIGNED(nbytes, 4))
-		nbytes = ALIGN(nbytes, 4);
+}
 
-	return nbytes;
+/*
+ * write_tsc_record:
+ * Write the timing record of function `fname`: a pointer to its name,
+ * followed by the number of calls to it and its inclusive and exclusive
+ * cycles as 64-bit counters.
+ */
+static void write_tsc_record(const char *fname)
+{
+	char buf[256];
+
+	snprintf(buf, sizeof buf, ".Ltsc_name_%s:\n\t.string \"%s\"\n",
+	         fname, fname);
+	section_puts(SECTION_STR, buf);
+
+	/* The name pointer is padded to 8 bytes in 32-bit mode. */
+	snprintf(buf, sizeof buf, ".align 8\n.Ltsc_%s:\n"
+	         "\t%s .Ltsc_name_%s%s\n\t.quad 0, 0, 0\n", fname,
+	         fcc_m64 ? ".quad" : ".long", fname, fcc_m64 ? "" : ", 0");
+	section_puts(SECTION_TSC, buf);
 }
 
-static void write_x86(struct x86_sequence *x86)
+static void write_x86(struct x86_sequence *x86, int global)
 {
 	struct x86_instruction *x;
-	char buf[64];
+	struct function_text f, *fp;
+	struct section *text;
+	char buf[256];
 	size_t len;
 
+	if (fcc_flags & FFLAG_PROFILE_USE) {
+		f.count = profile_function_count(x86->fname);
+		f.order = functions.nmembs;
+		buf_init(&f.text);
+		vector_append(&functions, &f);
+		fp = (struct function_text *)functions.data + f.order;
+		text = &fp->text;
+	} else {
+		text = &sections[SECTION_TEXT];
+	}
+
 	buf[0] = '\n';
-	section_write(SECTION_TEXT, buf, 1);
+	buf_write(text, buf, 1);
+	if (fcc_flags & FFLAG_FUNCTION_SECTIONS) {
+		len = snprintf(buf, sizeof buf,
+		               ".section .text.%s,\"ax\",@progbits\n",
+		               x86->fname);
+		buf_write(text, buf, len);
+	}
+	if (global) {
+		len = snprintf(buf, sizeof buf, ".globl %s\n", x86->fname);
+		buf_write(text, buf, len);
+	}
 	VECTOR_ITER(&x86->seq, x) {
 		len = x86_write_instruction(x, buf);
 		/* printf("%s", buf); */
-		section_write(SECTION_TEXT, buf, len);
+		buf_write(text, buf, len);
 	}
+	write_jump_tables(x86);
+
+	if (fcc_flags & FFLAG_INSTRUMENT_RDTSC)
+		write_tsc_record(x86->fname);
+}
+
+/* Functions are ordered from most to least frequently called. */
+static int function_cmp(const void *a, const void *b)
+{
+	const struct function_text *fa = a;
+	const struct function_text *fb = b;
+
+	if (fa->count != fb->count)
+		return fa->count < fb->count ? 1 : -1;
+
+	return fa->order < fb->order ? -1 : fa->order > fb->order;
+}
+
+/*
+ * write_functions:
+ * Write the text of all held back functions, hottest first, so that
+ * frequently called functions share as few pages as possible.
+ */
+static void write_functions(void)
+{
+	struct function_text *f;
+
+	qsort(functions.data, functions.nmembs, sizeof *f, function_cmp);
+	VECTOR_ITER(&functions, f) {
+		section_write(SECTION_TEXT, f->text.buf, f->text.len);
+		free(f->text.buf);
+	}
+	functions.nmembs = 0;
+}
+
+/*
+ * Function registered to run at exit in an instrumented program. The counts
+ * of earlier runs are read from the profile file with fread and added to the
+ * counters if the file holds as many, and the sums are written back to it.
+ */
+static const char *profile_dump32 =
+	"\n.Lprof_dump:\n"
+	"\tpushl %ebp\n"
+	"\tmovl %esp, %ebp\n"
+	"\tpushl %ebx\n"
+	"\tpushl %esi\n"
+	"\tandl $-16, %esp\n"
+	"\tsubl $16, %esp\n"
+	"\tmovl $.Lprof_file, (%esp)\n"
+	"\tmovl $.Lprof_rmode, 4(%esp)\n"
+	"\tcall fopen\n"
+	"\ttestl %eax, %eax\n"
+	"\tje .Lprof_write\n"
+	"\tmovl %eax, %ebx\n"
+	"\tmovl $.Lprof_old, (%esp)\n"
+	"\tmovl $8, 4(%esp)\n"
+	"\tmovl $.Lprof_n+1, 8(%esp)\n"
+	"\tmovl %ebx, 12(%esp)\n"
+	"\tcall fread\n"
+	"\tmovl %eax, %esi\n"
+	"\tmovl %ebx, (%esp)\n"
+	"\tcall fclose\n"
+	"\tcmpl $.Lprof_n+1, %esi\n"
+	"\tjne .Lprof_write\n"
+	"\tcmpl $.Lprof_n, .Lprof_old\n"
+	"\tjne .Lprof_write\n"
+	"\tcmpl $0, .Lprof_old+4\n"
+	"\tjne .Lprof_write\n"
+	"\tmovl $.Lprof_n, %ecx\n"
+	".Lprof_add:\n"
+	"\ttestl %ecx, %ecx\n"
+	"\tje .Lprof_write\n"
+	"\tmovl .Lprof_old(,%ecx,8), %eax\n"
+	"\tmovl .Lprof_old+4(,%ecx,8), %edx\n"
+	"\taddl %eax, .Lprof(,%ecx,8)\n"
+	"\tadcl %edx, .Lprof+4(,%ecx,8)\n"
+	"\tdecl %ecx\n"
+	"\tjmp .Lprof_add\n"
+	".Lprof_write:\n"
+	"\tmovl $.Lprof_file, (%esp)\n"
+	"\tmovl $.Lprof_mode, 4(%esp)\n"
+	"\tcall fopen\n"
+	"\ttestl %eax, %eax\n"
+	"\tje .Lprof_done\n"
+	"\tmovl %eax, %ebx\n"
+	"\tmovl $.Lprof_n, .Lprof\n"
+	"\tmovl $.Lprof, (%esp)\n"
+	"\tmovl $8, 4(%esp)\n"
+	"\tmovl $.Lprof_n+1, 8(%esp)\n"
+	"\tmovl %ebx, 12(%esp)\n"
+	"\tcall fwrite\n"
+	"\tmovl %ebx, (%esp)\n"
+	"\tcall fclose\n"
+	".Lprof_done:\n"
+	"\tmovl -4(%ebp), %ebx\n"
+	"\tmovl -8(%ebp), %esi\n"
+	"\tleave\n"
+	"\tret\n";
+
+static const char *profile_dump64 =
+	"\n.Lprof_dump:\n"
+	"\tpushq %rbp\n"
+	"\tmovq %rsp, %rbp\n"
+	"\tpushq %rbx\n"
+	"\tpushq %r12\n"
+	"\tleaq .Lprof_file(%rip), %rdi\n"
+	"\tleaq .Lprof_rmode(%rip), %rsi\n"
+	"\tcall fopen\n"
+	"\ttestq %rax, %rax\n"
+	"\tje .Lprof_write\n"
+	"\tmovq %rax, %rbx\n"
+	"\tleaq .Lprof_old(%rip), %rdi\n"
+	"\tmovl $8, %esi\n"
+	"\tmovl $.Lprof_n+1, %edx\n"
+	"\tmovq %rbx, %rcx\n"
+	"\tcall fread\n"
+	"\tmovq %rax, %r12\n"
+	"\tmovq %rbx, %rdi\n"
+	"\tcall fclose\n"
+	"\tcmpq $.Lprof_n+1, %r12\n"
+	"\tjne .Lprof_write\n"
+	"\tleaq .Lprof_old(%rip), %rsi\n"
+	"\tcmpq $.Lprof_n, (%rsi)\n"
+	"\tjne .Lprof_write\n"
+	"\tleaq .Lprof(%rip), %rdi\n"
+	"\tmovl $.Lprof_n, %ecx\n"
+	".Lprof_add:\n"
+	"\ttestq %rcx, %rcx\n"
+	"\tje .Lprof_write\n"
+	"\tmovq (%rsi,%rcx,8), %rax\n"
+	"\taddq %rax, (%rdi,%rcx,8)\n"
+	"\tdecq %rcx\n"
+	"\tjmp .Lprof_add\n"
+	".Lprof_write:\n"
+	"\tleaq .Lprof_file(%rip), %rdi\n"
+	"\tleaq .Lprof_mode(%rip), %rsi\n"
+	"\tcall fopen\n"
+	"\ttestq %rax, %rax\n"
+	"\tje .Lprof_done\n"
+	"\tmovq %rax, %rbx\n"
+	"\tmovq $.Lprof_n, .Lprof(%rip)\n"
+	"\tleaq .Lprof(%rip), %rdi\n"
+	"\tmovl $8, %esi\n"
+	"\tmovl $.Lprof_n+1, %edx\n"
+	"\tmovq %rbx, %rcx\n"
+	"\tcall fwrite\n"
+	"\tmovq %rbx, %rdi\n"
+	"\tcall fclose\n"
+	".Lprof_done:\n"
+	"\tmovq -8(%rbp), %rbx\n"
+	"\tmovq -16(%rbp), %r12\n"
+	"\tleave\n"
+	"\tret\n";
+
+/*
+ * write_profile_runtime:
+ * Write the 64-bit counters of an instrumented translation unit, a buffer
+ * for the counts of earlier runs, and the function which saves them when
+ * the program exits. The counters are zeroed storage, so their number is
+ * only filled into the first quadword when they are saved.
+ */
+static void write_profile_runtime(void)
+{
+	char buf[384];
+	int n;
+
+	n = profile_num_counters();
+	snprintf(buf, sizeof buf, ".set .Lprof_n, %d\n.align 8\n.Lprof:\n"
+	         "\t.zero %d\n.Lprof_old:\n\t.zero %d\n",
+	         n, (n + 1) * 8, (n + 1) * 8);
+	section_puts(SECTION_BSS, buf);
+
+	snprintf(buf, sizeof buf, ".Lprof_file:\n\t.string \"%s\"\n"
+	         ".Lprof_rmode:\n\t.string \"rb\"\n"
+	         ".Lprof_mode:\n\t.string \"wb\"\n", profile_filename());
+	section_puts(SECTION_STR, buf);
+
+	if (fcc_flags & FFLAG_FUNCTION_SECTIONS)
+		section_puts(SECTION_TEXT, "\n.section .text\n");
+	section_puts(SECTION_TEXT, fcc_m64 ? profile_dump64 : profile_dump32);
+	section_puts(SECTION_FINI, fcc_m64 ? ".align 8\n\t.quad .Lprof_dump\n"
+	                                   : ".align 4\n\t.long .Lprof_dump\n");
 }
 
 /*
@@ -224,20 +580,46 @@ void translate_function(const char *fname,
 	size_t bytes;
 	struct local_vars locals;
 	struct x86_sequence x86;
+	struct symbol *func;
+	struct ast_node *tmp;
+	struct graph_node *decl;
+	int nreg;
+
+	/* Temporaries created by the parser are declared first. */
+	if ((tmp = ast_temporaries())) {
+		decl = create_declaration(tmp);
+		decl->next = g;
+		g = decl;
+	}
+
+	if (fcc_flags & (FFLAG_PROFILE_GENERATE | FFLAG_PROFILE_USE))
+		profile_function(fname, g);
+
+	if (fcc_flags & FFLAG_INLINE) {
+		g = inline_calls(g);
+		inline_add_function(fname, params, g);
+	}
+
+	if (fcc_flags & FFLAG_LOOP_PATTERNS)
+		g = idiom_loops(g);
 
 	local_init(&locals);
 	x86_seq_init(&x86, &locals);
 
-	bytes = read_locals(fname, &locals, params, g);
+	func = symtab_entry((char *)fname);
+	nreg = ir_register_args(&func->flags, params);
+	bytes = read_locals(fname, &locals, params, nreg, g);
+	if (fcc_flags & FFLAG_UNROLL_LOOPS)
+		g = unroll_loops(g);
+	simplify_asg(g);
+	if (fcc_flags & FFLAG_IF_CONVERSION)
+		g = if_convert(g);
 
-	x86_begin_function(&x86, fname);
-	x86_grow_stack(&x86, bytes);
+	x86_begin_function(&x86, fname, params, nreg, bytes);
 	x86_translate(&x86, g);
-	bytes += x86.tmp_reg.size << 2;
-	x86_shrink_stack(&x86, bytes);
 	x86_end_function(&x86);
 
-	write_x86(&x86);
+	write_x86(&x86, !FLAGS_IS_STATIC(func->flags.type_flags));
 
 	x86_seq_destroy(&x86);
 	local_destroy(&locals);
@@ -248,12 +630,16 @@ void flush_to_file(char *filename)
 	FILE *f;
 	int sec;
 
+	write_functions();
+	if (fcc_flags & FFLAG_PROFILE_GENERATE)
+		write_profile_runtime();
+
 	f = fopen(filename, "w");
 	for (sec = 0; sec < NUM_SECTIONS; ++sec) {
 		if (!sections[sec].len)
 			continue;
 
-		fprintf(f, ".section .%s\n", section_names[sec]);
+		fprintf(f, ".section %s\n", section_names[sec]);
 		fputs(sections[sec].buf, f);
 	}
 	fclose(f);
@@ -29,4 +29,6 @@ void translate_function(const char *fname,
 
 void flush_to_file(char *filename);
 
+int gen_string_label(const char *lexeme);
+
 #endif /* FCC_GEN_H */
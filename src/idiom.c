@@ -0,0 +1,562 @@
+/*
+ * src/idiom.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Recognition of loops which fill, copy or scan memory.
+ *
+ * A counted loop of the form
+ *
+ *	for (i = start; i < n; i = i + 1)
+ *		p[i] = k;
+ *
+ * whose body only stores a loop invariant or the current element of another
+ * pointer to the current element of `p`, either indexed by `i` or through
+ * pointers advanced by one element each iteration, is replaced by a call to
+ * memset or memcpy for all of its iterations. A loop advancing a char pointer
+ * or index until it reaches a null byte is replaced by a call to strlen. The
+ * builtin functions are called, so fills and copies with a constant trip count
+ * are expanded inline. Every variable which the loop advances is then set to
+ * its value on exit.
+ *
+ * A forward copy between overlapping pointers repeats elements, where memcpy
+ * need not, so the original loop is kept and run instead when the distance
+ * between the pointers is less than the number of elements copied.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "idiom.h"
+#include "types.h"
+#include "vectorize.h"
+
+/* A counted loop storing to consecutive elements of a pointer. */
+struct idiom_loop {
+	struct vec_loop v;              /* induction variable and bound */
+	long            trip;           /* iterations, or -1 if not known */
+	int             walk;           /* pointers advance, not indexed */
+	size_t          elem;           /* size of the elements stored */
+	struct ast_node *dst;           /* pointer stored through */
+	struct ast_node *src;           /* pointer copied from, or NULL */
+	struct ast_node *fill;          /* value stored by a fill */
+};
+
+static int is_var(struct ast_node *expr, struct ast_node *var)
+{
+	return expr->tag == NODE_IDENTIFIER &&
+	       strcmp(expr->lexeme, var->lexeme) == 0;
+}
+
+static int is_const(struct ast_node *expr, long value)
+{
+	return expr->tag == NODE_CONSTANT && expr->value == value;
+}
+
+/* is_char: check if `expr` is a char value */
+static int is_char(struct ast_node *expr)
+{
+	return FLAGS_TYPE(expr->expr_flags.type_flags) == TYPE_CHAR &&
+	       !FLAGS_IS_PTR(expr->expr_flags.type_flags);
+}
+
+/* pointee_size: return the size of the objects pointer `ptr` points to */
+static size_t pointee_size(struct ast_node *ptr)
+{
+	struct type_information type;
+	unsigned int ind;
+
+	type = ptr->expr_flags;
+	ind = FLAGS_INDIRECTION(type.type_flags) - 1;
+	type.type_flags = (type.type_flags & 0x00FFFFFF)
+		| (ind << FLAGS_INDIRECTION_SHIFT);
+	return type_size(&type);
+}
+
+/*
+ * is_step:
+ * Check if `expr` is the assignment `var = var + 1`. The increment of a
+ * pointer has already been scaled by the size of its elements.
+ */
+static int is_step(struct ast_node *expr, struct ast_node *var)
+{
+	struct ast_node *add;
+	long step;
+
+	if (expr->tag != EXPR_ASSIGN || !is_var(expr->left, var) ||
+	    expr->right->tag != EXPR_ADD)
+		return 0;
+
+	add = expr->right;
+	step = FLAGS_IS_PTR(var->expr_flags.type_flags)
+	       ? (long)pointee_size(var) : 1;
+	return (is_var(add->left, var) && is_const(add->right, step)) ||
+	       (is_var(add->right, var) && is_const(add->left, step));
+}
+
+/*
+ * idiom_element:
+ * If `expr` accesses the current element of some pointer in loop `l`,
+ * return the pointer. Otherwise, return NULL.
+ */
+static struct ast_node *idiom_element(struct idiom_loop *l,
+                                      struct ast_node *expr)
+{
+	if (expr->tag != EXPR_DEREFERENCE)
+		return NULL;
+
+	if (!l->walk)
+		return vec_access_ptr(&l->v, expr);
+
+	if (expr->left->tag == NODE_IDENTIFIER &&
+	    FLAGS_IS_PTR(expr->left->expr_flags.type_flags))
+		return expr->left;
+	return NULL;
+}
+
+/* uniform: check if all bytes of the `size` byte constant `value` match */
+static int uniform(long value, size_t size)
+{
+	size_t i;
+
+	for (i = 1; i < size; ++i) {
+		if (((value >> (8 * i)) & 0xFF) != (value & 0xFF))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * idiom_match_store:
+ * Check if for loop `f` fills or copies consecutive elements of a pointer,
+ * and describe it in `l` if it does.
+ */
+static int idiom_match_store(struct asg_node_for *f, struct idiom_loop *l)
+{
+	struct asg_node_statement *s;
+	struct ast_node *store, *rhs;
+	struct graph_node *g;
+	int steps;
+
+	if (!f->body || !vec_counted_loop(f, &l->v))
+		return 0;
+
+	s = (struct asg_node_statement *)f->body;
+	if (f->body->type != ASG_NODE_STATEMENT || !s->ast ||
+	    s->ast->tag != EXPR_ASSIGN)
+		return 0;
+
+	store = s->ast;
+	if (!FLAGS_IS_INTEGER(store->left->expr_flags.type_flags) ||
+	    FLAGS_IS_PTR(store->left->expr_flags.type_flags))
+		return 0;
+	l->elem = type_size(&store->left->expr_flags);
+
+	l->walk = 0;
+	if (!(l->dst = idiom_element(l, store->left))) {
+		l->walk = 1;
+		if (!(l->dst = idiom_element(l, store->left)))
+			return 0;
+	}
+
+	rhs = store->right;
+	l->src = l->fill = NULL;
+	if (rhs->tag == EXPR_DEREFERENCE) {
+		l->src = idiom_element(l, rhs);
+		if (!l->src || is_var(l->src, l->dst) ||
+		    l->src->expr_flags.type_flags !=
+		    l->dst->expr_flags.type_flags)
+			return 0;
+	} else if (rhs->tag == NODE_CONSTANT) {
+		/* memset can only store the same byte throughout. */
+		if (!uniform(rhs->value, l->elem))
+			return 0;
+		l->fill = rhs;
+	} else if (rhs->tag == NODE_IDENTIFIER && l->elem == 1 &&
+	           FLAGS_IS_INTEGER(rhs->expr_flags.type_flags) &&
+	           !FLAGS_IS_PTR(rhs->expr_flags.type_flags) &&
+	           !is_var(rhs, l->v.ivar)) {
+		l->fill = rhs;
+	} else {
+		return 0;
+	}
+
+	/* Each pointer walked is advanced once after the store. */
+	steps = 0;
+	for (g = f->body->next; g; g = g->next) {
+		s = (struct asg_node_statement *)g;
+		if (!l->walk || g->type != ASG_NODE_STATEMENT || !s->ast)
+			return 0;
+		if (!(steps & 1) && is_step(s->ast, l->dst))
+			steps |= 1;
+		else if (l->src && !(steps & 2) && is_step(s->ast, l->src))
+			steps |= 2;
+		else
+			return 0;
+	}
+	if (l->walk && steps != (l->src ? 3 : 1))
+		return 0;
+
+	l->trip = -1;
+	if (f->init->right->tag == NODE_CONSTANT &&
+	    l->v.limit->tag == NODE_CONSTANT) {
+		l->trip = l->v.limit->value - f->init->right->value;
+		if (l->trip < 0)
+			l->trip = 0;
+	}
+
+	return 1;
+}
+
+/* idiom_const: return a constant node with value `value` */
+static struct ast_node *idiom_const(long value)
+{
+	struct ast_node *n;
+
+	n = create_node(NODE_CONSTANT, "0");
+	n->value = value;
+	return n;
+}
+
+/* idiom_count: return the number of iterations which remain in `l` */
+static struct ast_node *idiom_count(struct idiom_loop *l)
+{
+	if (l->trip != -1)
+		return idiom_const(l->trip);
+
+	return create_expr(EXPR_SUB, ast_copy(l->v.limit),
+	                   ast_copy(l->v.ivar));
+}
+
+/* idiom_address: return the address of the current element of `ptr` */
+static struct ast_node *idiom_address(struct idiom_loop *l,
+                                      struct ast_node *ptr)
+{
+	if (l->walk)
+		return ast_copy(ptr);
+
+	return create_expr(EXPR_ADD, ast_copy(ptr), ast_copy(l->v.ivar));
+}
+
+/* idiom_call: return a call to builtin `func` with arguments `args` */
+static struct ast_node *idiom_call(const char *func, struct ast_node *args)
+{
+	struct ast_node *id;
+
+	id = create_node(NODE_IDENTIFIER, (char *)func);
+	return create_expr(EXPR_FUNC, id, args);
+}
+
+/* idiom_advance: return the statement `var = var + n` */
+static struct graph_node *idiom_advance(struct ast_node *var,
+                                        struct ast_node *n)
+{
+	struct ast_node *sum;
+
+	sum = create_expr(EXPR_ADD, ast_copy(var), n);
+	return create_statement(create_expr(EXPR_ASSIGN, ast_copy(var), sum));
+}
+
+/* idiom_size: return the number of bytes which remain to be stored by `l` */
+static struct ast_node *idiom_size(struct idiom_loop *l)
+{
+	if (l->elem == 1)
+		return idiom_count(l);
+
+	return create_expr(EXPR_MULT, idiom_count(l), idiom_const(l->elem));
+}
+
+/*
+ * idiom_disjoint:
+ * Return a condition which holds if the remaining elements of the source
+ * and destination of copy `l` do not overlap. Pointer differences are not
+ * scaled to elements, so the distance is compared in bytes.
+ */
+static struct ast_node *idiom_disjoint(struct idiom_loop *l)
+{
+	struct ast_node *ahead, *behind;
+
+	ahead = create_expr(EXPR_GT,
+	                    create_expr(EXPR_SUB, ast_copy(l->dst),
+	                                ast_copy(l->src)),
+	                    idiom_size(l));
+	behind = create_expr(EXPR_GT,
+	                     create_expr(EXPR_SUB, ast_copy(l->src),
+	                                 ast_copy(l->dst)),
+	                     idiom_size(l));
+	return create_expr(EXPR_LOGICAL_OR, ahead, behind);
+}
+
+/*
+ * idiom_run:
+ * Return the statements which perform all remaining iterations of `l` at
+ * once and leave its variables with their values on exit.
+ */
+static struct graph_node *idiom_run(struct idiom_loop *l)
+{
+	struct ast_node *args, *arg, *exit;
+	struct graph_node *g;
+
+	if (l->src)
+		arg = idiom_address(l, l->src);
+	else if (l->fill->tag == NODE_CONSTANT)
+		arg = idiom_const(l->fill->value & 0xFF);
+	else
+		arg = ast_copy(l->fill);
+
+	args = create_expr(EXPR_COMMA, idiom_address(l, l->dst), arg);
+	args = create_expr(EXPR_COMMA, args, idiom_size(l));
+	g = create_statement(idiom_call(l->src ? "__builtin_memcpy"
+	                                       : "__builtin_memset", args));
+
+	/* The induction variable is used to count, so is set last. */
+	if (l->walk) {
+		g = asg_append(g, idiom_advance(l->dst, idiom_count(l)));
+		if (l->src)
+			g = asg_append(g, idiom_advance(l->src,
+			                                idiom_count(l)));
+	}
+
+	exit = create_expr(EXPR_ASSIGN, ast_copy(l->v.ivar),
+	                   ast_copy(l->v.limit));
+	return asg_append(g, create_statement(exit));
+}
+
+/* idiom_free: free the statements in `g` */
+static void idiom_free(struct graph_node *g)
+{
+	struct asg_node_statement *s;
+	struct graph_node *next;
+
+	for (; g; g = next) {
+		next = g->next;
+		s = (struct asg_node_statement *)g;
+		if (s->ast)
+			free_tree(s->ast);
+		free(s);
+	}
+}
+
+/*
+ * idiom_replace_store:
+ * Return the statements replacing loop `f`, described by `l`.
+ * A copy keeps the loop for pointers which overlap.
+ */
+static struct graph_node *idiom_replace_store(struct asg_node_for *f,
+                                              struct idiom_loop *l)
+{
+	struct graph_node *head, *run;
+	struct ast_node *guard;
+
+	head = create_statement(f->init);
+	f->init = NULL;
+	f->next = NULL;
+
+	run = NULL;
+	if (l->trip) {
+		run = idiom_run(l);
+		guard = l->trip == -1 ? ast_copy(f->cond) : NULL;
+		if (l->src) {
+			run = create_conditional(idiom_disjoint(l), run,
+			                         (struct graph_node *)f);
+			f = NULL;
+		}
+		if (guard)
+			run = create_conditional(guard, run, NULL);
+	}
+
+	if (f) {
+		free_tree(f->cond);
+		free_tree(f->post);
+		idiom_free(f->body);
+		free(f);
+	}
+
+	return asg_append(head, run);
+}
+
+/*
+ * idiom_scan:
+ * If `cond` tests whether the current element of a char pointer `p`,
+ * either `*p` or `p[i]`, is nonzero, return the access.
+ */
+static struct ast_node *idiom_scan(struct ast_node *cond)
+{
+	if (cond->tag == EXPR_NE && is_const(cond->right, 0))
+		cond = cond->left;
+
+	if (cond->tag != EXPR_DEREFERENCE || !is_char(cond))
+		return NULL;
+	return cond;
+}
+
+/* idiom_strlen: return `var = var + strlen(str)` */
+static struct graph_node *idiom_strlen(struct ast_node *var,
+                                       struct ast_node *str)
+{
+	return idiom_advance(var, idiom_call("__builtin_strlen", str));
+}
+
+/* is_empty: check if graph `g` does nothing */
+static int is_empty(struct graph_node *g)
+{
+	for (; g; g = g->next) {
+		if (g->type != ASG_NODE_STATEMENT ||
+		    ((struct asg_node_statement *)g)->ast)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * idiom_replace_scan_for:
+ * If for loop `f` advances a char pointer or an index into one until it
+ * reaches a null byte, return the statements replacing it.
+ */
+static struct graph_node *idiom_replace_scan_for(struct asg_node_for *f)
+{
+	struct graph_node *head, *run;
+	struct ast_node *elem, *var, *ptr;
+	struct vec_loop v;
+
+	if (!f->cond || !f->post || !is_empty(f->body) ||
+	    !(elem = idiom_scan(f->cond)) || f->post->tag != EXPR_ASSIGN)
+		return NULL;
+
+	var = f->post->left;
+	if (!is_step(f->post, var))
+		return NULL;
+
+	if (FLAGS_IS_PTR(var->expr_flags.type_flags)) {
+		if (!is_var(elem->left, var))
+			return NULL;
+		run = idiom_strlen(var, ast_copy(var));
+	} else {
+		memset(&v, 0, sizeof v);
+		v.ivar = var;
+		if (var->expr_flags.type_flags != TYPE_INT ||
+		    !(ptr = vec_access_ptr(&v, elem)))
+			return NULL;
+		run = idiom_strlen(var, create_expr(EXPR_ADD, ast_copy(ptr),
+		                                    ast_copy(var)));
+	}
+
+	head = f->init ? create_statement(f->init) : NULL;
+	free_tree(f->cond);
+	free_tree(f->post);
+	idiom_free(f->body);
+	free(f);
+
+	return asg_append(head, run);
+}
+
+/*
+ * idiom_replace_scan_while:
+ * If while loop `w` advances a char pointer until it reaches a null byte,
+ * return the statement replacing it.
+ */
+static struct graph_node *idiom_replace_scan_while(struct asg_node_while *w)
+{
+	struct asg_node_statement *s;
+	struct ast_node *elem, *var;
+	struct graph_node *run;
+
+	s = (struct asg_node_statement *)w->body;
+	if (!s || s->next || s->type != ASG_NODE_STATEMENT || !s->ast ||
+	    !(elem = idiom_scan(w->cond)) ||
+	    elem->left->tag != NODE_IDENTIFIER)
+		return NULL;
+
+	var = elem->left;
+	if (!is_step(s->ast, var))
+		return NULL;
+
+	run = idiom_strlen(var, ast_copy(var));
+	free_tree(w->cond);
+	idiom_free(w->body);
+	free(w);
+
+	return run;
+}
+
+/* idiom_replace: return the statements replacing loop `g`, or NULL */
+static struct graph_node *idiom_replace(struct graph_node *g)
+{
+	struct asg_node_for *f;
+	struct idiom_loop l;
+
+	switch (g->type) {
+	case ASG_NODE_FOR:
+		f = (struct asg_node_for *)g;
+		if (idiom_match_store(f, &l))
+			return idiom_replace_store(f, &l);
+		return idiom_replace_scan_for(f);
+	case ASG_NODE_WHILE:
+		return idiom_replace_scan_while((struct asg_node_while *)g);
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * idiom_loops:
+ * Replace the loops in `g` which fill, copy or scan memory with calls to
+ * the corresponding library functions. Return the new graph.
+ */
+struct graph_node *idiom_loops(struct graph_node *g)
+{
+	struct asg_node_conditional *c;
+	struct asg_node_switch *sw;
+	struct asg_node_for *f;
+	struct asg_node_while *w;
+	struct graph_node **link, *next, *run;
+
+	for (link = &g; *link; ) {
+		switch ((*link)->type) {
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)*link;
+			c->succ = idiom_loops(c->succ);
+			c->fail = idiom_loops(c->fail);
+			break;
+		case ASG_NODE_FOR:
+			f = (struct asg_node_for *)*link;
+			f->body = idiom_loops(f->body);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			w = (struct asg_node_while *)*link;
+			w->body = idiom_loops(w->body);
+			break;
+		case ASG_NODE_SWITCH:
+			sw = (struct asg_node_switch *)*link;
+			sw->body = idiom_loops(sw->body);
+			break;
+		}
+
+		next = (*link)->next;
+		if (!(run = idiom_replace(*link))) {
+			link = &(*link)->next;
+			continue;
+		}
+
+		*link = asg_append(run, next);
+		while (*link != next)
+			link = &(*link)->next;
+	}
+
+	return g;
+}
@@ -0,0 +1,166 @@
+/*
+ * src/ifconv.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * If-conversion of small conditionals.
+ *
+ * A conditional whose branches assign a constant or variable to the same
+ * local variable, either both of them or only its then branch,
+ *
+ *	if (c)                          if (x < y)
+ *		x = a;                          x = y;
+ *	else
+ *		x = b;
+ *
+ * is replaced by the assignment of a conditional expression, `x = c ? a : b`
+ * or `x = x < y ? y : x`, whose value is selected from the flags with a cmov
+ * or setcc instead of by jumping around the assignments. Reading both values
+ * costs no more than a load each, while a mispredicted branch costs many
+ * cycles. A branch which the profile shows to be rarely taken is predicted
+ * well, so it is kept.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fcc.h"
+#include "ifconv.h"
+#include "ir.h"
+#include "profile.h"
+#include "types.h"
+
+/*
+ * ifconv_assign:
+ * If `g` is a single statement assigning to a scalar local variable,
+ * return the assignment.
+ */
+static struct ast_node *ifconv_assign(struct graph_node *g)
+{
+	struct ast_node *ast;
+	unsigned int flags;
+
+	if (!g || g->next || g->type != ASG_NODE_STATEMENT)
+		return NULL;
+
+	ast = ((struct asg_node_statement *)g)->ast;
+	if (!ast || ast->tag != EXPR_ASSIGN ||
+	    ast->left->tag != NODE_IDENTIFIER)
+		return NULL;
+
+	flags = ast->left->expr_flags.type_flags;
+	return FLAGS_IS_INTEGER(flags) || FLAGS_IS_PTR(flags) ? ast : NULL;
+}
+
+/*
+ * ifconv_replace:
+ * If conditional `c` can be converted, return the statement replacing it.
+ */
+static struct graph_node *ifconv_replace(struct asg_node_conditional *c)
+{
+	struct ast_node *then, *other;
+	struct graph_node *g;
+
+	if (!(then = ifconv_assign(c->succ)))
+		return NULL;
+
+	if (c->fail) {
+		other = ifconv_assign(c->fail);
+		if (!other ||
+		    strcmp(other->left->lexeme, then->left->lexeme) != 0)
+			return NULL;
+		other = other->right;
+	} else {
+		other = then->left;
+	}
+
+	if (!ir_can_select(c->cond, then->right, other))
+		return NULL;
+
+	/* Instrumented branches are kept to be counted. */
+	if (c->prof >= 0 && (fcc_flags & FFLAG_PROFILE_GENERATE))
+		return NULL;
+	if (profile_branch_cold(c, 0) || profile_branch_cold(c, 1))
+		return NULL;
+
+	if (c->fail) {
+		((struct asg_node_statement *)c->fail)->ast->right = NULL;
+		free_tree(((struct asg_node_statement *)c->fail)->ast);
+		free(c->fail);
+	} else {
+		other = ast_copy(other);
+	}
+
+	then->right = create_expr(EXPR_COND, c->cond,
+	                          create_expr(EXPR_CHOICE, then->right, other));
+	g = c->succ;
+	free(c);
+
+	return g;
+}
+
+/*
+ * if_convert:
+ * Replace the small conditionals in `g` which assign one of two values to a
+ * variable with a branchless selection of the value. Return the new graph.
+ */
+struct graph_node *if_convert(struct graph_node *g)
+{
+	struct asg_node_conditional *c;
+	struct asg_node_switch *sw;
+	struct asg_node_for *f;
+	struct asg_node_while *w;
+	struct graph_node **link, *next, *run;
+
+	for (link = &g; *link; ) {
+		next = (*link)->next;
+		run = NULL;
+
+		switch ((*link)->type) {
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)*link;
+			c->succ = if_convert(c->succ);
+			c->fail = if_convert(c->fail);
+			run = ifconv_replace(c);
+			break;
+		case ASG_NODE_FOR:
+			f = (struct asg_node_for *)*link;
+			f->body = if_convert(f->body);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			w = (struct asg_node_while *)*link;
+			w->body = if_convert(w->body);
+			break;
+		case ASG_NODE_SWITCH:
+			sw = (struct asg_node_switch *)*link;
+			sw->body = if_convert(sw->body);
+			break;
+		}
+
+		if (!run) {
+			link = &(*link)->next;
+			continue;
+		}
+
+		run->next = next;
+		*link = run;
+		link = &run->next;
+	}
+
+	return g;
+}
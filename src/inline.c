@@ -0,0 +1,800 @@
+/*
+ * src/inline.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Inlining of small functions at their call sites.
+ *
+ * The bodies of all functions in the translation unit are recorded after they
+ * have been translated. When a later function calls one whose body fits within
+ * the inline limit, the call is replaced by a copy of the callee's body, with
+ * the callee's parameters and locals renamed into the caller's frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fcc.h"
+#include "inline.h"
+#include "profile.h"
+#include "types.h"
+#include "uthash.h"
+#include "vector.h"
+
+/* The callee's body is a single return statement. */
+#define INLINE_EXPR 1
+/* The callee's only return statement is the last statement in its body. */
+#define INLINE_STMT 2
+
+/* A function whose body is available for inlining. */
+struct inline_func {
+	const char              *name;
+	struct vector           params;
+	struct graph_node       *body;
+	int                     cost;
+	int                     kind;
+	UT_hash_handle          hh;
+};
+
+/* A variable of the callee being mapped into the caller. */
+struct inline_var {
+	const char              *old;   /* name of the variable in the callee */
+	struct ast_node         *node;  /* identifier or argument replacing it */
+	int                     local;  /* node is a new local of the caller */
+	int                     used;
+};
+
+struct inline_state {
+	struct ast_node *decls;         /* new locals added to the caller */
+	int             budget;         /* remaining growth for the caller */
+};
+
+#define INLINE_DISCARD  0
+#define INLINE_ASSIGN   1
+#define INLINE_RETURN   2
+
+static struct inline_func *functions = NULL;
+static int inline_count = 0;
+
+/*
+ * asg_has_return:
+ * Check if there is a return statement anywhere within `g`,
+ * excluding the node `ignore`.
+ */
+static int asg_has_return(struct graph_node *g, struct graph_node *ignore)
+{
+	struct asg_node_conditional *c;
+
+	for (; g; g = g->next) {
+		if (g == ignore)
+			continue;
+
+		switch (g->type) {
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			if (asg_has_return(c->succ, ignore)
+			    || asg_has_return(c->fail, ignore))
+				return 1;
+			break;
+		case ASG_NODE_FOR:
+			if (asg_has_return(((struct asg_node_for *)g)->body,
+			                   ignore))
+				return 1;
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			if (asg_has_return(((struct asg_node_while *)g)->body,
+			                   ignore))
+				return 1;
+			break;
+		case ASG_NODE_SWITCH:
+			if (asg_has_return(((struct asg_node_switch *)g)->body,
+			                   ignore))
+				return 1;
+			break;
+		case ASG_NODE_RETURN:
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * read_params:
+ * Store the identifiers declared in parameter list `params` in `v`.
+ * Return 1 if any of the parameters cannot be handled by the inliner.
+ */
+static int read_params(struct vector *v, struct ast_node *params)
+{
+	if (!params)
+		return 1;
+
+	if (params->tag == EXPR_COMMA)
+		return read_params(v, params->left)
+		       || read_params(v, params->right);
+
+	if (FLAGS_TYPE(params->expr_flags.type_flags) == TYPE_STRUCT &&
+	    !FLAGS_IS_PTR(params->expr_flags.type_flags))
+		return 1;
+
+	vector_append(v, &params);
+	return 0;
+}
+
+/*
+ * inline_add_function:
+ * Record the body of function `fname` so that calls to it
+ * in the rest of the translation unit can be inlined.
+ */
+void inline_add_function(const char *fname,
+                         struct ast_node *params,
+                         struct graph_node *body)
+{
+	struct inline_func *f;
+	struct graph_node *last;
+	int kind, cost, limit;
+	long long count;
+
+	if (!body)
+		return;
+
+	for (last = body; last->next; last = last->next)
+		;
+
+	if (body == last && body->type == ASG_NODE_RETURN &&
+	    ((struct asg_node_return *)body)->retval)
+		kind = INLINE_EXPR;
+	else if (!asg_has_return(body, last))
+		kind = INLINE_STMT;
+	else
+		return;
+
+	/*
+	 * With profile feedback, functions which were never called are kept
+	 * out of line, and the hottest functions may be larger.
+	 */
+	limit = fcc_inline_limit;
+	count = profile_function_count(fname);
+	if (count == 0)
+		return;
+	if (profile_hot(count))
+		limit *= PROF_HOT_INLINE;
+
+	cost = asg_cost(body);
+	if (cost > limit)
+		return;
+
+	HASH_FIND_STR(functions, fname, f);
+	if (f)
+		return;
+
+	f = malloc(sizeof *f);
+	f->name = fname;
+	vector_init(&f->params, sizeof (struct ast_node *));
+	if (params && read_params(&f->params, params)) {
+		vector_destroy(&f->params);
+		free(f);
+		return;
+	}
+	f->body = asg_copy(body);
+	f->cost = cost;
+	f->kind = kind;
+
+	HASH_ADD_KEYPTR(hh, functions, f->name, strlen(f->name), f);
+}
+
+static struct ast_node *inline_node(int tag, struct ast_node *left,
+                                    struct ast_node *right,
+                                    struct type_information *type)
+{
+	struct ast_node *n;
+
+	n = calloc(1, sizeof *n);
+	n->tag = tag;
+	n->left = left;
+	n->right = right;
+	memcpy(&n->expr_flags, type, sizeof n->expr_flags);
+
+	return n;
+}
+
+/*
+ * inline_new_var:
+ * Create a local variable in the caller to hold the value of
+ * the callee's variable `orig` and add it to the variable map.
+ */
+static void inline_new_var(struct vector *vars, struct ast_node *orig)
+{
+	struct inline_var v;
+	char *name;
+
+	/* A dot cannot appear in a C identifier, so the name is unique. */
+	name = malloc(strlen(orig->lexeme) + 16);
+	sprintf(name, "%s.%d", orig->lexeme, inline_count);
+
+	v.old = orig->lexeme;
+	v.node = inline_node(NODE_IDENTIFIER, NULL, NULL, &orig->expr_flags);
+	v.node->lexeme = name;
+	v.local = 1;
+	v.used = 0;
+	vector_append(vars, &v);
+}
+
+static void inline_add_decl(struct inline_state *st, struct ast_node *id)
+{
+	struct ast_node *n;
+
+	n = ast_copy(id);
+	if (st->decls)
+		st->decls = inline_node(EXPR_COMMA, st->decls, n,
+		                        &n->expr_flags);
+	else
+		st->decls = n;
+}
+
+/* inline_decls: add all used renamed variables in `vars` to the caller */
+static void inline_decls(struct inline_state *st, struct vector *vars)
+{
+	struct inline_var *v;
+
+	VECTOR_ITER(vars, v) {
+		if (v->local && v->used)
+			inline_add_decl(st, v->node);
+	}
+}
+
+/* read_locals: map all locals declared in callee body `g` into `vars` */
+static void read_locals(struct vector *vars, struct ast_node *decl)
+{
+	if (!decl)
+		return;
+
+	if (decl->tag == NODE_IDENTIFIER) {
+		inline_new_var(vars, decl);
+	} else {
+		read_locals(vars, decl->left);
+		read_locals(vars, decl->right);
+	}
+}
+
+static void scan_locals(struct vector *vars, struct graph_node *g)
+{
+	struct asg_node_conditional *c;
+
+	for (; g; g = g->next) {
+		switch (g->type) {
+		case ASG_NODE_DECLARATION:
+			read_locals(vars, ((struct asg_node_statement *)g)->ast);
+			break;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			scan_locals(vars, c->succ);
+			scan_locals(vars, c->fail);
+			break;
+		case ASG_NODE_FOR:
+			scan_locals(vars, ((struct asg_node_for *)g)->body);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			scan_locals(vars, ((struct asg_node_while *)g)->body);
+			break;
+		case ASG_NODE_SWITCH:
+			scan_locals(vars, ((struct asg_node_switch *)g)->body);
+			break;
+		}
+	}
+}
+
+/*
+ * inline_rename:
+ * Replace all references to callee variables in `ast` with their
+ * counterparts in the caller.
+ */
+static void inline_rename(struct ast_node **ast, struct vector *vars)
+{
+	struct inline_var *v;
+	struct ast_node *n;
+
+	if (!*ast)
+		return;
+
+	if ((*ast)->tag != NODE_IDENTIFIER) {
+		inline_rename(&(*ast)->left, vars);
+		inline_rename(&(*ast)->right, vars);
+		return;
+	}
+
+	VECTOR_ITER(vars, v) {
+		if (v->old != (*ast)->lexeme)
+			continue;
+
+		n = ast_copy(v->node);
+		memcpy(&n->expr_flags, &(*ast)->expr_flags,
+		       sizeof n->expr_flags);
+		free(*ast);
+		*ast = n;
+		v->used = 1;
+		return;
+	}
+}
+
+static void inline_rename_asg(struct graph_node *g, struct vector *vars)
+{
+	struct asg_node_conditional *c;
+	struct asg_node_switch *s;
+	struct asg_node_for *f;
+	struct asg_node_while *w;
+
+	for (; g; g = g->next) {
+		switch (g->type) {
+		case ASG_NODE_STATEMENT:
+			inline_rename(&((struct asg_node_statement *)g)->ast,
+			              vars);
+			break;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			inline_rename(&c->cond, vars);
+			inline_rename_asg(c->succ, vars);
+			inline_rename_asg(c->fail, vars);
+			break;
+		case ASG_NODE_FOR:
+			f = (struct asg_node_for *)g;
+			inline_rename(&f->init, vars);
+			inline_rename(&f->cond, vars);
+			inline_rename(&f->post, vars);
+			inline_rename_asg(f->body, vars);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			w = (struct asg_node_while *)g;
+			inline_rename(&w->cond, vars);
+			inline_rename_asg(w->body, vars);
+			break;
+		case ASG_NODE_RETURN:
+			inline_rename(&((struct asg_node_return *)g)->retval,
+			              vars);
+			break;
+		case ASG_NODE_SWITCH:
+			s = (struct asg_node_switch *)g;
+			inline_rename(&s->expr, vars);
+			inline_rename_asg(s->body, vars);
+			break;
+		}
+	}
+}
+
+/*
+ * strip_declarations:
+ * Remove all declarations from copied callee body `g`.
+ * The callee's locals are declared at the start of the caller instead.
+ */
+static void strip_declarations(struct graph_node **link)
+{
+	struct asg_node_conditional *c;
+	struct graph_node *g;
+
+	while ((g = *link)) {
+		switch (g->type) {
+		case ASG_NODE_DECLARATION:
+			*link = g->next;
+			free(g);
+			continue;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			strip_declarations(&c->succ);
+			strip_declarations(&c->fail);
+			break;
+		case ASG_NODE_FOR:
+			strip_declarations(&((struct asg_node_for *)g)->body);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			strip_declarations(&((struct asg_node_while *)g)->body);
+			break;
+		case ASG_NODE_SWITCH:
+			strip_declarations(&((struct asg_node_switch *)g)->body);
+			break;
+		}
+		link = &g->next;
+	}
+}
+
+/* read_args: store the arguments of a call in `v`, from left to right */
+static void read_args(struct vector *v, struct ast_node *args)
+{
+	if (!args)
+		return;
+
+	if (args->tag == EXPR_COMMA) {
+		read_args(v, args->left);
+		read_args(v, args->right);
+	} else {
+		vector_append(v, &args);
+	}
+}
+
+/*
+ * ast_writes:
+ * Check if the expression `ast` may modify any variable, or, if `id` is
+ * not NULL, if it assigns to or takes the address of the variable `id`.
+ */
+static int ast_writes(struct ast_node *ast, const char *id)
+{
+	if (!ast)
+		return 0;
+
+	if (!id && (ast->tag == EXPR_ASSIGN || ast->tag == EXPR_FUNC))
+		return 1;
+
+	if (id && (ast->tag == EXPR_ASSIGN || ast->tag == EXPR_ADDRESS) &&
+	    ast->left->tag == NODE_IDENTIFIER && ast->left->lexeme == id)
+		return 1;
+
+	return ast_writes(ast->left, id) || ast_writes(ast->right, id);
+}
+
+/*
+ * can_substitute:
+ * Check whether argument `arg` can be used directly in place of the callee's
+ * parameter `param` in expression `body`, rather than being copied.
+ */
+static int can_substitute(struct ast_node *body, struct ast_node *param,
+                          struct ast_node *arg)
+{
+	unsigned int pflags, aflags;
+
+	pflags = param->expr_flags.type_flags;
+	aflags = arg->expr_flags.type_flags;
+
+	if (type_size(&param->expr_flags) != type_size(&arg->expr_flags) ||
+	    !FLAGS_IS_PTR(pflags) != !FLAGS_IS_PTR(aflags))
+		return 0;
+
+	if (ast_writes(body, param->lexeme))
+		return 0;
+
+	if (arg->tag == NODE_CONSTANT)
+		return 1;
+
+	/*
+	 * A local variable passed as an argument can only be substituted
+	 * if nothing in the callee could change its value.
+	 */
+	return arg->tag == NODE_IDENTIFIER &&
+	       !FLAGS_IS_FUNC(aflags) && !ast_writes(body, NULL);
+}
+
+/*
+ * map_params:
+ * Map the parameters of `f` to the arguments in `args`. Parameters which
+ * require a copy of their argument have an assignment added to `assigns`.
+ * Return 1 if the arguments don't match the function's parameters.
+ */
+static int map_params(struct inline_func *f, struct vector *vars,
+                      struct vector *args, struct vector *assigns,
+                      struct ast_node *body)
+{
+	struct ast_node *param, *arg, *asn;
+	struct inline_var v, *var;
+	size_t i;
+
+	if (args->nmembs != f->params.nmembs)
+		return 1;
+
+	for (i = 0; i < f->params.nmembs; ++i) {
+		vector_get(&f->params, i, &param);
+		vector_get(args, i, &arg);
+
+		if (body && can_substitute(body, param, arg)) {
+			v.old = param->lexeme;
+			v.node = arg;
+			v.local = 0;
+			v.used = 0;
+			vector_append(vars, &v);
+			continue;
+		}
+
+		inline_new_var(vars, param);
+		var = (struct inline_var *)vars->data + vars->nmembs - 1;
+		var->used = 1;
+		asn = inline_node(EXPR_ASSIGN, ast_copy(var->node), arg,
+		                  &var->node->expr_flags);
+		vector_append(assigns, &asn);
+	}
+
+	return 0;
+}
+
+/*
+ * inline_expr_call:
+ * Replace function call `call` with the single expression returned by `f`,
+ * preceded by assignments of the arguments to the callee's parameters.
+ */
+static struct ast_node *inline_expr_call(struct inline_state *st,
+                                         struct inline_func *f,
+                                         struct ast_node *call)
+{
+	struct ast_node *body, *res, *asn;
+	struct vector vars, args, assigns;
+	size_t i;
+
+	vector_init(&vars, sizeof (struct inline_var));
+	vector_init(&args, sizeof (struct ast_node *));
+	vector_init(&assigns, sizeof (struct ast_node *));
+
+	body = ((struct asg_node_return *)f->body)->retval;
+	read_args(&args, call->right);
+
+	res = NULL;
+	++inline_count;
+	if (map_params(f, &vars, &args, &assigns, body) == 0) {
+		res = ast_copy(body);
+		inline_rename(&res, &vars);
+		inline_decls(st, &vars);
+
+		for (i = assigns.nmembs; i > 0; --i) {
+			vector_get(&assigns, i - 1, &asn);
+			res = inline_node(EXPR_COMMA, asn, res,
+			                  &res->expr_flags);
+		}
+		memcpy(&res->expr_flags, &call->expr_flags,
+		       sizeof res->expr_flags);
+	}
+
+	vector_destroy(&vars);
+	vector_destroy(&args);
+	vector_destroy(&assigns);
+	return res;
+}
+
+/*
+ * inline_stmt_call:
+ * Replace a statement containing call `call` with a copy of the body of `f`.
+ * `how` determines what is done with the callee's return value.
+ */
+static struct graph_node *inline_stmt_call(struct inline_state *st,
+                                           struct inline_func *f,
+                                           struct ast_node *call,
+                                           int how, struct ast_node *lhs)
+{
+	struct vector vars, args, assigns;
+	struct graph_node *head, *body, **link, *tail;
+	struct ast_node *asn, *retval;
+	size_t i;
+
+	vector_init(&vars, sizeof (struct inline_var));
+	vector_init(&args, sizeof (struct ast_node *));
+	vector_init(&assigns, sizeof (struct ast_node *));
+
+	head = NULL;
+	read_args(&args, call->right);
+	++inline_count;
+	if (map_params(f, &vars, &args, &assigns, NULL) != 0)
+		goto out;
+
+	scan_locals(&vars, f->body);
+	body = asg_copy(f->body);
+	strip_declarations(&body);
+	inline_rename_asg(body, &vars);
+
+	/* Detach the callee's return statement. */
+	retval = NULL;
+	for (link = &body; *link && (*link)->next; link = &(*link)->next)
+		;
+	if (*link && (*link)->type == ASG_NODE_RETURN) {
+		retval = ((struct asg_node_return *)*link)->retval;
+		free(*link);
+		*link = NULL;
+	}
+
+	if (!retval && how == INLINE_ASSIGN)
+		retval = inline_node(NODE_CONSTANT, NULL, NULL,
+		                     &call->expr_flags);
+
+	if (how == INLINE_RETURN)
+		tail = create_return(retval);
+	else if (how == INLINE_ASSIGN)
+		tail = create_statement(inline_node(EXPR_ASSIGN, lhs, retval,
+		                                    &lhs->expr_flags));
+	else
+		tail = retval ? create_statement(retval) : NULL;
+
+	for (i = 0; i < assigns.nmembs; ++i) {
+		vector_get(&assigns, i, &asn);
+		head = asg_append(head, create_statement(asn));
+	}
+	if (body)
+		head = asg_append(head, body);
+	if (tail)
+		head = asg_append(head, tail);
+	inline_decls(st, &vars);
+
+	/* An empty function with no return value disappears entirely. */
+	if (!head)
+		head = create_statement(inline_node(NODE_CONSTANT, NULL, NULL,
+		                                    &call->expr_flags));
+
+out:
+	vector_destroy(&vars);
+	vector_destroy(&args);
+	vector_destroy(&assigns);
+	return head;
+}
+
+/* inline_find: find an inlinable function called by `call` */
+static struct inline_func *inline_find(struct inline_state *st,
+                                       struct ast_node *call, int kind)
+{
+	struct inline_func *f;
+
+	if (!call || call->tag != EXPR_FUNC ||
+	    call->left->tag != NODE_IDENTIFIER)
+		return NULL;
+
+	HASH_FIND_STR(functions, call->left->lexeme, f);
+	if (!f || f->kind != kind || f->cost > st->budget)
+		return NULL;
+
+	return f;
+}
+
+/*
+ * inline_ast:
+ * Inline all calls to single expression functions within `ast`.
+ */
+static void inline_ast(struct inline_state *st, struct ast_node **ast)
+{
+	struct inline_func *f;
+	struct ast_node *res;
+
+	if (!*ast)
+		return;
+
+	inline_ast(st, &(*ast)->left);
+	inline_ast(st, &(*ast)->right);
+
+	if (!(f = inline_find(st, *ast, INLINE_EXPR)))
+		return;
+
+	if ((res = inline_expr_call(st, f, *ast))) {
+		st->budget -= f->cost;
+		*ast = res;
+	}
+}
+
+/*
+ * inline_statement:
+ * If `g` is a statement whose value comes from a call to a multi-statement
+ * function, return the list of statements with which it should be replaced.
+ */
+static struct graph_node *inline_statement(struct inline_state *st,
+                                           struct graph_node *g)
+{
+	struct ast_node *ast, *call, *lhs;
+	struct graph_node *res;
+	struct inline_func *f;
+	int how;
+
+	lhs = NULL;
+	if (g->type == ASG_NODE_STATEMENT) {
+		ast = ((struct asg_node_statement *)g)->ast;
+		if (ast->tag == EXPR_ASSIGN && ast->left->tag == NODE_IDENTIFIER) {
+			call = ast->right;
+			lhs = ast->left;
+			how = INLINE_ASSIGN;
+		} else {
+			call = ast;
+			how = INLINE_DISCARD;
+		}
+	} else if (g->type == ASG_NODE_RETURN) {
+		call = ((struct asg_node_return *)g)->retval;
+		how = INLINE_RETURN;
+	} else {
+		return NULL;
+	}
+
+	if (!(f = inline_find(st, call, INLINE_STMT)))
+		return NULL;
+
+	inline_ast(st, &call->right);
+	if ((res = inline_stmt_call(st, f, call, how, lhs)))
+		st->budget -= f->cost;
+
+	return res;
+}
+
+static void inline_asg(struct inline_state *st, struct graph_node **link)
+{
+	struct asg_node_conditional *c;
+	struct graph_node *g, *res, *last;
+	struct asg_node_switch *s;
+	struct asg_node_for *f;
+	struct asg_node_while *w;
+
+	while ((g = *link)) {
+		if ((res = inline_statement(st, g))) {
+			for (last = res; last->next; last = last->next)
+				;
+			last->next = g->next;
+			*link = res;
+			link = &last->next;
+			continue;
+		}
+
+		switch (g->type) {
+		case ASG_NODE_STATEMENT:
+			inline_ast(st, &((struct asg_node_statement *)g)->ast);
+			break;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			inline_ast(st, &c->cond);
+			/* Calls in rarely taken branches are not worth growing. */
+			if (!profile_branch_cold(c, 0))
+				inline_asg(st, &c->succ);
+			if (!profile_branch_cold(c, 1))
+				inline_asg(st, &c->fail);
+			break;
+		case ASG_NODE_FOR:
+			f = (struct asg_node_for *)g;
+			inline_ast(st, &f->init);
+			inline_ast(st, &f->cond);
+			inline_ast(st, &f->post);
+			inline_asg(st, &f->body);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			w = (struct asg_node_while *)g;
+			inline_ast(st, &w->cond);
+			inline_asg(st, &w->body);
+			break;
+		case ASG_NODE_RETURN:
+			inline_ast(st, &((struct asg_node_return *)g)->retval);
+			break;
+		case ASG_NODE_SWITCH:
+			s = (struct asg_node_switch *)g;
+			inline_ast(st, &s->expr);
+			inline_asg(st, &s->body);
+			break;
+		}
+		link = &g->next;
+	}
+}
+
+/*
+ * inline_calls:
+ * Inline calls to small functions within function body `g`.
+ * Return the new body of the function.
+ */
+struct graph_node *inline_calls(struct graph_node *g)
+{
+	struct inline_state st;
+	struct graph_node *decl;
+
+	st.decls = NULL;
+	st.budget = fcc_inline_limit * INLINE_UNIT_GROWTH;
+	inline_asg(&st, &g);
+
+	if (st.decls) {
+		decl = create_declaration(st.decls);
+		decl->next = g;
+		g = decl;
+	}
+
+	return g;
+}
@@ -0,0 +1,36 @@
+/*
+ * src/inline.h
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FCC_INLINE_H
+#define FCC_INLINE_H
+
+#include "asg.h"
+#include "ast.h"
+
+/*
+ * The total size of the function bodies which can be inlined into a single
+ * caller, as a multiple of the inline limit.
+ */
+#define INLINE_UNIT_GROWTH 8
+
+void inline_add_function(const char *fname,
+                         struct ast_node *params,
+                         struct graph_node *body);
+struct graph_node *inline_calls(struct graph_node *g);
+
+#endif /* FCC_INLINE_H */
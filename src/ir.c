@@ -18,12 +18,16 @@
 
 #include <string.h>
 
+#include "builtin.h"
+#include "fcc.h"
 #include "ir.h"
 #include "types.h"
 
 void ir_init(struct ir_sequence *ir)
 {
 	vector_init(&ir->seq, sizeof (struct ir_instruction));
+	ir->labels = IR_COND_TARGET + 1;
+	ir->depth = 0;
 }
 
 void ir_destroy(struct ir_sequence *ir)
@@ -34,6 +38,7 @@ void ir_destroy(struct ir_sequence *ir)
 void ir_clear(struct ir_sequence *ir)
 {
 	vector_clear(&ir->seq);
+	ir->labels = IR_COND_TARGET + 1;
 }
 
 #define IS_TERM(n) \
@@ -43,12 +48,44 @@ void ir_clear(struct ir_sequence *ir)
 
 struct tmp_reg {
 	int next;
+	int live;               /* registers currently allocated */
+	int peak;               /* most registers allocated at once */
 	int items[NUM_TEMP_REGS];
 };
 
 static int ir_read_ast(struct ir_sequence *ir,
                        struct ast_node *expr,
                        struct tmp_reg *temps);
+static int ir_read_logical(struct ir_sequence *ir,
+                           struct ast_node *expr,
+                           struct tmp_reg *temps);
+static int ir_read_conditional(struct ir_sequence *ir,
+                               struct ast_node *expr,
+                               struct tmp_reg *temps);
+static int ir_read_postfix(struct ir_sequence *ir,
+                           struct ast_node *expr,
+                           struct tmp_reg *temps);
+static void ir_discard(struct ir_sequence *ir,
+                       struct ast_node *expr,
+                       struct tmp_reg *temps);
+
+static int tmp_alloc(struct tmp_reg *temps)
+{
+	int reg;
+
+	reg = temps->next;
+	temps->next = temps->items[reg];
+	if (++temps->live > temps->peak)
+		temps->peak = temps->live;
+	return reg;
+}
+
+static void tmp_free(struct tmp_reg *temps, int reg)
+{
+	temps->items[reg] = temps->next;
+	temps->next = reg;
+	--temps->live;
+}
 
 static int ir_parse_lvalue_deref(struct ir_sequence *ir,
                                  struct ast_node *expr,
@@ -62,8 +99,7 @@ static int ir_parse_lvalue_deref(struct ir_sequence *ir,
 		++deref;
 
 	if (IS_TERM(expr)) {
-		tmpreg = temps->next;
-		temps->next = temps->items[temps->next];
+		tmpreg = tmp_alloc(temps);
 
 		inst.tag = IR_LOAD;
 		inst.target = tmpreg;
@@ -86,12 +122,111 @@ static int ir_parse_lvalue_deref(struct ir_sequence *ir,
 	return tmpreg;
 }
 
+/* ir_is_struct: check if `expr` is a struct value rather than a pointer */
+static int ir_is_struct(struct ast_node *expr)
+{
+	return FLAGS_TYPE(expr->expr_flags.type_flags) == TYPE_STRUCT &&
+	       !FLAGS_IS_PTR(expr->expr_flags.type_flags);
+}
+
+/* ir_num_args: count the number of arguments in argument list `arglist` */
+int ir_num_args(struct ast_node *arglist)
+{
+	if (!arglist)
+		return 0;
+	else if (arglist->tag == EXPR_COMMA)
+		return ir_num_args(arglist->left) + ir_num_args(arglist->right);
+	else
+		return 1;
+}
+
+/*
+ * ir_leading_scalars:
+ * Count the arguments in `arglist` before the first struct passed by value.
+ */
+static int ir_leading_scalars(struct ast_node *arglist)
+{
+	int n;
+
+	if (!arglist)
+		return 0;
+
+	if (arglist->tag != EXPR_COMMA)
+		return !ir_is_struct(arglist);
+
+	n = ir_leading_scalars(arglist->left);
+	if (n < ir_num_args(arglist->left))
+		return n;
+	return n + ir_leading_scalars(arglist->right);
+}
+
+/*
+ * ir_register_args:
+ * Return the number of the arguments `arglist` to a function of type `func`
+ * which are passed in registers rather than on the stack.
+ * Structs are always passed on the stack, as are all arguments after them.
+ */
+int ir_register_args(struct type_information *func, struct ast_node *arglist)
+{
+	int argc;
+
+	argc = ir_leading_scalars(arglist);
+
+	/* The System V ABI passes arguments in registers to every function. */
+	if (fcc_m64)
+		return argc < IR_SYSV_REGS ? argc : IR_SYSV_REGS;
+
+	if (!(fcc_flags & FFLAG_REGPARM) || !FLAGS_IS_STATIC(func->type_flags))
+		return 0;
+
+	return argc < IR_REGPARM_MAX ? argc : IR_REGPARM_MAX;
+}
+
+/* ir_arg_words: return the number of stack words taken by argument `arg` */
+int ir_arg_words(struct ast_node *arg)
+{
+	if (!ir_is_struct(arg))
+		return 1;
+
+	return ALIGN(type_size(&arg->expr_flags), FCC_WORD_SIZE)
+	       / FCC_WORD_SIZE;
+}
+
+/*
+ * ir_stack_words:
+ * Return the number of stack words taken by the arguments in `arglist`
+ * after the first `nreg`, which are passed in registers.
+ */
+int ir_stack_words(struct ast_node *arglist, int nreg)
+{
+	int nleft;
+
+	if (!arglist)
+		return 0;
+
+	if (arglist->tag != EXPR_COMMA)
+		return nreg ? 0 : ir_arg_words(arglist);
+
+	nleft = ir_num_args(arglist->left);
+	if (nreg >= nleft)
+		return ir_stack_words(arglist->right, nreg - nleft);
+	return ir_stack_words(arglist->left, nreg)
+	       + ir_stack_words(arglist->right, 0);
+}
+
+static void ir_member_operand(struct ir_sequence *ir, struct ir_operand *op,
+                              struct ast_node *mem_expr, struct tmp_reg *temps);
+
 /*
  * ir_parse_arguments:
  * Parse the argument list for a function and convert to IR instructions.
+ * `argno` is the position of the first argument in `arglist`, and the first
+ * `nreg` of the function's `argc` arguments are passed in registers, with
+ * the rest taking `nstack` words of the stack.
  */
 static void ir_parse_arguments(struct ir_sequence *ir,
                                struct ast_node *arglist,
+                               int argno, int nreg, int argc, int nstack,
                                struct tmp_reg *temps)
 {
 	struct ir_instruction inst;
@@ -99,24 +234,40 @@ static void ir_parse_arguments(struct ir_sequence *ir,
 	if (!arglist)
 		return;
 
+	inst.target = -1;
+	memcpy(&inst.type, &arglist->expr_flags, sizeof inst.type);
+	inst.rhs.op_type = IR_OPERAND_AST_NODE;
+	inst.rhs.reg = argno == argc - 1 && argno >= nreg ? nstack : 0;
+
 	if (IS_TERM(arglist)) {
+		/* These are loaded directly into their register before a call. */
+		if (argno < nreg)
+			return;
 		inst.tag = IR_PUSH;
 		inst.lhs.op_type = IR_OPERAND_AST_NODE;
 		inst.lhs.node = arglist;
 	} else if (arglist->tag == EXPR_MEMBER) {
-		/* TODO */
 		inst.tag = IR_PUSH;
+		ir_member_operand(ir, &inst.lhs, arglist, temps);
+		if (inst.lhs.op_type == IR_OPERAND_REG_OFF)
+			tmp_free(temps, inst.lhs.reg);
 	} else if (arglist->tag == EXPR_COMMA) {
-		ir_parse_arguments(ir, arglist->right, temps);
-		ir_parse_arguments(ir, arglist->left, temps);
+		ir_parse_arguments(ir, arglist->right,
+		                   argno + ir_num_args(arglist->left),
+		                   nreg, argc, nstack, temps);
+		ir_parse_arguments(ir, arglist->left, argno,
+		                   nreg, argc, nstack, temps);
 		return;
 	} else {
-		/* Some expression. */
+		/* Some expression, or the address of a struct pointed to. */
 		inst.tag = IR_PUSH;
 		inst.lhs.op_type = IR_OPERAND_TEMP_REG;
-		inst.lhs.reg = ir_read_ast(ir, arglist, temps);
-		temps->items[inst.lhs.reg] = temps->next;
-		temps->next = inst.lhs.reg;
+		if (ir_is_struct(arglist) &&
+		    arglist->tag == EXPR_DEREFERENCE)
+			inst.lhs.reg = ir_parse_lvalue_deref(ir, arglist, temps);
+		else
+			inst.lhs.reg = ir_read_ast(ir, arglist, temps);
+		tmp_free(temps, inst.lhs.reg);
 	}
 	vector_append(&ir->seq, &inst);
 }
@@ -142,6 +293,25 @@ static void ir_member_operand(struct ir_sequence *ir, struct ir_operand *op,
 	op->off = m->offset;
 }
 
+/*
+ * ir_read_operand:
+ * Read operand `expr` of expression `parent` into a temporary register.
+ * A dereference which is assigned to, or which is a struct, is read as
+ * the address of the object rather than its value.
+ */
+static int ir_read_operand(struct ir_sequence *ir,
+                           struct ast_node *parent,
+                           struct ast_node *expr,
+                           struct tmp_reg *temps)
+{
+	if (expr->tag == EXPR_DEREFERENCE &&
+	    ((parent->tag == EXPR_ASSIGN && expr == parent->left) ||
+	     ir_is_struct(expr)))
+		return ir_parse_lvalue_deref(ir, expr, temps);
+
+	return ir_read_ast(ir, expr, temps);
+}
+
 static int ir_read_ast_member(struct ir_sequence *ir,
                               struct ast_node *expr,
                               struct tmp_reg *temps)
@@ -156,8 +326,7 @@ static int ir_read_ast_member(struct ir_sequence *ir,
 	if (expr->left->tag == EXPR_MEMBER && expr->right->tag == EXPR_MEMBER) {
 		ir_member_operand(ir, &inst.lhs, expr->left, temps);
 		ir_member_operand(ir, &inst.rhs, expr->right, temps);
-		inst.target = temps->next;
-		temps->next = temps->items[temps->next];
+		inst.target = tmp_alloc(temps);
 		vector_append(&ir->seq, &inst);
 		return inst.target;
 	}
@@ -175,11 +344,10 @@ static int ir_read_ast_member(struct ir_sequence *ir,
 	if (IS_TERM(node)) {
 		other->op_type = IR_OPERAND_AST_NODE;
 		other->node = node;
-		inst.target = temps->next;
-		temps->next = temps->items[temps->next];
+		inst.target = tmp_alloc(temps);
 	} else {
 		other->op_type = IR_OPERAND_TEMP_REG;
-		other->reg = ir_read_ast(ir, node, temps);
+		other->reg = ir_read_operand(ir, expr, node, temps);
 		inst.target = other->reg;
 	}
 
@@ -187,16 +355,346 @@ static int ir_read_ast_member(struct ir_sequence *ir,
 	return inst.target;
 }
 
+/* ir_has_side_effects: check if evaluating `expr` can modify anything */
+static int ir_has_side_effects(struct ast_node *expr)
+{
+	if (!expr || IS_TERM(expr))
+		return 0;
+
+	if (expr->tag == EXPR_ASSIGN || expr->tag == EXPR_FUNC)
+		return 1;
+
+	if (expr->tag == EXPR_MEMBER)
+		return ir_has_side_effects(expr->left);
+
+	return ir_has_side_effects(expr->left) ||
+	       ir_has_side_effects(expr->right);
+}
+
+/*
+ * ir_need:
+ * Return the number of temporary registers which must be live at once
+ * to evaluate `expr`: its Sethi-Ullman number, with terminal operands,
+ * which are used directly, needing none.
+ */
+static int ir_need(struct ast_node *expr)
+{
+	int l, r;
+
+	if (IS_TERM(expr))
+		return 0;
+
+	/* Arguments are pushed as soon as they are evaluated. */
+	if (expr->tag == EXPR_FUNC) {
+		r = expr->right ? ir_need(expr->right) : 0;
+		return r > 1 ? r : 1;
+	}
+
+	if (expr->tag == EXPR_MEMBER)
+		return ir_need(expr->left);
+
+	/* The previous value is held while the assignment is evaluated. */
+	if (expr->tag == EXPR_POSTFIX)
+		return ir_need(expr->left) + 1;
+
+	l = ir_need(expr->left);
+	r = expr->right ? ir_need(expr->right) : 0;
+	/* A comma's left operand or a condition is done with first. */
+	if (expr->tag == EXPR_COMMA || expr->tag == EXPR_COND)
+		return l > r ? l : r ? r : 1;
+	if (expr->tag == EXPR_CHOICE)
+		return l > r ? l : r;
+
+	if (l == r)
+		return l + 1;
+	return l > r ? l : r;
+}
+
+/*
+ * ir_right_first:
+ * Check if the right operand of binary expression `expr` should be
+ * evaluated before its left. Evaluating the operand which needs more
+ * temporary registers first means they are free again while the value
+ * of the other is computed. Only the operands of commutative operators
+ * are exchanged, and never when either could have a side effect.
+ */
+static int ir_right_first(struct ast_node *expr)
+{
+	switch (expr->tag) {
+	case EXPR_ADD:
+	case EXPR_MULT:
+	case EXPR_AND:
+	case EXPR_OR:
+	case EXPR_XOR:
+		break;
+	default:
+		return 0;
+	}
+
+	if (ir_has_side_effects(expr->left) ||
+	    ir_has_side_effects(expr->right))
+		return 0;
+
+	return ir_need(expr->right) > ir_need(expr->left);
+}
+
+/* A pointer addition split into the parts of an x86 memory operand. */
+struct ir_address {
+	struct ast_node *base;
+	struct ast_node *index;
+	long scale;
+	long disp;
+};
+
+/* ir_plus_const: check if `expr` is a signed addition of a constant */
+static int ir_plus_const(struct ast_node *expr)
+{
+	return expr->tag == EXPR_ADD && expr->right->tag == NODE_CONSTANT &&
+	       !(expr->expr_flags.type_flags & QUAL_UNSIGNED);
+}
+
+/*
+ * ir_match_address:
+ * Check if pointer addition `expr` can be computed by a single memory
+ * operand, splitting it into `addr` if so. The index scaled in by
+ * pointer_additive_scale becomes the scale of the operand, and a constant
+ * added to the index is moved into its displacement.
+ */
+static int ir_match_address(struct ast_node *expr, struct ir_address *addr)
+{
+	struct ast_node *off;
+
+	if (expr->tag != EXPR_ADD ||
+	    !FLAGS_IS_PTR(expr->expr_flags.type_flags))
+		return 0;
+
+	if (FLAGS_IS_PTR(expr->left->expr_flags.type_flags)) {
+		addr->base = expr->left;
+		off = expr->right;
+	} else {
+		addr->base = expr->right;
+		off = expr->left;
+	}
+	if (addr->base->tag == NODE_CONSTANT ||
+	    addr->base->tag == EXPR_MEMBER)
+		return 0;
+
+	addr->index = NULL;
+	addr->scale = 1;
+	addr->disp = 0;
+	if (off->tag == NODE_CONSTANT) {
+		addr->disp = off->value;
+		return addr->disp == (int)addr->disp;
+	}
+
+	if (off->tag == EXPR_MULT && off->right->tag == NODE_CONSTANT) {
+		switch (off->right->value) {
+		case 1:
+		case 2:
+		case 4:
+		case 8:
+			addr->scale = off->right->value;
+			off = off->left;
+			break;
+		}
+	}
+	if (ir_plus_const(off)) {
+		addr->disp = off->right->value * addr->scale;
+		off = off->left;
+	}
+
+	addr->index = off;
+	return off->tag != EXPR_MEMBER && off->tag != NODE_CONSTANT &&
+	       addr->disp == (int)addr->disp;
+}
+
+/*
+ * ir_read_address:
+ * Compute the address of pointer addition `expr`, split into `addr`,
+ * with a single IR_INDEX instruction.
+ */
+static int ir_read_address(struct ir_sequence *ir,
+                           struct ast_node *expr,
+                           struct ir_address *addr,
+                           struct tmp_reg *temps)
+{
+	struct ir_instruction inst;
+
+	inst.tag = IR_INDEX;
+	memcpy(&inst.type, &expr->expr_flags, sizeof inst.type);
+
+	if (IS_TERM(addr->base)) {
+		inst.lhs.op_type = IR_OPERAND_AST_NODE;
+		inst.lhs.node = addr->base;
+	} else {
+		inst.lhs.op_type = IR_OPERAND_TEMP_REG;
+		inst.lhs.reg = ir_read_ast(ir, addr->base, temps);
+	}
+	inst.lhs.off = addr->disp;
+
+	if (!addr->index || IS_TERM(addr->index)) {
+		inst.rhs.op_type = IR_OPERAND_AST_NODE;
+		inst.rhs.node = addr->index;
+	} else {
+		inst.rhs.op_type = IR_OPERAND_TEMP_REG;
+		inst.rhs.reg = ir_read_ast(ir, addr->index, temps);
+	}
+	inst.rhs.off = addr->scale;
+
+	if (inst.lhs.op_type == IR_OPERAND_TEMP_REG) {
+		inst.target = inst.lhs.reg;
+		if (inst.rhs.op_type == IR_OPERAND_TEMP_REG)
+			tmp_free(temps, inst.rhs.reg);
+	} else if (inst.rhs.op_type == IR_OPERAND_TEMP_REG) {
+		inst.target = inst.rhs.reg;
+	} else {
+		inst.target = tmp_alloc(temps);
+	}
+
+	vector_append(&ir->seq, &inst);
+	return inst.target;
+}
+
+/*
+ * ir_load:
+ * Load the value of variable or struct member `expr` into a temporary
+ * register.
+ */
+static int ir_load(struct ir_sequence *ir, struct ast_node *expr,
+                   struct tmp_reg *temps)
+{
+	struct ir_instruction inst;
+
+	inst.tag = IR_LOAD;
+	memcpy(&inst.type, &expr->expr_flags, sizeof inst.type);
+	if (expr->tag == EXPR_MEMBER) {
+		ir_member_operand(ir, &inst.lhs, expr, temps);
+		if (inst.lhs.op_type == IR_OPERAND_REG_OFF)
+			inst.target = inst.lhs.reg;
+		else
+			inst.target = tmp_alloc(temps);
+	} else {
+		inst.lhs.op_type = IR_OPERAND_AST_NODE;
+		inst.lhs.node = expr;
+		inst.target = tmp_alloc(temps);
+	}
+
+	vector_append(&ir->seq, &inst);
+	return inst.target;
+}
+
+/*
+ * ir_update_value:
+ * If assignment `expr` has the form `x = x op y`, with an operator which
+ * can be applied to `x` where it is stored, return `y`. Otherwise, or if
+ * evaluating `x` once rather than twice would change the program, return
+ * NULL.
+ */
+static struct ast_node *ir_update_value(struct ast_node *expr)
+{
+	struct ast_node *op;
+
+	op = expr->right;
+	if (ir_has_side_effects(expr->left))
+		return NULL;
+
+	switch (op->tag) {
+	case EXPR_ADD:
+	case EXPR_AND:
+	case EXPR_OR:
+	case EXPR_XOR:
+		if (ast_equal(op->right, expr->left))
+			return op->left;
+		/* fallthrough */
+	case EXPR_SUB:
+	case EXPR_LSHIFT:
+	case EXPR_RSHIFT:
+		if (ast_equal(op->left, expr->left))
+			return op->right;
+		/* fallthrough */
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * ir_read_update:
+ * Generate IR for assignment `expr`, of the form `x = x op val`, which
+ * updates `x` in place.
+ */
+static int ir_read_update(struct ir_sequence *ir,
+                          struct ast_node *expr,
+                          struct ast_node *val,
+                          struct tmp_reg *temps)
+{
+	struct ir_instruction inst;
+	struct ast_node *obj;
+
+	obj = expr->left;
+	inst.tag = IR_UPDATE;
+	memcpy(&inst.type, &obj->expr_flags, sizeof inst.type);
+
+	if (IS_TERM(obj)) {
+		inst.lhs.op_type = IR_OPERAND_AST_NODE;
+		inst.lhs.node = obj;
+	} else if (obj->tag == EXPR_MEMBER) {
+		ir_member_operand(ir, &inst.lhs, obj, temps);
+	} else {
+		inst.lhs.op_type = IR_OPERAND_TEMP_REG;
+		inst.lhs.reg = ir_parse_lvalue_deref(ir, obj, temps);
+	}
+
+	if (IS_TERM(val)) {
+		inst.rhs.op_type = IR_OPERAND_AST_NODE;
+		inst.rhs.node = val;
+	} else {
+		inst.rhs.op_type = IR_OPERAND_TEMP_REG;
+		inst.rhs.reg = val->tag == EXPR_MEMBER
+		               ? ir_load(ir, val, temps)
+		               : ir_read_ast(ir, val, temps);
+	}
+	inst.rhs.off = expr->right->tag;
+
+	if (inst.lhs.op_type == IR_OPERAND_TEMP_REG ||
+	    inst.lhs.op_type == IR_OPERAND_REG_OFF) {
+		inst.target = inst.lhs.reg;
+		if (inst.rhs.op_type == IR_OPERAND_TEMP_REG)
+			tmp_free(temps, inst.rhs.reg);
+	} else if (inst.rhs.op_type == IR_OPERAND_TEMP_REG) {
+		inst.target = inst.rhs.reg;
+	} else {
+		inst.target = tmp_alloc(temps);
+	}
+
+	vector_append(&ir->seq, &inst);
+	return inst.target;
+}
+
 static int ir_read_ast(struct ir_sequence *ir,
                        struct ast_node *expr,
                        struct tmp_reg *temps)
 {
 	struct ir_instruction inst;
-	int tmp;
+	struct ast_node *first, *second, *val;
+	struct ir_address addr;
+	int argc, nreg;
 
 	if (IS_TERM(expr) || expr->tag == EXPR_MEMBER)
 		return -1;
 
+	if (expr->tag == EXPR_LOGICAL_AND || expr->tag == EXPR_LOGICAL_OR ||
+	    expr->tag == EXPR_LOGICAL_NOT)
+		return ir_read_logical(ir, expr, temps);
+
+	if (expr->tag == EXPR_COND)
+		return ir_read_conditional(ir, expr, temps);
+
+	if (expr->tag == EXPR_POSTFIX)
+		return ir_read_postfix(ir, expr, temps);
+
+	if (expr->tag == EXPR_ASSIGN && (val = ir_update_value(expr)))
+		return ir_read_update(ir, expr, val, temps);
+
 	inst.tag = expr->tag;
 	memcpy(&inst.type, &expr->expr_flags, sizeof inst.type);
 
@@ -205,10 +703,17 @@ static int ir_read_ast(struct ir_sequence *ir,
 		inst.lhs.node = expr->left;
 		inst.rhs.op_type = IR_OPERAND_AST_NODE;
 		inst.rhs.node = expr->right;
-		ir_parse_arguments(ir, expr->right, temps);
+		/* Expanded builtins take all of their arguments in registers. */
+		argc = ir_num_args(expr->right);
+		if (builtin_expands(expr->left, expr->right) != -1)
+			nreg = argc;
+		else
+			nreg = ir_register_args(&expr->left->expr_flags,
+			                        expr->right);
+		ir_parse_arguments(ir, expr->right, 0, nreg, argc,
+		                   ir_stack_words(expr->right, nreg), temps);
 
-		inst.target = temps->next;
-		temps->next = temps->items[temps->next];
+		inst.target = tmp_alloc(temps);
 
 		vector_append(&ir->seq, &inst);
 		return inst.target;
@@ -220,8 +725,7 @@ static int ir_read_ast(struct ir_sequence *ir,
 			inst.lhs.op_type = IR_OPERAND_AST_NODE;
 			inst.lhs.node = expr->left;
 
-			inst.target = temps->next;
-			temps->next = temps->items[temps->next];
+			inst.target = tmp_alloc(temps);
 		} else if (expr->left->tag == EXPR_MEMBER) {
 			/* TODO */
 		} else {
@@ -236,17 +740,11 @@ static int ir_read_ast(struct ir_sequence *ir,
 	}
 
 	if (expr->tag == EXPR_COMMA) {
-		if (!IS_TERM(expr->left)) {
-			tmp = ir_read_ast(ir, expr->left, temps);
-			/* Discard the result. */
-			temps->items[tmp] = temps->next;
-			temps->next = tmp;
-		}
+		ir_discard(ir, expr->left, temps);
 		if (IS_TERM(expr->right)) {
 			/* Bit of a hack, but no one does this in C anyway. */
 			inst.tag = EXPR_UNARY_PLUS;
-			inst.target = temps->next;
-			temps->next = temps->items[temps->next];
+			inst.target = tmp_alloc(temps);
 			inst.lhs.op_type = IR_OPERAND_AST_NODE;
 			inst.lhs.node = expr->right;
 			vector_append(&ir->seq, &inst);
@@ -259,10 +757,12 @@ static int ir_read_ast(struct ir_sequence *ir,
 	if (expr->left->tag == EXPR_MEMBER || expr->right->tag == EXPR_MEMBER)
 		return ir_read_ast_member(ir, expr, temps);
 
+	if (ir_match_address(expr, &addr))
+		return ir_read_address(ir, expr, &addr, temps);
+
 	if (IS_TERM(expr->left) && IS_TERM(expr->right)) {
 		/* Two terminal values: need a new temporary register. */
-		inst.target = temps->next;
-		temps->next = temps->items[temps->next];
+		inst.target = tmp_alloc(temps);
 
 		inst.lhs.op_type = IR_OPERAND_AST_NODE;
 		inst.lhs.node = expr->left;
@@ -273,48 +773,49 @@ static int ir_read_ast(struct ir_sequence *ir,
 		inst.lhs.op_type = IR_OPERAND_AST_NODE;
 		inst.lhs.node = expr->left;
 		inst.rhs.op_type = IR_OPERAND_TEMP_REG;
-		inst.rhs.reg = ir_read_ast(ir, expr->right, temps);
+		inst.rhs.reg = ir_read_operand(ir, expr, expr->right, temps);
 
 		inst.target = inst.rhs.reg;
 	} else if (IS_TERM(expr->right)) {
 		/* Ditto. */
 		inst.lhs.op_type = IR_OPERAND_TEMP_REG;
-		if (expr->tag == EXPR_ASSIGN &&
-		    expr->left->tag == EXPR_DEREFERENCE)
-			inst.lhs.reg = ir_parse_lvalue_deref(ir, expr->left,
-			                                     temps);
-		else
-			inst.lhs.reg = ir_read_ast(ir, expr->left, temps);
+		inst.lhs.reg = ir_read_operand(ir, expr, expr->left, temps);
 
 		inst.rhs.op_type = IR_OPERAND_AST_NODE;
 		inst.rhs.node = expr->right;
 
 		inst.target = inst.lhs.reg;
 	} else {
-		/* Both operands are expressions, use left's register. */
+		/*
+		 * Both operands are expressions, use the register of the
+		 * one evaluated first. The operand evaluated last is
+		 * always the rhs, as it is on top of the stack.
+		 */
+		first = expr->left;
+		second = expr->right;
+		if (ir_right_first(expr)) {
+			first = expr->right;
+			second = expr->left;
+		}
+
 		inst.lhs.op_type = IR_OPERAND_TEMP_REG;
-		if (expr->tag == EXPR_ASSIGN &&
-		    expr->left->tag == EXPR_DEREFERENCE)
-			inst.lhs.reg = ir_parse_lvalue_deref(ir, expr->left,
-			                                     temps);
-		else
-			inst.lhs.reg = ir_read_ast(ir, expr->left, temps);
+		inst.lhs.reg = ir_read_operand(ir, expr, first, temps);
 
 		inst.rhs.op_type = IR_OPERAND_TEMP_REG;
-		inst.rhs.reg = ir_read_ast(ir, expr->right, temps);
+		inst.rhs.reg = ir_read_operand(ir, expr, second, temps);
 
 		inst.target = inst.lhs.reg;
 
 		/* We no longer need the value in temp register rhs. */
-		temps->items[inst.rhs.reg] = temps->next;
-		temps->next = inst.rhs.reg;
+		tmp_free(temps, inst.rhs.reg);
 	}
 
 	vector_append(&ir->seq, &inst);
 	return inst.target;
 }
 
-static void ir_compare_zero(struct ir_sequence *ir, int term, void *item)
+static void ir_compare_zero(struct ir_sequence *ir, int term, void *item,
+                            struct ast_node *mask)
 {
 	struct ir_instruction inst;
 
@@ -329,35 +830,478 @@ static void ir_compare_zero(struct ir_sequence *ir, int term, void *item)
 		inst.lhs.op_type = IR_OPERAND_TEMP_REG;
 		inst.lhs.reg = ((struct ir_instruction *)item)->target;
 	}
+	inst.rhs.op_type = IR_OPERAND_AST_NODE;
+	inst.rhs.node = mask;
+	vector_append(&ir->seq, &inst);
+}
+
+/*
+ * ir_test_mask:
+ * Check if bitwise and `expr` compared to zero can be a single test of its
+ * left operand against the constant on its right.
+ */
+static int ir_test_mask(struct ast_node *expr)
+{
+	struct ast_node *l, *r;
+
+	if (expr->tag != EXPR_AND)
+		return 0;
+
+	l = expr->left;
+	r = expr->right;
+	return r->tag == NODE_CONSTANT && r->value == (int)r->value &&
+	       l->tag != EXPR_MEMBER &&
+	       type_size(&l->expr_flags) == type_size(&expr->expr_flags);
+}
+
+static int ir_new_label(struct ir_sequence *ir)
+{
+	return ir->labels++;
+}
+
+static void ir_label(struct ir_sequence *ir, int label)
+{
+	struct ir_instruction inst;
+
+	memset(&inst, 0, sizeof inst);
+	inst.tag = IR_LABEL;
+	inst.target = label;
 	vector_append(&ir->seq, &inst);
 }
 
+/*
+ * ir_flags_instruction:
+ * Append an instruction `tag` which uses the flags set by comparison `cmp`.
+ */
+static void ir_flags_instruction(struct ir_sequence *ir, int tag,
+                                 int target, int cmp, int val)
+{
+	struct ir_instruction inst;
+
+	inst.tag = tag;
+	inst.target = target;
+	inst.type.type_flags = TYPE_INT;
+	inst.type.extra = NULL;
+	inst.lhs.op_type = IR_OPERAND_AST_NODE;
+	inst.lhs.reg = cmp;
+	inst.rhs.op_type = IR_OPERAND_AST_NODE;
+	inst.rhs.reg = val;
+	vector_append(&ir->seq, &inst);
+}
+
+/* ir_label_used: check if anything after instruction `start` jumps to `label` */
+static int ir_label_used(struct ir_sequence *ir, size_t start, int label)
+{
+	struct ir_instruction *inst;
+
+	for (inst = (struct ir_instruction *)ir->seq.data + start;
+	     inst < (struct ir_instruction *)ir->seq.data + ir->seq.nmembs;
+	     ++inst) {
+		if (inst->tag == IR_JUMP && inst->target == label)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * ir_read_postfix:
+ * Generate IR for postfix increment or decrement `expr`, whose value is
+ * that of its operand before the assignment which updates it.
+ */
+static int ir_read_postfix(struct ir_sequence *ir,
+                           struct ast_node *expr,
+                           struct tmp_reg *temps)
+{
+	struct ast_node *obj;
+	int tmp;
+
+	obj = expr->left->left;
+	if (IS_TERM(obj) || obj->tag == EXPR_MEMBER)
+		tmp = ir_load(ir, obj, temps);
+	else
+		tmp = ir_read_ast(ir, obj, temps);
+
+	ir_discard(ir, expr->left, temps);
+	return tmp;
+}
+
+/*
+ * ir_discard:
+ * Generate IR for expression `expr`, whose value is not used.
+ * Assignments within it only store their values.
+ */
+static void ir_discard(struct ir_sequence *ir,
+                       struct ast_node *expr,
+                       struct tmp_reg *temps)
+{
+	struct ir_instruction *last;
+	int tmp;
+
+	if (IS_TERM(expr) || expr->tag == EXPR_MEMBER)
+		return;
+
+	switch (expr->tag) {
+	case EXPR_COMMA:
+		ir_discard(ir, expr->left, temps);
+		ir_discard(ir, expr->right, temps);
+		return;
+	case EXPR_POSTFIX:
+		ir_discard(ir, expr->left, temps);
+		return;
+	default:
+		break;
+	}
+
+	tmp = ir_read_ast(ir, expr, temps);
+	if (expr->tag == EXPR_ASSIGN) {
+		last = (struct ir_instruction *)ir->seq.data +
+		       ir->seq.nmembs - 1;
+		last->target = -1;
+	}
+	tmp_free(temps, tmp);
+}
+
+/*
+ * ir_compare:
+ * Generate IR to set the flags according to the truth value of `expr`.
+ * Return the comparison that was made.
+ */
+static int ir_compare(struct ir_sequence *ir, struct ast_node *expr,
+                      struct tmp_reg *temps)
+{
+	struct ir_instruction inst;
+	struct ast_node *mask;
+
+	if (expr->tag >= EXPR_EQ && expr->tag <= EXPR_GE) {
+		/* The result of the comparison is never stored. */
+		tmp_free(temps, ir_read_ast(ir, expr, temps));
+		return expr->tag;
+	}
+
+	mask = NULL;
+	if (ir_test_mask(expr)) {
+		mask = expr->right;
+		expr = expr->left;
+	}
+
+	if (IS_TERM(expr)) {
+		ir_compare_zero(ir, 1, expr, mask);
+	} else {
+		inst.target = ir_read_ast(ir, expr, temps);
+		ir_compare_zero(ir, 0, &inst, mask);
+		tmp_free(temps, inst.target);
+	}
+
+	return IR_TEST;
+}
+
+/*
+ * ir_branch:
+ * Generate IR to jump to `label` if the truth value of `expr` is `jump_if`,
+ * evaluating logical operators as branches.
+ */
+static void ir_branch(struct ir_sequence *ir, struct ast_node *expr,
+                      int label, int jump_if, struct tmp_reg *temps)
+{
+	int skip;
+
+	switch (expr->tag) {
+	case EXPR_LOGICAL_AND:
+	case EXPR_LOGICAL_OR:
+		if ((expr->tag == EXPR_LOGICAL_OR) == !!jump_if) {
+			/* Either operand alone can take the branch. */
+			ir_branch(ir, expr->left, label, jump_if, temps);
+			ir_branch(ir, expr->right, label, jump_if, temps);
+		} else {
+			/* The left operand can decide not to take it. */
+			skip = ir_new_label(ir);
+			ir_branch(ir, expr->left, skip, !jump_if, temps);
+			ir_branch(ir, expr->right, label, jump_if, temps);
+			ir_label(ir, skip);
+		}
+		break;
+	case EXPR_LOGICAL_NOT:
+		ir_branch(ir, expr->left, label, !jump_if, temps);
+		break;
+	case NODE_CONSTANT:
+		if (!expr->value == !jump_if)
+			ir_flags_instruction(ir, IR_JUMP, label, -1, 0);
+		break;
+	default:
+		ir_flags_instruction(ir, IR_JUMP, label,
+		                     ir_compare(ir, expr, temps), !!jump_if);
+		break;
+	}
+}
+
+/*
+ * ir_bool:
+ * Generate IR for logical expression `expr` which jumps to `ltrue` or
+ * `lfalse` as soon as its value is known. The final operand instead falls
+ * through with the flags set by the returned comparison, and the value
+ * of the expression is whether that comparison is `*sense`.
+ * Return -1 if the expression does not fall through.
+ */
+static int ir_bool(struct ir_sequence *ir, struct ast_node *expr,
+                   int ltrue, int lfalse, int *sense,
+                   struct tmp_reg *temps)
+{
+	int cmp;
+
+	switch (expr->tag) {
+	case EXPR_LOGICAL_AND:
+		ir_branch(ir, expr->left, lfalse, 0, temps);
+		return ir_bool(ir, expr->right, ltrue, lfalse, sense, temps);
+	case EXPR_LOGICAL_OR:
+		ir_branch(ir, expr->left, ltrue, 1, temps);
+		return ir_bool(ir, expr->right, ltrue, lfalse, sense, temps);
+	case EXPR_LOGICAL_NOT:
+		cmp = ir_bool(ir, expr->left, lfalse, ltrue, sense, temps);
+		*sense = !*sense;
+		return cmp;
+	case NODE_CONSTANT:
+		ir_flags_instruction(ir, IR_JUMP, expr->value ? ltrue : lfalse,
+		                     -1, 0);
+		return -1;
+	default:
+		*sense = 1;
+		return ir_compare(ir, expr, temps);
+	}
+}
+
+/*
+ * ir_read_logical:
+ * Generate IR for the value of a logical expression. The final operand's
+ * value is set directly from the flags, while operands which short-circuit
+ * the expression jump to a constant result.
+ */
+static int ir_read_logical(struct ir_sequence *ir,
+                           struct ast_node *expr,
+                           struct tmp_reg *temps)
+{
+	int ltrue, lfalse, lend, cmp, sense, used_true, used_false, target;
+	size_t start;
+
+	ltrue = ir_new_label(ir);
+	lfalse = ir_new_label(ir);
+	lend = ir_new_label(ir);
+	start = ir->seq.nmembs;
+
+	cmp = ir_bool(ir, expr, ltrue, lfalse, &sense, temps);
+	used_true = ir_label_used(ir, start, ltrue);
+	used_false = ir_label_used(ir, start, lfalse);
+
+	if (cmp != -1) {
+		ir_flags_instruction(ir, IR_SETCC, -1, cmp, sense);
+		if (used_true || used_false)
+			ir_flags_instruction(ir, IR_JUMP, lend, -1, 0);
+	}
+	if (used_true) {
+		ir_label(ir, ltrue);
+		ir_flags_instruction(ir, IR_SETCC, -1, -1, 1);
+		if (used_false)
+			ir_flags_instruction(ir, IR_JUMP, lend, -1, 0);
+	}
+	if (used_false) {
+		ir_label(ir, lfalse);
+		ir_flags_instruction(ir, IR_SETCC, -1, -1, 0);
+	}
+	if (used_true || used_false)
+		ir_label(ir, lend);
+
+	target = tmp_alloc(temps);
+	ir_flags_instruction(ir, IR_RESULT, target, -1, 0);
+
+	return target;
+}
+
+/* ir_select_term: check if `expr` can be read whether or not it is chosen */
+static int ir_select_term(struct ast_node *expr)
+{
+	return expr->tag == NODE_CONSTANT ||
+	       (expr->tag == NODE_IDENTIFIER &&
+	        !FLAGS_IS_FUNC(expr->expr_flags.type_flags));
+}
+
+/*
+ * ir_can_select:
+ * Check if the value of conditional expression `cond ? a : b` can be selected
+ * from the flags set by `cond` with a conditional move, rather than by jumping
+ * over one of its operands. Both operands must be constants or variables, and
+ * the condition a single comparison.
+ */
+int ir_can_select(struct ast_node *cond, struct ast_node *a,
+                  struct ast_node *b)
+{
+	if (!(fcc_flags & FFLAG_IF_CONVERSION) ||
+	    !ir_select_term(a) || !ir_select_term(b))
+		return 0;
+
+	while (cond->tag == EXPR_LOGICAL_NOT)
+		cond = cond->left;
+	return cond->tag != EXPR_LOGICAL_AND && cond->tag != EXPR_LOGICAL_OR &&
+	       cond->tag != NODE_CONSTANT;
+}
+
+/* ir_value: generate IR setting the value of a conditional to `expr` */
+static void ir_value(struct ir_sequence *ir, struct ast_node *expr,
+                     struct tmp_reg *temps)
+{
+	struct ir_instruction inst;
+
+	inst.tag = IR_VALUE;
+	inst.target = -1;
+	memcpy(&inst.type, &expr->expr_flags, sizeof inst.type);
+	if (IS_TERM(expr)) {
+		inst.lhs.op_type = IR_OPERAND_AST_NODE;
+		inst.lhs.node = expr;
+	} else if (expr->tag == EXPR_MEMBER) {
+		ir_member_operand(ir, &inst.lhs, expr, temps);
+		if (inst.lhs.op_type == IR_OPERAND_REG_OFF)
+			tmp_free(temps, inst.lhs.reg);
+	} else {
+		inst.lhs.op_type = IR_OPERAND_TEMP_REG;
+		inst.lhs.reg = ir_read_ast(ir, expr, temps);
+		tmp_free(temps, inst.lhs.reg);
+	}
+	inst.rhs.op_type = IR_OPERAND_AST_NODE;
+	inst.rhs.node = NULL;
+	vector_append(&ir->seq, &inst);
+}
+
+/*
+ * ir_read_conditional:
+ * Generate IR for the value of conditional expression `expr`. The value is
+ * selected without branching if possible. Otherwise, each operand sets it on
+ * its own path, as the constants of a logical expression do.
+ */
+static int ir_read_conditional(struct ir_sequence *ir,
+                               struct ast_node *expr,
+                               struct tmp_reg *temps)
+{
+	struct ir_instruction inst;
+	struct ast_node *cond, *a, *b, *tmp;
+	int lfalse, lend;
+
+	cond = expr->left;
+	a = expr->right->left;
+	b = expr->right->right;
+	memcpy(&inst.type, &expr->expr_flags, sizeof inst.type);
+
+	if (ir_can_select(cond, a, b)) {
+		for (; cond->tag == EXPR_LOGICAL_NOT; cond = cond->left) {
+			tmp = a;
+			a = b;
+			b = tmp;
+		}
+		inst.tag = IR_SELECT;
+		inst.lhs.op_type = IR_OPERAND_AST_NODE;
+		inst.lhs.node = a;
+		inst.lhs.off = ir_compare(ir, cond, temps);
+		inst.rhs.op_type = IR_OPERAND_AST_NODE;
+		inst.rhs.node = b;
+		inst.target = tmp_alloc(temps);
+		vector_append(&ir->seq, &inst);
+		return inst.target;
+	}
+
+	lfalse = ir_new_label(ir);
+	lend = ir_new_label(ir);
+	ir_branch(ir, cond, lfalse, 0, temps);
+	ir_value(ir, a, temps);
+	ir_flags_instruction(ir, IR_JUMP, lend, -1, 0);
+	ir_label(ir, lfalse);
+	ir_value(ir, b, temps);
+	ir_label(ir, lend);
+
+	inst.tag = IR_RESULT;
+	inst.target = tmp_alloc(temps);
+	inst.lhs.op_type = IR_OPERAND_AST_NODE;
+	inst.lhs.reg = -1;
+	inst.rhs.op_type = IR_OPERAND_AST_NODE;
+	inst.rhs.reg = 0;
+	vector_append(&ir->seq, &inst);
+	return inst.target;
+}
+
+static void ir_init_temps(struct tmp_reg *t)
+{
+	int i;
+
+	t->next = 0;
+	t->live = 0;
+	t->peak = 0;
+	for (i = 0; i < NUM_TEMP_REGS - 1; ++i)
+		t->items[i] = i + 1;
+	t->items[i] = -1;
+}
+
+/*
+ * ir_parse_cond:
+ * Generate IR for condition `expr` which jumps to IR_COND_TARGET
+ * if the truth value of `expr` is `jump_if`.
+ */
+void ir_parse_cond(struct ir_sequence *ir, struct ast_node *expr, int jump_if)
+{
+	struct tmp_reg t;
+
+	ir_init_temps(&t);
+	ir_branch(ir, expr, IR_COND_TARGET, jump_if, &t);
+	if (t.peak > ir->depth)
+		ir->depth = t.peak;
+}
+
 void ir_parse_expr(struct ir_sequence *ir, struct ast_node *expr, int cond)
 {
 	struct tmp_reg t;
 	struct ir_instruction inst;
-	int i;
+	struct ast_node *mask;
 
 	if (expr->tag == NODE_STRLIT)
 		return;
 
-	t.next = 0;
-	for (i = 0; i < NUM_TEMP_REGS - 1; ++i)
-		t.items[i] = i + 1;
-	t.items[i] = -1;
+	ir_init_temps(&t);
 
 	if (cond && !TAG_IS_COND(expr->tag)) {
+		mask = NULL;
+		if (ir_test_mask(expr)) {
+			mask = expr->right;
+			expr = expr->left;
+		}
 		if (expr->tag == NODE_CONSTANT || expr->tag == NODE_IDENTIFIER) {
-			ir_compare_zero(ir, 1, expr);
+			ir_compare_zero(ir, 1, expr, mask);
 		} else {
-			ir_read_ast(ir, expr, &t);
-			vector_get(&ir->seq, ir->seq.nmembs - 1, &inst);
-			ir_compare_zero(ir, 0, &inst);
+			inst.target = ir_read_ast(ir, expr, &t);
+			ir_compare_zero(ir, 0, &inst, mask);
 		}
-		return;
+	} else {
+		ir_discard(ir, expr, &t);
 	}
 
-	ir_read_ast(ir, expr, &t);
+	if (t.peak > ir->depth)
+		ir->depth = t.peak;
+}
+
+/*
+ * ir_parse_value:
+ * Generate IR for expression `expr` whose value is used, and return
+ * the temporary register which holds it.
+ */
+int ir_parse_value(struct ir_sequence *ir, struct ast_node *expr)
+{
+	struct tmp_reg t;
+	int tmp;
+
+	ir_init_temps(&t);
+	if (expr->tag == EXPR_MEMBER)
+		tmp = ir_load(ir, expr, &t);
+	else
+		tmp = ir_read_ast(ir, expr, &t);
+
+	if (t.peak > ir->depth)
+		ir->depth = t.peak;
+	return tmp;
 }
 
 static void ir_print_operand(struct ir_operand *op)
@@ -414,16 +1358,56 @@ void ir_print_sequence(struct ir_sequence *ir)
 	struct ir_instruction *inst;
 
 	VECTOR_ITER(&ir->seq, inst) {
-		if (inst->tag == IR_TEST) {
+		if (inst->tag == IR_JUMP) {
+			printf("jump\tL%d", inst->target);
+			if (inst->lhs.reg != -1)
+				printf(" if %s%s", inst->rhs.reg ? "" : "!",
+				       inst->lhs.reg == IR_TEST
+				       ? "test" : expr_str[inst->lhs.reg]);
+		} else if (inst->tag == IR_LABEL) {
+			printf("L%d:", inst->target);
+		} else if (inst->tag == IR_SETCC) {
+			if (inst->lhs.reg == -1)
+				printf("setcc\t%d", inst->rhs.reg);
+			else
+				printf("setcc\t%s%s", inst->rhs.reg ? "" : "!",
+				       inst->lhs.reg == IR_TEST
+				       ? "test" : expr_str[inst->lhs.reg]);
+		} else if (inst->tag == IR_RESULT) {
+			printf("t%d\t= setcc", inst->target);
+		} else if (inst->tag == IR_VALUE) {
+			printf("setcc\t");
+			ir_print_operand(&inst->lhs);
+		} else if (inst->tag == IR_SELECT) {
+			printf("t%d\t= %s ? ", inst->target,
+			       inst->lhs.off == IR_TEST
+			       ? "test" : expr_str[inst->lhs.off]);
+			ir_print_operand(&inst->lhs);
+			printf(" : ");
+			ir_print_operand(&inst->rhs);
+		} else if (inst->tag == IR_TEST) {
 			printf("test\t");
 			ir_print_operand(&inst->lhs);
+			if (inst->rhs.node) {
+				printf(" & ");
+				ir_print_operand(&inst->rhs);
+			}
 		} else if (inst->tag == IR_PUSH) {
 			printf("push\t");
 			ir_print_operand(&inst->lhs);
+		} else if (inst->tag == IR_INDEX) {
+			printf("t%d\t= &", inst->target);
+			ir_print_operand(&inst->lhs);
+			if (inst->rhs.node) {
+				printf("[");
+				ir_print_operand(&inst->rhs);
+				printf(" * %lu]", inst->rhs.off);
+			}
 		} else if (inst->tag == IR_LOAD) {
 			printf("t%d\t= ", inst->target);
 			ir_print_operand(&inst->lhs);
-		} else if (inst->tag == EXPR_ASSIGN) {
+		} else if (inst->tag == EXPR_ASSIGN ||
+		           inst->tag == IR_UPDATE) {
 			if (inst->lhs.op_type == IR_OPERAND_TEMP_REG) {
 				printf("M[");
 				ir_print_operand(&inst->lhs);
@@ -431,7 +1415,8 @@ void ir_print_sequence(struct ir_sequence *ir)
 			} else {
 				ir_print_operand(&inst->lhs);
 			}
-			printf("\t= ");
+			printf("\t%s= ", inst->tag == IR_UPDATE
+			                  ? expr_str[inst->rhs.off] : "");
 			ir_print_operand(&inst->rhs);
 		} else if (inst->tag == EXPR_DEREFERENCE) {
 			printf("t%d\t= M[", inst->target);
@@ -27,6 +27,12 @@
 
 #define NUM_TEMP_REGS 31
 
+/* Maximum number of arguments passed in registers to a static function. */
+#define IR_REGPARM_MAX 3
+
+/* Number of arguments passed in registers under the x86-64 System V ABI. */
+#define IR_SYSV_REGS 6
+
 #define IR_OPERAND_AST_NODE 0
 #define IR_OPERAND_TEMP_REG 1
 #define IR_OPERAND_NODE_OFF 2
@@ -46,10 +52,62 @@ struct ir_operand {
 	size_t off;
 };
 
+/*
+ * IR_TEST sets the flags for `lhs` masked by constant `rhs`, or for `lhs`
+ * itself if `rhs` is an AST node operand with a NULL node.
+ * IR_PUSH pushes function argument `lhs`. The first stack argument pushed
+ * for a call has the number of stack words taken by the arguments of that
+ * call in `rhs.reg`, while every other push has 0. A struct argument is
+ * copied onto the stack from the address in `lhs`.
+ * IR_LOAD loads variable or struct member `lhs` into `target`.
+ */
 #define IR_TEST   0xA0
 #define IR_PUSH   0xA1
 #define IR_LOAD   0xA2
 
+/*
+ * Control flow within an expression, used for the logical operators.
+ * IR_JUMP jumps to label `target` if the flags set by comparison `lhs.reg`
+ * indicate that it is `rhs.reg`, or unconditionally if `lhs.reg` is -1.
+ * IR_SETCC sets the value of a logical expression in the same way, or to the
+ * constant `rhs.reg` if `lhs.reg` is -1, and IR_RESULT stores that value in
+ * temporary register `target`.
+ */
+#define IR_JUMP   0xA3
+#define IR_LABEL  0xA4
+#define IR_SETCC  0xA5
+#define IR_RESULT 0xA6
+
+/*
+ * IR_INDEX computes the address `lhs` + `rhs` * `rhs.off` + `lhs.off`
+ * into `target`, where `lhs` is a pointer and `rhs` an integer index, or an
+ * AST node operand with a NULL node if there is no index. It is selected
+ * for pointer additions which fit in a single x86 memory operand.
+ */
+#define IR_INDEX  0xA7
+
+/*
+ * The conditional operator. IR_VALUE sets the value stored by IR_RESULT to
+ * operand `lhs` on one path through the expression. IR_SELECT instead sets
+ * `target` to term `lhs` if the flags set by comparison `lhs.off` indicate
+ * that it is true, or to term `rhs` otherwise, without branching.
+ */
+#define IR_VALUE  0xA8
+#define IR_SELECT 0xA9
+
+/*
+ * IR_UPDATE assigns the result of binary operator `rhs.off` applied to the
+ * object `lhs` and value `rhs` to that object in place. The object is a
+ * variable, a struct member, or the object at the address in temporary
+ * register `lhs`, as for an assignment.
+ * An assignment or update whose value is used stores it in `target`, which
+ * is -1 otherwise.
+ */
+#define IR_UPDATE 0xAA
+
+/* The label to which the branches generated by ir_parse_cond jump. */
+#define IR_COND_TARGET 0
+
 struct ir_instruction {
 	uint16_t tag;
 	int16_t target;
@@ -60,12 +118,22 @@ struct ir_instruction {
 
 struct ir_sequence {
 	struct vector seq;
+	int labels;             /* number of labels used in the sequence */
+	int depth;              /* most temporaries live in any expression */
 };
 
 void ir_init(struct ir_sequence *ir);
 void ir_destroy(struct ir_sequence *ir);
 void ir_clear(struct ir_sequence *ir);
 void ir_parse_expr(struct ir_sequence *ir, struct ast_node *expr, int cond);
+int ir_parse_value(struct ir_sequence *ir, struct ast_node *expr);
+void ir_parse_cond(struct ir_sequence *ir, struct ast_node *expr, int jump_if);
+int ir_register_args(struct type_information *func, struct ast_node *arglist);
+int ir_num_args(struct ast_node *arglist);
+int ir_arg_words(struct ast_node *arg);
+int ir_stack_words(struct ast_node *arglist, int nreg);
+int ir_can_select(struct ast_node *cond, struct ast_node *a,
+                  struct ast_node *b);
 
 void ir_print_sequence(struct ir_sequence *ir);
 
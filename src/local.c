@@ -49,6 +49,27 @@ void local_mark_used(struct local_vars *locals, const char *name)
 		l->flags |= LFLAGS_USED;
 }
 
+void local_mark_addressed(struct local_vars *locals, const char *name)
+{
+	struct local *l;
+
+	if ((l = local_find(locals, name)))
+		l->flags |= LFLAGS_ADDRESSED;
+}
+
+/* local_any_addressed: check if the address of any local is taken */
+int local_any_addressed(struct local_vars *locals)
+{
+	struct local *l;
+
+	VECTOR_ITER(&locals->locals, l) {
+		if (l->flags & LFLAGS_ADDRESSED)
+			return 1;
+	}
+
+	return 0;
+}
+
 struct local *local_find(struct local_vars *locals, const char *name)
 {
 	struct local *l;
@@ -25,6 +25,7 @@
 #include "types.h"
 
 #define LFLAGS_USED 0x1
+#define LFLAGS_ADDRESSED 0x2
 
 #define LFLAGS_REG_SHIFT 8
 #define LFLAGS_REG(lflags) (((lflags) >> LFLAGS_REG_SHIFT) & 0xF)
@@ -49,6 +50,8 @@ void local_destroy(struct local_vars *locals);
 void local_add(struct local_vars *locals, const char *name,
                struct type_information *type);
 void local_mark_used(struct local_vars *locals, const char *name);
+void local_mark_addressed(struct local_vars *locals, const char *name);
+int local_any_addressed(struct local_vars *locals);
 struct local *local_find(struct local_vars *locals, const char *name);
 
 #endif /* FCC_LOCAL_H */
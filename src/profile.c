@@ -0,0 +1,282 @@
+/*
+ * src/profile.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Profile-guided optimization.
+ *
+ * Every function, conditional and loop in the translation unit is given a
+ * set of counters, numbered in the order in which they appear in the source.
+ * With -fprofile-generate, code to increment the counters is emitted, and
+ * the counters are written to the profile file when the program exits.
+ * With -fprofile-use, the counts are read back from the file to guide the
+ * layout of branches, the order of functions and the inliner.
+ *
+ * The profile file holds the number of counters followed by their values,
+ * all as 64-bit integers. Each run of an instrumented program adds its counts
+ * to those already in the file, so that several training runs combine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "fcc.h"
+#include "profile.h"
+#include "uthash.h"
+
+/* Profile counter of a function's entry. */
+struct prof_func {
+	const char      *name;
+	int             counter;
+	UT_hash_handle  hh;
+};
+
+static struct prof_func *functions = NULL;
+static int ncounters = 0;
+
+/* Counts read from the profile file, if any. */
+static unsigned long long *counts = NULL;
+static unsigned long long ncounts = 0;
+static unsigned long long max_count = 0;
+
+/*
+ * profile_filename:
+ * Return the name of the profile file of the current translation unit,
+ * which is the name of the source file with its extension replaced.
+ */
+const char *profile_filename(void)
+{
+	static char name[256];
+	const char *base;
+	char *dot;
+
+	base = strrchr(fcc_filename, '/');
+	base = base ? base + 1 : fcc_filename;
+
+	snprintf(name, sizeof name - 8, "%s", base);
+	if ((dot = strrchr(name, '.')))
+		*dot = '\0';
+	strcat(name, ".fprof");
+
+	return name;
+}
+
+/*
+ * profile_init:
+ * Read the counts of the profile file if profile feedback is being used.
+ */
+void profile_init(void)
+{
+	unsigned long long n, i;
+	FILE *f;
+
+	if (!(fcc_flags & FFLAG_PROFILE_USE))
+		return;
+
+	if (!(f = fopen(profile_filename(), "rb"))) {
+		warning_profile_missing(profile_filename());
+		return;
+	}
+
+	if (fread(&n, sizeof n, 1, f) == 1 &&
+	    n <= (size_t)-1 / sizeof *counts) {
+		counts = malloc(n * sizeof *counts);
+		if (fread(counts, sizeof *counts, n, f) == n) {
+			ncounts = n;
+		} else {
+			free(counts);
+			counts = NULL;
+		}
+	}
+	fclose(f);
+
+	if (!counts) {
+		warning_profile_mismatch(profile_filename());
+		return;
+	}
+
+	for (i = 0; i < ncounts; ++i) {
+		if (counts[i] > max_count)
+			max_count = counts[i];
+	}
+}
+
+/*
+ * profile_finish:
+ * Check that the profile which was read matches the translation unit.
+ */
+void profile_finish(void)
+{
+	struct prof_func *p, *tmp;
+
+	if (counts && ncounts != (unsigned long long)ncounters)
+		warning_profile_mismatch(profile_filename());
+
+	HASH_ITER(hh, functions, p, tmp) {
+		HASH_DEL(functions, p);
+		free(p);
+	}
+	free(counts);
+}
+
+/* profile_asg: number the counters of all branches and loops within `g` */
+static void profile_asg(struct graph_node *g)
+{
+	struct asg_node_conditional *c;
+	struct asg_node_for *f;
+	struct asg_node_while *w;
+
+	for (; g; g = g->next) {
+		switch (g->type) {
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			c->prof = ncounters;
+			ncounters += 2;
+			profile_asg(c->succ);
+			profile_asg(c->fail);
+			break;
+		case ASG_NODE_FOR:
+			f = (struct asg_node_for *)g;
+			f->prof = ncounters;
+			ncounters += 2;
+			profile_asg(f->body);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			w = (struct asg_node_while *)g;
+			w->prof = ncounters;
+			ncounters += 2;
+			profile_asg(w->body);
+			break;
+		case ASG_NODE_SWITCH:
+			profile_asg(((struct asg_node_switch *)g)->body);
+			break;
+		}
+	}
+}
+
+/*
+ * profile_function:
+ * Assign counters to function `fname` with body `g`. This must happen before
+ * any calls are inlined into it, so that the numbering is the same whether
+ * the profile is being generated or used.
+ */
+void profile_function(const char *fname, struct graph_node *g)
+{
+	struct prof_func *p;
+
+	HASH_FIND_STR(functions, fname, p);
+	if (p)
+		return;
+
+	p = malloc(sizeof *p);
+	p->name = fname;
+	p->counter = ncounters++;
+	HASH_ADD_KEYPTR(hh, functions, p->name, strlen(p->name), p);
+
+	profile_asg(g);
+}
+
+/* profile_function_counter: return the entry counter of `fname`, or -1 */
+int profile_function_counter(const char *fname)
+{
+	struct prof_func *p;
+
+	HASH_FIND_STR(functions, fname, p);
+	return p ? p->counter : -1;
+}
+
+/* profile_num_counters: return the number of counters assigned so far */
+int profile_num_counters(void)
+{
+	return ncounters;
+}
+
+/*
+ * profile_count:
+ * Return the value of counter `counter` in the profile,
+ * or -1 if there is no profile data for it.
+ */
+long long profile_count(int counter)
+{
+	if (!counts || counter < 0 || (unsigned long long)counter >= ncounts)
+		return -1;
+
+	return counts[counter];
+}
+
+/* profile_function_count: return the number of calls to `fname`, or -1 */
+long long profile_function_count(const char *fname)
+{
+	return profile_count(profile_function_counter(fname));
+}
+
+/*
+ * profile_cold:
+ * Check if code run `count` times out of `total` is rarely executed.
+ */
+int profile_cold(long long count, long long total)
+{
+	return count >= 0 && total > 0 && count * PROF_COLD_RATIO < total;
+}
+
+/*
+ * profile_hot:
+ * Check if a function called `count` times is among the hottest code
+ * in the translation unit.
+ */
+int profile_hot(long long count)
+{
+	return count > 0 &&
+	       (unsigned long long)count * PROF_HOT_RATIO >= max_count;
+}
+
+/*
+ * profile_branch_cold:
+ * Check if the then branch of conditional `c`, or its else branch if
+ * `fail` is set, is rarely taken.
+ */
+int profile_branch_cold(struct asg_node_conditional *c, int fail)
+{
+	long long total, taken;
+
+	if (c->prof < 0)
+		return 0;
+
+	total = profile_count(c->prof + PROF_ENTRY);
+	taken = profile_count(c->prof + PROF_TAKEN);
+	if (total < 0 || taken < 0)
+		return 0;
+
+	return profile_cold(fail ? total - taken : taken, total);
+}
+
+/*
+ * profile_loop_cold:
+ * Check if the body of the loop whose counters start at `prof` is rarely
+ * entered when the loop is reached.
+ */
+int profile_loop_cold(int prof)
+{
+	if (prof < 0)
+		return 0;
+
+	return profile_cold(profile_count(prof + PROF_TAKEN),
+	                    profile_count(prof + PROF_ENTRY));
+}
@@ -0,0 +1,52 @@
+/*
+ * src/profile.h
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FCC_PROFILE_H
+#define FCC_PROFILE_H
+
+#include "asg.h"
+
+/* Counters kept for each conditional and loop, from its `prof` counter. */
+#define PROF_ENTRY      0       /* times the statement was reached */
+#define PROF_TAKEN      1       /* times its then branch or body was run */
+
+/* A branch run less than once in this many executions is cold. */
+#define PROF_COLD_RATIO 100
+
+/* A function called at least once per this many of the hottest count is hot. */
+#define PROF_HOT_RATIO  8
+
+/* Factor by which the inline limit is raised for hot functions. */
+#define PROF_HOT_INLINE 4
+
+void profile_init(void);
+void profile_finish(void);
+const char *profile_filename(void);
+
+void profile_function(const char *fname, struct graph_node *g);
+int profile_function_counter(const char *fname);
+int profile_num_counters(void);
+
+long long profile_count(int counter);
+long long profile_function_count(const char *fname);
+int profile_cold(long long count, long long total);
+int profile_hot(long long count);
+int profile_branch_cold(struct asg_node_conditional *c, int fail);
+int profile_loop_cold(int prof);
+
+#endif /* FCC_PROFILE_H */
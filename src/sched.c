@@ -0,0 +1,839 @@
+/*
+ * src/sched.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Instruction scheduling within basic blocks.
+ *
+ * The body of a translated function is split into blocks bounded by labels,
+ * jumps, calls and instructions with effects not named by their operands.
+ * The instructions of a block are ordered by their dependences through
+ * registers, the flags and memory, and list scheduled for the execution
+ * units and latencies of the machine selected with -mtune. The compare
+ * feeding a conditional jump which ends a block is kept immediately before
+ * it, so that the processor can fuse the two.
+ *
+ * Each order is measured by the cycles an in-order machine would spend
+ * waiting on operands, and a block is only reordered if this is reduced.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fcc.h"
+#include "sched.h"
+
+/* Latency classes of instructions. */
+enum {
+	SCHED_MOVE,
+	SCHED_ALU,
+	SCHED_LEA,
+	SCHED_SHIFT,
+	SCHED_MUL,
+	SCHED_DIV,
+	SCHED_VEC,
+	SCHED_SHUF,
+	SCHED_NCLASSES
+};
+
+/* Kinds of execution unit. */
+enum {
+	SCHED_PORT_ALU,
+	SCHED_PORT_MUL,
+	SCHED_PORT_DIV,
+	SCHED_PORT_VEC,
+	SCHED_PORT_LOAD,
+	SCHED_PORT_STORE,
+	SCHED_NPORTS
+};
+
+struct sched_model {
+	const char      *name;
+	int             width;          /* instructions issued each cycle */
+	int             ports[SCHED_NPORTS];
+	int             latency[SCHED_NCLASSES];
+	int             load;           /* latency of a load from the cache */
+	int             forward;        /* latency of a load from a store */
+};
+
+/* Approximate figures for 32-bit operations on a few implementations. */
+static const struct sched_model sched_models[] = {
+	{ "generic", 4, { 3, 1, 1, 2, 2, 1 },
+	  { 1, 1, 1, 1, 3, 26, 1, 1 }, 4, 5 },
+	{ "atom", 2, { 2, 1, 1, 2, 1, 1 },
+	  { 1, 1, 1, 1, 5, 50, 1, 1 }, 3, 3 },
+	{ "core2", 4, { 3, 1, 1, 3, 1, 1 },
+	  { 1, 1, 1, 1, 3, 23, 1, 1 }, 3, 5 },
+	{ "skylake", 4, { 4, 1, 1, 3, 2, 1 },
+	  { 1, 1, 1, 1, 3, 26, 1, 1 }, 5, 5 },
+	{ "znver1", 4, { 4, 1, 1, 4, 2, 1 },
+	  { 1, 1, 1, 1, 3, 25, 1, 1 }, 4, 5 }
+};
+
+static const struct sched_model *sched_model = &sched_models[0];
+
+/* Execution unit used by each class of instruction. */
+static const int sched_class_ports[SCHED_NCLASSES] = {
+	[SCHED_MOVE]    = SCHED_PORT_ALU,
+	[SCHED_ALU]     = SCHED_PORT_ALU,
+	[SCHED_LEA]     = SCHED_PORT_ALU,
+	[SCHED_SHIFT]   = SCHED_PORT_ALU,
+	[SCHED_MUL]     = SCHED_PORT_MUL,
+	[SCHED_DIV]     = SCHED_PORT_DIV,
+	[SCHED_VEC]     = SCHED_PORT_VEC,
+	[SCHED_SHUF]    = SCHED_PORT_VEC
+};
+
+/* Longest run of instructions scheduled together. */
+#define SCHED_MAX_BLOCK 64
+
+/* Registers and the flags are bits of a resource mask. */
+#define SCHED_XMM(n)    (X86_NUM_GPRS + (n))
+#define SCHED_FLAGS     32
+#define SCHED_BIT(r)    (1ULL << (r))
+
+/* Kinds of memory accessed by an instruction. */
+enum {
+	SCHED_MEM_FRAME,        /* slot addressed from the base pointer */
+	SCHED_MEM_STACK,        /* addressed from the stack pointer */
+	SCHED_MEM_GLOBAL,       /* static storage */
+	SCHED_MEM_POINTER       /* anywhere else */
+};
+
+struct sched_mem {
+	int kind;
+	int off;
+	int size;
+	int read;
+	int write;
+};
+
+struct sched_node {
+	struct x86_instruction  inst;
+	unsigned long long      uses;
+	unsigned long long      defs;
+	int                     dead_flags;     /* flags written are not read */
+	struct sched_mem        mem[2];
+	int                     nmem;
+	int                     latency;        /* cycles until results ready */
+	unsigned int            ports;
+	int                     height;         /* longest path to block end */
+};
+
+struct sched_info {
+	struct sched_node       nodes[SCHED_MAX_BLOCK];
+	signed char             delay[SCHED_MAX_BLOCK][SCHED_MAX_BLOCK];
+	int                     n;
+	int                     hold;   /* compare kept before its jump */
+	int                     stack_addressed;
+	int                     before; /* stall cycles of the original code */
+	int                     after;
+};
+
+/*
+ * sched_tune:
+ * Select the machine whose latencies instructions are scheduled for.
+ * Return 0 if `name` is recognized, 1 otherwise.
+ */
+int sched_tune(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof sched_models / sizeof *sched_models; ++i) {
+		if (strcmp(name, sched_models[i].name) == 0) {
+			sched_model = &sched_models[i];
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* sched_gpr: return the full register containing `gpr` */
+static int sched_gpr(int gpr)
+{
+	switch (gpr) {
+	case X86_GPR_AL:
+	case X86_GPR_AH:
+		return X86_GPR_AX;
+	case X86_GPR_CH:
+	case X86_GPR_CL:
+		return X86_GPR_CX;
+	default:
+		return gpr;
+	}
+}
+
+/* sched_boundary: check if `inst` cannot be moved within its block */
+static int sched_boundary(struct x86_instruction *inst)
+{
+	struct x86_operand *dst;
+	int rmw;
+
+	switch (inst->instruction) {
+	case X86_LABEL:
+	case X86_NAMED_LABEL:
+	case X86_RET:
+	case X86_CALL:
+	case X86_RDTSC:
+	case X86_MOVS:
+	case X86_STOS:
+	case X86_REP_MOVS:
+	case X86_REP_STOS:
+		return 1;
+	default:
+		break;
+	}
+
+	if (x86_is_jump(inst->instruction))
+		return 1;
+
+	/*
+	 * Moving the base pointer changes the meaning of every slot, and the
+	 * epilogue restoring the stack pointer must stay where it is.
+	 */
+	dst = x86_dest_operand(inst, &rmw);
+	if (!dst || dst->type != X86_OPERAND_GPR)
+		return 0;
+	return dst->gpr == X86_GPR_BP ||
+	       (dst->gpr == X86_GPR_SP && inst->instruction == X86_MOV);
+}
+
+/* sched_reads_flags: check if `inst` reads the flags */
+static int sched_reads_flags(struct x86_instruction *inst)
+{
+	switch (inst->instruction) {
+	case X86_ADC:
+	case X86_SBB:
+	case X86_SETE:
+	case X86_SETG:
+	case X86_SETGE:
+	case X86_SETL:
+	case X86_SETLE:
+	case X86_SETNE:
+	case X86_CMOVE:
+	case X86_CMOVG:
+	case X86_CMOVGE:
+	case X86_CMOVL:
+	case X86_CMOVLE:
+	case X86_CMOVNE:
+		return 1;
+	default:
+		return x86_is_cond_jump(inst->instruction);
+	}
+}
+
+/* sched_writes_flags: check if `inst` may change the flags */
+static int sched_writes_flags(struct x86_instruction *inst)
+{
+	switch (inst->instruction) {
+	case X86_MOV:
+	case X86_PUSH:
+	case X86_POP:
+	case X86_LEA:
+	case X86_NOT:
+	case X86_SETE:
+	case X86_SETG:
+	case X86_SETGE:
+	case X86_SETL:
+	case X86_SETLE:
+	case X86_SETNE:
+	case X86_CMOVE:
+	case X86_CMOVG:
+	case X86_CMOVGE:
+	case X86_CMOVL:
+	case X86_CMOVLE:
+	case X86_CMOVNE:
+	case X86_MOVZB:
+	case X86_MOVSB:
+	case X86_MOVSLQ:
+	case X86_CDQ:
+	case X86_RDTSC:
+	case X86_MOVS:
+	case X86_STOS:
+	case X86_REP_MOVS:
+	case X86_REP_STOS:
+	case X86_LABEL:
+	case X86_NAMED_LABEL:
+		return 0;
+	default:
+		/* Neither do jumps or SSE instructions. */
+		if (x86_is_jump(inst->instruction))
+			return 0;
+		return inst->instruction < X86_MOVD ||
+		       inst->instruction > X86_PSRAD;
+	}
+}
+
+/* sched_class: return the latency class of `inst` */
+static int sched_class(struct x86_instruction *inst)
+{
+	switch (inst->instruction) {
+	case X86_MOV:
+	case X86_PUSH:
+	case X86_POP:
+	case X86_MOVZB:
+	case X86_MOVSB:
+	case X86_MOVSLQ:
+	case X86_MOVD:
+	case X86_MOVDQA:
+	case X86_MOVDQU:
+		return SCHED_MOVE;
+	case X86_LEA:
+		return SCHED_LEA;
+	case X86_SHL:
+	case X86_SHR:
+	case X86_SAR:
+		return SCHED_SHIFT;
+	case X86_IMUL:
+		return SCHED_MUL;
+	case X86_DIV:
+		return SCHED_DIV;
+	case X86_PSHUFD:
+	case X86_PUNPCKLBW:
+	case X86_PUNPCKLWD:
+		return SCHED_SHUF;
+	default:
+		if (inst->instruction >= X86_MOVD &&
+		    inst->instruction <= X86_PSRAD)
+			return SCHED_VEC;
+		return SCHED_ALU;
+	}
+}
+
+static void sched_add_mem(struct sched_node *node, int kind, int off,
+                          int read, int write)
+{
+	struct sched_mem *m;
+
+	m = &node->mem[node->nmem++];
+	m->kind = kind;
+	m->off = off;
+	m->size = x86_access_width(&node->inst);
+	m->read = read;
+	m->write = write;
+}
+
+/*
+ * sched_address:
+ * Add the registers used to form the address in `op` to those read by
+ * `node`. Return the kind of memory `op` refers to, or -1 if it is not a
+ * memory operand.
+ */
+static int sched_address(struct sched_node *node, struct x86_operand *op)
+{
+	switch (op->type) {
+	case X86_OPERAND_OFFSET:
+		node->uses |= SCHED_BIT(op->offset.gpr);
+		if (op->offset.gpr == X86_GPR_BP)
+			return SCHED_MEM_FRAME;
+		if (op->offset.gpr == X86_GPR_SP)
+			return SCHED_MEM_STACK;
+		return SCHED_MEM_POINTER;
+	case X86_OPERAND_INDEX:
+		node->uses |= SCHED_BIT(op->index.base);
+		node->uses |= SCHED_BIT(op->index.index);
+		return SCHED_MEM_POINTER;
+	case X86_OPERAND_JUMP_TABLE:
+		node->uses |= SCHED_BIT(op->table.gpr);
+		return SCHED_MEM_GLOBAL;
+	case X86_OPERAND_RIP_LABEL:
+	case X86_OPERAND_COUNTER:
+	case X86_OPERAND_SYMBOL:
+		return SCHED_MEM_GLOBAL;
+	case X86_OPERAND_STRING:
+		/* String literals are addressed immediately in 32-bit code. */
+		return fcc_m64 ? SCHED_MEM_GLOBAL : -1;
+	default:
+		return -1;
+	}
+}
+
+/* sched_operand: record the resources used by operand `op` of `node` */
+static void sched_operand(struct sched_node *node, struct x86_operand *op,
+                          int read, int write)
+{
+	unsigned long long r;
+	int kind, size;
+
+	switch (op->type) {
+	case X86_OPERAND_GPR:
+	case X86_OPERAND_XMM:
+		if (op->type == X86_OPERAND_GPR) {
+			r = SCHED_BIT(sched_gpr(op->gpr));
+			size = node->inst.size;
+			/* Writing part of a register keeps the rest of it. */
+			if (op->gpr >= X86_GPR_AL || size == 1 || size == 2)
+				read = 1;
+		} else {
+			r = SCHED_BIT(SCHED_XMM(op->xmm));
+		}
+		if (read)
+			node->uses |= r;
+		if (write)
+			node->defs |= r;
+		break;
+	default:
+		if ((kind = sched_address(node, op)) != -1) {
+			sched_add_mem(node, kind, kind == SCHED_MEM_FRAME
+			              ? op->offset.off : 0, read, write);
+		}
+		break;
+	}
+}
+
+/* sched_describe: find the resources used by `node` and its latency */
+static void sched_describe(struct sched_node *node)
+{
+	struct x86_instruction *inst;
+	struct x86_operand *ops[3], *dst;
+	int i, n, rmw, cls, loads;
+
+	inst = &node->inst;
+	node->uses = node->defs = 0;
+	node->nmem = 0;
+
+	ops[0] = &inst->op1;
+	ops[1] = &inst->op2;
+	ops[2] = &inst->op3;
+	n = x86_operand_count(inst);
+	dst = x86_dest_operand(inst, &rmw);
+
+	for (i = 0; i < n; ++i) {
+		if (ops[i] == dst)
+			sched_operand(node, ops[i], rmw, 1);
+		else if (inst->instruction == X86_LEA)
+			sched_address(node, ops[i]);
+		else
+			sched_operand(node, ops[i], 1, 0);
+	}
+
+	switch (inst->instruction) {
+	case X86_PUSH:
+	case X86_POP:
+		node->uses |= SCHED_BIT(X86_GPR_SP);
+		node->defs |= SCHED_BIT(X86_GPR_SP);
+		sched_add_mem(node, SCHED_MEM_STACK, 0,
+		              inst->instruction == X86_POP,
+		              inst->instruction == X86_PUSH);
+		break;
+	case X86_DIV:
+		node->uses |= SCHED_BIT(X86_GPR_AX) | SCHED_BIT(X86_GPR_DX);
+		node->defs |= SCHED_BIT(X86_GPR_AX) | SCHED_BIT(X86_GPR_DX);
+		break;
+	case X86_CDQ:
+		node->uses |= SCHED_BIT(X86_GPR_AX);
+		node->defs |= SCHED_BIT(X86_GPR_DX);
+		break;
+	default:
+		break;
+	}
+
+	if (sched_reads_flags(inst))
+		node->uses |= SCHED_BIT(SCHED_FLAGS);
+	if (sched_writes_flags(inst))
+		node->defs |= SCHED_BIT(SCHED_FLAGS);
+	node->dead_flags = 0;
+
+	loads = 0;
+	node->ports = 0;
+	for (i = 0; i < node->nmem; ++i) {
+		if (node->mem[i].read) {
+			loads = 1;
+			node->ports |= 1U << SCHED_PORT_LOAD;
+		}
+		if (node->mem[i].write)
+			node->ports |= 1U << SCHED_PORT_STORE;
+	}
+
+	/* A move to or from memory needs no unit besides the memory's. */
+	cls = sched_class(inst);
+	if (cls != SCHED_MOVE || !node->nmem)
+		node->ports |= 1U << sched_class_ports[cls];
+
+	if (cls == SCHED_MOVE && loads)
+		node->latency = sched_model->load;
+	else
+		node->latency = sched_model->latency[cls] +
+		                (loads ? sched_model->load : 0);
+}
+
+/* sched_alias: check if memory accesses `a` and `b` must stay ordered */
+static int sched_alias(struct sched_info *info, struct sched_mem *a,
+                       struct sched_mem *b)
+{
+	struct sched_mem *other;
+
+	if (!a->write && !b->write)
+		return 0;
+
+	if (a->kind == SCHED_MEM_POINTER || b->kind == SCHED_MEM_POINTER) {
+		other = a->kind == SCHED_MEM_POINTER ? b : a;
+		return other->kind != SCHED_MEM_STACK || info->stack_addressed;
+	}
+
+	if (a->kind != b->kind)
+		return 0;
+	if (a->kind == SCHED_MEM_FRAME)
+		return a->off < b->off + b->size && b->off < a->off + a->size;
+	return 1;
+}
+
+/*
+ * sched_delay:
+ * Return the cycles after `a` issues that `b`, which follows it, may issue,
+ * or -1 if the two are independent.
+ */
+static int sched_delay(struct sched_info *info, struct sched_node *a,
+                       struct sched_node *b)
+{
+	unsigned long long defs, same;
+	int d, i, j, m;
+
+	/* Writes of the flags which are never read need not be ordered. */
+	defs = a->defs;
+	if (a->dead_flags)
+		defs &= ~SCHED_BIT(SCHED_FLAGS);
+	same = a->defs & b->defs;
+	if (a->dead_flags && b->dead_flags)
+		same &= ~SCHED_BIT(SCHED_FLAGS);
+
+	if (defs & b->uses)
+		d = a->latency;
+	else if ((a->uses & b->defs) || same)
+		d = 0;
+	else
+		d = -1;
+
+	for (i = 0; i < a->nmem; ++i) {
+		for (j = 0; j < b->nmem; ++j) {
+			if (!sched_alias(info, &a->mem[i], &b->mem[j]))
+				continue;
+			m = a->mem[i].write && b->mem[j].read
+			    ? sched_model->forward : 0;
+			if (m > d)
+				d = m;
+		}
+	}
+
+	return d;
+}
+
+/*
+ * sched_flags_live:
+ * Check if the flags may be read after the block ending before `term`,
+ * which is NULL at the end of the function.
+ */
+static int sched_flags_live(struct x86_instruction *term)
+{
+	if (!term)
+		return 0;
+
+	switch (term->instruction) {
+	case X86_CALL:
+	case X86_RET:
+		return 0;
+	default:
+		return sched_reads_flags(term) || !sched_writes_flags(term);
+	}
+}
+
+static int sched_fits(struct sched_node *node, int *used)
+{
+	int p;
+
+	for (p = 0; p < SCHED_NPORTS; ++p) {
+		if ((node->ports & 1U << p) &&
+		    used[p] == sched_model->ports[p])
+			return 0;
+	}
+	return 1;
+}
+
+static void sched_take(struct sched_node *node, int *used)
+{
+	int p;
+
+	for (p = 0; p < SCHED_NPORTS; ++p) {
+		if (node->ports & 1U << p)
+			++used[p];
+	}
+}
+
+/*
+ * sched_estimate:
+ * Return the number of cycles an in-order machine stalls waiting on
+ * operands while running the block's instructions in `order`.
+ */
+static int sched_estimate(struct sched_info *info, int *order)
+{
+	int ready[SCHED_MAX_BLOCK], used[SCHED_NPORTS];
+	int cycle, issued, stalls, i, j, k;
+	struct sched_node *node;
+
+	memset(ready, 0, sizeof ready);
+	memset(used, 0, sizeof used);
+	cycle = issued = stalls = 0;
+
+	for (k = 0; k < info->n; ++k) {
+		i = order[k];
+		node = &info->nodes[i];
+
+		if (ready[i] > cycle) {
+			stalls += ready[i] - cycle;
+			cycle = ready[i];
+			issued = 0;
+			memset(used, 0, sizeof used);
+		}
+		while (issued == sched_model->width ||
+		       !sched_fits(node, used)) {
+			++cycle;
+			issued = 0;
+			memset(used, 0, sizeof used);
+		}
+
+		++issued;
+		sched_take(node, used);
+		for (j = i + 1; j < info->n; ++j) {
+			if (info->delay[i][j] >= 0 &&
+			    cycle + info->delay[i][j] > ready[j])
+				ready[j] = cycle + info->delay[i][j];
+		}
+	}
+
+	return stalls;
+}
+
+/*
+ * sched_list:
+ * Order the block's instructions by issuing in each cycle those whose
+ * operands are ready, longest path to the end of the block first.
+ */
+static void sched_list(struct sched_info *info, int *order)
+{
+	int npreds[SCHED_MAX_BLOCK], earliest[SCHED_MAX_BLOCK];
+	int used[SCHED_NPORTS];
+	char done[SCHED_MAX_BLOCK];
+	int cycle, issued, best, d, i, j, k;
+
+	memset(npreds, 0, sizeof npreds);
+	memset(earliest, 0, sizeof earliest);
+	memset(done, 0, sizeof done);
+	for (i = 0; i < info->n; ++i) {
+		for (j = i + 1; j < info->n; ++j) {
+			if (info->delay[i][j] >= 0)
+				++npreds[j];
+		}
+	}
+
+	for (cycle = k = 0; k < info->n; ++cycle) {
+		memset(used, 0, sizeof used);
+		for (issued = 0; issued < sched_model->width; ++issued) {
+			best = -1;
+			for (i = 0; i < info->n; ++i) {
+				if (done[i] || npreds[i] || earliest[i] > cycle)
+					continue;
+				if (i == info->hold && k != info->n - 1)
+					continue;
+				if (!sched_fits(&info->nodes[i], used))
+					continue;
+				if (best == -1 || info->nodes[i].height >
+				                  info->nodes[best].height)
+					best = i;
+			}
+			if (best == -1)
+				break;
+
+			order[k++] = best;
+			done[best] = 1;
+			sched_take(&info->nodes[best], used);
+			for (j = best + 1; j < info->n; ++j) {
+				d = info->delay[best][j];
+				if (d < 0)
+					continue;
+				--npreds[j];
+				if (cycle + d > earliest[j])
+					earliest[j] = cycle + d;
+			}
+		}
+	}
+}
+
+/*
+ * sched_graph:
+ * Find the dependences between the instructions of the block, and which
+ * compare must be kept before the block's final jump `term`.
+ */
+static void sched_graph(struct sched_info *info, struct x86_instruction *term)
+{
+	struct sched_node *node;
+	int i, j, live, last;
+
+	/* Find which writes of the flags are read. */
+	live = sched_flags_live(term);
+	last = -1;
+	for (i = info->n - 1; i >= 0; --i) {
+		node = &info->nodes[i];
+		if (node->defs & SCHED_BIT(SCHED_FLAGS)) {
+			node->dead_flags = !live;
+			if (last == -1)
+				last = i;
+			live = 0;
+		}
+		if (node->uses & SCHED_BIT(SCHED_FLAGS))
+			live = 1;
+	}
+
+	for (i = info->n - 1; i >= 0; --i) {
+		node = &info->nodes[i];
+		node->height = node->latency;
+		for (j = i + 1; j < info->n; ++j) {
+			info->delay[i][j] = sched_delay(info, node,
+			                                &info->nodes[j]);
+			if (info->delay[i][j] >= 0 &&
+			    info->delay[i][j] + info->nodes[j].height >
+			    node->height)
+				node->height = info->delay[i][j] +
+				               info->nodes[j].height;
+		}
+	}
+
+	info->hold = -1;
+	if (!term || !x86_is_jump(term->instruction) ||
+	    !sched_reads_flags(term) || last == -1 ||
+	    info->nodes[last].dead_flags)
+		return;
+
+	switch (info->nodes[last].inst.instruction) {
+	case X86_CMP:
+	case X86_TEST:
+	case X86_ADD:
+	case X86_SUB:
+	case X86_AND:
+		break;
+	default:
+		return;
+	}
+
+	for (j = last + 1; j < info->n; ++j) {
+		if (info->delay[last][j] >= 0)
+			return;
+	}
+	info->hold = last;
+}
+
+/*
+ * sched_block:
+ * Schedule the `n` instructions starting at `insts`, which are followed by
+ * `term`, or by the end of the function if it is NULL.
+ */
+static void sched_block(struct sched_info *info, struct x86_instruction *insts,
+                        int n, struct x86_instruction *term)
+{
+	int order[SCHED_MAX_BLOCK], orig[SCHED_MAX_BLOCK];
+	int before, after, fused, i;
+
+	info->n = n;
+	for (i = 0; i < n; ++i) {
+		info->nodes[i].inst = insts[i];
+		sched_describe(&info->nodes[i]);
+		orig[i] = i;
+	}
+	sched_graph(info, term);
+
+	before = sched_estimate(info, orig);
+	info->before += before;
+	if (!(fcc_flags & FFLAG_SCHEDULE_INSNS)) {
+		info->after += before;
+		return;
+	}
+
+	sched_list(info, order);
+	after = sched_estimate(info, order);
+
+	/* Fusing a compare with its jump is worth reordering for alone. */
+	fused = info->hold != -1 && info->hold != n - 1;
+	if (after > before || (after == before && !fused)) {
+		info->after += before;
+		return;
+	}
+
+	info->after += after;
+	for (i = 0; i < n; ++i)
+		insts[i] = info->nodes[order[i]].inst;
+}
+
+/*
+ * sched_stack_addressed:
+ * Check if the address of anything on the stack is taken, in which case
+ * it may be accessed through a pointer.
+ */
+static int sched_stack_addressed(struct x86_instruction *insts, size_t n)
+{
+	struct x86_instruction *inst;
+
+	for (inst = insts; inst < insts + n; ++inst) {
+		if (inst->instruction == X86_LEA &&
+		    inst->op1.type == X86_OPERAND_OFFSET &&
+		    inst->op1.offset.gpr == X86_GPR_SP)
+			return 1;
+		if (inst->instruction == X86_MOV &&
+		    inst->op1.type == X86_OPERAND_GPR &&
+		    inst->op1.gpr == X86_GPR_SP)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * sched_optimize:
+ * Schedule the instructions of each basic block in the body of the
+ * function in `seq`.
+ */
+void sched_optimize(struct x86_sequence *seq)
+{
+	struct x86_instruction *insts;
+	struct sched_info *info;
+	size_t i, start, n;
+	int end;
+
+	insts = seq->seq.data;
+	n = seq->seq.nmembs;
+
+	info = malloc(sizeof *info);
+	info->stack_addressed = sched_stack_addressed(insts + seq->body,
+	                                              n - seq->body);
+	info->before = info->after = 0;
+
+	for (start = i = seq->body; i <= n; ++i) {
+		end = i == n || sched_boundary(&insts[i]);
+		if (!end && i - start < SCHED_MAX_BLOCK)
+			continue;
+
+		if (i - start > 1)
+			sched_block(info, insts + start, i - start,
+			            i == n ? NULL : &insts[i]);
+		start = end ? i + 1 : i;
+	}
+
+	if (fcc_flags & FFLAG_SCHED_VERBOSE)
+		fprintf(stderr, "%s: %d stall cycles before scheduling, "
+		        "%d after\n", seq->fname, info->before, info->after);
+	free(info);
+}
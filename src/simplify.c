@@ -0,0 +1,721 @@
+/*
+ * src/simplify.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Algebraic simplification of expressions.
+ *
+ * Before a function is translated, each of its expressions is rewritten from
+ * the bottom up until no rule applies. Operations on constants are folded with
+ * the width and signedness of their type, chains of associative operations are
+ * regrouped so that their constants combine, and algebraic identities are
+ * removed. An operand is only discarded if evaluating it has no side effects.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "simplify.h"
+#include "types.h"
+
+static int is_unsigned(struct type_information *type)
+{
+	return (type->type_flags & QUAL_UNSIGNED) ||
+	       FLAGS_IS_PTR(type->type_flags);
+}
+
+/*
+ * simplify_const:
+ * Return `value` truncated and extended to the width of type `type`.
+ */
+long simplify_const(long value, struct type_information *type)
+{
+	switch (type_size(type)) {
+	case 1:
+		return is_unsigned(type) ? (long)(unsigned char)value
+		                         : (long)(signed char)value;
+	case 4:
+		return is_unsigned(type) ? (long)(unsigned int)value
+		                         : (long)(int)value;
+	default:
+		return value;
+	}
+}
+
+static int same_type(struct ast_node *a, struct ast_node *b)
+{
+	if (a->expr_flags.type_flags != b->expr_flags.type_flags)
+		return 0;
+
+	return FLAGS_TYPE(a->expr_flags.type_flags) != TYPE_STRUCT ||
+	       a->expr_flags.extra == b->expr_flags.extra;
+}
+
+static int is_const(struct ast_node *expr, long value)
+{
+	return expr->tag == NODE_CONSTANT &&
+	       expr->value == simplify_const(value, &expr->expr_flags);
+}
+
+/* is_pure: check if evaluating `expr` has no side effects */
+static int is_pure(struct ast_node *expr)
+{
+	if (!expr)
+		return 1;
+
+	if (expr->tag == EXPR_ASSIGN || expr->tag == EXPR_FUNC)
+		return 0;
+
+	return is_pure(expr->left) && is_pure(expr->right);
+}
+
+/* log2_exact: return the base 2 logarithm of `n`, or -1 if inexact */
+static int log2_exact(long n)
+{
+	int k;
+
+	if (n <= 0 || (n & (n - 1)))
+		return -1;
+
+	for (k = 0; n > 1; n >>= 1)
+		++k;
+	return k;
+}
+
+/*
+ * fold:
+ * If `expr` operates only on constants, compute its value and return it as
+ * a constant of the type of `expr`, freeing `expr`. Otherwise, return NULL.
+ */
+static struct ast_node *fold(struct ast_node *expr)
+{
+	struct ast_node *lhs, *rhs;
+	struct type_information *type;
+	unsigned long ua, ub;
+	long a, b, r;
+	int uns;
+
+	lhs = expr->left;
+	rhs = expr->right;
+	if (lhs->tag != NODE_CONSTANT || (rhs && rhs->tag != NODE_CONSTANT))
+		return NULL;
+
+	type = &expr->expr_flags;
+	uns = is_unsigned(type);
+	a = simplify_const(lhs->value, type);
+	b = rhs ? rhs->value : 0;
+	if (expr->tag >= EXPR_EQ && expr->tag <= EXPR_GE) {
+		/*
+		 * Comparisons are unsigned if either operand is, in the
+		 * width of the wider operand.
+		 */
+		a = lhs->value;
+		uns = is_unsigned(&lhs->expr_flags) ||
+		      is_unsigned(&rhs->expr_flags);
+		if (uns && type_size(&lhs->expr_flags) <= 4 &&
+		    type_size(&rhs->expr_flags) <= 4) {
+			a = (unsigned int)a;
+			b = (unsigned int)b;
+		}
+	} else if (rhs && expr->tag != EXPR_LSHIFT &&
+	           expr->tag != EXPR_RSHIFT) {
+		b = simplify_const(b, type);
+	}
+	ua = a;
+	ub = b;
+
+	switch (expr->tag) {
+	case EXPR_LOGICAL_OR:
+		r = lhs->value || rhs->value;
+		break;
+	case EXPR_LOGICAL_AND:
+		r = lhs->value && rhs->value;
+		break;
+	case EXPR_OR:
+		r = a | b;
+		break;
+	case EXPR_XOR:
+		r = a ^ b;
+		break;
+	case EXPR_AND:
+		r = a & b;
+		break;
+	case EXPR_EQ:
+		r = a == b;
+		break;
+	case EXPR_NE:
+		r = a != b;
+		break;
+	case EXPR_LT:
+		r = uns ? ua < ub : a < b;
+		break;
+	case EXPR_GT:
+		r = uns ? ua > ub : a > b;
+		break;
+	case EXPR_LE:
+		r = uns ? ua <= ub : a <= b;
+		break;
+	case EXPR_GE:
+		r = uns ? ua >= ub : a >= b;
+		break;
+	case EXPR_LSHIFT:
+		if (b < 0 || b >= 32)
+			return NULL;
+		r = ua << b;
+		break;
+	case EXPR_RSHIFT:
+		if (b < 0 || b >= 32)
+			return NULL;
+		r = uns ? (long)(ua >> b) : a >> b;
+		break;
+	case EXPR_ADD:
+		r = ua + ub;
+		break;
+	case EXPR_SUB:
+		r = ua - ub;
+		break;
+	case EXPR_MULT:
+		r = ua * ub;
+		break;
+	case EXPR_DIV:
+		if (!b)
+			return NULL;
+		r = uns ? (long)(ua / ub) : a / b;
+		break;
+	case EXPR_MOD:
+		if (!b)
+			return NULL;
+		r = uns ? (long)(ua % ub) : a % b;
+		break;
+	case EXPR_UNARY_MINUS:
+		r = -ua;
+		break;
+	case EXPR_NOT:
+		r = ~a;
+		break;
+	case EXPR_LOGICAL_NOT:
+		r = !lhs->value;
+		break;
+	default:
+		return NULL;
+	}
+
+	memcpy(&lhs->expr_flags, &expr->expr_flags, sizeof lhs->expr_flags);
+	lhs->value = simplify_const(r, &lhs->expr_flags);
+	free(rhs);
+	free(expr);
+
+	return lhs;
+}
+
+/*
+ * simplify_fold:
+ * Return the value of `expr` as a constant if its operands are constants.
+ * Otherwise, return `expr`.
+ */
+struct ast_node *simplify_fold(struct ast_node *expr)
+{
+	struct ast_node *n;
+
+	return (n = fold(expr)) ? n : expr;
+}
+
+/* make_const: replace `expr` with a constant `value` of the same type */
+static struct ast_node *make_const(struct ast_node *expr, long value)
+{
+	struct ast_node *n;
+
+	n = create_node(NODE_CONSTANT, "0");
+	memcpy(&n->expr_flags, &expr->expr_flags, sizeof n->expr_flags);
+	n->value = simplify_const(value, &n->expr_flags);
+	free_tree(expr);
+
+	return n;
+}
+
+/* keep: replace `expr` with its operand `op` */
+static struct ast_node *keep(struct ast_node *expr, struct ast_node *op)
+{
+	if (expr->left == op)
+		expr->left = NULL;
+	else
+		expr->right = NULL;
+	free_tree(expr);
+
+	return op;
+}
+
+/*
+ * truth:
+ * Return the truth value of `expr` within expression `parent`,
+ * which is reused to compare it to zero if required.
+ */
+static struct ast_node *truth(struct ast_node *parent, struct ast_node *expr)
+{
+	struct ast_node *zero;
+
+	if (TAG_IS_COND(expr->tag)) {
+		if (parent->left == expr)
+			parent->left = NULL;
+		else
+			parent->right = NULL;
+		free_tree(parent);
+		return expr;
+	}
+
+	zero = create_node(NODE_CONSTANT, "0");
+	zero->expr_flags.type_flags = TYPE_INT;
+	zero->expr_flags.extra = NULL;
+	zero->value = 0;
+
+	if (parent->left != expr)
+		free_tree(parent->left);
+	else if (parent->right)
+		free_tree(parent->right);
+	parent->tag = EXPR_NE;
+	parent->left = expr;
+	parent->right = zero;
+	parent->expr_flags.type_flags = TYPE_INT;
+	parent->expr_flags.extra = NULL;
+
+	return parent;
+}
+
+/* The comparison which is true exactly when the original is false. */
+static const int inverse[] = {
+	[EXPR_EQ] = EXPR_NE,
+	[EXPR_NE] = EXPR_EQ,
+	[EXPR_LT] = EXPR_GE,
+	[EXPR_GT] = EXPR_LE,
+	[EXPR_LE] = EXPR_GT,
+	[EXPR_GE] = EXPR_LT
+};
+
+/* The comparison which is equivalent when the operands are swapped. */
+static const int mirror[] = {
+	[EXPR_EQ] = EXPR_EQ,
+	[EXPR_NE] = EXPR_NE,
+	[EXPR_LT] = EXPR_GT,
+	[EXPR_GT] = EXPR_LT,
+	[EXPR_LE] = EXPR_GE,
+	[EXPR_GE] = EXPR_LE
+};
+
+static int is_associative(int tag)
+{
+	return tag == EXPR_ADD || tag == EXPR_MULT || tag == EXPR_AND ||
+	       tag == EXPR_OR || tag == EXPR_XOR;
+}
+
+/* combine: apply associative operator `op` to constants `a` and `b` */
+static long combine(int op, long a, long b)
+{
+	switch (op) {
+	case EXPR_ADD:
+		return (unsigned long)a + (unsigned long)b;
+	case EXPR_MULT:
+		return (unsigned long)a * (unsigned long)b;
+	case EXPR_AND:
+		return a & b;
+	case EXPR_OR:
+		return a | b;
+	default:
+		return a ^ b;
+	}
+}
+
+/*
+ * reassociate:
+ * Regroup a chain of associative operations `expr` so that its constant
+ * operands are applied last, where they can be combined.
+ * Return 1 if `expr` was changed.
+ */
+static int reassociate(struct ast_node **expr)
+{
+	struct ast_node *e, *l, *r, *c;
+	int integer;
+
+	e = *expr;
+	l = e->left;
+	r = e->right;
+	integer = !FLAGS_IS_PTR(e->expr_flags.type_flags);
+
+	/* (x op c1) op c2 => x op (c1 op c2) */
+	if (l->tag == e->tag && same_type(l, e) &&
+	    l->right->tag == NODE_CONSTANT && r->tag == NODE_CONSTANT) {
+		/* Pointer offsets keep the type of the offset. */
+		c = l->right;
+		if (integer)
+			memcpy(&c->expr_flags, &e->expr_flags,
+			       sizeof c->expr_flags);
+		c->value = simplify_const(combine(e->tag, c->value, r->value),
+		                          &c->expr_flags);
+		free(r);
+		free(e);
+		*expr = l;
+		return 1;
+	}
+
+	if (!integer)
+		return 0;
+
+	/* (x op c) op y => (x op y) op c */
+	if (l->tag == e->tag && same_type(l, e) &&
+	    l->right->tag == NODE_CONSTANT && r->tag != NODE_CONSTANT &&
+	    same_type(l->left, e) && same_type(r, e)) {
+		e->right = l->right;
+		l->right = r;
+		return 1;
+	}
+
+	/* x op (y op c) => (x op y) op c */
+	if (r->tag == e->tag && same_type(r, e) &&
+	    r->right->tag == NODE_CONSTANT && l->tag != NODE_CONSTANT &&
+	    same_type(r->left, e) && same_type(l, e)) {
+		c = r->right;
+		r->right = r->left;
+		r->left = l;
+		e->left = r;
+		e->right = c;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * simplify_binary:
+ * Apply the identities of binary operator `expr`, whose constant operand,
+ * if any, is on the right. Return 1 if `expr` was changed.
+ */
+static int simplify_binary(struct ast_node **expr)
+{
+	struct ast_node *e, *l, *r;
+	int k;
+
+	e = *expr;
+	l = e->left;
+	r = e->right;
+
+	/* x op x */
+	if (ast_equal(l, r) && is_pure(l)) {
+		switch (e->tag) {
+		case EXPR_SUB:
+		case EXPR_XOR:
+			*expr = make_const(e, 0);
+			return 1;
+		case EXPR_AND:
+		case EXPR_OR:
+			if (!same_type(l, e))
+				break;
+			free_tree(r);
+			e->right = NULL;
+			*expr = keep(e, l);
+			return 1;
+		}
+	}
+
+	if (r->tag != NODE_CONSTANT)
+		return is_associative(e->tag) ? reassociate(expr) : 0;
+
+	switch (e->tag) {
+	case EXPR_ADD:
+	case EXPR_OR:
+	case EXPR_XOR:
+	case EXPR_LSHIFT:
+	case EXPR_RSHIFT:
+		if (is_const(r, 0) && same_type(l, e)) {
+			*expr = keep(e, l);
+			return 1;
+		}
+		break;
+	case EXPR_SUB:
+		if (!FLAGS_IS_INTEGER(r->expr_flags.type_flags) ||
+		    FLAGS_IS_PTR(r->expr_flags.type_flags))
+			break;
+		/* x - c => x + -c, which can then be reassociated. */
+		if (FLAGS_IS_PTR(e->expr_flags.type_flags)) {
+			r->expr_flags.type_flags = TYPE_INT;
+			r->expr_flags.extra = NULL;
+		} else {
+			memcpy(&r->expr_flags, &e->expr_flags,
+			       sizeof r->expr_flags);
+		}
+		r->value = simplify_const(-(unsigned long)r->value,
+		                          &r->expr_flags);
+		e->tag = EXPR_ADD;
+		return 1;
+	case EXPR_MULT:
+		if (is_const(r, 1) && same_type(l, e)) {
+			*expr = keep(e, l);
+			return 1;
+		}
+		if (is_const(r, 0) && is_pure(l)) {
+			*expr = make_const(e, 0);
+			return 1;
+		}
+		break;
+	case EXPR_AND:
+		if (simplify_const(r->value, &e->expr_flags) ==
+		    simplify_const(-1, &e->expr_flags) && same_type(l, e)) {
+			*expr = keep(e, l);
+			return 1;
+		}
+		if (is_const(r, 0) && is_pure(l)) {
+			*expr = make_const(e, 0);
+			return 1;
+		}
+		break;
+	case EXPR_DIV:
+		if (is_const(r, 1) && same_type(l, e)) {
+			*expr = keep(e, l);
+			return 1;
+		}
+		/* Unsigned division by a power of two is a shift. */
+		if (e->expr_flags.type_flags & QUAL_UNSIGNED &&
+		    (k = log2_exact(r->value)) > 0) {
+			e->tag = EXPR_RSHIFT;
+			r->value = k;
+			return 1;
+		}
+		break;
+	case EXPR_MOD:
+		if (is_const(r, 1) && is_pure(l)) {
+			*expr = make_const(e, 0);
+			return 1;
+		}
+		/* Unsigned remainder by a power of two is a mask. */
+		if (e->expr_flags.type_flags & QUAL_UNSIGNED &&
+		    log2_exact(r->value) > 0) {
+			e->tag = EXPR_AND;
+			r->value = simplify_const(r->value - 1, &r->expr_flags);
+			return 1;
+		}
+		break;
+	case EXPR_LOGICAL_AND:
+		if (!is_const(r, 0)) {
+			*expr = truth(e, l);
+			return 1;
+		}
+		if (is_pure(l)) {
+			*expr = make_const(e, 0);
+			return 1;
+		}
+		break;
+	case EXPR_LOGICAL_OR:
+		if (is_const(r, 0)) {
+			*expr = truth(e, l);
+			return 1;
+		}
+		if (is_pure(l)) {
+			*expr = make_const(e, 1);
+			return 1;
+		}
+		break;
+	}
+
+	return is_associative(e->tag) ? reassociate(expr) : 0;
+}
+
+/*
+ * simplify_node:
+ * Apply a single rewrite to the root of `expr`, whose operands have already
+ * been simplified. Return 1 if `expr` was changed.
+ */
+static int simplify_node(struct ast_node **expr)
+{
+	struct ast_node *e, *l, *r, *n;
+
+	e = *expr;
+	if (e->tag <= NODE_MEMBER)
+		return 0;
+
+	if ((n = fold(e))) {
+		*expr = n;
+		return 1;
+	}
+
+	l = e->left;
+	r = e->right;
+
+	switch (e->tag) {
+	case EXPR_UNARY_MINUS:
+	case EXPR_NOT:
+		/* -(-x) => x, ~(~x) => x */
+		if (l->tag == e->tag && same_type(l->left, e)) {
+			*expr = l->left;
+			free(l);
+			free(e);
+			return 1;
+		}
+		return 0;
+	case EXPR_LOGICAL_NOT:
+		/* !!x => x != 0 */
+		if (l->tag == EXPR_LOGICAL_NOT) {
+			n = l->left;
+			l->left = NULL;
+			free_tree(l);
+			e->left = n;
+			*expr = truth(e, n);
+			return 1;
+		}
+		/* !(a < b) => a >= b */
+		if (l->tag >= EXPR_EQ && l->tag <= EXPR_GE) {
+			l->tag = inverse[l->tag];
+			*expr = l;
+			free(e);
+			return 1;
+		}
+		return 0;
+	case EXPR_LOGICAL_AND:
+	case EXPR_LOGICAL_OR:
+		/* The right operand of a constant is never evaluated. */
+		if (l->tag == NODE_CONSTANT) {
+			if (!l->value == (e->tag == EXPR_LOGICAL_AND)) {
+				*expr = make_const(e, e->tag == EXPR_LOGICAL_OR);
+				return 1;
+			}
+			*expr = truth(e, r);
+			return 1;
+		}
+		return simplify_binary(expr);
+	case EXPR_EQ:
+	case EXPR_NE:
+	case EXPR_LT:
+	case EXPR_GT:
+	case EXPR_LE:
+	case EXPR_GE:
+		/* Constants are compared on the right. */
+		if (l->tag == NODE_CONSTANT && r->tag != NODE_CONSTANT) {
+			e->left = r;
+			e->right = l;
+			e->tag = mirror[e->tag];
+			return 1;
+		}
+		return 0;
+	case EXPR_ADD:
+	case EXPR_MULT:
+	case EXPR_AND:
+	case EXPR_OR:
+	case EXPR_XOR:
+		if (l->tag == NODE_CONSTANT && r->tag != NODE_CONSTANT) {
+			e->left = r;
+			e->right = l;
+			return 1;
+		}
+		return simplify_binary(expr);
+	case EXPR_SUB:
+	case EXPR_DIV:
+	case EXPR_MOD:
+	case EXPR_LSHIFT:
+	case EXPR_RSHIFT:
+		return simplify_binary(expr);
+	case EXPR_COND:
+		/* Only the operand chosen by a constant is evaluated. */
+		if (l->tag != NODE_CONSTANT)
+			return 0;
+		n = l->value ? r->left : r->right;
+		if (!same_type(n, e))
+			return 0;
+		if (n == r->left)
+			r->left = NULL;
+		else
+			r->right = NULL;
+		free_tree(e);
+		*expr = n;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* simplify_tree: apply one round of rewrites to `expr`, bottom-up */
+static int simplify_tree(struct ast_node **expr)
+{
+	int changed;
+
+	if (!*expr)
+		return 0;
+
+	changed = simplify_tree(&(*expr)->left);
+	changed |= simplify_tree(&(*expr)->right);
+	while (simplify_node(expr))
+		changed = 1;
+
+	return changed;
+}
+
+/*
+ * simplify_expr:
+ * Simplify expression `expr` until no more rewrites apply.
+ * Return the simplified expression.
+ */
+struct ast_node *simplify_expr(struct ast_node *expr)
+{
+	while (simplify_tree(&expr))
+		;
+
+	return expr;
+}
+
+/* simplify_asg: simplify all expressions within `g` */
+void simplify_asg(struct graph_node *g)
+{
+	struct asg_node_conditional *c;
+	struct asg_node_statement *s;
+	struct asg_node_return *r;
+	struct asg_node_switch *sw;
+	struct asg_node_for *f;
+	struct asg_node_while *w;
+
+	for (; g; g = g->next) {
+		switch (g->type) {
+		case ASG_NODE_STATEMENT:
+			s = (struct asg_node_statement *)g;
+			s->ast = simplify_expr(s->ast);
+			break;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			c->cond = simplify_expr(c->cond);
+			simplify_asg(c->succ);
+			simplify_asg(c->fail);
+			break;
+		case ASG_NODE_FOR:
+			f = (struct asg_node_for *)g;
+			f->init = simplify_expr(f->init);
+			f->cond = simplify_expr(f->cond);
+			f->post = simplify_expr(f->post);
+			simplify_asg(f->body);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			w = (struct asg_node_while *)g;
+			w->cond = simplify_expr(w->cond);
+			simplify_asg(w->body);
+			break;
+		case ASG_NODE_RETURN:
+			r = (struct asg_node_return *)g;
+			r->retval = simplify_expr(r->retval);
+			break;
+		case ASG_NODE_SWITCH:
+			sw = (struct asg_node_switch *)g;
+			sw->expr = simplify_expr(sw->expr);
+			simplify_asg(sw->body);
+			break;
+		}
+	}
+}
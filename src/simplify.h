@@ -0,0 +1,30 @@
+/*
+ * src/simplify.h
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FCC_SIMPLIFY_H
+#define FCC_SIMPLIFY_H
+
+#include "asg.h"
+#include "ast.h"
+
+long simplify_const(long value, struct type_information *type);
+struct ast_node *simplify_fold(struct ast_node *expr);
+struct ast_node *simplify_expr(struct ast_node *expr);
+void simplify_asg(struct graph_node *g);
+
+#endif /* FCC_SIMPLIFY_H */
@@ -0,0 +1,586 @@
+/*
+ * src/slots.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Redundant load and dead store elimination on stack slots.
+ *
+ * A forward pass over a translated function finds the registers known to
+ * hold the value of each slot addressed from the base pointer, keeping only
+ * what all paths into a label agree on. Loads of a slot whose value is
+ * already in a register are removed or turned into register moves. A
+ * backward pass then finds the bytes of the frame which may be read before
+ * they are next written, and removes stores to locals which are not.
+ *
+ * Calls, string instructions and memory accesses through pointers are
+ * assumed to read and write every slot.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fcc.h"
+#include "slots.h"
+
+/* A register known to hold the value of a stack slot. */
+struct slot_val {
+	int valid;
+	int off;
+	int size;
+	int exact;      /* register holds what loading the slot would give */
+};
+
+/* Slot values known on entry to a label. */
+struct slot_state {
+	int             reached;
+	struct slot_val regs[X86_NUM_GPRS];
+};
+
+struct slot_info {
+	struct x86_sequence     *seq;
+	struct x86_instruction  *insts;
+	size_t                  ninsts;
+	char                    *drop;
+	int                     frame;  /* bytes of locals below the base */
+	struct vector           targets;
+};
+
+static int slot_is_frame(struct x86_operand *op)
+{
+	return op->type == X86_OPERAND_OFFSET && op->offset.gpr == X86_GPR_BP;
+}
+
+/* slot_is_pointer: check if memory operand `op` may address any slot */
+static int slot_is_pointer(struct x86_operand *op)
+{
+	switch (op->type) {
+	case X86_OPERAND_OFFSET:
+		return op->offset.gpr != X86_GPR_BP &&
+		       op->offset.gpr != X86_GPR_SP;
+	case X86_OPERAND_INDEX:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* slot_gpr: return the full register containing `gpr` */
+static int slot_gpr(int gpr)
+{
+	switch (gpr) {
+	case X86_GPR_AL:
+	case X86_GPR_AH:
+		return X86_GPR_AX;
+	case X86_GPR_CH:
+	case X86_GPR_CL:
+		return X86_GPR_CX;
+	default:
+		return gpr;
+	}
+}
+
+/* slot_barrier: check if `inst` may access memory not named by operands */
+static int slot_barrier(struct x86_instruction *inst)
+{
+	switch (inst->instruction) {
+	case X86_CALL:
+	case X86_MOVS:
+	case X86_STOS:
+	case X86_REP_MOVS:
+	case X86_REP_STOS:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* slot_clobbers: return a mask of the registers written by `inst` */
+static unsigned int slot_clobbers(struct x86_instruction *inst)
+{
+	struct x86_operand *dst;
+	unsigned int regs;
+	int rmw;
+
+	if (slot_barrier(inst))
+		return ~0U;
+
+	switch (inst->instruction) {
+	case X86_DIV:
+	case X86_RDTSC:
+		regs = 1U << X86_GPR_AX | 1U << X86_GPR_DX;
+		break;
+	case X86_CDQ:
+		regs = 1U << X86_GPR_DX;
+		break;
+	default:
+		regs = 0;
+		break;
+	}
+
+	dst = x86_dest_operand(inst, &rmw);
+	if (dst && dst->type == X86_OPERAND_GPR)
+		regs |= 1U << slot_gpr(dst->gpr);
+	return regs;
+}
+
+/*
+ * slot_move:
+ * Check if `inst` moves a full register to or from a stack slot, returning
+ * the register's operand.
+ */
+static struct x86_operand *slot_move(struct x86_instruction *inst)
+{
+	struct x86_operand *reg;
+
+	if (inst->instruction != X86_MOV)
+		return NULL;
+	if (inst->size != 4 && inst->size != 8)
+		return NULL;
+
+	if (slot_is_frame(&inst->op1))
+		reg = &inst->op2;
+	else if (slot_is_frame(&inst->op2))
+		reg = &inst->op1;
+	else
+		return NULL;
+
+	if (reg->type != X86_OPERAND_GPR || reg->gpr >= X86_GPR_AL ||
+	    reg->gpr == X86_GPR_SP || reg->gpr == X86_GPR_BP)
+		return NULL;
+	return reg;
+}
+
+static int slot_holds(struct slot_val *v, int off, int size)
+{
+	return v->valid && v->off == off && v->size == size;
+}
+
+/*
+ * slot_transfer:
+ * Update the slot values held in registers `regs` for the execution of
+ * instruction `inst`.
+ */
+static void slot_transfer(struct x86_instruction *inst, struct slot_val *regs)
+{
+	struct x86_operand *dst, *reg;
+	unsigned int clobbers;
+	int rmw, off, w, i;
+
+	clobbers = slot_clobbers(inst);
+	if (clobbers & 1U << X86_GPR_BP)
+		clobbers = ~0U;
+
+	dst = x86_dest_operand(inst, &rmw);
+	if (slot_barrier(inst) || (dst && slot_is_pointer(dst))) {
+		clobbers = ~0U;
+	} else if (dst && slot_is_frame(dst)) {
+		off = dst->offset.off;
+		w = x86_access_width(inst);
+		for (i = 0; i < X86_NUM_GPRS; ++i) {
+			if (regs[i].off < off + w &&
+			    off < regs[i].off + regs[i].size)
+				regs[i].valid = 0;
+		}
+	}
+
+	for (i = 0; i < X86_NUM_GPRS; ++i) {
+		if (clobbers & 1U << i)
+			regs[i].valid = 0;
+	}
+
+	if (!(reg = slot_move(inst)))
+		return;
+
+	i = reg->gpr;
+	regs[i].valid = 1;
+	regs[i].size = inst->size;
+	if (reg == &inst->op2) {
+		regs[i].off = inst->op1.offset.off;
+		regs[i].exact = 1;
+	} else {
+		/* The upper half of a 64-bit register is not stored. */
+		regs[i].off = inst->op2.offset.off;
+		regs[i].exact = inst->size == FCC_WORD_SIZE;
+	}
+}
+
+/*
+ * slot_rewrite_operands:
+ * Replace the slots read in place by instruction `in` with registers known
+ * to hold their values.
+ */
+static void slot_rewrite_operands(struct x86_instruction *in,
+                                  struct slot_val *regs)
+{
+	struct x86_operand *ops[] = { &in->op1, &in->op2, &in->op3 };
+	struct x86_operand *dst;
+	int rmw, w, n, i, r;
+
+	if (in->instruction == X86_LEA || slot_barrier(in))
+		return;
+
+	dst = x86_dest_operand(in, &rmw);
+	w = x86_access_width(in);
+	n = x86_operand_count(in);
+	for (i = 0; i < n; ++i) {
+		if (ops[i] == dst || !slot_is_frame(ops[i]))
+			continue;
+		for (r = 0; r < X86_NUM_GPRS; ++r) {
+			if (slot_holds(&regs[r], ops[i]->offset.off, w)) {
+				ops[i]->type = X86_OPERAND_GPR;
+				ops[i]->gpr = r;
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * slot_rewrite:
+ * If instruction `i` loads a slot whose value is known to be in a register,
+ * remove it or replace it with a move from that register.
+ */
+static void slot_rewrite(struct slot_info *si, size_t i, struct slot_val *regs)
+{
+	struct x86_instruction *in;
+	struct x86_operand *reg;
+	int off, r;
+
+	in = si->insts + i;
+	if (!(reg = slot_move(in)) || reg != &in->op2) {
+		slot_rewrite_operands(in, regs);
+		return;
+	}
+
+	off = in->op1.offset.off;
+	if (slot_holds(&regs[reg->gpr], off, in->size) &&
+	    regs[reg->gpr].exact) {
+		si->drop[i] = 1;
+		return;
+	}
+
+	for (r = 0; r < X86_NUM_GPRS; ++r) {
+		if (slot_holds(&regs[r], off, in->size)) {
+			in->op1.type = X86_OPERAND_GPR;
+			in->op1.gpr = r;
+			return;
+		}
+	}
+}
+
+/*
+ * slot_jump_targets:
+ * Set the `targets` of `si` to the labels reachable from jump instruction
+ * `in`. A jump through a table can reach any of its targets.
+ */
+static void slot_jump_targets(struct slot_info *si, struct x86_instruction *in)
+{
+	struct x86_jump_table *t;
+	int i;
+
+	vector_clear(&si->targets);
+	if (in->op1.type == X86_OPERAND_LABEL) {
+		vector_append(&si->targets, &in->op1.label);
+		return;
+	}
+	if (in->op1.type == X86_OPERAND_FUNC)
+		return;
+
+	VECTOR_ITER(&si->seq->tables, t) {
+		for (i = 0; i < t->ntargets; ++i)
+			vector_append(&si->targets, &t->targets[i]);
+	}
+}
+
+/*
+ * slot_meet:
+ * Merge slot values `regs` into the state of a label, keeping those on
+ * which they agree. Return 1 if the state of the label changed.
+ */
+static int slot_meet(struct slot_state *state, struct slot_val *regs)
+{
+	int i, changed;
+
+	if (!state->reached) {
+		state->reached = 1;
+		memcpy(state->regs, regs, sizeof state->regs);
+		return 1;
+	}
+
+	changed = 0;
+	for (i = 0; i < X86_NUM_GPRS; ++i) {
+		if (state->regs[i].valid &&
+		    (!slot_holds(&regs[i], state->regs[i].off,
+		                 state->regs[i].size) ||
+		     regs[i].exact != state->regs[i].exact)) {
+			state->regs[i].valid = 0;
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+/*
+ * slot_forward:
+ * Make a single pass over the function, merging the slot values reaching
+ * each label into `labels`. If `rewrite` is set, remove redundant loads.
+ * Return 1 if any label's state changed.
+ */
+static int slot_forward(struct slot_info *si, struct slot_state *labels,
+                        int rewrite)
+{
+	struct x86_instruction *in, orig;
+	struct slot_state cur, *state;
+	int changed, *l;
+	size_t i;
+
+	memset(&cur, 0, sizeof cur);
+	cur.reached = 1;
+	changed = 0;
+
+	for (i = 0; i < si->ninsts; ++i) {
+		in = si->insts + i;
+		if (in->instruction == X86_LABEL) {
+			state = &labels[in->lnum];
+			if (cur.reached)
+				changed |= slot_meet(state, cur.regs);
+			cur = *state;
+		}
+		if (!cur.reached)
+			continue;
+
+		orig = *in;
+		if (rewrite)
+			slot_rewrite(si, i, cur.regs);
+		slot_transfer(&orig, cur.regs);
+
+		if (x86_is_jump(in->instruction)) {
+			slot_jump_targets(si, in);
+			VECTOR_ITER(&si->targets, l)
+				changed |= slot_meet(&labels[*l], cur.regs);
+			if (in->instruction == X86_JMP)
+				cur.reached = 0;
+		} else if (in->instruction == X86_RET) {
+			cur.reached = 0;
+		}
+	}
+
+	return changed;
+}
+
+/* slot_mark: set the liveness of `w` bytes of the frame from `off` */
+static void slot_mark(struct slot_info *si, char *live, int off, int w,
+                      int val)
+{
+	int b;
+
+	for (b = off; b < off + w; ++b) {
+		if (b >= -si->frame && b < 0)
+			live[b + si->frame] = val;
+	}
+}
+
+/*
+ * slot_dead_store:
+ * Check if `inst` stores to a local none of whose bytes are `live`.
+ */
+static int slot_dead_store(struct slot_info *si, struct x86_instruction *inst,
+                           char *live)
+{
+	int off, b;
+
+	if (inst->instruction != X86_MOV || !slot_is_frame(&inst->op2))
+		return 0;
+
+	switch (inst->size) {
+	case 1:
+	case 2:
+	case 4:
+	case 8:
+		break;
+	default:
+		return 0;
+	}
+
+	off = inst->op2.offset.off;
+	if (off < -si->frame || off + inst->size > 0)
+		return 0;
+
+	for (b = off; b < off + inst->size; ++b) {
+		if (live[b + si->frame])
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * slot_liveness:
+ * Update the bytes of the frame `live` after instruction `inst` to those
+ * live before it.
+ */
+static void slot_liveness(struct slot_info *si, struct x86_instruction *inst,
+                          char *live)
+{
+	struct x86_operand *ops[] = { &inst->op1, &inst->op2, &inst->op3 };
+	struct x86_operand *dst;
+	int rmw, n, i;
+
+	if (slot_barrier(inst)) {
+		memset(live, 1, si->frame);
+		return;
+	}
+
+	dst = x86_dest_operand(inst, &rmw);
+	if (inst->instruction == X86_MOV && dst && slot_is_frame(dst) &&
+	    inst->size)
+		slot_mark(si, live, dst->offset.off, inst->size, 0);
+
+	/* lea computes an address without reading it. */
+	if (inst->instruction == X86_LEA)
+		return;
+
+	n = x86_operand_count(inst);
+	for (i = 0; i < n; ++i) {
+		if (ops[i] == dst && !rmw)
+			continue;
+		if (slot_is_pointer(ops[i])) {
+			memset(live, 1, si->frame);
+			return;
+		}
+		if (slot_is_frame(ops[i]))
+			slot_mark(si, live, ops[i]->offset.off,
+			          x86_access_width(inst), 1);
+	}
+}
+
+/*
+ * slot_backward:
+ * Make a single pass backwards over the function, merging the bytes of the
+ * frame live at each label into `labels`. If `remove` is set, remove dead
+ * stores. Return 1 if any label's live bytes changed.
+ */
+static int slot_backward(struct slot_info *si, char *labels, char *live,
+                         int remove)
+{
+	struct x86_instruction *in;
+	int changed, b, *l;
+	char *target;
+	size_t i;
+
+	memset(live, 0, si->frame);
+	changed = 0;
+
+	for (i = si->ninsts; i-- > 0; ) {
+		if (si->drop[i])
+			continue;
+
+		in = si->insts + i;
+		if (in->instruction == X86_RET) {
+			memset(live, 0, si->frame);
+		} else if (x86_is_jump(in->instruction)) {
+			if (in->instruction == X86_JMP)
+				memset(live, 0, si->frame);
+			slot_jump_targets(si, in);
+			VECTOR_ITER(&si->targets, l) {
+				target = labels + *l * si->frame;
+				for (b = 0; b < si->frame; ++b)
+					live[b] |= target[b];
+			}
+		}
+
+		if (remove && slot_dead_store(si, in, live)) {
+			si->drop[i] = 1;
+			continue;
+		}
+		slot_liveness(si, in, live);
+
+		if (in->instruction == X86_LABEL) {
+			target = labels + in->lnum * si->frame;
+			for (b = 0; b < si->frame; ++b) {
+				if (live[b] && !target[b]) {
+					target[b] = 1;
+					changed = 1;
+				}
+			}
+		}
+	}
+
+	return changed;
+}
+
+/*
+ * slot_compact:
+ * Remove the instructions marked in `drop` from the sequence.
+ */
+static void slot_compact(struct x86_sequence *seq, char *drop)
+{
+	struct x86_instruction *insts;
+	struct vector old;
+	size_t i, body;
+
+	old = seq->seq;
+	insts = old.data;
+	body = 0;
+	vector_init(&seq->seq, sizeof (struct x86_instruction));
+	for (i = 0; i < old.nmembs; ++i) {
+		if (i == seq->body)
+			body = seq->seq.nmembs;
+		if (!drop[i])
+			vector_append(&seq->seq, insts + i);
+	}
+	seq->body = body;
+	vector_destroy(&old);
+}
+
+/*
+ * slots_optimize:
+ * Remove loads of stack slots whose values are already held in registers,
+ * and stores to locals which are never read, from translated function `seq`.
+ */
+void slots_optimize(struct x86_sequence *seq)
+{
+	struct slot_state *states;
+	struct slot_info si;
+	char *labels, *live;
+
+	si.seq = seq;
+	si.insts = seq->seq.data;
+	si.ninsts = seq->seq.nmembs;
+	si.drop = calloc(si.ninsts, 1);
+	si.frame = seq->frame;
+	vector_init(&si.targets, sizeof (int));
+
+	states = calloc(seq->label ? seq->label : 1, sizeof *states);
+	while (slot_forward(&si, states, 0))
+		;
+	slot_forward(&si, states, 1);
+	free(states);
+
+	if (si.frame) {
+		labels = calloc((seq->label ? seq->label : 1) * si.frame, 1);
+		live = malloc(si.frame);
+		while (slot_backward(&si, labels, live, 0))
+			;
+		slot_backward(&si, labels, live, 1);
+		free(labels);
+		free(live);
+	}
+
+	slot_compact(seq, si.drop);
+	vector_destroy(&si.targets);
+	free(si.drop);
+}
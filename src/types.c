@@ -34,7 +34,7 @@ size_t type_size(struct type_information *type)
 	if (t == TYPE_STRLIT)
 		return 0;
 	else if (FLAGS_IS_PTR(type->type_flags))
-	         return 4;
+	         return FCC_WORD_SIZE;
 	else if (t == TYPE_VOID)
 		return 0;
 	else if (t == TYPE_STRUCT)
@@ -43,19 +43,32 @@ size_t type_size(struct type_information *type)
 		return sizes[t];
 }
 
+/* type_align: return the alignment of a value of type `type` */
+size_t type_align(struct type_information *type)
+{
+	if (FLAGS_TYPE(type->type_flags) == TYPE_STRUCT &&
+	    !FLAGS_IS_PTR(type->type_flags))
+		return ((struct struct_struct *)type->extra)->align;
+
+	return type_size(type);
+}
+
 static struct struct_struct *structs = NULL;
 
 static void struct_add_members(struct struct_struct *s, struct ast_node *ast)
 {
 	struct struct_member member;
-	size_t size;
+	size_t size, align;
 
 	if (!ast) {
 		return;
 	} else if (ast->tag == NODE_IDENTIFIER) {
 		size = type_size(&ast->expr_flags);
-		if (!ALIGNED(s->size, size))
-			s->size = ALIGN(s->size, size);
+		align = type_align(&ast->expr_flags);
+		if (!ALIGNED(s->size, align))
+			s->size = ALIGN(s->size, align);
+		if (align > s->align)
+			s->align = align;
 
 		member.name = ast->lexeme;
 		memcpy(&member.type, &ast->expr_flags, sizeof member.type);
@@ -85,9 +98,13 @@ struct struct_struct *struct_create(const char *name, struct ast_node *members)
 	s = malloc(sizeof *s);
 	s->name = name;
 	s->size = 0;
+	s->align = 1;
 	vector_init(&s->members, sizeof (struct struct_member));
 	struct_add_members(s, members);
 
+	/* Pad the struct so that its members stay aligned when copied. */
+	s->size = ALIGN(s->size, s->align);
+
 	HASH_ADD_KEYPTR(hh, structs, s->name, strlen(s->name), s);
 
 	return s;
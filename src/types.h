@@ -36,6 +36,7 @@ enum {
 struct struct_struct {
 	const char *name;
 	size_t size;
+	size_t align;           /* alignment of the most aligned member */
 	struct vector members;
 	UT_hash_handle hh;
 };
@@ -48,14 +49,16 @@ struct struct_member {
 
 /*
  * A type flags bitfield is set up as follows:
- * PPPPPPPPxxxxxxxUxxxxxxxFxxxxTTTT
+ * PPPPPPPPxxxxxxxUxxxxxxSFxxxxTTTT
  * P: level of indirection
  * U: unsigned flag
+ * S: function declared static
  * F: is a function
  * T: type
  */
 
 #define PROPERTY_FUNC   (1 << 8)
+#define PROPERTY_STATIC (1 << 9)
 #define QUAL_UNSIGNED   (1 << 16)
 
 #define FLAGS_INDIRECTION_SHIFT 24
@@ -63,11 +66,13 @@ struct struct_member {
 #define FLAGS_TYPE(x) ((x) & 0xF)
 #define FLAGS_IS_PTR(x) ((x) & 0xFF000000)
 #define FLAGS_IS_FUNC(x) ((x) & PROPERTY_FUNC)
+#define FLAGS_IS_STATIC(x) ((x) & PROPERTY_STATIC)
 #define FLAGS_IS_INTEGER(x) \
 	(FLAGS_TYPE(x) == TYPE_INT || FLAGS_TYPE(x) == TYPE_CHAR)
 #define FLAGS_INDIRECTION(x) ((x) >> FLAGS_INDIRECTION_SHIFT)
 
 size_t type_size(struct type_information *type);
+size_t type_align(struct type_information *type);
 
 struct struct_struct *struct_create(const char *name, struct ast_node *members);
 struct struct_struct *struct_find(const char *name);
@@ -0,0 +1,505 @@
+/*
+ * src/unroll.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Unrolling of counted loops.
+ *
+ * An innermost loop of the form
+ *
+ *	for (i = start; i < n; i = i + 1)
+ *		body;
+ *
+ * whose body changes neither `i` nor `n` runs k copies of its body in each
+ * iteration, the copies using `i`, `i + 1`, ..., `i + k - 1` in place of `i`:
+ *
+ *	for (i = start; i < n - (k - 1); i = i + k) {
+ *		body(i); body(i + 1); ... body(i + k - 1);
+ *	}
+ *	for (; i < n; i = i + 1)
+ *		body(i);
+ *
+ * The remaining iterations run in the second loop, which runs all of them if
+ * a variable bound n is too close to INT_MIN for n - (k - 1) to be computed.
+ * When the trip count is a constant, they are copied out instead, and a loop
+ * of few enough iterations is replaced by a copy of its body for each of them.
+ * The factor k is the largest power of two for which the copies stay small,
+ * and the growth of each function is limited by -funroll-limit.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fcc.h"
+#include "profile.h"
+#include "unroll.h"
+#include "vectorize.h"
+
+/* A counted loop which can be unrolled. */
+struct unroll_loop {
+	struct vec_loop v;              /* induction variable and bound */
+	long            start;          /* initial value, if trip is known */
+	long            trip;           /* iterations, or -1 if not known */
+	int             cost;           /* size of the loop body */
+};
+
+struct unroll_state {
+	struct graph_node **root;       /* body of the function */
+	int             budget;         /* remaining growth for the function */
+};
+
+static int is_var(struct ast_node *expr, const char *name)
+{
+	return expr->tag == NODE_IDENTIFIER && strcmp(expr->lexeme, name) == 0;
+}
+
+/*
+ * ast_writes:
+ * Check if expression `ast` takes the address of variable `name` or, unless
+ * `addr` is set, assigns to it.
+ */
+static int ast_writes(struct ast_node *ast, const char *name, int addr)
+{
+	if (!ast)
+		return 0;
+
+	if ((ast->tag == EXPR_ADDRESS || (!addr && ast->tag == EXPR_ASSIGN)) &&
+	    is_var(ast->left, name))
+		return 1;
+
+	return ast_writes(ast->left, name, addr) ||
+	       ast_writes(ast->right, name, addr);
+}
+
+/* asg_writes: check if any expression in `g` writes to `name` */
+static int asg_writes(struct graph_node *g, const char *name, int addr)
+{
+	struct asg_node_conditional *c;
+	struct asg_node_switch *sw;
+	struct asg_node_for *f;
+	struct asg_node_while *w;
+
+	for (; g; g = g->next) {
+		switch (g->type) {
+		case ASG_NODE_STATEMENT:
+			if (ast_writes(((struct asg_node_statement *)g)->ast,
+			               name, addr))
+				return 1;
+			break;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			if (ast_writes(c->cond, name, addr) ||
+			    asg_writes(c->succ, name, addr) ||
+			    asg_writes(c->fail, name, addr))
+				return 1;
+			break;
+		case ASG_NODE_FOR:
+			f = (struct asg_node_for *)g;
+			if (ast_writes(f->init, name, addr) ||
+			    ast_writes(f->cond, name, addr) ||
+			    ast_writes(f->post, name, addr) ||
+			    asg_writes(f->body, name, addr))
+				return 1;
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			w = (struct asg_node_while *)g;
+			if (ast_writes(w->cond, name, addr) ||
+			    asg_writes(w->body, name, addr))
+				return 1;
+			break;
+		case ASG_NODE_RETURN:
+			if (ast_writes(((struct asg_node_return *)g)->retval,
+			               name, addr))
+				return 1;
+			break;
+		case ASG_NODE_SWITCH:
+			sw = (struct asg_node_switch *)g;
+			if (ast_writes(sw->expr, name, addr) ||
+			    asg_writes(sw->body, name, addr))
+				return 1;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * unroll_body:
+ * Check if copies of loop body `g` can run one after another. It may not
+ * contain loops, or a break, which would only leave the copy it is in.
+ * Declarations could hide the induction variable, and a return outside
+ * of a conditional means that the loop does not repeat.
+ */
+static int unroll_body(struct graph_node *g, int top)
+{
+	struct asg_node_conditional *c;
+
+	for (; g; g = g->next) {
+		switch (g->type) {
+		case ASG_NODE_STATEMENT:
+			break;
+		case ASG_NODE_RETURN:
+			if (top)
+				return 0;
+			break;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			if (!unroll_body(c->succ, 0) ||
+			    !unroll_body(c->fail, 0))
+				return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * unroll_match:
+ * Check if for loop `f` can be unrolled, and describe it in `l` if so.
+ */
+static int unroll_match(struct unroll_state *st, struct asg_node_for *f,
+                        struct unroll_loop *l)
+{
+	struct ast_node *limit;
+	struct vec_loop v;
+	const char *name;
+
+	if (!f->body || !unroll_body(f->body, 1) || !vec_counted_loop(f, &l->v))
+		return 0;
+
+	/* The trip count is fixed once the loop is entered. */
+	limit = l->v.limit;
+	name = l->v.ivar->lexeme;
+	if (asg_writes(f->body, name, 0) || asg_writes(*st->root, name, 1))
+		return 0;
+	if (limit->tag == NODE_IDENTIFIER &&
+	    (asg_writes(f->body, limit->lexeme, 0) ||
+	     asg_writes(*st->root, limit->lexeme, 1)))
+		return 0;
+
+	/* Loops which are vectorized already run several iterations at once. */
+	if (fcc_flags & FFLAG_TREE_VECTORIZE && vec_analyze_loop(f, &v)) {
+		vec_loop_destroy(&v);
+		return 0;
+	}
+
+	/* Instrumented loops are kept to be counted. */
+	if (f->prof >= 0 && (fcc_flags & FFLAG_PROFILE_GENERATE))
+		return 0;
+	if (profile_loop_cold(f->prof))
+		return 0;
+
+	l->trip = -1;
+	if (f->init->right->tag == NODE_CONSTANT &&
+	    limit->tag == NODE_CONSTANT) {
+		l->start = f->init->right->value;
+		l->trip = limit->value - l->start;
+		if (l->trip < 0)
+			l->trip = 0;
+	}
+	l->cost = asg_cost(f->body);
+
+	return 1;
+}
+
+/*
+ * unroll_factor:
+ * Return the number of copies of the body of `l` which each iteration of
+ * the unrolled loop should run, or 1 if it should not be unrolled.
+ */
+static int unroll_factor(struct unroll_state *st, struct unroll_loop *l)
+{
+	long copies;
+	int k;
+
+	for (k = UNROLL_MAX_FACTOR; k > 1; k /= 2) {
+		if (k * l->cost > UNROLL_MAX_BODY ||
+		    (l->trip != -1 && k > l->trip))
+			continue;
+
+		/* A constant bound n - (k - 1) of the unrolled loop must fit. */
+		if (l->v.limit->tag == NODE_CONSTANT &&
+		    l->v.limit->value - (k - 1) < INT_MIN)
+			continue;
+
+		/* The remaining iterations need one more copy, or trip % k. */
+		copies = k + (l->trip == -1 ? 1 : l->trip % k);
+		if ((copies - 1) * l->cost <= st->budget)
+			return k;
+	}
+
+	return 1;
+}
+
+/* unroll_const: return a constant node with value `value` */
+static struct ast_node *unroll_const(long value)
+{
+	struct ast_node *n;
+
+	n = create_node(NODE_CONSTANT, "0");
+	n->value = value;
+	return n;
+}
+
+/*
+ * unroll_offset:
+ * Replace each use of variable `ivar` in expression `*expr` with
+ * `ivar + off`, or with the constant `off` if `fixed` is set.
+ */
+static void unroll_offset(struct ast_node **expr, struct ast_node *ivar,
+                          long off, int fixed)
+{
+	if (!*expr)
+		return;
+
+	if (is_var(*expr, ivar->lexeme)) {
+		if (fixed) {
+			free_tree(*expr);
+			*expr = unroll_const(off);
+		} else if (off) {
+			*expr = create_expr(EXPR_ADD, *expr, unroll_const(off));
+		}
+		return;
+	}
+
+	unroll_offset(&(*expr)->left, ivar, off, fixed);
+	unroll_offset(&(*expr)->right, ivar, off, fixed);
+}
+
+/* unroll_offset_asg: apply unroll_offset to each expression in `g` */
+static void unroll_offset_asg(struct graph_node *g, struct ast_node *ivar,
+                              long off, int fixed)
+{
+	struct asg_node_conditional *c;
+
+	for (; g; g = g->next) {
+		switch (g->type) {
+		case ASG_NODE_STATEMENT:
+			unroll_offset(&((struct asg_node_statement *)g)->ast,
+			              ivar, off, fixed);
+			break;
+		case ASG_NODE_RETURN:
+			unroll_offset(&((struct asg_node_return *)g)->retval,
+			              ivar, off, fixed);
+			break;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			unroll_offset(&c->cond, ivar, off, fixed);
+			unroll_offset_asg(c->succ, ivar, off, fixed);
+			unroll_offset_asg(c->fail, ivar, off, fixed);
+			break;
+		}
+	}
+}
+
+/*
+ * unroll_copies:
+ * Return `n` copies of loop body `body`, the j-th using `ivar + off + j`,
+ * or the constant `off + j` if `fixed` is set. If `orig` is set, `body`
+ * itself is the last copy.
+ */
+static struct graph_node *unroll_copies(struct graph_node *body,
+                                        struct ast_node *ivar,
+                                        long off, int fixed,
+                                        long n, int orig)
+{
+	struct graph_node *g, *copy;
+	long j;
+
+	g = NULL;
+	for (j = 0; j < n; ++j) {
+		copy = orig && j == n - 1 ? body : asg_copy(body);
+		unroll_offset_asg(copy, ivar, off + j, fixed);
+		g = asg_append(g, copy);
+	}
+
+	return g;
+}
+
+/* unroll_exit: return the statement `ivar = value` */
+static struct graph_node *unroll_exit(struct ast_node *ivar, long value)
+{
+	return create_statement(create_expr(EXPR_ASSIGN, ast_copy(ivar),
+	                                    unroll_const(value)));
+}
+
+/*
+ * unroll_full:
+ * Return a copy of the body of loop `f`, described by `l`, for each of its
+ * iterations, followed by the assignment of the final value of its
+ * induction variable.
+ */
+static struct graph_node *unroll_full(struct asg_node_for *f,
+                                      struct unroll_loop *l)
+{
+	struct graph_node *g;
+
+	g = unroll_copies(f->body, l->v.ivar, l->start, 1, l->trip, 1);
+	g = asg_append(g, unroll_exit(l->v.ivar, l->start + l->trip));
+
+	free_tree(f->init);
+	free_tree(f->cond);
+	free_tree(f->post);
+	free(f);
+
+	return g;
+}
+
+/*
+ * unroll_partial:
+ * Unroll loop `f`, described by `l`, by factor `k`, and return it followed
+ * by the remaining iterations.
+ */
+static struct graph_node *unroll_partial(struct asg_node_for *f,
+                                         struct unroll_loop *l, int k)
+{
+	struct graph_node *body, *rest, *loop;
+	struct ast_node *ivar, *guard;
+	long r;
+
+	ivar = l->v.ivar;
+	body = f->body;
+	if (l->trip == -1) {
+		rest = create_for_loop(NULL, ast_copy(f->cond),
+		                       ast_copy(f->post), body);
+		f->body = unroll_copies(body, ivar, 0, 0, k, 0);
+	} else {
+		r = l->trip % k;
+		rest = unroll_copies(body, ivar, l->start + l->trip - r, 1,
+		                     r, 0);
+		rest = asg_append(rest, unroll_exit(ivar, l->start + l->trip));
+		f->body = unroll_copies(body, ivar, 0, 0, k, 1);
+	}
+
+	/*
+	 * The unrolled loop runs while i < n - (k - 1). A variable bound this
+	 * close to INT_MIN would overflow, so the unrolled loop is then skipped
+	 * and the remaining iterations run them all.
+	 */
+	loop = (struct graph_node *)f;
+	if (f->cond->right->tag == NODE_CONSTANT) {
+		f->cond->right->value -= k - 1;
+	} else {
+		guard = create_expr(EXPR_GT, ast_copy(f->cond->right),
+		                    unroll_const((long)INT_MIN + k - 1));
+		f->cond->right = create_expr(EXPR_SUB, f->cond->right,
+		                             unroll_const(k - 1));
+		loop = create_conditional(guard, loop, NULL);
+		loop = asg_append(create_statement(f->init), loop);
+		f->init = NULL;
+	}
+	free_tree(f->post);
+	f->post = create_expr(EXPR_ASSIGN, ast_copy(ivar),
+	                      create_expr(EXPR_ADD, ast_copy(ivar),
+	                                  unroll_const(k)));
+
+	return asg_append(loop, rest);
+}
+
+/* unroll_replace: return the statements replacing loop `g`, or NULL */
+static struct graph_node *unroll_replace(struct unroll_state *st,
+                                         struct graph_node *g)
+{
+	struct asg_node_for *f;
+	struct unroll_loop l;
+	int k;
+
+	if (g->type != ASG_NODE_FOR)
+		return NULL;
+
+	f = (struct asg_node_for *)g;
+	if (!unroll_match(st, f, &l))
+		return NULL;
+
+	if (l.trip != -1 && l.trip <= UNROLL_MAX_PEEL &&
+	    l.trip * l.cost <= UNROLL_MAX_BODY &&
+	    (l.trip - 1) * l.cost <= st->budget) {
+		st->budget -= (l.trip - 1) * l.cost;
+		return unroll_full(f, &l);
+	}
+
+	if ((k = unroll_factor(st, &l)) == 1)
+		return NULL;
+
+	f->next = NULL;
+	st->budget -= (k - 1 + (l.trip == -1 ? 1 : l.trip % k)) * l.cost;
+	return unroll_partial(f, &l, k);
+}
+
+static void unroll_asg(struct unroll_state *st, struct graph_node **link)
+{
+	struct asg_node_conditional *c;
+	struct asg_node_switch *sw;
+	struct asg_node_for *f;
+	struct asg_node_while *w;
+	struct graph_node *next, *run;
+
+	while (*link) {
+		switch ((*link)->type) {
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)*link;
+			unroll_asg(st, &c->succ);
+			unroll_asg(st, &c->fail);
+			break;
+		case ASG_NODE_FOR:
+			f = (struct asg_node_for *)*link;
+			unroll_asg(st, &f->body);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			w = (struct asg_node_while *)*link;
+			unroll_asg(st, &w->body);
+			break;
+		case ASG_NODE_SWITCH:
+			sw = (struct asg_node_switch *)*link;
+			unroll_asg(st, &sw->body);
+			break;
+		}
+
+		next = (*link)->next;
+		if (!(run = unroll_replace(st, *link))) {
+			link = &(*link)->next;
+			continue;
+		}
+
+		*link = asg_append(run, next);
+		while (*link != next)
+			link = &(*link)->next;
+	}
+}
+
+/*
+ * unroll_loops:
+ * Unroll the small counted loops in function body `g`.
+ * Return the new body of the function.
+ */
+struct graph_node *unroll_loops(struct graph_node *g)
+{
+	struct unroll_state st;
+
+	st.root = &g;
+	st.budget = fcc_unroll_limit;
+	unroll_asg(&st, &g);
+
+	return g;
+}
@@ -0,0 +1,35 @@
+/*
+ * src/unroll.h
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FCC_UNROLL_H
+#define FCC_UNROLL_H
+
+#include "asg.h"
+
+/* Largest number of copies of a loop body run by each iteration. */
+#define UNROLL_MAX_FACTOR       8
+
+/* Largest size of the body of an unrolled loop, including its header. */
+#define UNROLL_MAX_BODY         64
+
+/* Largest constant trip count of a loop which is fully unrolled. */
+#define UNROLL_MAX_PEEL         16
+
+struct graph_node *unroll_loops(struct graph_node *g);
+
+#endif /* FCC_UNROLL_H */
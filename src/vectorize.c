@@ -0,0 +1,360 @@
+/*
+ * src/vectorize.c
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Vectorization of simple counted loops.
+ *
+ * An innermost loop of the form
+ *
+ *	for (i = start; i < n; i = i + 1)
+ *		p[i] = q[i] + k;
+ *
+ * whose body only stores to element `i` of some pointers values computed
+ * from element `i` of others and from loop invariants carries no dependence
+ * between iterations, except where the pointers overlap. Such loops are
+ * recognized here, and executed VEC_BYTES at a time by the code generator.
+ */
+
+#include <string.h>
+
+#include "fcc.h"
+#include "types.h"
+#include "vectorize.h"
+
+/* is_ivar: check if `expr` is the induction variable of loop `v` */
+static int is_ivar(struct vec_loop *v, struct ast_node *expr)
+{
+	return expr->tag == NODE_IDENTIFIER &&
+	       strcmp(expr->lexeme, v->ivar->lexeme) == 0;
+}
+
+/* is_int: check if `expr` has type plain signed int */
+static int is_int(struct ast_node *expr)
+{
+	return expr->expr_flags.type_flags == TYPE_INT;
+}
+
+/*
+ * vec_access_ptr:
+ * If `expr` is an access `*(p + i)` of the current element of pointer `p`,
+ * return `p`. Otherwise, return NULL.
+ */
+struct ast_node *vec_access_ptr(struct vec_loop *v, struct ast_node *expr)
+{
+	struct ast_node *ptr, *idx;
+	long size;
+
+	if (expr->tag != EXPR_DEREFERENCE || expr->left->tag != EXPR_ADD)
+		return NULL;
+
+	ptr = expr->left->left;
+	idx = expr->left->right;
+	if (!FLAGS_IS_PTR(ptr->expr_flags.type_flags)) {
+		ptr = expr->left->right;
+		idx = expr->left->left;
+	}
+	if (ptr->tag != NODE_IDENTIFIER || is_ivar(v, ptr))
+		return NULL;
+
+	/* The index is scaled by the element size for wider types. */
+	size = type_size(&expr->expr_flags);
+	if (size == 1)
+		return is_ivar(v, idx) ? ptr : NULL;
+
+	if (idx->tag != EXPR_MULT)
+		return NULL;
+	if (is_ivar(v, idx->left) && idx->right->tag == NODE_CONSTANT &&
+	    idx->right->value == size)
+		return ptr;
+	if (is_ivar(v, idx->right) && idx->left->tag == NODE_CONSTANT &&
+	    idx->left->value == size)
+		return ptr;
+
+	return NULL;
+}
+
+/* add_ptr: add pointer identifier `ptr` to `ptrs` if not already present */
+static void add_ptr(struct vector *ptrs, struct ast_node *ptr)
+{
+	struct ast_node **p;
+
+	VECTOR_ITER(ptrs, p) {
+		if (strcmp((*p)->lexeme, ptr->lexeme) == 0)
+			return;
+	}
+	vector_append(ptrs, &ptr);
+}
+
+/*
+ * find_invariant:
+ * Return the index of the invariant of loop `v` which is variable `name`,
+ * or constant `value` if `name` is NULL. Return -1 if there is none.
+ */
+static int find_invariant(struct vec_loop *v, const char *name, long value)
+{
+	struct vec_invariant *inv;
+	size_t i;
+
+	for (i = 0; i < v->invariants.nmembs; ++i) {
+		inv = (struct vec_invariant *)v->invariants.data + i;
+		if (!name && !inv->name && inv->value == value)
+			return i;
+		if (name && inv->name && strcmp(inv->name, name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/* vec_invariant_index: return the invariant which is the value of `expr` */
+int vec_invariant_index(struct vec_loop *v, struct ast_node *expr)
+{
+	if (expr->tag == NODE_CONSTANT)
+		return find_invariant(v, NULL, expr->value);
+
+	return find_invariant(v, expr->lexeme, 0);
+}
+
+/* vec_constant_index: return the invariant which is constant `value` */
+int vec_constant_index(struct vec_loop *v, long value)
+{
+	return find_invariant(v, NULL, value);
+}
+
+static void add_invariant(struct vec_loop *v, const char *name,
+                          struct ast_node *node, long value)
+{
+	struct vec_invariant inv;
+
+	if (find_invariant(v, name, value) != -1)
+		return;
+
+	inv.name = name;
+	inv.node = node;
+	inv.value = value;
+	vector_append(&v->invariants, &inv);
+}
+
+/*
+ * byte_compare_ok:
+ * Byte lanes can only be compared directly if both operands are char values
+ * of the same signedness, or constants which fit in one.
+ */
+static int byte_compare_ok(struct ast_node *lhs, struct ast_node *rhs)
+{
+	struct ast_node *ops[2] = { lhs, rhs };
+	long lo, hi;
+	int i, sign;
+
+	sign = -1;
+	for (i = 0; i < 2; ++i) {
+		if (ops[i]->tag == NODE_CONSTANT)
+			continue;
+		if (ops[i]->tag != NODE_IDENTIFIER &&
+		    ops[i]->tag != EXPR_DEREFERENCE)
+			return 0;
+		if (FLAGS_TYPE(ops[i]->expr_flags.type_flags) != TYPE_CHAR)
+			return 0;
+		if (sign != -1 &&
+		    sign != !!(ops[i]->expr_flags.type_flags & QUAL_UNSIGNED))
+			return 0;
+		sign = !!(ops[i]->expr_flags.type_flags & QUAL_UNSIGNED);
+	}
+
+	lo = sign == 1 ? 0 : -128;
+	hi = sign == 1 ? 255 : 127;
+	for (i = 0; i < 2; ++i) {
+		if (ops[i]->tag == NODE_CONSTANT &&
+		    (ops[i]->value < lo || ops[i]->value > hi))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * vec_expr:
+ * Check if the value of `expr` can be computed for every lane at once.
+ * Return the number of registers needed to hold its intermediate values,
+ * or -1 if it cannot.
+ */
+static int vec_expr(struct vec_loop *v, struct ast_node *expr)
+{
+	int lhs, rhs;
+
+	switch (expr->tag) {
+	case NODE_CONSTANT:
+		add_invariant(v, NULL, NULL, expr->value);
+		return 0;
+	case NODE_IDENTIFIER:
+		if (is_ivar(v, expr) ||
+		    !FLAGS_IS_INTEGER(expr->expr_flags.type_flags) ||
+		    FLAGS_IS_PTR(expr->expr_flags.type_flags))
+			return -1;
+		add_invariant(v, expr->lexeme, expr, 0);
+		return 0;
+	case EXPR_DEREFERENCE:
+		if (!vec_access_ptr(v, expr) ||
+		    type_size(&expr->expr_flags) != (size_t)v->elem)
+			return -1;
+		add_ptr(&v->ptrs, vec_access_ptr(v, expr));
+		return 1;
+	case EXPR_LSHIFT:
+	case EXPR_RSHIFT:
+		/* SSE2 has no byte shifts. */
+		if (v->elem != 4 || expr->right->tag != NODE_CONSTANT ||
+		    expr->right->value < 0 || expr->right->value > 31)
+			return -1;
+		lhs = vec_expr(v, expr->left);
+		return lhs < 0 ? -1 : (lhs ? lhs : 1);
+	case EXPR_EQ:
+		if (v->elem == 1 && !byte_compare_ok(expr->left, expr->right))
+			return -1;
+		/* The all ones result of the comparison is masked to 1. */
+		add_invariant(v, NULL, NULL, 1);
+		/* fall through */
+	case EXPR_ADD:
+	case EXPR_SUB:
+	case EXPR_AND:
+	case EXPR_OR:
+	case EXPR_XOR:
+		if (FLAGS_IS_PTR(expr->expr_flags.type_flags))
+			return -1;
+		lhs = vec_expr(v, expr->left);
+		rhs = vec_expr(v, expr->right);
+		if (lhs < 0 || rhs < 0)
+			return -1;
+
+		/* A commutative operation takes an invariant as its source. */
+		if (!lhs && rhs && expr->tag != EXPR_SUB) {
+			lhs = rhs;
+			rhs = 0;
+		}
+		if (!lhs)
+			lhs = 1;
+		return lhs > rhs + 1 ? lhs : rhs + 1;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * vec_counted_loop:
+ * Check if the header of for loop `f` has the form
+ *
+ *	for (i = start; i < n; i = i + 1)
+ *
+ * where `i` is an int variable and `n` is an int variable or constant,
+ * and set the induction variable and bound of `v` if it does.
+ */
+int vec_counted_loop(struct asg_node_for *f, struct vec_loop *v)
+{
+	struct ast_node *add;
+
+	if (!f->init || !f->cond || !f->post)
+		return 0;
+
+	if (f->init->tag != EXPR_ASSIGN ||
+	    f->init->left->tag != NODE_IDENTIFIER || !is_int(f->init->left))
+		return 0;
+
+	memset(v, 0, sizeof *v);
+	v->ivar = f->init->left;
+
+	if (f->cond->tag != EXPR_LT || !is_ivar(v, f->cond->left))
+		return 0;
+	v->limit = f->cond->right;
+	if (v->limit->tag != NODE_CONSTANT &&
+	    (v->limit->tag != NODE_IDENTIFIER || !is_int(v->limit) ||
+	     is_ivar(v, v->limit)))
+		return 0;
+
+	add = f->post->right;
+	if (f->post->tag != EXPR_ASSIGN || !is_ivar(v, f->post->left) ||
+	    add->tag != EXPR_ADD)
+		return 0;
+	if (!(is_ivar(v, add->left) && add->right->tag == NODE_CONSTANT &&
+	      add->right->value == 1) &&
+	    !(is_ivar(v, add->right) && add->left->tag == NODE_CONSTANT &&
+	      add->left->value == 1))
+		return 0;
+
+	return 1;
+}
+
+/*
+ * vec_analyze_loop:
+ * Check if for loop `f` can be vectorized, and describe it in `v`.
+ * Return 1 if it can, in which case `v` must later be destroyed.
+ */
+int vec_analyze_loop(struct asg_node_for *f, struct vec_loop *v)
+{
+	struct asg_node_statement *s;
+	struct ast_node *ptr;
+	struct graph_node *g;
+	int elem, need;
+
+	if (!f->body || !vec_counted_loop(f, v))
+		return 0;
+
+	vector_init(&v->ptrs, sizeof (struct ast_node *));
+	vector_init(&v->stores, sizeof (struct ast_node *));
+	vector_init(&v->invariants, sizeof (struct vec_invariant));
+
+	/* Each statement of the body must be a store p[i] = expr. */
+	for (g = f->body; g; g = g->next) {
+		s = (struct asg_node_statement *)g;
+		if (g->type != ASG_NODE_STATEMENT || !s->ast ||
+		    s->ast->tag != EXPR_ASSIGN)
+			goto fail;
+
+		elem = type_size(&s->ast->left->expr_flags);
+		if (!FLAGS_IS_INTEGER(s->ast->left->expr_flags.type_flags) ||
+		    FLAGS_IS_PTR(s->ast->left->expr_flags.type_flags) ||
+		    (elem != 1 && elem != 4) || (v->elem && elem != v->elem))
+			goto fail;
+		v->elem = elem;
+
+		if (!(ptr = vec_access_ptr(v, s->ast->left)))
+			goto fail;
+		add_ptr(&v->stores, ptr);
+		add_ptr(&v->ptrs, ptr);
+
+		if ((need = vec_expr(v, s->ast->right)) < 0)
+			goto fail;
+		if (need > v->temps)
+			v->temps = need;
+	}
+
+	if (v->temps + (int)v->invariants.nmembs > VEC_REGS)
+		goto fail;
+
+	v->lanes = VEC_BYTES / v->elem;
+	return 1;
+
+fail:
+	vec_loop_destroy(v);
+	return 0;
+}
+
+void vec_loop_destroy(struct vec_loop *v)
+{
+	vector_destroy(&v->ptrs);
+	vector_destroy(&v->stores);
+	vector_destroy(&v->invariants);
+}
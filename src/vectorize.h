@@ -0,0 +1,59 @@
+/*
+ * src/vectorize.h
+ * Copyright (C) 2017 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FCC_VECTORIZE_H
+#define FCC_VECTORIZE_H
+
+#include "asg.h"
+#include "ast.h"
+#include "vector.h"
+
+/* Size of an SSE register in bytes. */
+#define VEC_BYTES 16
+
+/* Number of SSE registers available on the target. */
+#define VEC_REGS (fcc_m64 ? 16 : 8)
+
+/* A loop invariant value, broadcast to every lane of a register. */
+struct vec_invariant {
+	const char      *name;  /* variable, or NULL for a constant */
+	struct ast_node *node;  /* identifier of the variable */
+	long            value;  /* value of the constant */
+};
+
+/* A counted loop whose body can be executed VEC_BYTES at a time. */
+struct vec_loop {
+	struct ast_node *ivar;          /* induction variable */
+	struct ast_node *limit;         /* upper bound, constant or identifier */
+	int             elem;           /* size of the elements accessed */
+	int             lanes;          /* elements in a single register */
+	int             temps;          /* registers needed by the body */
+	struct vector   ptrs;           /* distinct pointers accessed */
+	struct vector   stores;         /* distinct pointers stored to */
+	struct vector   invariants;
+};
+
+int vec_counted_loop(struct asg_node_for *f, struct vec_loop *v);
+int vec_analyze_loop(struct asg_node_for *f, struct vec_loop *v);
+void vec_loop_destroy(struct vec_loop *v);
+
+struct ast_node *vec_access_ptr(struct vec_loop *v, struct ast_node *expr);
+int vec_invariant_index(struct vec_loop *v, struct ast_node *expr);
+int vec_constant_index(struct vec_loop *v, long value);
+
+#endif /* FCC_VECTORIZE_H */
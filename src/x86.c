@@ -16,23 +16,66 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "branch.h"
+#include "builtin.h"
+#include "error.h"
+#include "fcc.h"
 #include "gen.h"
 #include "ir.h"
+#include "profile.h"
+#include "sched.h"
+#include "slots.h"
 #include "symtab.h"
 #include "types.h"
+#include "vectorize.h"
 #include "x86.h"
 
 static int curr_label = 0;
 
+/* Registers used to pass the first arguments to static functions. */
+static const int x86_arg_regs[IR_REGPARM_MAX] = {
+	X86_GPR_AX, X86_GPR_DX, X86_GPR_CX
+};
+
+/* Argument registers of the x86-64 System V calling convention. */
+static const int x86_64_arg_regs[IR_SYSV_REGS] = {
+	X86_GPR_DI, X86_GPR_SI, X86_GPR_DX,
+	X86_GPR_CX, X86_GPR_R8, X86_GPR_R9
+};
+
+/*
+ * Caller-saved registers used for intermediate values.
+ * Only the first three are available in 32-bit mode.
+ */
+static const int x86_scratch_regs[] = {
+	X86_GPR_AX, X86_GPR_DX, X86_GPR_CX, X86_GPR_SI, X86_GPR_DI,
+	X86_GPR_R8, X86_GPR_R9, X86_GPR_R10, X86_GPR_R11
+};
+
+#define NUM_SCRATCH_REGS \
+	(fcc_m64 ? sizeof x86_scratch_regs / sizeof *x86_scratch_regs : 3)
+
+/* x86_arg_reg: return the register in which argument `n` is passed */
+static int x86_arg_reg(int n)
+{
+	return fcc_m64 ? x86_64_arg_regs[n] : x86_arg_regs[n];
+}
+
 void x86_seq_init(struct x86_sequence *seq, struct local_vars *locals)
 {
 	vector_init(&seq->seq, sizeof (struct x86_instruction));
+	vector_init(&seq->cold, sizeof (struct x86_instruction));
+	seq->in_cold = 0;
+	seq->tsc_record = NULL;
 	seq->locals = locals;
 	seq->tmp_reg.size = 0;
 	seq->tmp_reg.regs = malloc(NUM_TEMP_REGS * sizeof *seq->tmp_reg.regs);
+	seq->tmp_reg.types = calloc(NUM_TEMP_REGS,
+	                            sizeof *seq->tmp_reg.types);
 
 	memset(seq->gprs, 0, sizeof seq->gprs);
 
@@ -40,28 +83,46 @@ void x86_seq_init(struct x86_sequence *seq, struct local_vars *locals)
 	memset(seq->tmp_reg.regs, 0xFF,
 	       NUM_TEMP_REGS * sizeof *seq->tmp_reg.regs);
 	seq->label = curr_label;
+
+	seq->break_label = -1;
+	seq->break_used = 0;
+	seq->cases = NULL;
+	seq->default_label = -1;
+	vector_init(&seq->tables, sizeof (struct x86_jump_table));
+	seq->pushed = 0;
+	seq->pads = 0;
+	seq->temp_depth = 0;
 }
 
 void x86_seq_destroy(struct x86_sequence *seq)
 {
+	struct x86_jump_table *t;
+
+	VECTOR_ITER(&seq->tables, t)
+		free(t->targets);
+	vector_destroy(&seq->tables);
 	vector_destroy(&seq->seq);
+	vector_destroy(&seq->cold);
+	free(seq->tsc_record);
 	free(seq->tmp_reg.regs);
+	free(seq->tmp_reg.types);
 	curr_label = seq->label;
 }
 
 static void x86_gpr_any_reset(struct x86_sequence *seq)
 {
-	seq->gprs[X86_GPR_AX].used = 0;
-	seq->gprs[X86_GPR_CX].used = 0;
-	seq->gprs[X86_GPR_DX].used = 0;
+	size_t i;
+
+	for (i = 0; i < NUM_SCRATCH_REGS; ++i)
+		seq->gprs[x86_scratch_regs[i]].used = 0;
 }
 
 static int x86_gpr_any_get(struct x86_sequence *seq)
 {
-	static const int regs[] = { X86_GPR_AX, X86_GPR_DX, X86_GPR_CX };
-	int i;
+	const int *regs = x86_scratch_regs;
+	size_t i;
 
-	for (i = 0; i < 3; ++i) {
+	for (i = 0; i < NUM_SCRATCH_REGS; ++i) {
 		if (!seq->gprs[regs[i]].used) {
 			seq->gprs[regs[i]].used = 1;
 			return regs[i];
@@ -71,1080 +132,4366 @@ static int x86_gpr_any_get(struct x86_sequence *seq)
 	return X86_GPR_DX;
 }
 
+static void x86_add_label(struct x86_sequence *seq, int label);
+
+static struct ast_node *nth_arg(struct ast_node *arglist, int n);
+
+/* x86_counter_offset: return the offset of profile counter `counter` */
+static int x86_counter_offset(int counter)
+{
+	/* The first quadword of the counters holds their number. */
+	return 8 * (counter + 1);
+}
+
 /*
- * x86_begin_function:
- * Write x86 header for function `fname`.
+ * x86_count:
+ * Increment counter `n` of those starting at `prof` if the program is being
+ * instrumented. The flags are clobbered, so this must be between statements.
  */
-void x86_begin_function(struct x86_sequence *seq, const char *fname)
+static void x86_count(struct x86_sequence *seq, int prof, int n)
 {
 	struct x86_instruction out;
 
-	out.instruction = X86_NAMED_LABEL;
-	out.size = 0;
-	out.lname = fname;
-	vector_append(&seq->seq, &out);
+	if (!(fcc_flags & FFLAG_PROFILE_GENERATE) || prof < 0)
+		return;
 
-	out.instruction = X86_PUSH;
-	out.size = 0;
-	out.op1.type = X86_OPERAND_GPR;
-	out.op1.gpr = X86_GPR_BP;
+	out.instruction = X86_ADD;
+	out.size = fcc_m64 ? 8 : 4;
+	out.op1.type = X86_OPERAND_CONSTANT;
+	out.op1.constant = 1;
+	out.op2.type = X86_OPERAND_COUNTER;
+	out.op2.counter = prof + n;
 	vector_append(&seq->seq, &out);
 
-	out.instruction = X86_MOV;
-	out.size = 4;
-	out.op1.type = X86_OPERAND_GPR;
-	out.op1.gpr = X86_GPR_SP;
-	out.op2.type = X86_OPERAND_GPR;
-	out.op2.gpr = X86_GPR_BP;
-	vector_append(&seq->seq, &out);
+	/* Counters are 64 bits wide, so 32-bit code carries into the top. */
+	if (!fcc_m64) {
+		out.instruction = X86_ADC;
+		out.op1.constant = 0;
+		out.op2.type = X86_OPERAND_SYMBOL;
+		out.op2.sym.name = ".Lprof";
+		out.op2.sym.off = x86_counter_offset(prof + n) + 4;
+		vector_append(&seq->seq, &out);
+	}
 }
 
-static void x86_add_label(struct x86_sequence *seq, int label);
+/*
+ * x86_use_profile:
+ * Check if code is being laid out according to the profile. Code which is
+ * already in the cold area is left as it is.
+ */
+static int x86_use_profile(struct x86_sequence *seq)
+{
+	return (fcc_flags & FFLAG_PROFILE_USE) && !seq->in_cold;
+}
 
 /*
- * x86_end_function:
- * Pop base pointer and return from function.
+ * x86_begin_cold:
+ * Start placing instructions in the function's cold area, saving
+ * the function's main sequence in `hot`.
  */
-void x86_end_function(struct x86_sequence *seq)
+static void x86_begin_cold(struct x86_sequence *seq, struct vector *hot)
 {
-	struct x86_instruction out;
+	*hot = seq->seq;
+	seq->seq = seq->cold;
+	seq->in_cold = 1;
+}
 
-	out.instruction = X86_POP;
-	out.size = 0;
-	out.op1.type = X86_OPERAND_GPR;
-	out.op1.gpr = X86_GPR_BP;
-	vector_append(&seq->seq, &out);
+/* x86_end_cold: return to placing instructions in main sequence `hot` */
+static void x86_end_cold(struct x86_sequence *seq, struct vector *hot)
+{
+	seq->cold = seq->seq;
+	seq->seq = *hot;
+	seq->in_cold = 0;
 
-	out.instruction = X86_RET;
-	out.size = 0;
-	vector_append(&seq->seq, &out);
+	/* The register contents are those at the end of the cold code. */
+	memset(seq->gprs, 0, sizeof seq->gprs);
 }
 
 /*
- * x86_grow_stack:
- * Subtract `bytes` from the stack pointer.
+ * Timing of functions with -finstrument-functions-rdtsc.
+ *
+ * Each function has a record holding the number of calls made to it and the
+ * total inclusive and exclusive cycles spent in it, as read by rdtsc. The
+ * runtime variable TSC_CHILD accumulates the cycles spent in the callees of
+ * the running function. On entry, a function saves its caller's value in its
+ * frame and clears it; on exit, it subtracts it from its own elapsed cycles
+ * to get its exclusive time, and adds its inclusive time to the saved value.
  */
-void x86_grow_stack(struct x86_sequence *seq, size_t bytes)
+#define TSC_CHILD       "__fcc_tsc_child"
+
+/* Offsets of the fields of a timing record, after the function's name. */
+#define TSC_CALLS       8
+#define TSC_INCL        16
+#define TSC_EXCL        24
+
+static struct x86_operand x86_gpr_op(int gpr)
 {
-	struct x86_instruction out;
+	struct x86_operand op;
 
-	if (!bytes)
-		return;
+	op.type = X86_OPERAND_GPR;
+	op.gpr = gpr;
+	return op;
+}
 
-	out.instruction = X86_SUB;
-	out.size = 4;
-	out.op1.type = X86_OPERAND_CONSTANT;
-	out.op1.constant = bytes;
-	out.op2.type = X86_OPERAND_GPR;
-	out.op2.gpr = X86_GPR_SP;
-	vector_append(&seq->seq, &out);
+static struct x86_operand x86_frame_op(int off)
+{
+	struct x86_operand op;
+
+	op.type = X86_OPERAND_OFFSET;
+	op.offset.off = off;
+	op.offset.gpr = X86_GPR_BP;
+	return op;
 }
 
-/*
- * x86_shrink_stack:
- * Add `bytes` to the stack pointer.
- */
-void x86_shrink_stack(struct x86_sequence *seq, size_t bytes)
+static struct x86_operand x86_symbol_op(const char *name, int off)
 {
-	struct x86_instruction out;
+	struct x86_operand op;
 
-	if (!bytes)
-		return;
+	op.type = X86_OPERAND_SYMBOL;
+	op.sym.name = name;
+	op.sym.off = off;
+	return op;
+}
 
-	out.instruction = X86_ADD;
-	out.size = 4;
-	out.op1.type = X86_OPERAND_CONSTANT;
-	out.op1.constant = bytes;
-	out.op2.type = X86_OPERAND_GPR;
-	out.op2.gpr = X86_GPR_SP;
+static struct x86_operand x86_constant_op(int constant)
+{
+	struct x86_operand op;
+
+	op.type = X86_OPERAND_CONSTANT;
+	op.constant = constant;
+	return op;
+}
+
+/* x86_emit: append instruction `insn` with operands `op1` and `op2` */
+static void x86_emit(struct x86_sequence *seq, int insn, int size,
+                     struct x86_operand op1, struct x86_operand op2)
+{
+	struct x86_instruction out;
+
+	out.instruction = insn;
+	out.size = size;
+	out.op1 = op1;
+	out.op2 = op2;
 	vector_append(&seq->seq, &out);
 }
 
 /*
- * tmp_reg_push:
- * Create an instruction to push register `gpr` into temporary register
- * `tmp_reg`, and update temporary register offsets.
+ * x86_tsc_read:
+ * Read the timestamp counter into %edx:%eax, or %rax in 64-bit mode.
  */
-static void tmp_reg_push(struct x86_sequence *seq, int tmp_reg, int gpr)
+static void x86_tsc_read(struct x86_sequence *seq)
 {
-	struct x86_instruction out;
-	int i;
+	struct x86_operand none;
+
+	none.type = X86_OPERAND_GPR;
+	none.gpr = X86_GPR_AX;
+	x86_emit(seq, X86_RDTSC, 0, none, none);
+	if (fcc_m64) {
+		x86_emit(seq, X86_SHL, 8, x86_constant_op(32),
+		         x86_gpr_op(X86_GPR_DX));
+		x86_emit(seq, X86_OR, 8, x86_gpr_op(X86_GPR_DX),
+		         x86_gpr_op(X86_GPR_AX));
+	}
+}
 
-	for (i = 0; i < NUM_TEMP_REGS; ++i) {
-		if (seq->tmp_reg.regs[i] != -1)
-			seq->tmp_reg.regs[i] += 4;
+/*
+ * x86_tsc_enter:
+ * Record the time at which the function was entered, and save and clear
+ * the cycles counted for its caller's callees.
+ */
+static void x86_tsc_enter(struct x86_sequence *seq)
+{
+	struct x86_operand ax, dx;
+	int t, c;
+
+	ax = x86_gpr_op(X86_GPR_AX);
+	dx = x86_gpr_op(X86_GPR_DX);
+	t = seq->tsc_slot;
+	c = seq->tsc_slot + 8;
+
+	x86_tsc_read(seq);
+	if (fcc_m64) {
+		x86_emit(seq, X86_MOV, 8, ax, x86_frame_op(t));
+		x86_emit(seq, X86_MOV, 8, x86_symbol_op(TSC_CHILD, 0), ax);
+		x86_emit(seq, X86_MOV, 8, ax, x86_frame_op(c));
+		x86_emit(seq, X86_MOV, 8, x86_constant_op(0),
+		         x86_symbol_op(TSC_CHILD, 0));
+	} else {
+		x86_emit(seq, X86_MOV, 4, ax, x86_frame_op(t));
+		x86_emit(seq, X86_MOV, 4, dx, x86_frame_op(t + 4));
+		x86_emit(seq, X86_MOV, 4, x86_symbol_op(TSC_CHILD, 0), ax);
+		x86_emit(seq, X86_MOV, 4, x86_symbol_op(TSC_CHILD, 4), dx);
+		x86_emit(seq, X86_MOV, 4, ax, x86_frame_op(c));
+		x86_emit(seq, X86_MOV, 4, dx, x86_frame_op(c + 4));
+		x86_emit(seq, X86_MOV, 4, x86_constant_op(0),
+		         x86_symbol_op(TSC_CHILD, 0));
+		x86_emit(seq, X86_MOV, 4, x86_constant_op(0),
+		         x86_symbol_op(TSC_CHILD, 4));
 	}
-	seq->tmp_reg.regs[tmp_reg] = 0;
-	seq->tmp_reg.size++;
 
-	if (gpr != -1) {
-		out.instruction = X86_PUSH;
-		out.size = 0;
-		out.op1.type = X86_OPERAND_GPR;
-		out.op1.gpr = gpr;
-		vector_append(&seq->seq, &out);
+	memset(seq->gprs, 0, sizeof seq->gprs);
+}
+
+/*
+ * x86_tsc_exit:
+ * Add the cycles spent in the function to its record and to its caller's
+ * callee count. The return value is preserved in %ecx.
+ */
+static void x86_tsc_exit(struct x86_sequence *seq)
+{
+	struct x86_operand ax, cx, dx, one;
+	const char *rec;
+	int t, c;
+
+	ax = x86_gpr_op(X86_GPR_AX);
+	cx = x86_gpr_op(X86_GPR_CX);
+	dx = x86_gpr_op(X86_GPR_DX);
+	one = x86_constant_op(1);
+	rec = seq->tsc_record;
+	t = seq->tsc_slot;
+	c = seq->tsc_slot + 8;
+
+	x86_emit(seq, X86_MOV, FCC_WORD_SIZE, ax, cx);
+	x86_tsc_read(seq);
+	if (fcc_m64) {
+		x86_emit(seq, X86_SUB, 8, x86_frame_op(t), ax);
+		x86_emit(seq, X86_ADD, 8, ax, x86_symbol_op(rec, TSC_INCL));
+		x86_emit(seq, X86_MOV, 8, ax, dx);
+		x86_emit(seq, X86_SUB, 8, x86_symbol_op(TSC_CHILD, 0), dx);
+		x86_emit(seq, X86_ADD, 8, dx, x86_symbol_op(rec, TSC_EXCL));
+		x86_emit(seq, X86_ADD, 8, x86_frame_op(c), ax);
+		x86_emit(seq, X86_MOV, 8, ax, x86_symbol_op(TSC_CHILD, 0));
+		x86_emit(seq, X86_ADD, 8, one, x86_symbol_op(rec, TSC_CALLS));
+	} else {
+		/* The elapsed time replaces the entry time in the frame. */
+		x86_emit(seq, X86_SUB, 4, x86_frame_op(t), ax);
+		x86_emit(seq, X86_SBB, 4, x86_frame_op(t + 4), dx);
+		x86_emit(seq, X86_ADD, 4, ax, x86_symbol_op(rec, TSC_INCL));
+		x86_emit(seq, X86_ADC, 4, dx, x86_symbol_op(rec, TSC_INCL + 4));
+		x86_emit(seq, X86_MOV, 4, ax, x86_frame_op(t));
+		x86_emit(seq, X86_MOV, 4, dx, x86_frame_op(t + 4));
+		x86_emit(seq, X86_SUB, 4, x86_symbol_op(TSC_CHILD, 0), ax);
+		x86_emit(seq, X86_SBB, 4, x86_symbol_op(TSC_CHILD, 4), dx);
+		x86_emit(seq, X86_ADD, 4, ax, x86_symbol_op(rec, TSC_EXCL));
+		x86_emit(seq, X86_ADC, 4, dx, x86_symbol_op(rec, TSC_EXCL + 4));
+		x86_emit(seq, X86_MOV, 4, x86_frame_op(c), ax);
+		x86_emit(seq, X86_MOV, 4, x86_frame_op(c + 4), dx);
+		x86_emit(seq, X86_ADD, 4, x86_frame_op(t), ax);
+		x86_emit(seq, X86_ADC, 4, x86_frame_op(t + 4), dx);
+		x86_emit(seq, X86_MOV, 4, ax, x86_symbol_op(TSC_CHILD, 0));
+		x86_emit(seq, X86_MOV, 4, dx, x86_symbol_op(TSC_CHILD, 4));
+		x86_emit(seq, X86_ADD, 4, one, x86_symbol_op(rec, TSC_CALLS));
+		x86_emit(seq, X86_ADC, 4, x86_constant_op(0),
+		         x86_symbol_op(rec, TSC_CALLS + 4));
 	}
+	x86_emit(seq, X86_MOV, FCC_WORD_SIZE, cx, ax);
 }
 
 /*
- * tmp_reg_pop:
- * Create an instruction to pop temporary register `tmp_reg` into register
- * `gpr`, and update temporary register offsets.
+ * x86_begin_function:
+ * Write x86 header for function `fname`, which takes parameters `params`,
+ * the first `nreg` of which are passed in registers, and reserves `bytes`
+ * bytes of stack space for its locals.
  */
-static void tmp_reg_pop(struct x86_sequence *seq, int tmp_reg, int gpr)
+void x86_begin_function(struct x86_sequence *seq, const char *fname,
+                        struct ast_node *params, int nreg, size_t bytes)
 {
 	struct x86_instruction out;
-	int i;
-
-	for (i = 0; i < NUM_TEMP_REGS; ++i) {
-		if (seq->tmp_reg.regs[i] != -1)
-			seq->tmp_reg.regs[i] -= 4;
+	struct ast_node *param;
+	struct local *l;
+	int i, gpr;
+
+	seq->fname = fname;
+	seq->nparams = ir_num_args(params);
+	seq->nstack = ir_stack_words(params, nreg);
+
+	/* Timed functions keep their entry time and caller's count below. */
+	if (fcc_flags & FFLAG_INSTRUMENT_RDTSC) {
+		bytes += 16;
+		seq->tsc_slot = -(int)bytes;
+		seq->tsc_record = malloc(strlen(fname) + 8);
+		sprintf(seq->tsc_record, ".Ltsc_%s", fname);
 	}
-	seq->tmp_reg.regs[tmp_reg] = -1;
-	seq->tmp_reg.size--;
+	seq->frame = bytes;
 
-	if (gpr != -1) {
-		out.instruction = X86_POP;
-		out.size = 0;
+	out.instruction = X86_NAMED_LABEL;
+	out.size = 0;
+	out.lname = fname;
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_PUSH;
+	out.size = 0;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_BP;
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_MOV;
+	out.size = FCC_WORD_SIZE;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_SP;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_BP;
+	vector_append(&seq->seq, &out);
+
+	x86_grow_stack(seq, bytes);
+
+	seq->body = seq->seq.nmembs;
+	seq->body_label = seq->label++;
+	seq->body_used = 0;
+	x86_add_label(seq, seq->body_label);
+	x86_count(seq, profile_function_counter(fname), 0);
+
+	/*
+	 * Store register parameters in their stack slots. Those whose address
+	 * is taken are only accessed through their slot from then on.
+	 */
+	for (i = 0; i < nreg; ++i) {
+		param = nth_arg(params, i);
+		l = local_find(seq->locals, param->lexeme);
+		if (!(l->flags & LFLAGS_USED))
+			continue;
+
+		gpr = x86_arg_reg(i);
+		out.instruction = X86_MOV;
+		out.size = FCC_WORD_SIZE;
 		out.op1.type = X86_OPERAND_GPR;
 		out.op1.gpr = gpr;
+		out.op2.type = X86_OPERAND_OFFSET;
+		out.op2.offset.off = l->offset;
+		out.op2.offset.gpr = X86_GPR_BP;
 		vector_append(&seq->seq, &out);
+
+		if (l->flags & LFLAGS_ADDRESSED)
+			continue;
+		l->flags = LFLAGS_SET_REG(l->flags, gpr);
+		seq->gprs[gpr].tag = X86_GPRVAL_NODE;
+		seq->gprs[gpr].node = param;
 	}
+
+	if (fcc_flags & FFLAG_INSTRUMENT_RDTSC)
+		x86_tsc_enter(seq);
+
+	seq->exit_label = seq->label++;
+	seq->exit_used = 0;
 }
 
-static int x86_load_tmp_reg(struct x86_sequence *seq,
-                            struct ir_operand *tmp_reg,
-                            int gpr);
+/* Stack depth at an instruction which is never reached. */
+#define DEPTH_UNKNOWN   (-1)
+
+/* x86_is_gpr: check if operand `op` is register `gpr` */
+static int x86_is_gpr(struct x86_operand *op, int gpr)
+{
+	return op->type == X86_OPERAND_GPR && op->gpr == gpr;
+}
+
+/* x86_is_frame_reg: check if `gpr` is the stack or base pointer */
+static int x86_is_frame_reg(int gpr)
+{
+	return gpr == X86_GPR_SP || gpr == X86_GPR_BP;
+}
 
 /*
- * ir_to_x86_operand:
- * Converts an operand from IR to x86.
+ * x86_frame_supported:
+ * Check that instruction `inst` in the body of a function uses the stack
+ * and base pointers only as the base of memory operands, in adjustments of
+ * the stack pointer by constants and in the function's epilogues.
  */
-static void ir_to_x86_operand(struct x86_sequence *seq,
-                              struct ir_operand *i,
-                              struct x86_operand *x,
-                              int forceoff)
+static int x86_frame_supported(struct x86_instruction *inst)
 {
-	struct local *l;
-	int gpr;
+	struct x86_operand *ops[] = { &inst->op1, &inst->op2, &inst->op3 };
+	int i, n;
 
-	if (i->op_type == IR_OPERAND_AST_NODE) {
-		switch (i->node->tag) {
-		case NODE_IDENTIFIER:
-			/* local variable: offset from base pointer */
-			l = local_find(seq->locals, i->node->lexeme);
-			gpr = LFLAGS_REG(l->flags);
-			if (!forceoff && seq->gprs[gpr].tag == X86_GPRVAL_NODE
-			    && strcmp(seq->gprs[gpr].node->lexeme,
-			              i->node->lexeme) == 0) {
-				x->type = X86_OPERAND_GPR;
-				x->gpr = gpr;
-			} else {
-				x->type = X86_OPERAND_OFFSET;
-				x->offset.off = l->offset;
-				x->offset.gpr = X86_GPR_BP;
-			}
+	switch (inst->instruction) {
+	case X86_POP:
+		if (x86_is_gpr(&inst->op1, X86_GPR_BP))
+			return 1;
+		break;
+	case X86_MOV:
+		if (x86_is_gpr(&inst->op1, X86_GPR_BP) &&
+		    x86_is_gpr(&inst->op2, X86_GPR_SP))
+			return 1;
+		break;
+	case X86_ADD:
+	case X86_SUB:
+		if (x86_is_gpr(&inst->op2, X86_GPR_SP))
+			return inst->op1.type == X86_OPERAND_CONSTANT;
+		break;
+	}
+
+	n = x86_operand_count(inst);
+	for (i = 0; i < n; ++i) {
+		switch (ops[i]->type) {
+		case X86_OPERAND_GPR:
+			if (x86_is_frame_reg(ops[i]->gpr))
+				return 0;
 			break;
-		case NODE_CONSTANT:
-			if (i->node->expr_flags.type_flags & QUAL_UNSIGNED ||
-			    FLAGS_IS_PTR(i->node->expr_flags.type_flags))
-				x->type = X86_OPERAND_UCONSTANT;
-			else
-				x->type = X86_OPERAND_CONSTANT;
-			x->constant = i->node->value;
+		case X86_OPERAND_INDEX:
+			if (x86_is_frame_reg(ops[i]->index.base) ||
+			    x86_is_frame_reg(ops[i]->index.index))
+				return 0;
 			break;
-		case NODE_STRLIT:
-			x->type = X86_OPERAND_LABEL;
+		case X86_OPERAND_JUMP_TABLE:
+			if (x86_is_frame_reg(ops[i]->table.gpr))
+				return 0;
 			break;
 		}
-	} else if (i->op_type == IR_OPERAND_TEMP_REG) {
-		x->type = X86_OPERAND_OFFSET;
-		x->offset.off = seq->tmp_reg.regs[i->reg];
-		x->offset.gpr = X86_GPR_SP;
-	} else if (i->op_type == IR_OPERAND_NODE_OFF) {
-		l = local_find(seq->locals, i->node->lexeme);
-		x->type = X86_OPERAND_OFFSET;
-		x->offset.off = l->offset + i->off;
-		x->offset.gpr = X86_GPR_BP;
-	} else {
-		x->type = X86_OPERAND_OFFSET;
-		x->offset.off = i->off;
-		i->op_type = IR_OPERAND_TEMP_REG;
-		x86_gpr_any_reset(seq);
-		x->offset.gpr = x86_load_tmp_reg(seq, i, X86_GPR_ANY);
 	}
+	return 1;
 }
 
 /*
- * x86_load_value:
- * Create an x86 instruction to load variable `var` into GPR `gpr`.
+ * x86_label_depth:
+ * Record that label `label` is reached with `d` bytes pushed onto the
+ * stack. Return 0 if it has already been reached at a different depth.
  */
-static int x86_load_value(struct x86_sequence *seq,
-                          struct ir_operand *val,
-                          int gpr)
+static int x86_label_depth(int *labels, int label, int d, int *changed)
 {
-	struct x86_instruction out;
-	struct local *l;
+	if (labels[label] == DEPTH_UNKNOWN) {
+		labels[label] = d;
+		*changed = 1;
+	}
+	return labels[label] == d;
+}
 
-	out.instruction = X86_MOV;
-	out.size = type_size(&val->node->expr_flags);
+/*
+ * x86_follow_jump:
+ * Record that the targets of jump instruction `in` are reached with `d`
+ * bytes pushed onto the stack. Return 0 if any is reached at a different
+ * depth.
+ */
+static int x86_follow_jump(struct x86_sequence *seq, struct x86_instruction *in,
+                           int *labels, int d, int *changed)
+{
+	struct x86_jump_table *t;
+	int i;
 
-	ir_to_x86_operand(seq, val, &out.op1, 0);
+	if (in->op1.type == X86_OPERAND_LABEL)
+		return x86_label_depth(labels, in->op1.label, d, changed);
+	if (in->op1.type == X86_OPERAND_FUNC)
+		return 1;
 
-	if (out.op1.type == X86_OPERAND_GPR) {
-		if (gpr == X86_GPR_ANY || gpr == out.op1.gpr) {
-			seq->gprs[out.op1.gpr].used = 1;
-			return out.op1.gpr;
+	/* A jump through a table can reach any of its targets. */
+	VECTOR_ITER(&seq->tables, t) {
+		for (i = 0; i < t->ntargets; ++i) {
+			if (!x86_label_depth(labels, t->targets[i], d, changed))
+				return 0;
 		}
 	}
+	return 1;
+}
 
-	if (gpr == X86_GPR_ANY)
-		gpr = x86_gpr_any_get(seq);
+/*
+ * x86_depth_pass:
+ * Make a single pass over the function body for x86_stack_depths, setting
+ * `changed` if the depth of a new label is found.
+ */
+static int x86_depth_pass(struct x86_sequence *seq, int *depth, int *labels,
+                          int *changed)
+{
+	struct x86_instruction *in;
+	size_t i;
+	int d;
+
+	d = 0;
+	for (i = seq->body; i < seq->seq.nmembs; ++i) {
+		in = (struct x86_instruction *)seq->seq.data + i;
+		if (in->instruction == X86_LABEL) {
+			if (d == DEPTH_UNKNOWN)
+				d = labels[in->lnum];
+			else if (!x86_label_depth(labels, in->lnum, d, changed))
+				return 0;
+		}
+		depth[i] = d;
+		if (d == DEPTH_UNKNOWN)
+			continue;
 
-	out.op2.type = X86_OPERAND_GPR;
-	out.op2.gpr = gpr;
-	if (val->node->tag == NODE_IDENTIFIER) {
-		l = local_find(seq->locals, val->node->lexeme);
-		l->flags = LFLAGS_SET_REG(l->flags, gpr);
-		seq->gprs[gpr].tag = X86_GPRVAL_NODE;
-		seq->gprs[gpr].node = val->node;
-	} else {
-		seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+		switch (in->instruction) {
+		case X86_PUSH:
+			d += FCC_WORD_SIZE;
+			break;
+		case X86_POP:
+			if (!x86_is_gpr(&in->op1, X86_GPR_BP))
+				d -= FCC_WORD_SIZE;
+			break;
+		case X86_ADD:
+			if (x86_is_gpr(&in->op2, X86_GPR_SP))
+				d -= in->op1.constant;
+			break;
+		case X86_SUB:
+			if (x86_is_gpr(&in->op2, X86_GPR_SP))
+				d += in->op1.constant;
+			break;
+		case X86_JMP:
+			if (!x86_follow_jump(seq, in, labels, d, changed))
+				return 0;
+			d = DEPTH_UNKNOWN;
+			break;
+		case X86_RET:
+			d = DEPTH_UNKNOWN;
+			break;
+		default:
+			if (x86_is_cond_jump(in->instruction) &&
+			    !x86_follow_jump(seq, in, labels, d, changed))
+				return 0;
+			break;
+		}
+		if (d < 0 && d != DEPTH_UNKNOWN)
+			return 0;
 	}
 
-	vector_append(&seq->seq, &out);
-	return gpr;
+	return 1;
 }
 
 /*
- * x86_load_tmp_reg:
- * Create an x86 instruction to load temporary register `tmp_reg`
- * into GPR `gpr` or X86_GPR_ANY.
- * If `tmp_reg` is at the top of the stack, pop it.
- * Return the GPR into which `tmp_reg` was placed.
+ * x86_stack_depths:
+ * Find the number of bytes pushed below the frame before each instruction
+ * of the function body, following jumps to their labels. Instructions which
+ * are never reached are at DEPTH_UNKNOWN. Return 0 if a label is reached
+ * at different depths, or the stack pointer is moved above the frame.
  */
-static int x86_load_tmp_reg(struct x86_sequence *seq,
-                            struct ir_operand *tmp_reg,
-                            int gpr)
+static int x86_stack_depths(struct x86_sequence *seq, int *depth)
 {
-	struct x86_instruction out, last;
+	int *labels, ok, changed, i;
 
-	ir_to_x86_operand(seq, tmp_reg, &out.op1, 0);
-	if (!out.op1.offset.off) {
-		/*
-		 * Item is on top of the stack.
-		 * Check to see if the most recent instruction was a push
-		 * of the same register. If so, delete it as it is unnecessary.
-		 */
-		vector_get(&seq->seq, seq->seq.nmembs - 1, &last);
-		if (last.instruction == X86_PUSH) {
-			vector_pop(&seq->seq, NULL);
+	labels = malloc(seq->label * sizeof *labels);
+	for (i = 0; i < seq->label; ++i)
+		labels[i] = DEPTH_UNKNOWN;
 
-			/* Keep item in the register it was popped from. */
-			if (gpr == X86_GPR_ANY) {
-				tmp_reg_pop(seq, tmp_reg->reg, -1);
-				if (!seq->gprs[last.op1.gpr].used) {
-					seq->gprs[last.op1.gpr].used = 1;
-					seq->gprs[last.op1.gpr].tag =
-						X86_GPRVAL_NONE;
-					return last.op1.gpr;
-				}
-				gpr = x86_gpr_any_get(seq);
-			}
+	/* Repeat until the depths at the targets of backward jumps are known. */
+	do {
+		changed = 0;
+		ok = x86_depth_pass(seq, depth, labels, &changed);
+	} while (ok && changed);
 
-			if (last.op1.gpr != gpr) {
-				/* Move item from last register to target. */
-				out.instruction = X86_MOV;
-				out.size = 4;
-				out.op1.type = X86_OPERAND_GPR;
-				out.op1.gpr = last.op1.gpr;
-				out.op2.type = X86_OPERAND_GPR;
-				out.op2.gpr = gpr;
-				vector_append(&seq->seq, &out);
-			}
-			tmp_reg_pop(seq, tmp_reg->reg, -1);
-			return gpr;
-		}
-		if (gpr == X86_GPR_ANY)
-			gpr = x86_gpr_any_get(seq);
-		tmp_reg_pop(seq, tmp_reg->reg, gpr);
-	} else {
-		if (gpr == X86_GPR_ANY)
-			gpr = x86_gpr_any_get(seq);
+	free(labels);
+	return ok;
+}
 
-		out.instruction = X86_MOV;
-		out.size = 4;
-		out.op2.type = X86_OPERAND_GPR;
-		out.op2.gpr = gpr;
-		vector_append(&seq->seq, &out);
+/*
+ * x86_touches_args:
+ * Check if instruction `inst`, at stack depth `d`, addresses any of the
+ * `n` bytes at the bottom of the frame.
+ */
+static int x86_touches_args(struct x86_instruction *inst, int d, int n)
+{
+	struct x86_operand *ops[] = { &inst->op1, &inst->op2, &inst->op3 };
+	int i, count;
+
+	/* A pop computes its address after moving the stack pointer. */
+	if (inst->instruction == X86_POP)
+		d -= FCC_WORD_SIZE;
+
+	count = x86_operand_count(inst);
+	for (i = 0; i < count; ++i) {
+		if (ops[i]->type == X86_OPERAND_OFFSET &&
+		    ops[i]->offset.gpr == X86_GPR_SP &&
+		    ops[i]->offset.off >= d - n)
+			return 1;
 	}
-	seq->gprs[gpr].tag = X86_GPRVAL_NONE;
-	return gpr;
+	return 0;
 }
 
 /*
- * translate_assign_instruction:
- * Converts an IR assignment instruction to a series of x86 instructions.
+ * x86_arg_slots:
+ * Walk back from call instruction `c`, made with `n` bytes of arguments and
+ * padding pushed from the bottom of the frame, to the instructions which
+ * created each of their stack slots. If `convert` is set, turn the pushes
+ * into stores to the outgoing argument area, and mark padding to be dropped.
+ * Return the number of bytes of arguments, or -1 if they cannot be stored.
  */
-static void translate_assign_instruction(struct x86_sequence *seq,
-                                         struct ir_instruction *i,
-                                         int cond)
+static int x86_arg_slots(struct x86_sequence *seq, int *depth, char *drop,
+                         size_t c, int n, int convert)
 {
-	struct x86_instruction out;
-	struct local *l;
-	int gpr;
-
-	out.instruction = X86_MOV;
-	out.size = type_size(&i->type);
-
-	l = NULL;
-	x86_gpr_any_reset(seq);
-	if (i->lhs.op_type == IR_OPERAND_AST_NODE) {
-		ir_to_x86_operand(seq, &i->lhs, &out.op2, 1);
-		l = local_find(seq->locals, i->lhs.node->lexeme);
-	} else if (i->lhs.op_type == IR_OPERAND_NODE_OFF ||
-	           i->lhs.op_type == IR_OPERAND_REG_OFF) {
-		ir_to_x86_operand(seq, &i->lhs, &out.op2, 0);
-	} else {
-		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
-		out.op2.type = X86_OPERAND_OFFSET;
-		out.op2.offset.off = 0;
-		out.op2.offset.gpr = gpr;
-	}
+	struct x86_instruction *in;
+	int lo, d, pad;
+	size_t i;
+
+	pad = 0;
+	for (i = c, lo = n; lo > 0; lo = d) {
+		if (i-- == seq->body)
+			return -1;
+
+		in = (struct x86_instruction *)seq->seq.data + i;
+		d = depth[i];
+		if (d == DEPTH_UNKNOWN || x86_touches_args(in, d, n))
+			return -1;
+		/* Other paths into a label may push their own arguments. */
+		if (in->instruction == X86_LABEL || x86_is_jump(in->instruction))
+			return -1;
+		/* Stores would change the alignment of calls in between. */
+		if (fcc_m64 && in->instruction == X86_CALL)
+			return -1;
+		if (d >= lo) {
+			d = lo;
+			continue;
+		}
 
-	if (i->rhs.op_type == IR_OPERAND_AST_NODE) {
-		switch (i->rhs.node->tag) {
-		case NODE_IDENTIFIER:
-			gpr = x86_load_value(seq, &i->rhs, X86_GPR_ANY);
-			out.op1.type = X86_OPERAND_GPR;
-			out.op1.gpr = gpr;
-			if (l) {
-				l->flags = LFLAGS_SET_REG(l->flags, gpr);
-				seq->gprs[gpr].tag = X86_GPRVAL_NODE;
-				seq->gprs[gpr].node = i->lhs.node;
-			} else {
-				seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+		if (in->instruction == X86_PUSH && d + FCC_WORD_SIZE == lo) {
+			switch (in->op1.type) {
+			case X86_OPERAND_GPR:
+			case X86_OPERAND_CONSTANT:
+			case X86_OPERAND_UCONSTANT:
+			case X86_OPERAND_STRING:
+				break;
+			default:
+				return -1;
 			}
-			break;
-		case NODE_CONSTANT:
-			ir_to_x86_operand(seq, &i->rhs, &out.op1, 0);
-			break;
-		case NODE_STRLIT:
-			break;
-		}
-	} else {
-		gpr = x86_load_tmp_reg(seq, &i->rhs, X86_GPR_ANY);
-		out.op1.type = X86_OPERAND_GPR;
-		out.op1.gpr = gpr;
-		if (l) {
-			l->flags = LFLAGS_SET_REG(l->flags, gpr);
-			seq->gprs[gpr].tag = X86_GPRVAL_NODE;
-			seq->gprs[gpr].node = i->lhs.node;
+			if (convert) {
+				in->instruction = X86_MOV;
+				in->size = FCC_WORD_SIZE;
+				in->op2.type = X86_OPERAND_OFFSET;
+				in->op2.offset.off = n - lo;
+				in->op2.offset.gpr = X86_GPR_SP;
+			}
+		} else if (fcc_m64 && in->instruction == X86_SUB && d == 0 &&
+		           in->op1.constant == FCC_WORD_SIZE) {
+			/* Alignment padding, which the frame now provides. */
+			pad = FCC_WORD_SIZE;
+			if (convert)
+				drop[i] = 1;
 		} else {
-			seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+			return -1;
 		}
 	}
-	vector_append(&seq->seq, &out);
 
-	(void)cond;
+	return n - pad;
 }
 
 /*
- * __translate_generic:
- * Translate generic x86 instruction `instruction` from IR.
+ * x86_store_args:
+ * If call instruction `c` is made from the bottom of the frame, store its
+ * stack arguments to the outgoing argument area instead of pushing them.
+ * Return the size of the area the call needs, or -1 if it pushes them.
  */
-static void __translate_generic(struct x86_sequence *seq,
-                                   struct ir_instruction *i,
-                                   int instruction, int push)
+static int x86_store_args(struct x86_sequence *seq, int *depth, char *drop,
+                          size_t c)
 {
-	struct x86_instruction out;
-	struct x86_operand *op;
-	int set, gpr;
+	struct x86_instruction *next;
+	int n;
 
-	out.instruction = instruction;
-	out.size = type_size(&i->type);
-	set = 0;
+	if (c + 1 == seq->seq.nmembs)
+		return -1;
 
-	x86_gpr_any_reset(seq);
-	if (i->lhs.op_type == IR_OPERAND_AST_NODE) {
-		switch (i->lhs.node->tag) {
-		case NODE_IDENTIFIER:
-			gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
-			out.op2.type = X86_OPERAND_GPR;
-			out.op2.gpr = gpr;
-			set = 1;
-			break;
-		case NODE_CONSTANT:
-			ir_to_x86_operand(seq, &i->lhs, &out.op1, 0);
-			break;
-		}
-	} else {
-		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
-		out.op2.type = X86_OPERAND_GPR;
-		out.op2.gpr = gpr;
-		set = 1;
+	/* The bottom of the frame is only aligned if the frame itself is. */
+	if (fcc_m64 && !ALIGNED(seq->frame, 16))
+		return -1;
+
+	next = (struct x86_instruction *)seq->seq.data + c + 1;
+	if (next->instruction != X86_ADD ||
+	    !x86_is_gpr(&next->op2, X86_GPR_SP) ||
+	    next->op1.constant != depth[c])
+		return -1;
+
+	n = next->op1.constant;
+	if (x86_arg_slots(seq, depth, drop, c, n, 0) == -1)
+		return -1;
+
+	drop[c + 1] = 1;
+	return x86_arg_slots(seq, depth, drop, c, n, 1);
+}
+
+/*
+ * x86_omit_frame_pointer:
+ * Address the frame of the function relative to the stack pointer rather
+ * than the base pointer, which is no longer set up. The frame, including an
+ * outgoing argument area for calls made from its bottom, is reserved once
+ * in the prologue; leaf functions without locals have no frame at all.
+ * Functions whose stack depth cannot be followed keep their frame pointer.
+ */
+static void x86_omit_frame_pointer(struct x86_sequence *seq)
+{
+	struct x86_instruction *insts, out;
+	struct x86_operand *ops[] = { &out.op1, &out.op2, &out.op3 };
+	struct vector old;
+	int *depth, calls, area, size, d, j;
+	size_t i, n;
+	char *drop;
+
+	insts = seq->seq.data;
+	for (i = seq->body; i < seq->seq.nmembs; ++i) {
+		if (!x86_frame_supported(insts + i))
+			return;
 	}
 
-	/* Output register has been set. */
-	if (set)
-		op = &out.op1;
-	else
-		op = &out.op2;
+	depth = malloc(seq->seq.nmembs * sizeof *depth);
+	drop = calloc(seq->seq.nmembs, 1);
+	if (!x86_stack_depths(seq, depth))
+		goto out;
 
-	if (i->rhs.op_type == IR_OPERAND_AST_NODE) {
-		switch (i->rhs.node->tag) {
-		case NODE_IDENTIFIER:
-			gpr = x86_load_value(seq, &i->rhs, X86_GPR_ANY);
-			op->type = X86_OPERAND_GPR;
-			op->gpr = gpr;
-			break;
-		case NODE_CONSTANT:
-			ir_to_x86_operand(seq, &i->rhs, &out.op1, 0);
-			break;
+	calls = area = 0;
+	for (i = seq->body; i < seq->seq.nmembs; ++i) {
+		if (insts[i].instruction != X86_CALL)
+			continue;
+		calls = 1;
+		size = x86_store_args(seq, depth, drop, i);
+		if (size > area)
+			area = size;
+	}
+
+	/* Drop the stack adjustments of calls which no longer push. */
+	old = seq->seq;
+	insts = old.data;
+	vector_init(&seq->seq, sizeof (struct x86_instruction));
+	for (i = 0; i < old.nmembs; ++i) {
+		if (!drop[i])
+			vector_append(&seq->seq, insts + i);
+	}
+	vector_destroy(&old);
+	x86_stack_depths(seq, depth);
+
+	/*
+	 * Calls from the body were aligned for a frame below a saved base
+	 * pointer, so x86-64 functions which make them keep a word for it.
+	 */
+	size = seq->frame + area;
+	if (fcc_m64 && calls)
+		size = seq->frame + ALIGN(area + 8, 16) - 8;
+
+	old = seq->seq;
+	n = seq->body;
+	vector_init(&seq->seq, sizeof (struct x86_instruction));
+	vector_append(&seq->seq, old.data);
+	x86_grow_stack(seq, size);
+	seq->body = seq->seq.nmembs;
+
+	/*
+	 * Locals are below the return address rather than the base pointer
+	 * which would have been saved under it, and parameters are above it.
+	 */
+	insts = old.data;
+	for (i = n; i < old.nmembs; ++i) {
+		out = insts[i];
+		d = depth[i] == DEPTH_UNKNOWN ? 0 : depth[i];
+		if (out.instruction == X86_MOV &&
+		    x86_is_gpr(&out.op1, X86_GPR_BP))
+			continue;
+		if (out.instruction == X86_POP &&
+		    x86_is_gpr(&out.op1, X86_GPR_BP)) {
+			x86_shrink_stack(seq, size + d);
+			continue;
 		}
-	} else {
-		gpr = x86_load_tmp_reg(seq, &i->rhs, X86_GPR_ANY);
-		op->type = X86_OPERAND_GPR;
-		op->gpr = gpr;
+
+		if (out.instruction == X86_POP)
+			d -= FCC_WORD_SIZE;
+		for (j = 0; j < x86_operand_count(&out); ++j) {
+			if (ops[j]->type == X86_OPERAND_OFFSET &&
+			    ops[j]->offset.gpr == X86_GPR_BP) {
+				if (ops[j]->offset.off > 0)
+					ops[j]->offset.off -= FCC_WORD_SIZE;
+				ops[j]->offset.gpr = X86_GPR_SP;
+				ops[j]->offset.off += size + d;
+			}
+		}
+		vector_append(&seq->seq, &out);
 	}
+	vector_destroy(&old);
 
-	seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
-	vector_append(&seq->seq, &out);
-	if (push)
-		tmp_reg_push(seq, i->target, out.op2.gpr);
+out:
+	free(depth);
+	free(drop);
 }
 
-static int x86_expr_instructions[] = {
-	[EXPR_OR]       = X86_OR,
-	[EXPR_XOR]      = X86_XOR,
-	[EXPR_AND]      = X86_AND,
-	[EXPR_LSHIFT]   = X86_SHL,
-	[EXPR_ADD]      = X86_ADD,
-	[EXPR_SUB]      = X86_SUB,
-	[EXPR_EQ]       = X86_SETE,
-	[EXPR_NE]       = X86_SETNE,
-	[EXPR_LT]       = X86_SETL,
-	[EXPR_GT]       = X86_SETG,
-	[EXPR_LE]       = X86_SETLE,
-	[EXPR_GE]       = X86_SETGE
-};
+/*
+ * x86_end_function:
+ * Restore the stack and base pointers and return from function.
+ */
+void x86_end_function(struct x86_sequence *seq)
+{
+	struct x86_instruction out, *insts;
+
+	/* A jump to the exit label from the end of the function is redundant. */
+	if (seq->exit_used) {
+		vector_get(&seq->seq, seq->seq.nmembs - 1, &out);
+		if (out.instruction == X86_JMP &&
+		    out.op1.type == X86_OPERAND_LABEL &&
+		    out.op1.label == seq->exit_label) {
+			vector_pop(&seq->seq, NULL);
+			--seq->exit_used;
+		}
+		if (seq->exit_used)
+			x86_add_label(seq, seq->exit_label);
+	}
 
-static int x86_inverse_jumps[] = {
-	[EXPR_LOGICAL_NOT]      = X86_JNE,
-	[EXPR_EQ]               = X86_JNE,
-	[EXPR_NE]               = X86_JE,
-	[EXPR_LT]               = X86_JGE,
-	[EXPR_GT]               = X86_JLE,
-	[EXPR_LE]               = X86_JG,
-	[EXPR_GE]               = X86_JL,
-	[IR_TEST]               = X86_JZ
-};
+	if (fcc_flags & FFLAG_INSTRUMENT_RDTSC)
+		x86_tsc_exit(seq);
 
-static int x86_jumps[] = {
-	[EXPR_LOGICAL_NOT]      = X86_JE,
-	[EXPR_EQ]               = X86_JE,
-	[EXPR_NE]               = X86_JNE,
-	[EXPR_LT]               = X86_JL,
-	[EXPR_GT]               = X86_JG,
-	[EXPR_LE]               = X86_JLE,
-	[EXPR_GE]               = X86_JGE,
+	if (!seq->body_used) {
+		insts = seq->seq.data;
+		memmove(insts + seq->body, insts + seq->body + 1,
+		        (seq->seq.nmembs - seq->body - 1) * sizeof *insts);
+		seq->seq.nmembs--;
+	}
+
+	/*
+	 * Return statements may be reached with temporary values
+	 * still on the stack, so restore it from the base pointer.
+	 */
+	if (seq->frame || seq->tmp_reg.size) {
+		out.instruction = X86_MOV;
+		out.size = FCC_WORD_SIZE;
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = X86_GPR_BP;
+		out.op2.type = X86_OPERAND_GPR;
+		out.op2.gpr = X86_GPR_SP;
+		vector_append(&seq->seq, &out);
+	}
+
+	out.instruction = X86_POP;
+	out.size = 0;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_BP;
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_RET;
+	out.size = 0;
+	vector_append(&seq->seq, &out);
+
+	VECTOR_ITER(&seq->cold, insts)
+		vector_append(&seq->seq, insts);
+
+	branch_optimize(seq);
+	slots_optimize(seq);
+	if (fcc_flags & (FFLAG_SCHEDULE_INSNS | FFLAG_SCHED_VERBOSE))
+		sched_optimize(seq);
+	if (fcc_flags & FFLAG_OMIT_FRAME_POINTER)
+		x86_omit_frame_pointer(seq);
+
+	if (fcc_flags & FFLAG_TEMPS_VERBOSE)
+		fprintf(stderr, "%s: peak temporary depth %d\n",
+		        seq->fname, seq->temp_depth);
+}
+
+/*
+ * x86_grow_stack:
+ * Subtract `bytes` from the stack pointer.
+ */
+void x86_grow_stack(struct x86_sequence *seq, size_t bytes)
+{
+	struct x86_instruction out;
+
+	if (!bytes)
+		return;
+
+	out.instruction = X86_SUB;
+	out.size = FCC_WORD_SIZE;
+	out.op1.type = X86_OPERAND_CONSTANT;
+	out.op1.constant = bytes;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_SP;
+	vector_append(&seq->seq, &out);
+}
+
+/*
+ * x86_shrink_stack:
+ * Add `bytes` to the stack pointer.
+ */
+void x86_shrink_stack(struct x86_sequence *seq, size_t bytes)
+{
+	struct x86_instruction out;
+
+	if (!bytes)
+		return;
+
+	out.instruction = X86_ADD;
+	out.size = FCC_WORD_SIZE;
+	out.op1.type = X86_OPERAND_CONSTANT;
+	out.op1.constant = bytes;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_SP;
+	vector_append(&seq->seq, &out);
+}
+
+/*
+ * tmp_reg_push:
+ * Create an instruction to push register `gpr` into temporary register
+ * `tmp_reg`, and update temporary register offsets.
+ */
+static void tmp_reg_push(struct x86_sequence *seq, int tmp_reg, int gpr)
+{
+	struct x86_instruction out;
+	int i;
+
+	for (i = 0; i < NUM_TEMP_REGS; ++i) {
+		if (seq->tmp_reg.regs[i] != -1)
+			seq->tmp_reg.regs[i] += FCC_WORD_SIZE;
+	}
+	seq->tmp_reg.regs[tmp_reg] = 0;
+	seq->tmp_reg.size++;
+
+	if (gpr != -1) {
+		out.instruction = X86_PUSH;
+		out.size = 0;
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = gpr;
+		vector_append(&seq->seq, &out);
+	}
+}
+
+/*
+ * tmp_reg_pop:
+ * Create an instruction to pop temporary register `tmp_reg` into register
+ * `gpr`, and update temporary register offsets.
+ */
+static void tmp_reg_pop(struct x86_sequence *seq, int tmp_reg, int gpr)
+{
+	struct x86_instruction out;
+	int i;
+
+	for (i = 0; i < NUM_TEMP_REGS; ++i) {
+		if (seq->tmp_reg.regs[i] != -1)
+			seq->tmp_reg.regs[i] -= FCC_WORD_SIZE;
+	}
+	seq->tmp_reg.regs[tmp_reg] = -1;
+	seq->tmp_reg.size--;
+
+	if (gpr != -1) {
+		out.instruction = X86_POP;
+		out.size = 0;
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = gpr;
+		vector_append(&seq->seq, &out);
+	}
+}
+
+static int x86_load_tmp_reg(struct x86_sequence *seq,
+                            struct ir_operand *tmp_reg,
+                            int gpr);
+
+/*
+ * x86_load_string:
+ * Load the address of string literal `str` into register `gpr`.
+ */
+static int x86_load_string(struct x86_sequence *seq,
+                           struct ast_node *str,
+                           int gpr)
+{
+	struct x86_instruction out;
+
+	if (gpr == X86_GPR_ANY)
+		gpr = x86_gpr_any_get(seq);
+
+	out.instruction = fcc_m64 ? X86_LEA : X86_MOV;
+	out.size = FCC_WORD_SIZE;
+	out.op1.type = X86_OPERAND_STRING;
+	out.op1.label = gen_string_label(str->lexeme);
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = gpr;
+	vector_append(&seq->seq, &out);
+
+	seq->gprs[gpr].used = 1;
+	seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+	return gpr;
+}
+
+/*
+ * x86_fold_address:
+ * Set `x` to a memory operand `off` bytes past the address in register `gpr`.
+ * If that address was computed by the last instruction emitted, a lea, the
+ * lea is removed and its source operand is accessed directly instead.
+ */
+static void x86_fold_address(struct x86_sequence *seq, int gpr, int off,
+                             struct x86_operand *x)
+{
+	struct x86_instruction *last;
+
+	x->type = X86_OPERAND_OFFSET;
+	x->offset.off = off;
+	x->offset.gpr = gpr;
+
+	if (!seq->seq.nmembs)
+		return;
+
+	last = (struct x86_instruction *)seq->seq.data + seq->seq.nmembs - 1;
+	if (last->instruction != X86_LEA || !x86_is_gpr(&last->op2, gpr) ||
+	    seq->gprs[gpr].tag != X86_GPRVAL_NONE)
+		return;
+
+	if (last->op1.type == X86_OPERAND_INDEX) {
+		*x = last->op1;
+		x->index.disp += off;
+		seq->gprs[x->index.base].used = 1;
+		seq->gprs[x->index.index].used = 1;
+	} else if (last->op1.type == X86_OPERAND_OFFSET &&
+	           last->op1.offset.gpr != X86_GPR_SP) {
+		/* Stack offsets change once the address is popped. */
+		*x = last->op1;
+		x->offset.off += off;
+		seq->gprs[x->offset.gpr].used = 1;
+	} else {
+		return;
+	}
+	vector_pop(&seq->seq, NULL);
+}
+
+/*
+ * ir_to_x86_operand:
+ * Converts an operand from IR to x86.
+ */
+static void ir_to_x86_operand(struct x86_sequence *seq,
+                              struct ir_operand *i,
+                              struct x86_operand *x,
+                              int forceoff)
+{
+	struct local *l;
+	int gpr;
+
+	if (i->op_type == IR_OPERAND_AST_NODE) {
+		switch (i->node->tag) {
+		case NODE_IDENTIFIER:
+			/*
+			 * local variable: offset from base pointer. One whose
+			 * address is taken may be changed through a pointer, so
+			 * a register caching it is not used.
+			 */
+			l = local_find(seq->locals, i->node->lexeme);
+			gpr = LFLAGS_REG(l->flags);
+			if (!forceoff && !(l->flags & LFLAGS_ADDRESSED) &&
+			    seq->gprs[gpr].tag == X86_GPRVAL_NODE
+			    && strcmp(seq->gprs[gpr].node->lexeme,
+			              i->node->lexeme) == 0) {
+				x->type = X86_OPERAND_GPR;
+				x->gpr = gpr;
+			} else {
+				x->type = X86_OPERAND_OFFSET;
+				x->offset.off = l->offset;
+				x->offset.gpr = X86_GPR_BP;
+			}
+			break;
+		case NODE_CONSTANT:
+			if (i->node->expr_flags.type_flags & QUAL_UNSIGNED ||
+			    FLAGS_IS_PTR(i->node->expr_flags.type_flags))
+				x->type = X86_OPERAND_UCONSTANT;
+			else
+				x->type = X86_OPERAND_CONSTANT;
+			x->constant = i->node->value;
+			break;
+		case NODE_STRLIT:
+			/* 64-bit addresses cannot be immediates. */
+			if (fcc_m64) {
+				x->type = X86_OPERAND_GPR;
+				x->gpr = x86_load_string(seq, i->node,
+				                         X86_GPR_ANY);
+			} else {
+				x->type = X86_OPERAND_STRING;
+				x->label = gen_string_label(i->node->lexeme);
+			}
+			break;
+		}
+	} else if (i->op_type == IR_OPERAND_TEMP_REG) {
+		x->type = X86_OPERAND_OFFSET;
+		x->offset.off = seq->tmp_reg.regs[i->reg];
+		x->offset.gpr = X86_GPR_SP;
+	} else if (i->op_type == IR_OPERAND_NODE_OFF) {
+		l = local_find(seq->locals, i->node->lexeme);
+		x->type = X86_OPERAND_OFFSET;
+		x->offset.off = l->offset + i->off;
+		x->offset.gpr = X86_GPR_BP;
+	} else {
+		i->op_type = IR_OPERAND_TEMP_REG;
+		x86_gpr_any_reset(seq);
+		gpr = x86_load_tmp_reg(seq, i, X86_GPR_ANY);
+		x86_fold_address(seq, gpr, i->off, x);
+	}
+}
+
+/*
+ * x86_load_value:
+ * Create an x86 instruction to load variable `var` into GPR `gpr`.
+ */
+static int x86_load_value(struct x86_sequence *seq,
+                          struct ir_operand *val,
+                          int gpr)
+{
+	struct x86_instruction out;
+	struct local *l;
+
+	if (val->node->tag == NODE_STRLIT)
+		return x86_load_string(seq, val->node, gpr);
+
+	out.instruction = X86_MOV;
+	out.size = type_size(&val->node->expr_flags);
+
+	ir_to_x86_operand(seq, val, &out.op1, 0);
+
+	if (out.op1.type == X86_OPERAND_GPR) {
+		if (gpr == X86_GPR_ANY || gpr == out.op1.gpr) {
+			seq->gprs[out.op1.gpr].used = 1;
+			return out.op1.gpr;
+		}
+	}
+
+	/* Characters are extended to the full width of the register. */
+	if (out.size < 4) {
+		if (out.op1.type == X86_OPERAND_OFFSET)
+			out.instruction = val->node->expr_flags.type_flags
+			                  & QUAL_UNSIGNED ? X86_MOVZB : X86_MOVSB;
+		out.size = 4;
+	}
+
+	if (gpr == X86_GPR_ANY)
+		gpr = x86_gpr_any_get(seq);
+
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = gpr;
+	if (val->node->tag == NODE_IDENTIFIER) {
+		l = local_find(seq->locals, val->node->lexeme);
+		l->flags = LFLAGS_SET_REG(l->flags, gpr);
+		seq->gprs[gpr].tag = X86_GPRVAL_NODE;
+		seq->gprs[gpr].node = val->node;
+	} else {
+		seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+	}
+
+	vector_append(&seq->seq, &out);
+	return gpr;
+}
+
+/*
+ * x86_load_tmp_reg:
+ * Create an x86 instruction to load temporary register `tmp_reg`
+ * into GPR `gpr` or X86_GPR_ANY.
+ * If `tmp_reg` is at the top of the stack, pop it.
+ * Return the GPR into which `tmp_reg` was placed.
+ */
+static int x86_load_tmp_reg(struct x86_sequence *seq,
+                            struct ir_operand *tmp_reg,
+                            int gpr)
+{
+	struct x86_instruction out, last;
+
+	ir_to_x86_operand(seq, tmp_reg, &out.op1, 0);
+	if (out.op1.type == X86_OPERAND_OFFSET &&
+	    out.op1.offset.gpr == X86_GPR_SP && !out.op1.offset.off) {
+		/*
+		 * Item is on top of the stack.
+		 * Check to see if the most recent instruction was a push
+		 * of the same register. If so, delete it as it is unnecessary.
+		 */
+		vector_get(&seq->seq, seq->seq.nmembs - 1, &last);
+		if (last.instruction == X86_PUSH) {
+			vector_pop(&seq->seq, NULL);
+
+			/* Keep item in the register it was popped from. */
+			if (gpr == X86_GPR_ANY) {
+				tmp_reg_pop(seq, tmp_reg->reg, -1);
+				if (!seq->gprs[last.op1.gpr].used) {
+					seq->gprs[last.op1.gpr].used = 1;
+					seq->gprs[last.op1.gpr].tag =
+						X86_GPRVAL_NONE;
+					return last.op1.gpr;
+				}
+				gpr = x86_gpr_any_get(seq);
+			}
+
+			if (last.op1.gpr != gpr) {
+				/* Move item from last register to target. */
+				out.instruction = X86_MOV;
+				out.size = FCC_WORD_SIZE;
+				out.op1.type = X86_OPERAND_GPR;
+				out.op1.gpr = last.op1.gpr;
+				out.op2.type = X86_OPERAND_GPR;
+				out.op2.gpr = gpr;
+				vector_append(&seq->seq, &out);
+			}
+			tmp_reg_pop(seq, tmp_reg->reg, -1);
+			return gpr;
+		}
+		if (gpr == X86_GPR_ANY)
+			gpr = x86_gpr_any_get(seq);
+		tmp_reg_pop(seq, tmp_reg->reg, gpr);
+	} else {
+		if (gpr == X86_GPR_ANY)
+			gpr = x86_gpr_any_get(seq);
+
+		out.instruction = X86_MOV;
+		out.size = FCC_WORD_SIZE;
+		out.op2.type = X86_OPERAND_GPR;
+		out.op2.gpr = gpr;
+		vector_append(&seq->seq, &out);
+	}
+	seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+	return gpr;
+}
+
+/* x86_operand_type: return the type of IR operand `op`, if known */
+static struct type_information *x86_operand_type(struct x86_sequence *seq,
+                                                 struct ir_operand *op)
+{
+	if (op->op_type == IR_OPERAND_AST_NODE)
+		return &op->node->expr_flags;
+	else if (op->op_type == IR_OPERAND_TEMP_REG)
+		return &seq->tmp_reg.types[op->reg];
+	else
+		return NULL;
+}
+
+/*
+ * x86_extend:
+ * Sign extend signed integer operand `op`, held in register `gpr`,
+ * to 64 bits if it is used by an instruction of `size` bytes.
+ * Unsigned values are already zero extended by 32-bit instructions.
+ */
+static void x86_extend(struct x86_sequence *seq, struct ir_operand *op,
+                       int gpr, int size)
+{
+	struct x86_instruction out;
+	struct type_information *type;
+
+	if (size != 8)
+		return;
+
+	type = x86_operand_type(seq, op);
+	if (!type || type_size(type) == 8 ||
+	    type->type_flags & QUAL_UNSIGNED)
+		return;
+
+	out.instruction = X86_MOVSLQ;
+	out.size = 0;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = gpr;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = gpr;
+	vector_append(&seq->seq, &out);
+	seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+}
+
+/* Blocks of up to this many bytes are copied a word at a time. */
+#define COPY_WORDS_MAX  16
+
+/* Blocks of up to this many bytes are copied 16 bytes at a time. */
+#define COPY_SSE_MAX    128
+
+/* x86_displace: return memory operand `op` displaced by `off` bytes */
+static struct x86_operand x86_displace(struct x86_operand *op, int off)
+{
+	struct x86_operand x;
+
+	x = *op;
+	x.offset.off += off;
+	return x;
+}
+
+/* x86_fill_unit: return the widest store of a fill with byte `fill` */
+static size_t x86_fill_unit(int fill)
+{
+	/* Immediates are 32 bits, so a nonzero pattern only fills a long. */
+	return fill ? 4 : FCC_WORD_SIZE;
+}
+
+/*
+ * x86_load_fill:
+ * Load register `gpr` with a word each of whose bytes is `fill`.
+ */
+static void x86_load_fill(struct x86_sequence *seq, int gpr, int fill)
+{
+	struct x86_instruction out;
+
+	out.size = 4;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = gpr;
+	if (fill) {
+		out.instruction = X86_MOV;
+		out.op1.type = X86_OPERAND_UCONSTANT;
+		out.op1.constant = (fill & 0xFF) * 0x01010101U;
+	} else {
+		out.instruction = X86_XOR;
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = gpr;
+	}
+	vector_append(&seq->seq, &out);
+	seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+}
+
+/*
+ * x86_copy_words:
+ * Copy bytes `off` to `size` of `src` to `dst`, or set each of them to
+ * `fill` if `src` is NULL, through register `gpr` using the widest moves
+ * which fit.
+ */
+static void x86_copy_words(struct x86_sequence *seq, struct x86_operand *dst,
+                           struct x86_operand *src, int fill, size_t off,
+                           size_t size, int gpr)
+{
+	struct x86_instruction out;
+	size_t n, unit;
+
+	if (off == size)
+		return;
+
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = gpr;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = gpr;
+	unit = src ? FCC_WORD_SIZE : x86_fill_unit(fill);
+	if (!src)
+		x86_load_fill(seq, gpr, fill);
+
+	for (; off < size; off += n) {
+		for (n = unit; n > size - off; n >>= 1)
+			;
+		out.instruction = X86_MOV;
+		out.size = n;
+		if (src) {
+			out.op1 = x86_displace(src, off);
+			out.op2.type = X86_OPERAND_GPR;
+			out.op2.gpr = gpr;
+			vector_append(&seq->seq, &out);
+			out.op1 = out.op2;
+		}
+		out.op2 = x86_displace(dst, off);
+		vector_append(&seq->seq, &out);
+	}
+	seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+}
+
+/*
+ * x86_copy_sse:
+ * Copy `size` bytes from `src` to `dst`, or set each of them to `fill` if
+ * `src` is NULL, 16 bytes at a time through %xmm0, and the remainder
+ * through `gpr`.
+ */
+static void x86_copy_sse(struct x86_sequence *seq, struct x86_operand *dst,
+                         struct x86_operand *src, int fill, size_t size,
+                         int gpr)
+{
+	struct x86_instruction out;
+	size_t off;
+
+	out.size = 0;
+	out.op1.type = X86_OPERAND_XMM;
+	out.op1.xmm = 0;
+	out.op2.type = X86_OPERAND_XMM;
+	out.op2.xmm = 0;
+	if (!src && !fill) {
+		out.instruction = X86_PXOR;
+		vector_append(&seq->seq, &out);
+	} else if (!src) {
+		/* Broadcast the fill pattern to every lane. */
+		x86_load_fill(seq, gpr, fill);
+		out.instruction = X86_MOVD;
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = gpr;
+		vector_append(&seq->seq, &out);
+
+		out.instruction = X86_PSHUFD;
+		out.op1.type = X86_OPERAND_CONSTANT;
+		out.op1.constant = 0;
+		out.op2.type = X86_OPERAND_XMM;
+		out.op2.xmm = 0;
+		out.op3.type = X86_OPERAND_XMM;
+		out.op3.xmm = 0;
+		vector_append(&seq->seq, &out);
+		out.op1.type = X86_OPERAND_XMM;
+		out.op1.xmm = 0;
+	}
+
+	for (off = 0; off + 16 <= size; off += 16) {
+		out.instruction = X86_MOVDQU;
+		if (src) {
+			out.op1 = x86_displace(src, off);
+			out.op2.type = X86_OPERAND_XMM;
+			out.op2.xmm = 0;
+			vector_append(&seq->seq, &out);
+			out.op1 = out.op2;
+		}
+		out.op2 = x86_displace(dst, off);
+		vector_append(&seq->seq, &out);
+	}
+	x86_copy_words(seq, dst, src, fill, off, size, gpr);
+}
+
+/*
+ * x86_copy_rep:
+ * Copy `size` bytes from `src` to `dst`, or set each of them to `fill` if
+ * `src` is NULL, with a single rep movs or rep stos of words followed by
+ * any odd bytes. %esi and %edi are callee-saved in 32-bit code, so are
+ * preserved.
+ */
+static void x86_copy_rep(struct x86_sequence *seq, struct x86_operand *dst,
+                         struct x86_operand *src, int fill, size_t size)
+{
+	struct x86_instruction out;
+	struct x86_operand dstop, srcop;
+	int regs[2] = { X86_GPR_SI, X86_GPR_DI };
+	int i, saved, n, unit;
+
+	/* Saving registers moves any operands relative to the stack. */
+	saved = fcc_m64 ? 0 : 2;
+	dstop = x86_displace(dst, dst->offset.gpr == X86_GPR_SP
+	                          ? saved * FCC_WORD_SIZE : 0);
+	if (src)
+		srcop = x86_displace(src, src->offset.gpr == X86_GPR_SP
+		                          ? saved * FCC_WORD_SIZE : 0);
+
+	out.instruction = X86_PUSH;
+	out.size = 0;
+	out.op1.type = X86_OPERAND_GPR;
+	for (i = 0; i < saved; ++i) {
+		out.op1.gpr = regs[i];
+		vector_append(&seq->seq, &out);
+	}
+
+	out.instruction = X86_LEA;
+	out.size = FCC_WORD_SIZE;
+	out.op2.type = X86_OPERAND_GPR;
+	if (src) {
+		out.op1 = srcop;
+		out.op2.gpr = X86_GPR_SI;
+		vector_append(&seq->seq, &out);
+	}
+	out.op1 = dstop;
+	out.op2.gpr = X86_GPR_DI;
+	vector_append(&seq->seq, &out);
+
+	unit = src ? FCC_WORD_SIZE : x86_fill_unit(fill);
+	out.instruction = X86_MOV;
+	out.size = 4;
+	out.op1.type = X86_OPERAND_CONSTANT;
+	out.op1.constant = size / unit;
+	out.op2.gpr = X86_GPR_CX;
+	vector_append(&seq->seq, &out);
+
+	if (!src)
+		x86_load_fill(seq, X86_GPR_AX, fill);
+
+	out.instruction = src ? X86_REP_MOVS : X86_REP_STOS;
+	out.size = unit;
+	vector_append(&seq->seq, &out);
+
+	/* The string instructions leave %esi and %edi past the last word. */
+	out.instruction = src ? X86_MOVS : X86_STOS;
+	for (n = unit / 2; n; n >>= 1) {
+		if (size & n) {
+			out.size = n;
+			vector_append(&seq->seq, &out);
+		}
+	}
+
+	out.instruction = X86_POP;
+	out.size = 0;
+	out.op1.type = X86_OPERAND_GPR;
+	for (i = saved - 1; i >= 0; --i) {
+		out.op1.gpr = regs[i];
+		vector_append(&seq->seq, &out);
+	}
+
+	seq->gprs[X86_GPR_CX].tag = X86_GPRVAL_NONE;
+	seq->gprs[X86_GPR_SI].tag = X86_GPRVAL_NONE;
+	seq->gprs[X86_GPR_DI].tag = X86_GPRVAL_NONE;
+}
+
+/*
+ * x86_block_copy:
+ * Copy `size` bytes from memory operand `src` to `dst`, or set each of them
+ * to `fill` if `src` is NULL. Small blocks are moved a word at a time,
+ * medium ones through an SSE register and large ones with a repeated string
+ * instruction. The operands must not be addressed through %ecx, %esi or %edi.
+ */
+static void x86_block_copy(struct x86_sequence *seq, struct x86_operand *dst,
+                           struct x86_operand *src, int fill, size_t size)
+{
+	if (size <= COPY_WORDS_MAX)
+		x86_copy_words(seq, dst, src, fill, 0, size, X86_GPR_CX);
+	else if (size <= COPY_SSE_MAX)
+		x86_copy_sse(seq, dst, src, fill, size, X86_GPR_CX);
+	else
+		x86_copy_rep(seq, dst, src, fill, size);
+}
+
+/*
+ * x86_object_operand:
+ * Convert IR operand `op`, the location of an object in memory, to memory
+ * operand `x`. An object which is pointed to has its address loaded into
+ * register `gpr`.
+ */
+static void x86_object_operand(struct x86_sequence *seq, struct ir_operand *op,
+                               struct x86_operand *x, int gpr)
+{
+	struct ir_operand tmp;
+
+	if (op->op_type == IR_OPERAND_AST_NODE ||
+	    op->op_type == IR_OPERAND_NODE_OFF) {
+		ir_to_x86_operand(seq, op, x, 1);
+		return;
+	}
+
+	tmp.op_type = IR_OPERAND_TEMP_REG;
+	tmp.reg = op->reg;
+	x->type = X86_OPERAND_OFFSET;
+	x->offset.off = op->op_type == IR_OPERAND_REG_OFF ? op->off : 0;
+	x->offset.gpr = x86_load_tmp_reg(seq, &tmp, gpr);
+}
+
+/* x86_is_struct: check if `type` is a struct value rather than a pointer */
+static int x86_is_struct(struct type_information *type)
+{
+	return FLAGS_TYPE(type->type_flags) == TYPE_STRUCT &&
+	       !FLAGS_IS_PTR(type->type_flags);
+}
+
+/*
+ * translate_struct_assign:
+ * Copy the struct on the right side of assignment `i` to its left, or clear
+ * it if it is initialized to zero.
+ */
+static void translate_struct_assign(struct x86_sequence *seq,
+                                    struct ir_instruction *i)
+{
+	struct x86_operand dst, src;
+
+	x86_gpr_any_reset(seq);
+
+	/* The source is on top of the stack if both are temporaries. */
+	if (i->rhs.op_type == IR_OPERAND_AST_NODE ||
+	    i->rhs.op_type == IR_OPERAND_NODE_OFF) {
+		x86_object_operand(seq, &i->lhs, &dst, X86_GPR_AX);
+		if (i->rhs.node->tag != NODE_CONSTANT)
+			x86_object_operand(seq, &i->rhs, &src, X86_GPR_DX);
+	} else {
+		x86_object_operand(seq, &i->rhs, &src, X86_GPR_DX);
+		x86_object_operand(seq, &i->lhs, &dst, X86_GPR_AX);
+	}
+
+	x86_block_copy(seq, &dst, i->rhs.op_type == IR_OPERAND_AST_NODE &&
+	               i->rhs.node->tag == NODE_CONSTANT ? NULL : &src,
+	               0, type_size(&i->type));
+}
+
+/*
+ * x86_push_assigned:
+ * If the value of assignment or update `i` is used, load it from `dst`,
+ * where it has just been stored, into its temporary register.
+ */
+static void x86_push_assigned(struct x86_sequence *seq,
+                              struct ir_instruction *i,
+                              struct x86_operand *dst)
+{
+	struct x86_instruction out;
+
+	if (i->target == -1)
+		return;
+
+	out.instruction = X86_MOV;
+	out.size = type_size(&i->type);
+	if (out.size < 4) {
+		out.instruction = i->type.type_flags & QUAL_UNSIGNED
+		                  ? X86_MOVZB : X86_MOVSB;
+		out.size = 4;
+	}
+	out.op1 = *dst;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_AX;
+	vector_append(&seq->seq, &out);
+
+	seq->gprs[X86_GPR_AX].tag = X86_GPRVAL_NONE;
+	tmp_reg_push(seq, i->target, X86_GPR_AX);
+}
+
+/*
+ * x86_update_in_place:
+ * Check if the value in register `gpr` to be stored in stack slot `dst` was
+ * computed by loading that slot and applying a single operation to it. If
+ * so, replace the load and operation with the operation on `dst` itself.
+ */
+static int x86_update_in_place(struct x86_sequence *seq,
+                               struct x86_operand *dst, int size, int gpr)
+{
+	struct x86_instruction *op, *load;
+	struct x86_operand *val;
+
+	if (seq->seq.nmembs < 2)
+		return 0;
+
+	op = (struct x86_instruction *)seq->seq.data + seq->seq.nmembs - 1;
+	load = op - 1;
+	switch (op->instruction) {
+	case X86_NEG:
+	case X86_NOT:
+		val = &op->op1;
+		break;
+	case X86_ADD:
+	case X86_SUB:
+	case X86_AND:
+	case X86_OR:
+	case X86_XOR:
+	case X86_SHL:
+	case X86_SHR:
+	case X86_SAR:
+		/* There can only be one memory operand. */
+		if (op->op1.type != X86_OPERAND_CONSTANT &&
+		    op->op1.type != X86_OPERAND_UCONSTANT &&
+		    (op->op1.type != X86_OPERAND_GPR || op->op1.gpr == gpr))
+			return 0;
+		val = &op->op2;
+		break;
+	default:
+		return 0;
+	}
+
+	if (op->size != size || !x86_is_gpr(val, gpr))
+		return 0;
+
+	if (load->instruction != X86_MOV || load->size != size ||
+	    !x86_is_gpr(&load->op2, gpr) ||
+	    load->op1.type != X86_OPERAND_OFFSET ||
+	    load->op1.offset.gpr != X86_GPR_BP ||
+	    load->op1.offset.off != dst->offset.off)
+		return 0;
+
+	*val = *dst;
+	*load = *op;
+	vector_pop(&seq->seq, NULL);
+	seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+	return 1;
+}
+
+/*
+ * translate_assign_instruction:
+ * Converts an IR assignment instruction to a series of x86 instructions.
+ */
+static void translate_assign_instruction(struct x86_sequence *seq,
+                                         struct ir_instruction *i,
+                                         int cond)
+{
+	struct x86_instruction out;
+	struct local *l;
+	int gpr, rgpr;
+
+	if (x86_is_struct(&i->type)) {
+		translate_struct_assign(seq, i);
+		return;
+	}
+
+	out.instruction = X86_MOV;
+	out.size = type_size(&i->type);
+
+	l = NULL;
+	rgpr = -1;
+	x86_gpr_any_reset(seq);
+
+	/* If both operands are temporaries, the rhs is on top of the stack. */
+	if (i->lhs.op_type == IR_OPERAND_TEMP_REG &&
+	    i->rhs.op_type == IR_OPERAND_TEMP_REG)
+		rgpr = x86_load_tmp_reg(seq, &i->rhs, X86_GPR_ANY);
+
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE) {
+		ir_to_x86_operand(seq, &i->lhs, &out.op2, 1);
+		l = local_find(seq->locals, i->lhs.node->lexeme);
+	} else if (i->lhs.op_type == IR_OPERAND_NODE_OFF ||
+	           i->lhs.op_type == IR_OPERAND_REG_OFF) {
+		ir_to_x86_operand(seq, &i->lhs, &out.op2, 0);
+	} else {
+		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+		x86_fold_address(seq, gpr, 0, &out.op2);
+	}
+
+	if (i->rhs.op_type == IR_OPERAND_AST_NODE) {
+		switch (i->rhs.node->tag) {
+		case NODE_IDENTIFIER:
+			gpr = x86_load_value(seq, &i->rhs, X86_GPR_ANY);
+			x86_extend(seq, &i->rhs, gpr, out.size);
+			out.op1.type = X86_OPERAND_GPR;
+			out.op1.gpr = gpr;
+			if (l) {
+				l->flags = LFLAGS_SET_REG(l->flags, gpr);
+				seq->gprs[gpr].tag = X86_GPRVAL_NODE;
+				seq->gprs[gpr].node = i->lhs.node;
+			} else {
+				seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+			}
+			break;
+		case NODE_CONSTANT:
+		case NODE_STRLIT:
+			ir_to_x86_operand(seq, &i->rhs, &out.op1, 0);
+			/* A register holding the old value is now stale. */
+			gpr = l ? LFLAGS_REG(l->flags) : 0;
+			if (l && seq->gprs[gpr].tag == X86_GPRVAL_NODE &&
+			    strcmp(seq->gprs[gpr].node->lexeme,
+			           i->lhs.node->lexeme) == 0)
+				seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+			break;
+		}
+	} else {
+		gpr = rgpr != -1 ? rgpr
+		                 : x86_load_tmp_reg(seq, &i->rhs, X86_GPR_ANY);
+		if (l && x86_update_in_place(seq, &out.op2, out.size, gpr)) {
+			x86_push_assigned(seq, i, &out.op2);
+			return;
+		}
+		x86_extend(seq, &i->rhs, gpr, out.size);
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = gpr;
+		if (l) {
+			l->flags = LFLAGS_SET_REG(l->flags, gpr);
+			seq->gprs[gpr].tag = X86_GPRVAL_NODE;
+			seq->gprs[gpr].node = i->lhs.node;
+		} else {
+			seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+		}
+	}
+	vector_append(&seq->seq, &out);
+	x86_push_assigned(seq, i, &out.op2);
+
+	(void)cond;
+}
+
+static int commutative(int instruction)
+{
+	switch (instruction) {
+	case X86_ADD:
+	case X86_OR:
+	case X86_XOR:
+	case X86_AND:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * x86_operand_size:
+ * Return the size of the register holding IR operand `op` which is
+ * compared or tested. Narrower values are extended when loaded.
+ */
+static int x86_operand_size(struct x86_sequence *seq, struct ir_operand *op)
+{
+	struct type_information *type;
+
+	type = x86_operand_type(seq, op);
+	return type && type_size(type) == 8 ? 8 : 4;
+}
+
+/* x86_compare_size: return the size of the wider operand of `i` */
+static int x86_compare_size(struct x86_sequence *seq,
+                            struct ir_instruction *i)
+{
+	if (x86_operand_size(seq, &i->lhs) == 8)
+		return 8;
+
+	return x86_operand_size(seq, &i->rhs);
+}
+
+/*
+ * x86_direct_operand:
+ * If IR operand `op` is a local variable of `size` bytes, set `x` to access
+ * it in place, in the register holding it or else in its stack slot, rather
+ * than loading it into a register first.
+ */
+static int x86_direct_operand(struct x86_sequence *seq, struct ir_operand *op,
+                              int size, struct x86_operand *x)
+{
+	if (op->op_type != IR_OPERAND_AST_NODE ||
+	    op->node->tag != NODE_IDENTIFIER ||
+	    type_size(&op->node->expr_flags) != (size_t)size)
+		return 0;
+
+	ir_to_x86_operand(seq, op, x, 0);
+	if (x->type == X86_OPERAND_GPR)
+		seq->gprs[x->gpr].used = 1;
+	return 1;
+}
+
+/*
+ * __translate_generic:
+ * Translate generic x86 instruction `instruction` from IR.
+ */
+static void __translate_generic(struct x86_sequence *seq,
+                                   struct ir_instruction *i,
+                                   int instruction, int push)
+{
+	struct x86_instruction out;
+	struct x86_operand *op;
+	int set, gpr;
+
+	out.instruction = instruction;
+	if (instruction == X86_CMP)
+		out.size = x86_compare_size(seq, i);
+	else
+		out.size = type_size(&i->type);
+	set = 0;
+
+	x86_gpr_any_reset(seq);
+	if (i->lhs.op_type == IR_OPERAND_TEMP_REG &&
+	    i->rhs.op_type == IR_OPERAND_TEMP_REG) {
+		/* The rhs was pushed last, so it is popped first. */
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = x86_load_tmp_reg(seq, &i->rhs, X86_GPR_ANY);
+		x86_extend(seq, &i->rhs, out.op1.gpr, out.size);
+		out.op2.type = X86_OPERAND_GPR;
+		out.op2.gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+		x86_extend(seq, &i->lhs, out.op2.gpr, out.size);
+		goto out;
+	}
+
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE) {
+		switch (i->lhs.node->tag) {
+		case NODE_IDENTIFIER:
+			/* A comparison only reads the variable in place. */
+			if (instruction == X86_CMP) {
+				set = x86_direct_operand(seq, &i->lhs, out.size,
+				                         &out.op2);
+				if (set)
+					break;
+			}
+			/*
+			 * It can also be the source of an operation whose
+			 * result is the temporary on the right.
+			 */
+			if (commutative(instruction) &&
+			    i->rhs.op_type == IR_OPERAND_TEMP_REG &&
+			    x86_direct_operand(seq, &i->lhs, out.size,
+			                       &out.op1))
+				break;
+			gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
+			x86_extend(seq, &i->lhs, gpr, out.size);
+			out.op2.type = X86_OPERAND_GPR;
+			out.op2.gpr = gpr;
+			set = 1;
+			break;
+		case NODE_CONSTANT:
+			/*
+			 * A constant can only be the source operand of a
+			 * commutative instruction with a non-constant rhs.
+			 */
+			if (!commutative(instruction) ||
+			    (i->rhs.op_type == IR_OPERAND_AST_NODE &&
+			     i->rhs.node->tag == NODE_CONSTANT)) {
+				gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
+				x86_extend(seq, &i->lhs, gpr, out.size);
+				out.op2.type = X86_OPERAND_GPR;
+				out.op2.gpr = gpr;
+				set = 1;
+				break;
+			}
+			ir_to_x86_operand(seq, &i->lhs, &out.op1, 0);
+			break;
+		}
+	} else {
+		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+		x86_extend(seq, &i->lhs, gpr, out.size);
+		out.op2.type = X86_OPERAND_GPR;
+		out.op2.gpr = gpr;
+		set = 1;
+	}
+
+	/* Output register has been set. */
+	if (set)
+		op = &out.op1;
+	else
+		op = &out.op2;
+
+	if (i->rhs.op_type == IR_OPERAND_AST_NODE) {
+		switch (i->rhs.node->tag) {
+		case NODE_IDENTIFIER:
+			/* Only one of the operands can be in memory. */
+			if (set && out.op2.type == X86_OPERAND_GPR &&
+			    x86_direct_operand(seq, &i->rhs, out.size, op))
+				break;
+			gpr = x86_load_value(seq, &i->rhs, X86_GPR_ANY);
+			x86_extend(seq, &i->rhs, gpr, out.size);
+			op->type = X86_OPERAND_GPR;
+			op->gpr = gpr;
+			break;
+		case NODE_CONSTANT:
+			ir_to_x86_operand(seq, &i->rhs, &out.op1, 0);
+			break;
+		}
+	} else {
+		gpr = x86_load_tmp_reg(seq, &i->rhs, X86_GPR_ANY);
+		x86_extend(seq, &i->rhs, gpr, out.size);
+		op->type = X86_OPERAND_GPR;
+		op->gpr = gpr;
+	}
+
+out:
+	if (instruction != X86_CMP)
+		seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
+	vector_append(&seq->seq, &out);
+	if (push)
+		tmp_reg_push(seq, i->target, out.op2.gpr);
+}
+
+static int x86_expr_instructions[] = {
+	[EXPR_OR]       = X86_OR,
+	[EXPR_XOR]      = X86_XOR,
+	[EXPR_AND]      = X86_AND,
+	[EXPR_LSHIFT]   = X86_SHL,
+	[EXPR_ADD]      = X86_ADD,
+	[EXPR_SUB]      = X86_SUB,
+	[EXPR_EQ]       = X86_SETE,
+	[EXPR_NE]       = X86_SETNE,
+	[EXPR_LT]       = X86_SETL,
+	[EXPR_GT]       = X86_SETG,
+	[EXPR_LE]       = X86_SETLE,
+	[EXPR_GE]       = X86_SETGE
+};
+
+static int x86_inverse_jumps[] = {
+	[EXPR_EQ]               = X86_JNE,
+	[EXPR_NE]               = X86_JE,
+	[EXPR_LT]               = X86_JGE,
+	[EXPR_GT]               = X86_JLE,
+	[EXPR_LE]               = X86_JG,
+	[EXPR_GE]               = X86_JL,
+	[IR_TEST]               = X86_JZ
+};
+
+static int x86_jumps[] = {
+	[EXPR_EQ]               = X86_JE,
+	[EXPR_NE]               = X86_JNE,
+	[EXPR_LT]               = X86_JL,
+	[EXPR_GT]               = X86_JG,
+	[EXPR_LE]               = X86_JLE,
+	[EXPR_GE]               = X86_JGE,
 	[IR_TEST]               = X86_JNZ
 };
 
-static void translate_arithmetic_instruction(struct x86_sequence *seq,
-                                             struct ir_instruction *i,
-                                             int cond)
+static int x86_inverse_sets[] = {
+	[EXPR_EQ]               = X86_SETNE,
+	[EXPR_NE]               = X86_SETE,
+	[EXPR_LT]               = X86_SETGE,
+	[EXPR_GT]               = X86_SETLE,
+	[EXPR_LE]               = X86_SETG,
+	[EXPR_GE]               = X86_SETL,
+	[IR_TEST]               = X86_SETE
+};
+
+static int x86_sets[] = {
+	[EXPR_EQ]               = X86_SETE,
+	[EXPR_NE]               = X86_SETNE,
+	[EXPR_LT]               = X86_SETL,
+	[EXPR_GT]               = X86_SETG,
+	[EXPR_LE]               = X86_SETLE,
+	[EXPR_GE]               = X86_SETGE,
+	[IR_TEST]               = X86_SETNE
+};
+
+static int x86_cmovs[] = {
+	[EXPR_EQ]               = X86_CMOVE,
+	[EXPR_NE]               = X86_CMOVNE,
+	[EXPR_LT]               = X86_CMOVL,
+	[EXPR_GT]               = X86_CMOVG,
+	[EXPR_LE]               = X86_CMOVLE,
+	[EXPR_GE]               = X86_CMOVGE,
+	[IR_TEST]               = X86_CMOVNE
+};
+
+static void translate_arithmetic_instruction(struct x86_sequence *seq,
+                                             struct ir_instruction *i,
+                                             int cond)
+{
+	return __translate_generic(seq, i, x86_expr_instructions[i->tag], 1);
+
+	(void)cond;
+}
+
+/*
+ * translate_shift_instruction:
+ * Translate a bitshift IR instruction to x86.
+ */
+static void translate_shift_instruction(struct x86_sequence *seq,
+                                        struct ir_instruction *i,
+                                        int cond)
+{
+	struct x86_instruction out;
+
+	out.instruction = i->tag == EXPR_LSHIFT
+	                  ? X86_SHL
+	                  : (i->type.type_flags & QUAL_UNSIGNED
+	                     ? X86_SHR : X86_SAR);
+	out.size = type_size(&i->type);
+
+	/* Number of bits to shift by is stored in cl (low byte of ecx) */
+	if (i->rhs.op_type == IR_OPERAND_AST_NODE) {
+		if (i->rhs.node->tag == NODE_CONSTANT) {
+			/* Unless it's a constant, which can be used directly */
+			out.op1.type = X86_OPERAND_CONSTANT;
+			out.op1.constant = i->rhs.node->value;
+		} else {
+			x86_load_value(seq, &i->rhs, X86_GPR_CX);
+			out.op1.type = X86_OPERAND_GPR;
+			out.op1.gpr = X86_GPR_CL;
+		}
+	} else {
+		x86_load_tmp_reg(seq, &i->rhs, X86_GPR_CX);
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = X86_GPR_CL;
+	}
+
+	/* The rhs is loaded first as it is on top of the stack. */
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE)
+		x86_load_value(seq, &i->lhs, X86_GPR_AX);
+	else
+		x86_load_tmp_reg(seq, &i->lhs, X86_GPR_AX);
+
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_AX;
+	seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
+
+	vector_append(&seq->seq, &out);
+	tmp_reg_push(seq, i->target, X86_GPR_AX);
+
+	(void)cond;
+}
+
+/*
+ * translate_update_instruction:
+ * Translate an IR update to a single x86 instruction which operates on the
+ * updated object in memory.
+ */
+static void translate_update_instruction(struct x86_sequence *seq,
+                                         struct ir_instruction *i,
+                                         int cond)
+{
+	struct x86_instruction out;
+	struct ir_operand addr;
+	struct local *l;
+	int gpr, shift;
+
+	switch (i->rhs.off) {
+	case EXPR_RSHIFT:
+		out.instruction = i->type.type_flags & QUAL_UNSIGNED
+		                  ? X86_SHR : X86_SAR;
+		break;
+	default:
+		out.instruction = x86_expr_instructions[i->rhs.off];
+		break;
+	}
+	out.size = type_size(&i->type);
+	shift = i->rhs.off == EXPR_LSHIFT || i->rhs.off == EXPR_RSHIFT;
+
+	x86_gpr_any_reset(seq);
+	if (shift)
+		seq->gprs[X86_GPR_CX].used = 1;
+
+	/*
+	 * A value in a temporary is on top of the stack, above the address
+	 * of the object, so it is loaded first. So is a shift count, which
+	 * must be in cl.
+	 */
+	gpr = -1;
+	if (i->rhs.op_type == IR_OPERAND_TEMP_REG) {
+		gpr = x86_load_tmp_reg(seq, &i->rhs,
+		                       shift ? X86_GPR_CX : X86_GPR_ANY);
+		x86_extend(seq, &i->rhs, gpr, out.size);
+	} else if (shift && i->rhs.node->tag != NODE_CONSTANT) {
+		gpr = x86_load_value(seq, &i->rhs, X86_GPR_CX);
+	}
+
+	l = NULL;
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE) {
+		ir_to_x86_operand(seq, &i->lhs, &out.op2, 1);
+		l = local_find(seq->locals, i->lhs.node->lexeme);
+	} else if (i->lhs.op_type == IR_OPERAND_NODE_OFF) {
+		ir_to_x86_operand(seq, &i->lhs, &out.op2, 0);
+	} else {
+		addr.op_type = IR_OPERAND_TEMP_REG;
+		addr.reg = i->lhs.reg;
+		x86_fold_address(seq,
+		                 x86_load_tmp_reg(seq, &addr, X86_GPR_ANY),
+		                 i->lhs.op_type == IR_OPERAND_REG_OFF
+		                 ? i->lhs.off : 0, &out.op2);
+	}
+
+	if (gpr != -1) {
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = shift ? X86_GPR_CL : gpr;
+	} else if (i->rhs.node->tag == NODE_CONSTANT) {
+		ir_to_x86_operand(seq, &i->rhs, &out.op1, 0);
+	} else {
+		gpr = x86_load_value(seq, &i->rhs, X86_GPR_ANY);
+		x86_extend(seq, &i->rhs, gpr, out.size);
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = gpr;
+	}
+
+	/* Adding or subtracting one is an increment or decrement. */
+	if ((out.instruction == X86_ADD || out.instruction == X86_SUB) &&
+	    out.op1.type == X86_OPERAND_CONSTANT &&
+	    (out.op1.constant == 1 || out.op1.constant == -1)) {
+		out.instruction = (out.instruction == X86_ADD) ==
+		                  (out.op1.constant == 1) ? X86_INC : X86_DEC;
+		out.op1 = out.op2;
+	}
+
+	/* A register holding the old value is now stale. */
+	gpr = l ? LFLAGS_REG(l->flags) : 0;
+	if (l && seq->gprs[gpr].tag == X86_GPRVAL_NODE &&
+	    strcmp(seq->gprs[gpr].node->lexeme, i->lhs.node->lexeme) == 0)
+		seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+
+	vector_append(&seq->seq, &out);
+	x86_push_assigned(seq, i, &out.op2);
+
+	(void)cond;
+}
+
+/*
+ * translate_comparison_instruction:
+ * Translate a comparison instruction with value into x86 instruction.
+ */
+static void translate_comparison_instruction(struct x86_sequence *seq,
+                                             struct ir_instruction *i,
+                                             int cond)
+{
+	struct x86_instruction out;
+
+	__translate_generic(seq, i, X86_CMP, 0);
+
+	if (cond)
+		return;
+
+	out.instruction = x86_expr_instructions[i->tag];
+	out.size = 0;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_AL;
+
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_MOVZB;
+	out.size = 4;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_AX;
+
+	seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
+	vector_append(&seq->seq, &out);
+	tmp_reg_push(seq, i->target, X86_GPR_AX);
+}
+
+/*
+ * translate_multiplicative_instruction:
+ * Translate a multiplication from IR to x86.
+ */
+static void translate_multiplicative_instruction(struct x86_sequence *seq,
+                                                 struct ir_instruction *i,
+                                                 int cond)
+{
+	struct x86_instruction out;
+	int gpr;
+
+	out.instruction = X86_IMUL;
+	out.size = 4;
+
+	x86_gpr_any_reset(seq);
+	if (i->lhs.op_type == IR_OPERAND_TEMP_REG &&
+	    i->rhs.op_type == IR_OPERAND_TEMP_REG) {
+		/* The rhs was pushed last, so it is popped first. */
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = x86_load_tmp_reg(seq, &i->rhs, X86_GPR_ANY);
+		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+	} else if (i->rhs.op_type == IR_OPERAND_AST_NODE &&
+	           i->rhs.node->tag == NODE_CONSTANT &&
+	           x86_direct_operand(seq, &i->lhs, 4, &out.op2)) {
+		/* An immediate multiplier can take its operand from memory. */
+		ir_to_x86_operand(seq, &i->rhs, &out.op1, 0);
+		gpr = x86_gpr_any_get(seq);
+		out.op3.type = X86_OPERAND_GPR;
+		out.op3.gpr = gpr;
+		goto out;
+	} else {
+		if (i->lhs.op_type == IR_OPERAND_AST_NODE)
+			gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
+		else
+			gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+
+		if (i->rhs.op_type == IR_OPERAND_AST_NODE &&
+		    i->rhs.node->tag == NODE_CONSTANT) {
+			ir_to_x86_operand(seq, &i->rhs, &out.op1, 0);
+		} else if (!x86_direct_operand(seq, &i->rhs, 4, &out.op1)) {
+			out.op1.type = X86_OPERAND_GPR;
+			if (i->rhs.op_type == IR_OPERAND_AST_NODE)
+				out.op1.gpr = x86_load_value(seq, &i->rhs,
+				                             X86_GPR_ANY);
+			else
+				out.op1.gpr = x86_load_tmp_reg(seq, &i->rhs,
+				                               X86_GPR_ANY);
+		}
+	}
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = gpr;
+	out.op3.type = X86_OPERAND_GPR;
+	out.op3.gpr = gpr;
+
+out:
+	seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+	vector_append(&seq->seq, &out);
+	tmp_reg_push(seq, i->target, gpr);
+
+	(void)cond;
+}
+
+/*
+ * translate_division_instruction:
+ * Translate a div or mod IR instruction to x86.
+ */
+static void translate_division_instruction(struct x86_sequence *seq,
+                                           struct ir_instruction *i,
+                                           int cond)
+{
+	struct x86_instruction out;
+
+	/* The rhs is loaded first as it is on top of the stack. */
+	if (i->rhs.op_type == IR_OPERAND_AST_NODE)
+		x86_load_value(seq, &i->rhs, X86_GPR_CX);
+	else
+		x86_load_tmp_reg(seq, &i->rhs, X86_GPR_CX);
+
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE)
+		x86_load_value(seq, &i->lhs, X86_GPR_AX);
+	else
+		x86_load_tmp_reg(seq, &i->lhs, X86_GPR_AX);
+
+	out.instruction = X86_CDQ;
+	out.size = 0;
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_DIV;
+	out.size = 4;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_CX;
+
+	seq->gprs[X86_GPR_AX].tag = X86_GPRVAL_NONE;
+	seq->gprs[X86_GPR_DX].tag = X86_GPRVAL_NONE;
+	vector_append(&seq->seq, &out);
+	tmp_reg_push(seq, i->target,
+	             i->tag == EXPR_DIV ? X86_GPR_AX : X86_GPR_DX);
+
+	(void)cond;
+}
+
+/*
+ * translate_address_instruction:
+ * Translate an address-of IR instruction to x86.
+ */
+static void translate_address_instruction(struct x86_sequence *seq,
+                                          struct ir_instruction *i,
+                                          int cond)
+{
+	struct x86_instruction out;
+
+	out.instruction = X86_LEA;
+	out.size = type_size(&i->type);
+	/* The address is that of the frame slot, even if a register caches it. */
+	ir_to_x86_operand(seq, &i->lhs, &out.op1, 1);
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_AX;
+
+	seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
+	vector_append(&seq->seq, &out);
+	tmp_reg_push(seq, i->target, X86_GPR_AX);
+
+	(void)cond;
+}
+
+/*
+ * translate_index_instruction:
+ * Compute the address of an indexed pointer addition with a single lea.
+ */
+static void translate_index_instruction(struct x86_sequence *seq,
+                                        struct ir_instruction *i,
+                                        int cond)
+{
+	struct x86_instruction out;
+	int base, index;
+
+	x86_gpr_any_reset(seq);
+
+	/* The index is on top of the stack if both are temporaries. */
+	index = -1;
+	if (i->rhs.op_type == IR_OPERAND_TEMP_REG) {
+		index = x86_load_tmp_reg(seq, &i->rhs, X86_GPR_ANY);
+		seq->gprs[index].tag = X86_GPRVAL_NONE;
+	}
+
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE)
+		base = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
+	else
+		base = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+	seq->gprs[base].tag = X86_GPRVAL_NONE;
+
+	if (i->rhs.op_type == IR_OPERAND_AST_NODE && i->rhs.node)
+		index = x86_load_value(seq, &i->rhs, X86_GPR_ANY);
+
+	out.instruction = X86_LEA;
+	out.size = FCC_WORD_SIZE;
+	if (index == -1) {
+		out.op1.type = X86_OPERAND_OFFSET;
+		out.op1.offset.off = i->lhs.off;
+		out.op1.offset.gpr = base;
+	} else {
+		x86_extend(seq, &i->rhs, index, FCC_WORD_SIZE);
+		out.op1.type = X86_OPERAND_INDEX;
+		out.op1.index.base = base;
+		out.op1.index.index = index;
+		out.op1.index.scale = i->rhs.off;
+		out.op1.index.disp = i->lhs.off;
+	}
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = base;
+
+	vector_append(&seq->seq, &out);
+	tmp_reg_push(seq, i->target, base);
+
+	(void)cond;
+}
+
+/*
+ * translate_dereference_instruction:
+ * Translate a pointer dereference IR instruction to x86.
+ */
+static void translate_dereference_instruction(struct x86_sequence *seq,
+                                              struct ir_instruction *i,
+                                              int cond)
+{
+	struct x86_instruction out;
+	int gpr;
+
+	x86_gpr_any_reset(seq);
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE)
+		gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
+	else
+		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+
+	out.instruction = X86_MOV;
+	out.size = type_size(&i->type);
+	if (out.size < 4) {
+		out.instruction = i->type.type_flags & QUAL_UNSIGNED
+		                  ? X86_MOVZB : X86_MOVSB;
+		out.size = 4;
+	}
+	x86_fold_address(seq, gpr, 0, &out.op1);
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = gpr;
+
+	seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
+	vector_append(&seq->seq, &out);
+	tmp_reg_push(seq, i->target, gpr);
+
+	(void)cond;
+}
+
+/*
+ * translate_unary_instruction:
+ * Translate a unary arithmetic/logical IR instruction to x86.
+ */
+static void translate_unary_instruction(struct x86_sequence *seq,
+                                        struct ir_instruction *i,
+                                        int cond)
+{
+	struct x86_instruction out;
+	int gpr;
+
+	x86_gpr_any_reset(seq);
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE)
+		gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
+	else
+		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+
+	/* Unary plus just loads the value. */
+	if (i->tag != EXPR_UNARY_PLUS) {
+		out.instruction = i->tag == EXPR_NOT ? X86_NOT : X86_NEG;
+		out.size = 4;
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = gpr;
+		seq->gprs[out.op1.gpr].tag = X86_GPRVAL_NONE;
+		vector_append(&seq->seq, &out);
+	}
+
+	tmp_reg_push(seq, i->target, gpr);
+	(void)cond;
+}
+
+/* nth_arg: return the `n`th argument in argument list `arglist` */
+static struct ast_node *nth_arg(struct ast_node *arglist, int n)
+{
+	int nleft;
+
+	while (arglist->tag == EXPR_COMMA) {
+		nleft = ir_num_args(arglist->left);
+		if (n < nleft) {
+			arglist = arglist->left;
+		} else {
+			arglist = arglist->right;
+			n -= nleft;
+		}
+	}
+
+	return arglist;
+}
+
+/*
+ * x86_load_register_args:
+ * Place the first `nreg` arguments in `args` into registers `regs`, or their
+ * ABI argument registers if `regs` is NULL. Computed arguments are on top of
+ * the stack, while terminals are loaded directly.
+ */
+static void x86_load_register_args(struct x86_sequence *seq,
+                                   struct ast_node *args, int nreg,
+                                   const int *regs)
+{
+	struct x86_instruction out, last;
+	struct ast_node *arg;
+	struct ir_operand op;
+	int i, gpr;
+
+	for (i = 0; i < nreg; ++i) {
+		arg = nth_arg(args, i);
+		if (arg->tag <= NODE_STRLIT)
+			continue;
+
+		gpr = regs ? regs[i] : x86_arg_reg(i);
+		seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+		seq->pushed--;
+
+		out.instruction = X86_POP;
+		out.size = 0;
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = gpr;
+
+		/* Move a value which was just pushed directly. */
+		vector_get(&seq->seq, seq->seq.nmembs - 1, &last);
+		if (last.instruction == X86_PUSH &&
+		    last.op1.type == X86_OPERAND_GPR) {
+			vector_pop(&seq->seq, NULL);
+			if (last.op1.gpr == gpr)
+				continue;
+
+			out.instruction = X86_MOV;
+			out.size = FCC_WORD_SIZE;
+			out.op1.gpr = last.op1.gpr;
+			out.op2.type = X86_OPERAND_GPR;
+			out.op2.gpr = gpr;
+		}
+		vector_append(&seq->seq, &out);
+	}
+
+	op.op_type = IR_OPERAND_AST_NODE;
+	for (i = 0; i < nreg; ++i) {
+		arg = nth_arg(args, i);
+		if (arg->tag > NODE_STRLIT)
+			continue;
+
+		op.node = arg;
+		x86_load_value(seq, &op, regs ? regs[i] : x86_arg_reg(i));
+	}
+}
+
+/*
+ * x86_call_misaligned:
+ * Check if the stack would not be 16-byte aligned at a call which
+ * pushes `nstack` arguments, as required by the x86-64 ABI.
+ */
+static int x86_call_misaligned(struct x86_sequence *seq, int nstack)
+{
+	size_t depth;
+
+	depth = seq->frame + FCC_WORD_SIZE
+	        * (seq->tmp_reg.size + seq->pushed + nstack);
+	return fcc_m64 && !ALIGNED(depth, 16);
+}
+
+/*
+ * x86_pop_pad:
+ * Return the number of bytes of padding inserted before
+ * the stack arguments of the innermost pending call.
+ */
+static int x86_pop_pad(struct x86_sequence *seq)
+{
+	int pad;
+
+	pad = seq->pads & 1;
+	seq->pads >>= 1;
+	seq->pushed -= pad;
+	return pad * FCC_WORD_SIZE;
+}
+
+/*
+ * Registers holding the destination and source of an expanded builtin.
+ * Neither is used by the block copy itself.
+ */
+static const int x86_builtin_regs[] = { X86_GPR_DX, X86_GPR_AX };
+
+/*
+ * x86_expand_builtin:
+ * Expand call `i` to builtin function `b` inline. The constant arguments
+ * are read directly, and the rest are loaded into `x86_builtin_regs`.
+ */
+static void x86_expand_builtin(struct x86_sequence *seq,
+                               struct ir_instruction *i, int b)
+{
+	struct x86_operand dst, src;
+	struct ast_node *fill;
+	size_t size;
+
+	dst.type = X86_OPERAND_OFFSET;
+	dst.offset.gpr = x86_builtin_regs[0];
+	dst.offset.off = 0;
+	src.type = X86_OPERAND_OFFSET;
+	src.offset.gpr = x86_builtin_regs[1];
+	src.offset.off = 0;
+
+	size = nth_arg(i->rhs.node, 2)->value;
+	if (b == BUILTIN_MEMCPY) {
+		x86_load_register_args(seq, i->rhs.node, 2, x86_builtin_regs);
+		x86_block_copy(seq, &dst, &src, 0, size);
+	} else {
+		fill = nth_arg(i->rhs.node, 1);
+		x86_load_register_args(seq, i->rhs.node, 1, x86_builtin_regs);
+		x86_block_copy(seq, &dst, NULL, fill->value, size);
+	}
+
+	memset(seq->gprs, 0, sizeof seq->gprs);
+
+	/* Both functions return their destination. */
+	tmp_reg_push(seq, i->target, dst.offset.gpr);
+}
+
+/*
+ * translate_function_call:
+ * Translate a function call to x86 and fix the stack afterwards.
+ */
+static void translate_function_call(struct x86_sequence *seq,
+                                    struct ir_instruction *i,
+                                    int cond)
+{
+	struct x86_instruction out;
+	int argc, nreg, nstack, pad, b;
+
+	if ((b = builtin_expands(i->lhs.node, i->rhs.node)) != -1) {
+		x86_expand_builtin(seq, i, b);
+		return;
+	}
+
+	argc = ir_num_args(i->rhs.node);
+	nreg = ir_register_args(&i->lhs.node->expr_flags, i->rhs.node);
+	nstack = ir_stack_words(i->rhs.node, nreg);
+	x86_load_register_args(seq, i->rhs.node, nreg, NULL);
+
+	/* Calls with stack arguments were aligned by their first push. */
+	pad = 0;
+	if (argc > nreg) {
+		if (fcc_m64)
+			pad = x86_pop_pad(seq);
+	} else if (x86_call_misaligned(seq, 0)) {
+		pad = FCC_WORD_SIZE;
+		x86_grow_stack(seq, pad);
+	}
+
+	out.instruction = X86_CALL;
+	out.size = 0;
+	out.op1.type = X86_OPERAND_FUNC;
+	out.op1.func = (char *)builtin_call_name(i->lhs.node->lexeme);
+	vector_append(&seq->seq, &out);
+
+	/* The argument and scratch registers are caller-saved. */
+	memset(seq->gprs, 0, sizeof seq->gprs);
+
+	/* Correct for argument pushes. */
+	seq->pushed -= nstack;
+	x86_shrink_stack(seq, nstack * FCC_WORD_SIZE + pad);
+
+	tmp_reg_push(seq, i->target, X86_GPR_AX);
+	(void)cond;
+}
+
+/*
+ * translate_test_instruction:
+ * Translate an IR test instruction to x86.
+ */
+static void translate_test_instruction(struct x86_sequence *seq,
+                                       struct ir_instruction *i,
+                                       int cond)
+{
+	struct x86_instruction out;
+	int gpr;
+
+	x86_gpr_any_reset(seq);
+	out.instruction = X86_TEST;
+	out.size = x86_operand_size(seq, &i->lhs);
+
+	if (!x86_direct_operand(seq, &i->lhs, out.size, &out.op2)) {
+		if (i->lhs.op_type == IR_OPERAND_AST_NODE)
+			gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
+		else
+			gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+		out.op2.type = X86_OPERAND_GPR;
+		out.op2.gpr = gpr;
+		seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+	}
+
+	if (i->rhs.node) {
+		ir_to_x86_operand(seq, &i->rhs, &out.op1, 0);
+	} else if (out.op2.type == X86_OPERAND_GPR) {
+		out.op1 = out.op2;
+	} else {
+		/* A value in memory is compared with zero instead. */
+		out.instruction = X86_CMP;
+		out.op1.type = X86_OPERAND_CONSTANT;
+		out.op1.constant = 0;
+	}
+
+	vector_append(&seq->seq, &out);
+	(void)cond;
+}
+
+/*
+ * x86_pad_args:
+ * Pad the stack before the first push of a call's `nstack` words of
+ * stack arguments so that it is aligned once all of them are pushed.
+ */
+static void x86_pad_args(struct x86_sequence *seq, int nstack)
+{
+	if (!fcc_m64 || !nstack)
+		return;
+
+	seq->pads <<= 1;
+	if (x86_call_misaligned(seq, nstack)) {
+		x86_grow_stack(seq, FCC_WORD_SIZE);
+		seq->pads |= 1;
+		seq->pushed++;
+	}
+}
+
+/*
+ * x86_load_member:
+ * Load the value of struct member `op`, of type `type`, into a register.
+ */
+static int x86_load_member(struct x86_sequence *seq, struct ir_operand *op,
+                           struct type_information *type)
+{
+	struct x86_instruction out;
+	int gpr;
+
+	x86_object_operand(seq, op, &out.op1, X86_GPR_ANY);
+	gpr = out.op1.offset.gpr == X86_GPR_BP ? x86_gpr_any_get(seq)
+	                                        : out.op1.offset.gpr;
+
+	out.instruction = X86_MOV;
+	out.size = type_size(type);
+	if (out.size < 4) {
+		out.instruction = type->type_flags & QUAL_UNSIGNED
+		                  ? X86_MOVZB : X86_MOVSB;
+		out.size = 4;
+	}
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = gpr;
+	vector_append(&seq->seq, &out);
+
+	seq->gprs[gpr].tag = X86_GPRVAL_NONE;
+	return gpr;
+}
+
+/*
+ * x86_push_struct:
+ * Copy the struct argument of push instruction `i` onto the stack.
+ */
+static void x86_push_struct(struct x86_sequence *seq,
+                            struct ir_instruction *i)
+{
+	struct x86_operand dst, src;
+	size_t size, words;
+
+	size = type_size(&i->type);
+	words = ALIGN(size, FCC_WORD_SIZE) / FCC_WORD_SIZE;
+
+	x86_object_operand(seq, &i->lhs, &src, X86_GPR_DX);
+	x86_pad_args(seq, i->rhs.reg);
+	x86_grow_stack(seq, words * FCC_WORD_SIZE);
+
+	dst.type = X86_OPERAND_OFFSET;
+	dst.offset.off = 0;
+	dst.offset.gpr = X86_GPR_SP;
+	x86_block_copy(seq, &dst, &src, 0, size);
+	seq->pushed += words;
+}
+
+/*
+ * translate_push_instruction:
+ * Translate a push instruction to x86.
+ */
+static void translate_push_instruction(struct x86_sequence *seq,
+                                       struct ir_instruction *i,
+                                       int cond)
+{
+	struct x86_instruction out;
+	int gpr;
+
+	out.instruction = X86_PUSH;
+	out.size = 0;
+
+	x86_gpr_any_reset(seq);
+	if (x86_is_struct(&i->type)) {
+		x86_push_struct(seq, i);
+		return;
+	}
+
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE) {
+		if (i->lhs.node->tag == NODE_CONSTANT) {
+			out.op1.type = X86_OPERAND_CONSTANT;
+			out.op1.constant = i->lhs.node->value;
+		} else {
+			gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
+			out.op1.type = X86_OPERAND_GPR;
+			out.op1.constant = gpr;
+		}
+	} else if (i->lhs.op_type == IR_OPERAND_TEMP_REG) {
+		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.constant = gpr;
+	} else {
+		gpr = x86_load_member(seq, &i->lhs, &i->type);
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.constant = gpr;
+	}
+
+	x86_pad_args(seq, i->rhs.reg);
+	vector_append(&seq->seq, &out);
+	seq->pushed++;
+	(void)cond;
+}
+
+static void translate_load_instruction(struct x86_sequence *seq,
+                                       struct ir_instruction *i,
+                                       int cond)
+{
+	int gpr;
+
+	x86_gpr_any_reset(seq);
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE)
+		gpr = x86_load_value(seq, &i->lhs, X86_GPR_AX);
+	else
+		gpr = x86_load_member(seq, &i->lhs, &i->type);
+	tmp_reg_push(seq, i->target, gpr);
+	(void)cond;
+}
+
+static void x86_add_jump(struct x86_sequence *seq, int type, int label);
+
+/* x86_ir_label: return the x86 label corresponding to IR label `label` */
+static int x86_ir_label(struct x86_sequence *seq, int label)
+{
+	if (label == IR_COND_TARGET)
+		return seq->cond_target;
+
+	return seq->ir_labels + label;
+}
+
+/*
+ * translate_jump_instruction:
+ * Translate an IR jump on the result of a comparison to x86.
+ */
+static void translate_jump_instruction(struct x86_sequence *seq,
+                                       struct ir_instruction *i,
+                                       int cond)
+{
+	int type;
+
+	if (i->lhs.reg == -1)
+		type = X86_JMP;
+	else if (i->rhs.reg)
+		type = x86_jumps[i->lhs.reg];
+	else
+		type = x86_inverse_jumps[i->lhs.reg];
+
+	x86_add_jump(seq, type, x86_ir_label(seq, i->target));
+	(void)cond;
+}
+
+static void translate_label_instruction(struct x86_sequence *seq,
+                                        struct ir_instruction *i,
+                                        int cond)
+{
+	x86_add_label(seq, x86_ir_label(seq, i->target));
+	(void)cond;
+}
+
+/*
+ * translate_setcc_instruction:
+ * Set the value of a logical expression in eax.
+ */
+static void translate_setcc_instruction(struct x86_sequence *seq,
+                                        struct ir_instruction *i,
+                                        int cond)
+{
+	struct x86_instruction out;
+
+	seq->gprs[X86_GPR_AX].tag = X86_GPRVAL_NONE;
+	if (i->lhs.reg == -1) {
+		out.instruction = X86_MOV;
+		out.size = 4;
+		out.op1.type = X86_OPERAND_CONSTANT;
+		out.op1.constant = i->rhs.reg;
+		out.op2.type = X86_OPERAND_GPR;
+		out.op2.gpr = X86_GPR_AX;
+		vector_append(&seq->seq, &out);
+		return;
+	}
+
+	out.instruction = i->rhs.reg ? x86_sets[i->lhs.reg]
+	                             : x86_inverse_sets[i->lhs.reg];
+	out.size = 0;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_AL;
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_MOVZB;
+	out.size = 4;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_AX;
+	vector_append(&seq->seq, &out);
+
+	(void)cond;
+}
+
+static void translate_result_instruction(struct x86_sequence *seq,
+                                         struct ir_instruction *i,
+                                         int cond)
+{
+	tmp_reg_push(seq, i->target, X86_GPR_AX);
+	(void)cond;
+}
+
+/*
+ * translate_value_instruction:
+ * Set the value of a conditional expression in eax.
+ */
+static void translate_value_instruction(struct x86_sequence *seq,
+                                        struct ir_instruction *i,
+                                        int cond)
+{
+	int gpr;
+
+	x86_gpr_any_reset(seq);
+	if (i->lhs.op_type == IR_OPERAND_AST_NODE) {
+		x86_load_value(seq, &i->lhs, X86_GPR_AX);
+	} else if (i->lhs.op_type == IR_OPERAND_TEMP_REG) {
+		x86_load_tmp_reg(seq, &i->lhs, X86_GPR_AX);
+	} else {
+		gpr = x86_load_member(seq, &i->lhs, &i->type);
+		if (gpr != X86_GPR_AX)
+			x86_emit(seq, X86_MOV, FCC_WORD_SIZE, x86_gpr_op(gpr),
+			         x86_gpr_op(X86_GPR_AX));
+	}
+	seq->gprs[X86_GPR_AX].tag = X86_GPRVAL_NONE;
+	(void)cond;
+}
+
+/* Instructions taken by two moves of constants and a two uop cmov. */
+#define X86_SELECT_CMOV_COST 4
+
+/*
+ * x86_select_constants:
+ * Set eax to `t` if comparison `cmp` is true or `f` otherwise, using the
+ * flags as a 0 or 1 which is scaled into a mask and offset. Return 0 if
+ * this takes more instructions than selecting the values with a cmov.
+ */
+static int x86_select_constants(struct x86_sequence *seq, int cmp,
+                                long t, long f, int size)
+{
+	long diff, base;
+	int set, cost;
+
+	diff = t - f;
+	if (size == 4) {
+		/* Only the low 32 bits of the result matter. */
+		diff = (int)diff;
+		t = (int)t;
+		f = (int)f;
+	} else if (t != (int)t || f != (int)f || diff != (int)diff) {
+		return 0;
+	}
+
+	/* A difference of one is just the flag, added to the smaller value. */
+	set = diff == -1 ? x86_inverse_sets[cmp] : x86_sets[cmp];
+	base = diff == -1 ? t : f;
+	cost = 2 + (diff != 1 && diff != -1) * 2 + !!base;
+	if (cost > X86_SELECT_CMOV_COST)
+		return 0;
+
+	x86_emit(seq, set, 0, x86_gpr_op(X86_GPR_AL), x86_gpr_op(X86_GPR_AL));
+	x86_emit(seq, X86_MOVZB, 4, x86_gpr_op(X86_GPR_AL),
+	         x86_gpr_op(X86_GPR_AX));
+	if (diff != 1 && diff != -1) {
+		x86_emit(seq, X86_NEG, size, x86_gpr_op(X86_GPR_AX),
+		         x86_gpr_op(X86_GPR_AX));
+		x86_emit(seq, X86_AND, size, x86_constant_op(diff),
+		         x86_gpr_op(X86_GPR_AX));
+	}
+	if (base)
+		x86_emit(seq, X86_ADD, size, x86_constant_op(base),
+		         x86_gpr_op(X86_GPR_AX));
+	return 1;
+}
+
+/*
+ * translate_select_instruction:
+ * Select the value of a conditional expression from the flags set by the
+ * comparison before it, without branching.
+ */
+static void translate_select_instruction(struct x86_sequence *seq,
+                                         struct ir_instruction *i,
+                                         int cond)
+{
+	struct x86_instruction out;
+	int size;
+
+	size = type_size(&i->type) > 4 ? 8 : 4;
+	x86_gpr_any_reset(seq);
+	seq->gprs[X86_GPR_AX].used = 1;
+
+	if (i->lhs.node->tag != NODE_CONSTANT ||
+	    i->rhs.node->tag != NODE_CONSTANT ||
+	    !x86_select_constants(seq, i->lhs.off, i->lhs.node->value,
+	                          i->rhs.node->value, size)) {
+		/* Neither load changes the flags. */
+		x86_load_value(seq, &i->rhs, X86_GPR_AX);
+		out.instruction = x86_cmovs[i->lhs.off];
+		out.size = size;
+		if (!x86_direct_operand(seq, &i->lhs, size, &out.op1)) {
+			out.op1.type = X86_OPERAND_GPR;
+			out.op1.gpr = x86_load_value(seq, &i->lhs,
+			                             X86_GPR_ANY);
+		}
+		out.op2.type = X86_OPERAND_GPR;
+		out.op2.gpr = X86_GPR_AX;
+		vector_append(&seq->seq, &out);
+	}
+
+	seq->gprs[X86_GPR_AX].tag = X86_GPRVAL_NONE;
+	tmp_reg_push(seq, i->target, X86_GPR_AX);
+	(void)cond;
+}
+
+static void (*tr_func[])(struct x86_sequence *, struct ir_instruction *, int) = {
+	[EXPR_ASSIGN]                   = translate_assign_instruction,
+	[EXPR_LOGICAL_OR]               = NULL,
+	[EXPR_LOGICAL_AND]              = NULL,
+	[EXPR_OR]                       = translate_arithmetic_instruction,
+	[EXPR_XOR]                      = translate_arithmetic_instruction,
+	[EXPR_AND]                      = translate_arithmetic_instruction,
+	[EXPR_EQ]                       = translate_comparison_instruction,
+	[EXPR_NE]                       = translate_comparison_instruction,
+	[EXPR_LT]                       = translate_comparison_instruction,
+	[EXPR_GT]                       = translate_comparison_instruction,
+	[EXPR_LE]                       = translate_comparison_instruction,
+	[EXPR_GE]                       = translate_comparison_instruction,
+	[EXPR_LSHIFT]                   = translate_shift_instruction,
+	[EXPR_RSHIFT]                   = translate_shift_instruction,
+	[EXPR_ADD]                      = translate_arithmetic_instruction,
+	[EXPR_SUB]                      = translate_arithmetic_instruction,
+	[EXPR_MULT]                     = translate_multiplicative_instruction,
+	[EXPR_DIV]                      = translate_division_instruction,
+	[EXPR_MOD]                      = translate_division_instruction,
+	[EXPR_ADDRESS]                  = translate_address_instruction,
+	[EXPR_DEREFERENCE]              = translate_dereference_instruction,
+	[EXPR_UNARY_PLUS]               = translate_unary_instruction,
+	[EXPR_UNARY_MINUS]              = translate_unary_instruction,
+	[EXPR_NOT]                      = translate_unary_instruction,
+	[EXPR_LOGICAL_NOT]              = NULL,
+	[EXPR_FUNC]                     = translate_function_call,
+	[IR_TEST]                       = translate_test_instruction,
+	[IR_PUSH]                       = translate_push_instruction,
+	[IR_LOAD]                       = translate_load_instruction,
+	[IR_JUMP]                       = translate_jump_instruction,
+	[IR_LABEL]                      = translate_label_instruction,
+	[IR_SETCC]                      = translate_setcc_instruction,
+	[IR_RESULT]                     = translate_result_instruction,
+	[IR_INDEX]                      = translate_index_instruction,
+	[IR_VALUE]                      = translate_value_instruction,
+	[IR_SELECT]                     = translate_select_instruction,
+	[IR_UPDATE]                     = translate_update_instruction
+};
+
+/*
+ * x86_add_jump:
+ * Create a jump instruction of type `type` to jump to label ID `label`.
+ */
+static void x86_add_jump(struct x86_sequence *seq, int type, int label)
 {
-	return __translate_generic(seq, i, x86_expr_instructions[i->tag], 1);
+	struct x86_instruction out;
+
+	out.instruction = type;
+	out.size = 0;
+	out.op1.type = X86_OPERAND_LABEL;
+	out.op1.label = label;
+
+	vector_append(&seq->seq, &out);
+}
+
+/*
+ * x86_end_jump:
+ * Remove an unconditional jump to `label` from the end of the sequence,
+ * for when the label is about to be placed immediately after it.
+ */
+static void x86_end_jump(struct x86_sequence *seq, int label)
+{
+	struct x86_instruction *last;
+
+	last = (struct x86_instruction *)seq->seq.data + seq->seq.nmembs - 1;
+	if (last->instruction == X86_JMP &&
+	    last->op1.type == X86_OPERAND_LABEL && last->op1.label == label)
+		vector_pop(&seq->seq, NULL);
+}
+
+/*
+ * x86_add_label:
+ * Create an instruction represting a label with ID `label`.
+ */
+static void x86_add_label(struct x86_sequence *seq, int label)
+{
+	struct x86_instruction out;
+
+	out.instruction = X86_LABEL;
+	out.size = 0;
+	out.lnum = label;
+	vector_append(&seq->seq, &out);
+
+	/* Registers may hold different values on each path to the label. */
+	memset(seq->gprs, 0, sizeof seq->gprs);
+}
+
+/*
+ * x86_translate_expr:
+ * Translate a single expression statement to x86.
+ * If `cond` is set, the final instruction only needs to set the flags.
+ */
+static void x86_translate_expr(struct x86_sequence *seq,
+                               struct ir_sequence *ir,
+                               int cond)
+{
+	struct ir_instruction *i, *last;
+	int flags;
+
+	seq->ir_labels = seq->label;
+	seq->label += ir->labels;
+
+	last = (struct ir_instruction *)ir->seq.data + ir->seq.nmembs - 1;
+	VECTOR_ITER(&ir->seq, i) {
+		/* Comparisons used by a jump, setcc or select only set flags. */
+		if (i == last)
+			flags = cond;
+		else
+			flags = i[1].tag == IR_JUMP || i[1].tag == IR_SETCC ||
+			        i[1].tag == IR_SELECT;
+		tr_func[i->tag](seq, i, flags);
+
+		/* Record the types of values for later widening. */
+		if (i->target != -1 &&
+		    (i->tag < IR_TEST || i->tag == IR_LOAD ||
+		     i->tag == IR_RESULT || i->tag == IR_INDEX ||
+		     i->tag == IR_SELECT || i->tag == IR_UPDATE))
+			seq->tmp_reg.types[i->target] = i->type;
+	}
+}
+
+/*
+ * x86_translate_branch:
+ * Translate condition `expr` to a sequence of x86 instructions
+ * which jump to `label` if its truth value is `jump_if`.
+ */
+static void x86_translate_branch(struct x86_sequence *seq,
+                                 struct ir_sequence *ir,
+                                 struct ast_node *expr,
+                                 int label, int jump_if)
+{
+	ir_clear(ir);
+	ir_parse_cond(ir, expr, jump_if);
+	seq->cond_target = label;
+	x86_translate_expr(seq, ir, 0);
+	ir_clear(ir);
+}
+
+/*
+ * x86_load_expr:
+ * Evaluate expression `expr` and load its value into register `gpr`.
+ */
+static void x86_load_expr(struct x86_sequence *seq,
+                          struct ir_sequence *ir,
+                          struct ast_node *expr,
+                          int gpr)
+{
+	struct ir_operand op;
+
+	if (expr->tag <= NODE_STRLIT) {
+		/* expr is a terminal, not an expression */
+		op.op_type = IR_OPERAND_AST_NODE;
+		op.node = expr;
+		x86_load_value(seq, &op, gpr);
+	} else {
+		op.op_type = IR_OPERAND_TEMP_REG;
+		op.reg = ir_parse_value(ir, expr);
+		x86_translate_expr(seq, ir, 0);
+		x86_load_tmp_reg(seq, &op, gpr);
+		ir_clear(ir);
+	}
+}
+
+/*
+ * x86_translate_cold:
+ * Translate statements `g` in the function's cold area, starting at label
+ * `label` and returning to label `back` in the main sequence.
+ */
+static void x86_translate_cold(struct x86_sequence *seq,
+                               struct graph_node *g,
+                               int label, int back)
+{
+	struct vector hot;
+
+	x86_begin_cold(seq, &hot);
+	x86_add_label(seq, label);
+	x86_translate(seq, g);
+	x86_add_jump(seq, X86_JMP, back);
+	x86_end_cold(seq, &hot);
+}
+
+/*
+ * x86_translate_cond_profiled:
+ * Lay out conditional `cond` according to the profile. A rarely taken branch
+ * is moved to the cold area, and otherwise the more frequently taken branch
+ * falls through. Return 0 if the default layout should be used.
+ */
+static int x86_translate_cond_profiled(struct x86_sequence *seq,
+                                       struct ir_sequence *ir,
+                                       struct asg_node_conditional *cond)
+{
+	struct graph_node *hot, *cold;
+	long long total, taken;
+	int jcold, jsucc, jend;
+
+	if (profile_branch_cold(cond, 0) ||
+	    (cond->fail && profile_branch_cold(cond, 1))) {
+		cold = profile_branch_cold(cond, 0) ? cond->succ : cond->fail;
+		hot = cold == cond->succ ? cond->fail : cond->succ;
+		jcold = seq->label++;
+		jend = seq->label++;
+
+		x86_translate_branch(seq, ir, cond->cond, jcold,
+		                     cold == cond->succ);
+		x86_translate(seq, hot);
+		x86_translate_cold(seq, cold, jcold, jend);
+		x86_add_label(seq, jend);
+		return 1;
+	}
+
+	if (!cond->fail || cond->prof < 0)
+		return 0;
+
+	total = profile_count(cond->prof + PROF_ENTRY);
+	taken = profile_count(cond->prof + PROF_TAKEN);
+	if (taken < 0 || total < 0 || taken >= total - taken)
+		return 0;
+
+	/* The else branch is hotter, so it falls through instead. */
+	jsucc = seq->label++;
+	jend = seq->label++;
+	x86_translate_branch(seq, ir, cond->cond, jsucc, 1);
+	x86_translate(seq, cond->fail);
+	x86_add_jump(seq, X86_JMP, jend);
+	x86_add_label(seq, jsucc);
+	x86_translate(seq, cond->succ);
+	x86_add_label(seq, jend);
+	return 1;
+}
+
+void x86_translate_cond(struct x86_sequence *seq,
+                        struct ir_sequence *ir,
+                        struct asg_node_conditional *cond)
+{
+	int jfail, jend;
+
+	x86_count(seq, cond->prof, PROF_ENTRY);
+	if (x86_use_profile(seq) && x86_translate_cond_profiled(seq, ir, cond))
+		return;
+
+	jfail = seq->label++;
+	jend = cond->fail ? seq->label++ : -1;
+
+	x86_translate_branch(seq, ir, cond->cond, jfail, 0);
+	x86_count(seq, cond->prof, PROF_TAKEN);
+	x86_translate(seq, cond->succ);
+
+	if (cond->fail) {
+		x86_add_jump(seq, X86_JMP, jend);
+		x86_add_label(seq, jfail);
+		x86_translate(seq, cond->fail);
+	}
+
+	x86_add_label(seq, cond->fail ? jend : jfail);
+}
+
+/*
+ * x86_vec_index:
+ * Load the induction variable of loop `v` into %ecx, which indexes
+ * the elements accessed by the loop.
+ */
+static void x86_vec_index(struct x86_sequence *seq, struct vec_loop *v)
+{
+	struct x86_instruction out;
+	struct local *l;
+
+	l = local_find(seq->locals, v->ivar->lexeme);
+	out.instruction = fcc_m64 ? X86_MOVSLQ : X86_MOV;
+	out.size = fcc_m64 ? 0 : 4;
+	out.op1.type = X86_OPERAND_OFFSET;
+	out.op1.offset.off = l->offset;
+	out.op1.offset.gpr = X86_GPR_BP;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_CX;
+	vector_append(&seq->seq, &out);
+}
+
+/*
+ * x86_vec_element:
+ * Load pointer `ptr` into %eax and set `op` to address its element
+ * at the index in %ecx.
+ */
+static void x86_vec_element(struct x86_sequence *seq, struct vec_loop *v,
+                            struct ast_node *ptr, struct x86_operand *op)
+{
+	struct x86_instruction out;
+	struct local *l;
+
+	l = local_find(seq->locals, ptr->lexeme);
+	out.instruction = X86_MOV;
+	out.size = FCC_WORD_SIZE;
+	out.op1.type = X86_OPERAND_OFFSET;
+	out.op1.offset.off = l->offset;
+	out.op1.offset.gpr = X86_GPR_BP;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_AX;
+	vector_append(&seq->seq, &out);
 
-	(void)cond;
+	op->type = X86_OPERAND_INDEX;
+	op->index.base = X86_GPR_AX;
+	op->index.index = X86_GPR_CX;
+	op->index.scale = v->elem;
+	op->index.disp = 0;
 }
 
 /*
- * translate_shift_instruction:
- * Translate a bitshift IR instruction to x86.
+ * x86_vec_remaining:
+ * Jump to `label` if `cmp` applied to the loop bound of `v` and the
+ * end of the vector starting at the index in %ecx holds.
  */
-static void translate_shift_instruction(struct x86_sequence *seq,
-                                        struct ir_instruction *i,
-                                        int cond)
+static void x86_vec_remaining(struct x86_sequence *seq, struct vec_loop *v,
+                              int cmp, int label)
 {
 	struct x86_instruction out;
+	struct local *l;
 
-	if (i->lhs.op_type == IR_OPERAND_AST_NODE)
-		x86_load_value(seq, &i->lhs, X86_GPR_AX);
-	else
-		x86_load_tmp_reg(seq, &i->lhs, X86_GPR_AX);
-
-	out.instruction = i->tag == EXPR_LSHIFT
-	                  ? X86_SHL
-	                  : (i->type.type_flags & QUAL_UNSIGNED
-	                     ? X86_SHR : X86_SAR);
-	out.size = type_size(&i->type);
+	out.instruction = X86_LEA;
+	out.size = 4;
+	out.op1.type = X86_OPERAND_OFFSET;
+	out.op1.offset.off = v->lanes;
+	out.op1.offset.gpr = X86_GPR_CX;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_DX;
+	vector_append(&seq->seq, &out);
 
-	/* Number of bits to shift by is stored in cl (low byte of ecx) */
-	if (i->rhs.op_type == IR_OPERAND_AST_NODE) {
-		if (i->rhs.node->tag == NODE_CONSTANT) {
-			/* Unless it's a constant, which can be used directly */
-			out.op1.type = X86_OPERAND_CONSTANT;
-			out.op1.constant = i->rhs.node->value;
-		} else {
-			x86_load_value(seq, &i->rhs, X86_GPR_CX);
-			out.op1.type = X86_OPERAND_GPR;
-			out.op1.gpr = X86_GPR_CL;
-		}
+	out.instruction = X86_CMP;
+	if (v->limit->tag == NODE_CONSTANT) {
+		out.op1.type = X86_OPERAND_CONSTANT;
+		out.op1.constant = v->limit->value;
 	} else {
-		x86_load_tmp_reg(seq, &i->rhs, X86_GPR_CX);
-		out.op1.type = X86_OPERAND_GPR;
-		out.op1.gpr = X86_GPR_CL;
+		l = local_find(seq->locals, v->limit->lexeme);
+		out.op1.type = X86_OPERAND_OFFSET;
+		out.op1.offset.off = l->offset;
+		out.op1.offset.gpr = X86_GPR_BP;
 	}
-
-	out.op2.type = X86_OPERAND_GPR;
-	out.op2.gpr = X86_GPR_AX;
-	seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
-
 	vector_append(&seq->seq, &out);
-	tmp_reg_push(seq, i->target, X86_GPR_AX);
 
-	(void)cond;
+	x86_add_jump(seq, cmp, label);
 }
 
 /*
- * translate_comparison_instruction:
- * Translate a comparison instruction with value into x86 instruction.
+ * x86_vec_alias_check:
+ * Jump to `label` if the elements of pointers `p` and `q` which are
+ * accessed by the remaining iterations of loop `v` overlap.
  */
-static void translate_comparison_instruction(struct x86_sequence *seq,
-                                             struct ir_instruction *i,
-                                             int cond)
+static void x86_vec_alias_check(struct x86_sequence *seq, struct vec_loop *v,
+                                struct ast_node *p, struct ast_node *q,
+                                int label)
 {
 	struct x86_instruction out;
+	struct local *l;
 
-	__translate_generic(seq, i, X86_CMP, 0);
+	/* %eax = |p - q| */
+	l = local_find(seq->locals, p->lexeme);
+	out.instruction = X86_MOV;
+	out.size = FCC_WORD_SIZE;
+	out.op1.type = X86_OPERAND_OFFSET;
+	out.op1.offset.off = l->offset;
+	out.op1.offset.gpr = X86_GPR_BP;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_AX;
+	vector_append(&seq->seq, &out);
 
-	if (cond)
-		return;
+	l = local_find(seq->locals, q->lexeme);
+	out.instruction = X86_SUB;
+	out.op1.offset.off = l->offset;
+	vector_append(&seq->seq, &out);
 
-	out.instruction = x86_expr_instructions[i->tag];
-	out.size = 0;
+	out.instruction = X86_MOV;
 	out.op1.type = X86_OPERAND_GPR;
-	out.op1.gpr = X86_GPR_AL;
+	out.op1.gpr = X86_GPR_AX;
+	out.op2.gpr = X86_GPR_DX;
+	vector_append(&seq->seq, &out);
 
+	out.instruction = X86_SAR;
+	out.op1.type = X86_OPERAND_CONSTANT;
+	out.op1.constant = FCC_WORD_SIZE * 8 - 1;
 	vector_append(&seq->seq, &out);
 
-	out.instruction = X86_MOVZB;
-	out.op2.type = X86_OPERAND_GPR;
+	out.instruction = X86_XOR;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_DX;
 	out.op2.gpr = X86_GPR_AX;
+	vector_append(&seq->seq, &out);
 
-	seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
+	out.instruction = X86_SUB;
 	vector_append(&seq->seq, &out);
-	tmp_reg_push(seq, i->target, X86_GPR_AX);
+
+	/* %edx = (n - i) * elem */
+	out.instruction = X86_MOV;
+	out.size = 4;
+	if (v->limit->tag == NODE_CONSTANT) {
+		out.op1.type = X86_OPERAND_CONSTANT;
+		out.op1.constant = v->limit->value;
+	} else {
+		l = local_find(seq->locals, v->limit->lexeme);
+		out.op1.type = X86_OPERAND_OFFSET;
+		out.op1.offset.off = l->offset;
+		out.op1.offset.gpr = X86_GPR_BP;
+	}
+	out.op2.gpr = X86_GPR_DX;
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_SUB;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_CX;
+	vector_append(&seq->seq, &out);
+
+	if (v->elem == 4) {
+		out.instruction = X86_SHL;
+		out.op1.type = X86_OPERAND_CONSTANT;
+		out.op1.constant = 2;
+		vector_append(&seq->seq, &out);
+	}
+
+	out.instruction = X86_CMP;
+	out.size = FCC_WORD_SIZE;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_DX;
+	out.op2.gpr = X86_GPR_AX;
+	vector_append(&seq->seq, &out);
+
+	x86_add_jump(seq, X86_JB, label);
 }
 
-/*
- * translate_multiplicative_instruction:
- * Translate a multiplication from IR to x86.
- */
-static void translate_multiplicative_instruction(struct x86_sequence *seq,
-                                                 struct ir_instruction *i,
-                                                 int cond)
+/* x86_vec_insn: apply SSE instruction `instruction` to `src` and `xmm` */
+static void x86_vec_insn(struct x86_sequence *seq, int instruction,
+                         struct x86_operand *src, int xmm)
 {
 	struct x86_instruction out;
-	struct x86_operand *op;
-	int set, gpr;
 
-	out.instruction = X86_IMUL;
+	out.instruction = instruction;
 	out.size = 0;
-	out.op3.type = X86_OPERAND_GPR;
-	set = 0;
+	out.op1 = *src;
+	out.op2.type = X86_OPERAND_XMM;
+	out.op2.xmm = xmm;
+	vector_append(&seq->seq, &out);
+}
 
-	x86_gpr_any_reset(seq);
-	if (i->lhs.op_type == IR_OPERAND_AST_NODE) {
-		switch (i->lhs.node->tag) {
-		case NODE_IDENTIFIER:
-			gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
-			out.op2.type = X86_OPERAND_GPR;
-			out.op2.gpr = gpr;
-			out.op3.gpr = gpr;
-			set = 1;
-			break;
-		case NODE_CONSTANT:
-			ir_to_x86_operand(seq, &i->lhs, &out.op1, 0);
-			break;
-		}
+/* x86_vec_inv_reg: return the register holding loop invariant `n` */
+static int x86_vec_inv_reg(int n)
+{
+	return VEC_REGS - 1 - n;
+}
+
+/*
+ * x86_vec_splat:
+ * Broadcast invariant `inv` of loop `v` to every lane of register `xmm`.
+ */
+static void x86_vec_splat(struct x86_sequence *seq, struct vec_loop *v,
+                          struct vec_invariant *inv, int xmm)
+{
+	struct x86_instruction out;
+	struct ir_operand op;
+
+	if (inv->name) {
+		op.op_type = IR_OPERAND_AST_NODE;
+		op.node = inv->node;
+		x86_load_value(seq, &op, X86_GPR_AX);
 	} else {
-		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+		out.instruction = X86_MOV;
+		out.size = 4;
+		out.op1.type = X86_OPERAND_CONSTANT;
+		out.op1.constant = inv->value;
 		out.op2.type = X86_OPERAND_GPR;
-		out.op2.gpr = gpr;
-		out.op3.gpr = gpr;
-		set = 1;
+		out.op2.gpr = X86_GPR_AX;
+		vector_append(&seq->seq, &out);
 	}
 
-	if (set)
-		op = &out.op1;
-	else
-		op = &out.op2;
-
-	if (i->rhs.op_type == IR_OPERAND_AST_NODE) {
-		switch (i->rhs.node->tag) {
-		case NODE_IDENTIFIER:
-			gpr = x86_load_value(seq, &i->rhs, X86_GPR_ANY);
-			op->type = X86_OPERAND_GPR;
-			op->gpr = gpr;
-			if (!set)
-				out.op3.gpr = gpr;
-			break;
-		case NODE_CONSTANT:
-			ir_to_x86_operand(seq, &i->rhs, &out.op1, 0);
-			break;
-		}
-	} else {
-		gpr = x86_load_tmp_reg(seq, &i->rhs, X86_GPR_ANY);
-		op->type = X86_OPERAND_GPR;
-		op->gpr = gpr;
-		if (!set)
-			out.op3.gpr = gpr;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_AX;
+	x86_vec_insn(seq, X86_MOVD, &out.op1, xmm);
+
+	out.op1.type = X86_OPERAND_XMM;
+	out.op1.xmm = xmm;
+	if (v->elem == 1) {
+		x86_vec_insn(seq, X86_PUNPCKLBW, &out.op1, xmm);
+		x86_vec_insn(seq, X86_PUNPCKLWD, &out.op1, xmm);
 	}
 
-	seq->gprs[out.op3.gpr].tag = X86_GPRVAL_NONE;
+	out.instruction = X86_PSHUFD;
+	out.size = 0;
+	out.op1.type = X86_OPERAND_CONSTANT;
+	out.op1.constant = 0;
+	out.op2.type = X86_OPERAND_XMM;
+	out.op2.xmm = xmm;
+	out.op3.type = X86_OPERAND_XMM;
+	out.op3.xmm = xmm;
 	vector_append(&seq->seq, &out);
-	tmp_reg_push(seq, i->target, out.op3.gpr);
+}
 
-	(void)cond;
+static int vec_is_invariant(struct ast_node *expr)
+{
+	return expr->tag == NODE_CONSTANT || expr->tag == NODE_IDENTIFIER;
 }
 
+static int x86_vec_expr(struct x86_sequence *seq, struct vec_loop *v,
+                        struct ast_node *expr, int temp);
+
 /*
- * translate_division_instruction:
- * Translate a div or mod IR instruction to x86.
+ * x86_vec_temp:
+ * Compute `expr` into temporary register `temp`, which can be modified.
  */
-static void translate_division_instruction(struct x86_sequence *seq,
-                                           struct ir_instruction *i,
-                                           int cond)
+static int x86_vec_temp(struct x86_sequence *seq, struct vec_loop *v,
+                        struct ast_node *expr, int temp)
 {
-	struct x86_instruction out;
+	struct x86_operand op;
+	int reg;
+
+	reg = x86_vec_expr(seq, v, expr, temp);
+	if (reg != temp) {
+		op.type = X86_OPERAND_XMM;
+		op.xmm = reg;
+		x86_vec_insn(seq, X86_MOVDQA, &op, temp);
+	}
+	return temp;
+}
 
-	if (i->lhs.op_type == IR_OPERAND_AST_NODE)
-		x86_load_value(seq, &i->lhs, X86_GPR_AX);
-	else
-		x86_load_tmp_reg(seq, &i->lhs, X86_GPR_AX);
+/*
+ * x86_vec_expr:
+ * Compute the lanes of `expr` using temporary registers from `temp` up.
+ * Return the register holding the result, which is either `temp` or
+ * an invariant register.
+ */
+static int x86_vec_expr(struct x86_sequence *seq, struct vec_loop *v,
+                        struct ast_node *expr, int temp)
+{
+	struct ast_node *lhs, *rhs;
+	struct x86_operand op;
+	int instruction, reg;
+
+	switch (expr->tag) {
+	case NODE_CONSTANT:
+	case NODE_IDENTIFIER:
+		return x86_vec_inv_reg(vec_invariant_index(v, expr));
+	case EXPR_DEREFERENCE:
+		x86_vec_element(seq, v, vec_access_ptr(v, expr), &op);
+		x86_vec_insn(seq, X86_MOVDQU, &op, temp);
+		return temp;
+	case EXPR_LSHIFT:
+	case EXPR_RSHIFT:
+		reg = x86_vec_temp(seq, v, expr->left, temp);
+		if (expr->tag == EXPR_LSHIFT)
+			instruction = X86_PSLLD;
+		else if (expr->expr_flags.type_flags & QUAL_UNSIGNED)
+			instruction = X86_PSRLD;
+		else
+			instruction = X86_PSRAD;
+		op.type = X86_OPERAND_CONSTANT;
+		op.constant = expr->right->value;
+		x86_vec_insn(seq, instruction, &op, reg);
+		return reg;
+	}
 
-	out.instruction = X86_CDQ;
-	out.size = 0;
-	vector_append(&seq->seq, &out);
+	lhs = expr->left;
+	rhs = expr->right;
+	if (expr->tag != EXPR_SUB && vec_is_invariant(lhs) &&
+	    !vec_is_invariant(rhs)) {
+		lhs = expr->right;
+		rhs = expr->left;
+	}
 
-	if (i->rhs.op_type == IR_OPERAND_AST_NODE)
-		x86_load_value(seq, &i->rhs, X86_GPR_CX);
-	else
-		x86_load_tmp_reg(seq, &i->rhs, X86_GPR_CX);
+	switch (expr->tag) {
+	case EXPR_ADD:
+		instruction = v->elem == 1 ? X86_PADDB : X86_PADDD;
+		break;
+	case EXPR_SUB:
+		instruction = v->elem == 1 ? X86_PSUBB : X86_PSUBD;
+		break;
+	case EXPR_EQ:
+		instruction = v->elem == 1 ? X86_PCMPEQB : X86_PCMPEQD;
+		break;
+	case EXPR_AND:
+		instruction = X86_PAND;
+		break;
+	case EXPR_OR:
+		instruction = X86_POR;
+		break;
+	default:
+		instruction = X86_PXOR;
+		break;
+	}
 
-	out.instruction = X86_DIV;
-	out.size = 0;
-	out.op1.type = X86_OPERAND_GPR;
-	out.op1.gpr = X86_GPR_CX;
+	reg = x86_vec_temp(seq, v, lhs, temp);
+	op.type = X86_OPERAND_XMM;
+	op.xmm = x86_vec_expr(seq, v, rhs, temp + 1);
+	x86_vec_insn(seq, instruction, &op, reg);
 
-	seq->gprs[X86_GPR_AX].tag = X86_GPRVAL_NONE;
-	seq->gprs[X86_GPR_DX].tag = X86_GPRVAL_NONE;
-	vector_append(&seq->seq, &out);
-	tmp_reg_push(seq, i->target,
-	             i->tag == EXPR_DIV ? X86_GPR_AX : X86_GPR_DX);
+	/* Comparisons set lanes to all ones; C requires the value 1. */
+	if (expr->tag == EXPR_EQ) {
+		op.xmm = x86_vec_inv_reg(vec_constant_index(v, 1));
+		x86_vec_insn(seq, X86_PAND, &op, reg);
+	}
 
-	(void)cond;
+	return reg;
 }
 
 /*
- * translate_address_instruction:
- * Translate an address-of IR instruction to x86.
+ * x86_vec_body:
+ * Translate the body of loop `f` to operate on `v->lanes` elements
+ * starting at the index in %ecx. The first pointer stored to is aligned.
  */
-static void translate_address_instruction(struct x86_sequence *seq,
-                                          struct ir_instruction *i,
-                                          int cond)
+static void x86_vec_body(struct x86_sequence *seq, struct vec_loop *v,
+                         struct asg_node_for *f)
+{
+	struct asg_node_statement *s;
+	struct x86_instruction out;
+	struct ast_node *ptr, *aligned;
+	struct graph_node *g;
+	int reg;
+
+	aligned = *(struct ast_node **)v->stores.data;
+	for (g = f->body; g; g = g->next) {
+		s = (struct asg_node_statement *)g;
+		reg = x86_vec_expr(seq, v, s->ast->right, 0);
+
+		ptr = vec_access_ptr(v, s->ast->left);
+		x86_vec_element(seq, v, ptr, &out.op2);
+		out.instruction = strcmp(ptr->lexeme, aligned->lexeme) == 0
+		                  ? X86_MOVDQA : X86_MOVDQU;
+		out.size = 0;
+		out.op1.type = X86_OPERAND_XMM;
+		out.op1.xmm = reg;
+		vector_append(&seq->seq, &out);
+	}
+}
+
+/*
+ * x86_vec_scalar:
+ * Translate a single scalar iteration of loop `f`, jumping
+ * back to `label` if the loop condition still holds.
+ */
+static void x86_vec_scalar(struct x86_sequence *seq, struct ir_sequence *ir,
+                           struct asg_node_for *f, int label)
+{
+	x86_translate(seq, f->body);
+	ir_parse_expr(ir, f->post, 0);
+	x86_translate_expr(seq, ir, 0);
+	ir_clear(ir);
+	x86_translate_branch(seq, ir, f->cond, label, 1);
+}
+
+/*
+ * x86_translate_vector_for:
+ * Translate loop `f`, described by `v`, using SSE2 instructions.
+ * A scalar prologue runs until the first pointer stored to is aligned.
+ * The vector loop then runs while whole vectors of iterations remain and
+ * no pointers overlap, and a scalar epilogue runs any remaining iterations.
+ */
+static void x86_translate_vector_for(struct x86_sequence *seq,
+                                     struct ir_sequence *ir,
+                                     struct asg_node_for *f,
+                                     struct vec_loop *v)
 {
 	struct x86_instruction out;
+	struct ast_node **ptrs;
+	struct vec_invariant *inv;
+	int jexit, jpro, jalign, jvec, jscalar, jepi;
+	size_t i, j;
+
+	jexit = seq->label++;
+	jpro = seq->label++;
+	jalign = seq->label++;
+	jvec = seq->label++;
+	jscalar = seq->label++;
+	jepi = seq->label++;
+
+	ir_parse_expr(ir, f->init, 0);
+	x86_translate_expr(seq, ir, 0);
+	ir_clear(ir);
+	x86_translate_branch(seq, ir, f->cond, jexit, 0);
 
+	/* Scalar prologue, until the first store is aligned. */
+	x86_add_label(seq, jpro);
+	x86_vec_index(seq, v);
+	x86_vec_element(seq, v, *(struct ast_node **)v->stores.data, &out.op1);
 	out.instruction = X86_LEA;
-	out.size = type_size(&i->type);
-	ir_to_x86_operand(seq, &i->lhs, &out.op1, 0);
+	out.size = FCC_WORD_SIZE;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_AX;
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_TEST;
+	out.size = 4;
+	out.op1.type = X86_OPERAND_CONSTANT;
+	out.op1.constant = VEC_BYTES - 1;
+	vector_append(&seq->seq, &out);
+	x86_add_jump(seq, X86_JZ, jalign);
+
+	x86_vec_scalar(seq, ir, f, jpro);
+	x86_add_jump(seq, X86_JMP, jexit);
+
+	/* The index of the first aligned iteration is in %ecx. */
+	x86_add_label(seq, jalign);
+	x86_vec_remaining(seq, v, X86_JG, jscalar);
+
+	ptrs = v->ptrs.data;
+	for (i = 0; i < v->ptrs.nmembs; ++i) {
+		for (j = i + 1; j < v->ptrs.nmembs; ++j)
+			x86_vec_alias_check(seq, v, ptrs[i], ptrs[j], jscalar);
+	}
+
+	for (i = 0; i < v->invariants.nmembs; ++i) {
+		inv = (struct vec_invariant *)v->invariants.data + i;
+		x86_vec_splat(seq, v, inv, x86_vec_inv_reg(i));
+	}
+
+	x86_add_label(seq, jvec);
+	x86_vec_body(seq, v, f);
+
+	out.instruction = X86_ADD;
+	out.size = FCC_WORD_SIZE;
+	out.op1.type = X86_OPERAND_CONSTANT;
+	out.op1.constant = v->lanes;
 	out.op2.type = X86_OPERAND_GPR;
-	out.op2.gpr = X86_GPR_AX;
+	out.op2.gpr = X86_GPR_CX;
+	vector_append(&seq->seq, &out);
+	x86_vec_remaining(seq, v, X86_JLE, jvec);
 
-	seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
+	out.instruction = X86_MOV;
+	out.size = 4;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_CX;
+	out.op2.type = X86_OPERAND_OFFSET;
+	out.op2.offset.off = local_find(seq->locals,
+	                                v->ivar->lexeme)->offset;
+	out.op2.offset.gpr = X86_GPR_BP;
 	vector_append(&seq->seq, &out);
-	tmp_reg_push(seq, i->target, X86_GPR_AX);
 
-	(void)cond;
+	/* Scalar epilogue for the remaining iterations. */
+	x86_add_label(seq, jscalar);
+	x86_translate_branch(seq, ir, f->cond, jexit, 0);
+	x86_add_label(seq, jepi);
+	x86_vec_scalar(seq, ir, f, jepi);
+	x86_add_label(seq, jexit);
 }
 
 /*
- * translate_dereference_instruction:
- * Translate a pointer dereference IR instruction to x86.
+ * x86_translate_for:
+ * Translate a for loop to x86. The condition is tested
+ * both before entering the loop and at the end of its body.
+ * A loop whose body is rarely entered is placed in the cold area.
  */
-static void translate_dereference_instruction(struct x86_sequence *seq,
-                                              struct ir_instruction *i,
-                                              int cond)
+void x86_translate_for(struct x86_sequence *seq,
+                       struct ir_sequence *ir,
+                       struct asg_node_for *f)
 {
-	struct x86_instruction out;
-	int gpr;
+	struct vec_loop v;
+	struct vector hot;
+	int jexit, jstart, outer_break, outer_used, cold;
+
+	/* Vectorized loops only count how often they are reached. */
+	x86_count(seq, f->prof, PROF_ENTRY);
+	if (fcc_flags & FFLAG_TREE_VECTORIZE && vec_analyze_loop(f, &v)) {
+		x86_translate_vector_for(seq, ir, f, &v);
+		vec_loop_destroy(&v);
+		return;
+	}
 
-	x86_gpr_any_reset(seq);
-	if (i->lhs.op_type == IR_OPERAND_AST_NODE)
-		gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
-	else
-		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+	jstart = seq->label++;
+	jexit = seq->label++;
+	outer_break = seq->break_label;
+	outer_used = seq->break_used;
+	cold = f->cond && x86_use_profile(seq) && profile_loop_cold(f->prof);
+
+	if (f->init) {
+		ir_parse_expr(ir, f->init, 0);
+		x86_translate_expr(seq, ir, 0);
+		ir_clear(ir);
+	}
 
-	out.instruction = X86_MOV;
-	out.size = type_size(&i->type);
-	out.op1.type = X86_OPERAND_OFFSET;
-	out.op1.offset.off = 0;
-	out.op1.offset.gpr = gpr;
-	out.op2.type = X86_OPERAND_GPR;
-	out.op2.gpr = gpr;
+	if (cold) {
+		x86_translate_branch(seq, ir, f->cond, jstart, 1);
+		x86_add_label(seq, jexit);
+		x86_begin_cold(seq, &hot);
+	} else if (f->cond) {
+		x86_translate_branch(seq, ir, f->cond, jexit, 0);
+	}
 
-	seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
-	vector_append(&seq->seq, &out);
-	tmp_reg_push(seq, i->target, gpr);
+	x86_add_label(seq, jstart);
+	x86_count(seq, f->prof, PROF_TAKEN);
+	seq->break_label = jexit;
+	x86_translate(seq, f->body);
+	seq->break_label = outer_break;
+	seq->break_used = outer_used;
 
-	(void)cond;
+	if (f->post) {
+		ir_parse_expr(ir, f->post, 0);
+		x86_translate_expr(seq, ir, 0);
+		ir_clear(ir);
+	}
+
+	if (f->cond)
+		x86_translate_branch(seq, ir, f->cond, jstart, 1);
+	else
+		x86_add_jump(seq, X86_JMP, jstart);
+
+	if (cold) {
+		x86_add_jump(seq, X86_JMP, jexit);
+		x86_end_cold(seq, &hot);
+	} else {
+		x86_add_label(seq, jexit);
+	}
 }
 
 /*
- * translate_unary_instruction:
- * Translate a unary arithmetic/logical IR instruction to x86.
+ * x86_translate_while:
+ * Translate while or do-while loop specified by `w` to x86.
+ * A while loop whose body is rarely entered is placed in the cold area.
  */
-static void translate_unary_instruction(struct x86_sequence *seq,
-                                        struct ir_instruction *i,
-                                        int cond)
+void x86_translate_while(struct x86_sequence *seq,
+                         struct ir_sequence *ir,
+                         int type,
+                         struct asg_node_while *w)
 {
-	struct x86_instruction out;
-	int gpr;
+	struct vector hot;
+	int jexit, jstart, outer_break, outer_used, cold;
 
-	x86_gpr_any_reset(seq);
-	if (i->tag == EXPR_LOGICAL_NOT) {
-		gpr = 0;
-		out.instruction = X86_CMP;
-		out.size = 0;
+	jstart = seq->label++;
+	jexit = seq->label++;
+	outer_break = seq->break_label;
+	outer_used = seq->break_used;
+	cold = type == ASG_NODE_WHILE && x86_use_profile(seq) &&
+	       profile_loop_cold(w->prof);
+
+	x86_count(seq, w->prof, PROF_ENTRY);
+	if (cold) {
+		x86_translate_branch(seq, ir, w->cond, jstart, 1);
+		x86_add_label(seq, jexit);
+		x86_begin_cold(seq, &hot);
+	} else if (type == ASG_NODE_WHILE) {
+		x86_translate_branch(seq, ir, w->cond, jexit, 0);
+	}
 
-		if (i->lhs.op_type == IR_OPERAND_AST_NODE)
-			gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
-		else
-			gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+	x86_add_label(seq, jstart);
+	x86_count(seq, w->prof, PROF_TAKEN);
+	seq->break_label = jexit;
+	seq->break_used = 0;
+	x86_translate(seq, w->body);
+	x86_translate_branch(seq, ir, w->cond, jstart, 1);
 
-		out.op1.type = X86_OPERAND_CONSTANT;
-		out.op1.constant = 0;
-		out.op2.type = X86_OPERAND_GPR;
-		out.op2.constant = gpr;
-		seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
-		vector_append(&seq->seq, &out);
+	/* A do-while loop only needs an exit label if it is broken out of. */
+	if (cold) {
+		x86_add_jump(seq, X86_JMP, jexit);
+		x86_end_cold(seq, &hot);
+	} else if (type == ASG_NODE_WHILE || seq->break_used) {
+		x86_add_label(seq, jexit);
+	}
 
-		if (cond)
-			return;
+	seq->break_label = outer_break;
+	seq->break_used = outer_used;
+}
 
-		out.instruction = X86_SETNE;
-		out.op1.type = X86_OPERAND_GPR;
-		out.op1.gpr = X86_GPR_AL;
-		vector_append(&seq->seq, &out);
+/* Minimum number of cases dispatched through a jump table. */
+#define SWITCH_TABLE_MIN_CASES  4
+/* Minimum percentage of the values in a jump table's range with a case. */
+#define SWITCH_TABLE_MIN_DENSITY 40
+/* Maximum number of distinct targets reached through bit tests. */
+#define SWITCH_BT_MAX_TARGETS   3
+/* Maximum number of clusters tested in sequence rather than bisected. */
+#define SWITCH_LINEAR_MAX       3
+
+struct x86_case {
+	long long value;
+	int label;
+	struct graph_node *node;
+};
 
-		out.instruction = X86_MOVZB;
-		out.op2.type = X86_OPERAND_GPR;
-		out.op2.gpr = X86_GPR_AX;
-		seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
-	} else if (i->tag == EXPR_UNARY_PLUS) {
-		/* Just load the value. */
-		if (i->lhs.op_type == IR_OPERAND_AST_NODE)
-			gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
-		else
-			gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
-		tmp_reg_push(seq, i->target, gpr);
-		return;
-	} else {
-		if (i->lhs.op_type == IR_OPERAND_AST_NODE)
-			gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
-		else
-			gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+enum {
+	CLUSTER_CASE,
+	CLUSTER_TABLE,
+	CLUSTER_BITS
+};
 
-		out.instruction = i->tag == EXPR_NOT ? X86_NOT : X86_NEG;
-		out.size = 0;
-		out.op1.type = X86_OPERAND_GPR;
-		out.op1.gpr = gpr;
-		seq->gprs[out.op1.gpr].tag = X86_GPRVAL_NONE;
-	}
+/* A run of consecutive cases which are dispatched together. */
+struct x86_cluster {
+	int kind;
+	size_t first;
+	size_t last;
+};
 
-	vector_append(&seq->seq, &out);
-	tmp_reg_push(seq, i->target, gpr);
+static int case_cmp(const void *a, const void *b)
+{
+	const struct x86_case *x = a;
+	const struct x86_case *y = b;
+
+	return x->value < y->value ? -1 : x->value > y->value;
 }
 
 /*
- * num_args:
- * Count the number of arguments in argument list AST `arglist`.
+ * x86_collect_cases:
+ * Assign labels to all of the case labels within switch body `g`, storing
+ * them in `cases`. Consecutive labels share a single x86 label.
  */
-static int num_args(struct ast_node *arglist)
+static void x86_collect_cases(struct x86_sequence *seq, struct vector *cases,
+                              int is_unsigned, struct graph_node *g)
 {
-	if (!arglist)
-		return 0;
-	else if (arglist->tag == EXPR_COMMA)
-		return num_args(arglist->left) + num_args(arglist->right);
-	else
-		return 1;
+	struct asg_node_conditional *c;
+	struct x86_case xc;
+	int label;
+
+	for (label = -1; g; g = g->next) {
+		switch (g->type) {
+		case ASG_NODE_CASE:
+			if (label == -1)
+				label = seq->label++;
+			if (!((struct asg_node_case *)g)->value) {
+				if (seq->default_label != -1) {
+					error_case_default();
+					exit(1);
+				}
+				seq->default_label = label;
+				continue;
+			}
+			xc.value = ((struct asg_node_case *)g)->value->value;
+			xc.value = is_unsigned ? (long long)(unsigned int)xc.value
+			                       : (long long)(int)xc.value;
+			xc.label = label;
+			xc.node = g;
+			vector_append(cases, &xc);
+			continue;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			x86_collect_cases(seq, cases, is_unsigned, c->succ);
+			x86_collect_cases(seq, cases, is_unsigned, c->fail);
+			break;
+		case ASG_NODE_FOR:
+			x86_collect_cases(seq, cases, is_unsigned,
+			                  ((struct asg_node_for *)g)->body);
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			x86_collect_cases(seq, cases, is_unsigned,
+			                  ((struct asg_node_while *)g)->body);
+			break;
+		}
+		label = -1;
+	}
+}
+
+/* table_dense: check if cases `first` to `last` form a dense jump table */
+static int table_dense(struct x86_case *c, size_t first, size_t last)
+{
+	long long range;
+
+	range = c[last].value - c[first].value + 1;
+	return (long long)(last - first + 1) * 100
+	       >= range * SWITCH_TABLE_MIN_DENSITY;
+}
+
+/* bits_base: the value subtracted from the switch value for a bit test */
+static long long bits_base(struct x86_case *c, size_t first, size_t last)
+{
+	/* Small non-negative values can be tested without being rebased. */
+	return c[first].value >= 0 && c[last].value < 32 ? 0 : c[first].value;
 }
 
 /*
- * translate_function_call:
- * Translate a function call to x86 and fix the stack afterwards.
+ * bits_profitable:
+ * Check if cases `first` to `last` fit in a bit mask, reach few enough
+ * targets, and are numerous enough to be worth testing together.
  */
-static void translate_function_call(struct x86_sequence *seq,
-                                    struct ir_instruction *i,
-                                    int cond)
+static int bits_profitable(struct x86_case *c, size_t first, size_t last)
 {
-	struct x86_instruction out;
-	int argc;
+	int targets[SWITCH_BT_MAX_TARGETS];
+	int ntargets, t;
+	size_t i, n;
 
-	out.instruction = X86_CALL;
-	out.size = 0;
-	out.op1.type = X86_OPERAND_FUNC;
-	out.op1.func = i->lhs.node->lexeme;
-	vector_append(&seq->seq, &out);
+	if (c[last].value - bits_base(c, first, last) >= 32)
+		return 0;
 
-	/* Correct for argument pushes. */
-	argc = num_args(i->rhs.node);
-	x86_shrink_stack(seq, argc << 2);
+	ntargets = 0;
+	for (i = first; i <= last; ++i) {
+		for (t = 0; t < ntargets && targets[t] != c[i].label; ++t)
+			;
+		if (t == ntargets) {
+			if (ntargets == SWITCH_BT_MAX_TARGETS)
+				return 0;
+			targets[ntargets++] = c[i].label;
+		}
+	}
 
-	tmp_reg_push(seq, i->target, X86_GPR_AX);
-	(void)cond;
+	/* Each additional target costs a mask load, test and jump. */
+	n = last - first + 1;
+	return n >= (size_t)(ntargets == 1 ? 3 : ntargets == 2 ? 5 : 6);
 }
 
 /*
- * translate_test_instruction:
- * Translate an IR test instruction to x86.
+ * x86_switch_clusters:
+ * Partition sorted cases `c` into clusters, greedily choosing the longest
+ * dense jump table or bit test starting at each case. Return the number
+ * of clusters written to `clusters`.
  */
-static void translate_test_instruction(struct x86_sequence *seq,
-                                       struct ir_instruction *i,
-                                       int cond)
+static size_t x86_switch_clusters(struct x86_case *c, size_t n,
+                                  struct x86_cluster *clusters)
 {
-	struct x86_instruction out;
-	int gpr;
+	struct x86_cluster *cl;
+	size_t i, j, ncl;
+
+	for (i = ncl = 0; i < n; i = cl->last + 1) {
+		cl = &clusters[ncl++];
+		cl->kind = CLUSTER_CASE;
+		cl->first = cl->last = i;
+
+		for (j = n; j-- > i + SWITCH_TABLE_MIN_CASES - 1; ) {
+			if (table_dense(c, i, j)) {
+				cl->kind = CLUSTER_TABLE;
+				cl->last = j;
+				break;
+			}
+		}
+		if (cl->kind != CLUSTER_CASE)
+			continue;
 
-	x86_gpr_any_reset(seq);
-	if (i->lhs.op_type == IR_OPERAND_AST_NODE)
-		gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
-	else
-		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+		for (j = n; j-- > i + 2; ) {
+			if (bits_profitable(c, i, j)) {
+				cl->kind = CLUSTER_BITS;
+				cl->last = j;
+				break;
+			}
+		}
+	}
 
-	out.instruction = X86_TEST;
-	out.size = 0;
-	out.op1.type = X86_OPERAND_GPR;
-	out.op1.constant = gpr;
+	return ncl;
+}
+
+/* x86_switch_cmp: compare register `gpr` with constant `value` */
+static void x86_switch_cmp(struct x86_sequence *seq, int gpr, long long value)
+{
+	struct x86_instruction out;
+
+	out.instruction = X86_CMP;
+	out.size = 4;
+	out.op1.type = X86_OPERAND_CONSTANT;
+	out.op1.constant = (int)value;
 	out.op2.type = X86_OPERAND_GPR;
 	out.op2.gpr = gpr;
-
-	seq->gprs[out.op2.gpr].tag = X86_GPRVAL_NONE;
 	vector_append(&seq->seq, &out);
-	(void)cond;
 }
 
 /*
- * translate_push_instruction:
- * Translate a push instruction to x86.
+ * x86_switch_range:
+ * Jump to `miss` if the switch value in %eax lies outside of [base, top].
+ * Return the register holding the value relative to `base`.
  */
-static void translate_push_instruction(struct x86_sequence *seq,
-                                       struct ir_instruction *i,
-                                       int cond)
+static int x86_switch_range(struct x86_sequence *seq, long long base,
+                            long long top, int miss)
 {
 	struct x86_instruction out;
 	int gpr;
 
-	out.instruction = X86_PUSH;
-	out.size = 0;
-
-	x86_gpr_any_reset(seq);
-	if (i->lhs.op_type == IR_OPERAND_AST_NODE) {
-		if (i->lhs.node->tag == NODE_CONSTANT) {
-			out.op1.type = X86_OPERAND_CONSTANT;
-			out.op1.constant = i->lhs.node->value;
-		} else {
-			gpr = x86_load_value(seq, &i->lhs, X86_GPR_ANY);
-			out.op1.type = X86_OPERAND_GPR;
-			out.op1.constant = gpr;
-		}
-	} else {
-		gpr = x86_load_tmp_reg(seq, &i->lhs, X86_GPR_ANY);
+	gpr = X86_GPR_AX;
+	if (base) {
+		/* Keep the original value for the clusters tested after. */
+		out.instruction = X86_MOV;
+		out.size = 4;
 		out.op1.type = X86_OPERAND_GPR;
-		out.op1.constant = gpr;
-	}
-
-	vector_append(&seq->seq, &out);
-	(void)cond;
-}
+		out.op1.gpr = X86_GPR_AX;
+		out.op2.type = X86_OPERAND_GPR;
+		out.op2.gpr = X86_GPR_CX;
+		vector_append(&seq->seq, &out);
 
-static void translate_load_instruction(struct x86_sequence *seq,
-                                       struct ir_instruction *i,
-                                       int cond)
-{
-	x86_load_value(seq, &i->lhs, X86_GPR_AX);
-	tmp_reg_push(seq, i->target, X86_GPR_AX);
-	(void)cond;
-}
+		out.instruction = X86_SUB;
+		out.op1.type = X86_OPERAND_CONSTANT;
+		out.op1.constant = (int)base;
+		vector_append(&seq->seq, &out);
+		gpr = X86_GPR_CX;
+	}
 
-static void (*tr_func[])(struct x86_sequence *, struct ir_instruction *, int) = {
-	[EXPR_ASSIGN]                   = translate_assign_instruction,
-	[EXPR_LOGICAL_OR]               = NULL,
-	[EXPR_LOGICAL_AND]              = NULL,
-	[EXPR_OR]                       = translate_arithmetic_instruction,
-	[EXPR_XOR]                      = translate_arithmetic_instruction,
-	[EXPR_AND]                      = translate_arithmetic_instruction,
-	[EXPR_EQ]                       = translate_comparison_instruction,
-	[EXPR_NE]                       = translate_comparison_instruction,
-	[EXPR_LT]                       = translate_comparison_instruction,
-	[EXPR_GT]                       = translate_comparison_instruction,
-	[EXPR_LE]                       = translate_comparison_instruction,
-	[EXPR_GE]                       = translate_comparison_instruction,
-	[EXPR_LSHIFT]                   = translate_shift_instruction,
-	[EXPR_RSHIFT]                   = translate_shift_instruction,
-	[EXPR_ADD]                      = translate_arithmetic_instruction,
-	[EXPR_SUB]                      = translate_arithmetic_instruction,
-	[EXPR_MULT]                     = translate_multiplicative_instruction,
-	[EXPR_DIV]                      = translate_division_instruction,
-	[EXPR_MOD]                      = translate_division_instruction,
-	[EXPR_ADDRESS]                  = translate_address_instruction,
-	[EXPR_DEREFERENCE]              = translate_dereference_instruction,
-	[EXPR_UNARY_PLUS]               = translate_unary_instruction,
-	[EXPR_UNARY_MINUS]              = translate_unary_instruction,
-	[EXPR_NOT]                      = translate_unary_instruction,
-	[EXPR_LOGICAL_NOT]              = translate_unary_instruction,
-	[EXPR_FUNC]                     = translate_function_call,
-	[IR_TEST]                       = translate_test_instruction,
-	[IR_PUSH]                       = translate_push_instruction,
-	[IR_LOAD]                       = translate_load_instruction
-};
+	/* A single unsigned comparison also catches values below `base`. */
+	x86_switch_cmp(seq, gpr, top - base);
+	x86_add_jump(seq, X86_JA, miss);
+
+	return gpr;
+}
 
 /*
- * x86_add_jump:
- * Create a jump instruction of type `type` to jump to label ID `label`.
+ * x86_switch_table_rel:
+ * Jump through entry `gpr` of table `label`, which holds the offsets
+ * of its targets from the table. The table is addressed relative to
+ * the instruction pointer, so the code is position independent.
  */
-static void x86_add_jump(struct x86_sequence *seq, int type, int label)
+static void x86_switch_table_rel(struct x86_sequence *seq, int label, int gpr)
 {
 	struct x86_instruction out;
 
-	out.instruction = type;
-	out.size = 0;
-	out.op1.type = X86_OPERAND_LABEL;
+	out.instruction = X86_LEA;
+	out.size = 8;
+	out.op1.type = X86_OPERAND_RIP_LABEL;
 	out.op1.label = label;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_DX;
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_MOVSLQ;
+	out.size = 0;
+	out.op1.type = X86_OPERAND_INDEX;
+	out.op1.index.base = X86_GPR_DX;
+	out.op1.index.index = gpr;
+	out.op1.index.scale = 4;
+	out.op1.index.disp = 0;
+	out.op2.gpr = gpr;
+	vector_append(&seq->seq, &out);
 
+	out.instruction = X86_ADD;
+	out.size = 8;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_DX;
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_JMP;
+	out.size = 0;
+	out.op1.gpr = gpr;
 	vector_append(&seq->seq, &out);
 }
 
 /*
- * x86_add_label:
- * Create an instruction represting a label with ID `label`.
+ * x86_switch_table:
+ * Dispatch the cases of cluster `cl` through a jump table.
  */
-static void x86_add_label(struct x86_sequence *seq, int label)
+static void x86_switch_table(struct x86_sequence *seq, struct x86_case *c,
+                             struct x86_cluster *cl, int miss, int dflt)
 {
+	struct x86_jump_table t;
 	struct x86_instruction out;
+	long long base;
+	size_t i;
+	int gpr;
 
-	out.instruction = X86_LABEL;
+	base = c[cl->first].value;
+	gpr = x86_switch_range(seq, base, c[cl->last].value, miss);
+
+	t.label = seq->label++;
+	t.ntargets = c[cl->last].value - base + 1;
+	t.targets = malloc(t.ntargets * sizeof *t.targets);
+	for (i = 0; i < (size_t)t.ntargets; ++i)
+		t.targets[i] = dflt;
+	for (i = cl->first; i <= cl->last; ++i)
+		t.targets[c[i].value - base] = c[i].label;
+	vector_append(&seq->tables, &t);
+
+	if (fcc_m64) {
+		x86_switch_table_rel(seq, t.label, gpr);
+		return;
+	}
+
+	out.instruction = X86_JMP;
 	out.size = 0;
-	out.lnum = label;
+	out.op1.type = X86_OPERAND_JUMP_TABLE;
+	out.op1.table.label = t.label;
+	out.op1.table.gpr = gpr;
 	vector_append(&seq->seq, &out);
 }
 
 /*
- * x86_translate_expr:
- * Translate a single expression statement to x86.
+ * x86_switch_bits:
+ * Dispatch the cases of cluster `cl` by testing the switch value
+ * against a mask of the case values leading to each target.
  */
-static void x86_translate_expr(struct x86_sequence *seq,
-                               struct ir_sequence *ir,
-                               int cond)
+static void x86_switch_bits(struct x86_sequence *seq, struct x86_case *c,
+                            struct x86_cluster *cl, int miss, int dflt)
 {
-	struct ir_instruction *i;
+	struct x86_instruction out;
+	unsigned int mask;
+	long long base;
+	size_t i, j;
+	int gpr;
 
-	VECTOR_ITER(&ir->seq, i)
-		tr_func[i->tag](seq, i, cond);
-}
+	base = bits_base(c, cl->first, cl->last);
+	gpr = x86_switch_range(seq, base, c[cl->last].value, miss);
 
-void x86_translate_cond(struct x86_sequence *seq,
-                        struct ir_sequence *ir,
-                        struct asg_node_conditional *cond)
-{
-	struct ir_instruction i;
-	int jfail, jend;
+	for (i = cl->first; i <= cl->last; ++i) {
+		/* Each target is tested once, at its first case. */
+		for (j = cl->first; j < i && c[j].label != c[i].label; ++j)
+			;
+		if (j != i)
+			continue;
 
-	jfail = seq->label++;
-	jend = cond->fail ? seq->label++ : -1;
+		mask = 0;
+		for (j = i; j <= cl->last; ++j) {
+			if (c[j].label == c[i].label)
+				mask |= 1U << (c[j].value - base);
+		}
 
-	ir_parse_expr(ir, cond->cond, 1);
-	x86_translate_expr(seq, ir, 1);
+		/* Every value in range goes to the same target. */
+		if (mask == 0xFFFFFFFFU >> (31 - (c[cl->last].value - base))) {
+			x86_add_jump(seq, X86_JMP, c[i].label);
+			return;
+		}
 
-	vector_pop(&ir->seq, &i);
-	x86_add_jump(seq, x86_inverse_jumps[i.tag], jfail);
-	x86_translate(seq, cond->succ);
+		out.instruction = X86_MOV;
+		out.size = 4;
+		out.op1.type = X86_OPERAND_UCONSTANT;
+		out.op1.constant = mask;
+		out.op2.type = X86_OPERAND_GPR;
+		out.op2.gpr = X86_GPR_DX;
+		vector_append(&seq->seq, &out);
 
-	if (cond->fail) {
-		x86_add_jump(seq, X86_JMP, jend);
-		x86_add_label(seq, jfail);
-		x86_translate(seq, cond->fail);
+		out.instruction = X86_BT;
+		out.op1.type = X86_OPERAND_GPR;
+		out.op1.gpr = gpr;
+		vector_append(&seq->seq, &out);
+
+		x86_add_jump(seq, X86_JC, c[i].label);
 	}
+	x86_add_jump(seq, X86_JMP, dflt);
+}
 
-	x86_add_label(seq, cond->fail ? jend : jfail);
+/*
+ * x86_switch_lower:
+ * Dispatch the value in %eax to clusters `lo` to `hi` through a balanced
+ * binary search, testing small groups of clusters in sequence. Values
+ * which do not match any cluster go to `dflt`.
+ */
+static void x86_switch_lower(struct x86_sequence *seq, struct x86_case *c,
+                             struct x86_cluster *cl, size_t lo, size_t hi,
+                             int dflt, int is_unsigned)
+{
+	size_t i, mid;
+	int miss;
+
+	if (hi - lo < SWITCH_LINEAR_MAX) {
+		for (i = lo; i <= hi; ++i) {
+			miss = i == hi ? dflt : seq->label++;
+			switch (cl[i].kind) {
+			case CLUSTER_CASE:
+				x86_switch_cmp(seq, X86_GPR_AX,
+				               c[cl[i].first].value);
+				x86_add_jump(seq, X86_JE, c[cl[i].first].label);
+				if (i == hi)
+					x86_add_jump(seq, X86_JMP, dflt);
+				continue;
+			case CLUSTER_TABLE:
+				x86_switch_table(seq, c, &cl[i], miss, dflt);
+				break;
+			case CLUSTER_BITS:
+				x86_switch_bits(seq, c, &cl[i], miss, dflt);
+				break;
+			}
+			if (i != hi)
+				x86_add_label(seq, miss);
+		}
+		return;
+	}
+
+	mid = lo + (hi - lo + 1) / 2;
+	miss = seq->label++;
+	x86_switch_cmp(seq, X86_GPR_AX, c[cl[mid].first].value);
+	x86_add_jump(seq, is_unsigned ? X86_JAE : X86_JGE, miss);
+	x86_switch_lower(seq, c, cl, lo, mid - 1, dflt, is_unsigned);
+	x86_add_label(seq, miss);
+	x86_switch_lower(seq, c, cl, mid, hi, dflt, is_unsigned);
 }
 
-void x86_translate_for(struct x86_sequence *seq,
-                       struct ir_sequence *ir,
-                       struct asg_node_for *f)
+/*
+ * x86_translate_switch:
+ * Translate switch statement `s` to x86. Cases are grouped into jump
+ * tables, bit tests and single comparisons, which are then dispatched
+ * to through a binary search on their values.
+ */
+void x86_translate_switch(struct x86_sequence *seq,
+                          struct ir_sequence *ir,
+                          struct asg_node_switch *s)
 {
-	struct ir_instruction i;
-	int jexit, jtest;
+	struct x86_cluster *clusters;
+	struct vector cases, *outer_cases;
+	int outer_default, outer_break, outer_used, is_unsigned, jend;
+	struct x86_case *c;
+	size_t i, ncl;
+
+	outer_cases = seq->cases;
+	outer_default = seq->default_label;
+	outer_break = seq->break_label;
+	outer_used = seq->break_used;
+
+	is_unsigned = (s->expr->expr_flags.type_flags & QUAL_UNSIGNED)
+	              || FLAGS_IS_PTR(s->expr->expr_flags.type_flags);
+	vector_init(&cases, sizeof (struct x86_case));
+	seq->default_label = -1;
+	x86_collect_cases(seq, &cases, is_unsigned, s->body);
+
+	c = cases.data;
+	qsort(c, cases.nmembs, sizeof *c, case_cmp);
+	for (i = 1; i < cases.nmembs; ++i) {
+		if (c[i].value == c[i - 1].value) {
+			error_case_duplicate((int)c[i].value);
+			exit(1);
+		}
+	}
 
-	jtest = seq->label++;
-	jexit = seq->label++;
+	jend = seq->label++;
+	if (seq->default_label == -1)
+		seq->default_label = jend;
+
+	x86_load_expr(seq, ir, s->expr, X86_GPR_AX);
+	if (cases.nmembs) {
+		clusters = malloc(cases.nmembs * sizeof *clusters);
+		ncl = x86_switch_clusters(c, cases.nmembs, clusters);
+		x86_switch_lower(seq, c, clusters, 0, ncl - 1,
+		                 seq->default_label, is_unsigned);
+		free(clusters);
+	} else {
+		x86_add_jump(seq, X86_JMP, seq->default_label);
+	}
+	memset(seq->gprs, 0, sizeof seq->gprs);
 
-	ir_parse_expr(ir, f->init, 0);
-	x86_translate_expr(seq, ir, 0);
-	ir_clear(ir);
+	seq->cases = &cases;
+	seq->break_label = jend;
+	x86_translate(seq, s->body);
 
-	x86_add_label(seq, jtest);
-	ir_parse_expr(ir, f->cond, 1);
-	x86_translate_expr(seq, ir, 1);
+	/* A break at the end of the body falls through to the end label. */
+	x86_end_jump(seq, jend);
+	x86_add_label(seq, jend);
 
-	vector_pop(&ir->seq, &i);
-	x86_add_jump(seq, x86_inverse_jumps[i.tag], jexit);
-	ir_clear(ir);
+	vector_destroy(&cases);
+	seq->cases = outer_cases;
+	seq->default_label = outer_default;
+	seq->break_label = outer_break;
+	seq->break_used = outer_used;
+}
 
-	x86_translate(seq, f->body);
+/*
+ * x86_translate_case:
+ * Place the label of case or default label `c` of the innermost switch.
+ */
+static void x86_translate_case(struct x86_sequence *seq,
+                               struct asg_node_case *c)
+{
+	struct x86_instruction *last;
+	struct x86_case *xc;
+	int label;
 
-	ir_parse_expr(ir, f->post, 0);
-	x86_translate_expr(seq, ir, 0);
-	x86_add_jump(seq, X86_JMP, jtest);
+	if (!seq->cases) {
+		error_case_outside(!c->value);
+		exit(1);
+	}
 
-	x86_add_label(seq, jexit);
+	label = seq->default_label;
+	if (c->value) {
+		VECTOR_ITER(seq->cases, xc) {
+			if (xc->node == (struct graph_node *)c)
+				break;
+		}
+		label = xc->label;
+	}
+
+	/* Consecutive labels share the same x86 label. */
+	last = (struct x86_instruction *)seq->seq.data + seq->seq.nmembs - 1;
+	if (last->instruction == X86_LABEL && last->lnum == label)
+		return;
+
+	x86_add_label(seq, label);
 }
 
 /*
- * x86_translate_while:
- * Translate while or do-while loop specified by `w` to x86.
+ * x86_translate_tail_call:
+ * Translate `return call` by overwriting the function's own arguments with
+ * those of the call and jumping to the callee, which then returns directly
+ * to our caller. Return 0 if the call cannot be made in place, which is also
+ * the case if the address of a local or parameter may be passed to it.
  */
-void x86_translate_while(struct x86_sequence *seq,
-                         struct ir_sequence *ir,
-                         int type,
-                         struct asg_node_while *w)
+static int x86_translate_tail_call(struct x86_sequence *seq,
+                                   struct ir_sequence *ir,
+                                   struct ast_node *call)
 {
-	struct ir_instruction i;
-	int jexit, jstart;
+	struct x86_instruction out;
+	int argc, nreg, nstack, i;
 
-	jstart = seq->label++;
-	if (type == ASG_NODE_WHILE)
-		jexit = seq->label++;
+	if (!(fcc_flags & FFLAG_SIBLING_CALLS) || call->tag != EXPR_FUNC ||
+	    call->left->tag != NODE_IDENTIFIER ||
+	    builtin_find(call->left->lexeme) != -1 ||
+	    local_any_addressed(seq->locals))
+		return 0;
 
-	ir_parse_expr(ir, w->cond, 1);
-	vector_get(&ir->seq, ir->seq.nmembs - 1, &i);
+	/* The callee's stack arguments must fit in our own argument area. */
+	argc = ir_num_args(call->right);
+	nreg = ir_register_args(&call->left->expr_flags, call->right);
+	nstack = ir_stack_words(call->right, nreg);
+	if (nstack > seq->nstack)
+		return 0;
+
+	/* Evaluate and push all of the arguments, but don't make the call. */
+	ir_parse_expr(ir, call, 0);
+	vector_pop(&ir->seq, NULL);
+	x86_translate_expr(seq, ir, 0);
+	x86_load_register_args(seq, call->right, nreg, NULL);
 
-	if (type == ASG_NODE_WHILE) {
-		x86_translate_expr(seq, ir, 1);
-		x86_add_jump(seq, x86_inverse_jumps[i.tag], jexit);
+	/* Arguments are pushed from right to left, so the first is on top. */
+	out.instruction = X86_POP;
+	out.size = FCC_WORD_SIZE;
+	out.op1.type = X86_OPERAND_OFFSET;
+	out.op1.offset.gpr = X86_GPR_BP;
+	for (i = 0; i < nstack; ++i) {
+		out.op1.offset.off = (2 + i) * FCC_WORD_SIZE;
+		vector_append(&seq->seq, &out);
+	}
+	memset(seq->gprs, 0, sizeof seq->gprs);
+	seq->pushed -= nstack;
+	if (fcc_m64 && argc > nreg)
+		x86_shrink_stack(seq, x86_pop_pad(seq));
+
+	if (strcmp(call->left->lexeme, seq->fname) == 0 &&
+	    argc == seq->nparams) {
+		/* Self-recursion: loop back to the start of the function. */
+		x86_shrink_stack(seq, seq->tmp_reg.size * FCC_WORD_SIZE);
+		x86_add_jump(seq, X86_JMP, seq->body_label);
+		seq->body_used = 1;
+		return 1;
 	}
 
-	x86_add_label(seq, jstart);
-	x86_translate(seq, w->body);
-	x86_translate_expr(seq, ir, 1);
-	x86_add_jump(seq, x86_jumps[i.tag], jstart);
+	out.instruction = X86_MOV;
+	out.size = FCC_WORD_SIZE;
+	out.op1.type = X86_OPERAND_GPR;
+	out.op1.gpr = X86_GPR_BP;
+	out.op2.type = X86_OPERAND_GPR;
+	out.op2.gpr = X86_GPR_SP;
+	vector_append(&seq->seq, &out);
 
-	if (type == ASG_NODE_WHILE)
-		x86_add_label(seq, jexit);
+	out.instruction = X86_POP;
+	out.size = 0;
+	out.op1.gpr = X86_GPR_BP;
+	vector_append(&seq->seq, &out);
+
+	out.instruction = X86_JMP;
+	out.op1.type = X86_OPERAND_FUNC;
+	out.op1.func = call->left->lexeme;
+	vector_append(&seq->seq, &out);
+
+	return 1;
 }
 
 /*
@@ -1155,25 +4502,60 @@ void x86_translate_ret(struct x86_sequence *seq,
                        struct ir_sequence *ir,
                        struct asg_node_return *ret)
 {
-	struct ir_instruction i;
-	struct ir_operand op;
-
 	if (ret->retval) {
-		if (ret->retval->tag <= NODE_STRLIT) {
-			/* retval is a terminal, not an expression */
-			op.op_type = IR_OPERAND_AST_NODE;
-			op.node = ret->retval;
-			x86_load_value(seq, &op, X86_GPR_AX);
-		} else {
-			ir_parse_expr(ir, ret->retval, 0);
-			x86_translate_expr(seq, ir, 0);
+		if (x86_translate_tail_call(seq, ir, ret->retval))
+			return;
+		x86_load_expr(seq, ir, ret->retval, X86_GPR_AX);
+	}
+
+	x86_add_jump(seq, X86_JMP, seq->exit_label);
+	seq->exit_used++;
+}
+
+/*
+ * asg_has_case:
+ * Check if statement `g`, or any statement following it if `list` is set,
+ * contains a label of the enclosing switch.
+ */
+static int asg_has_case(struct graph_node *g, int list)
+{
+	struct asg_node_conditional *c;
 
-			vector_pop(&ir->seq, &i);
-			op.op_type = IR_OPERAND_TEMP_REG;
-			op.reg = i.target;
-			x86_load_tmp_reg(seq, &op, X86_GPR_AX);
+	for (; g; g = list ? g->next : NULL) {
+		switch (g->type) {
+		case ASG_NODE_CASE:
+			return 1;
+		case ASG_NODE_CONDITIONAL:
+			c = (struct asg_node_conditional *)g;
+			if (asg_has_case(c->succ, 1) || asg_has_case(c->fail, 1))
+				return 1;
+			break;
+		case ASG_NODE_FOR:
+			if (asg_has_case(((struct asg_node_for *)g)->body, 1))
+				return 1;
+			break;
+		case ASG_NODE_WHILE:
+		case ASG_NODE_DO_WHILE:
+			if (asg_has_case(((struct asg_node_while *)g)->body, 1))
+				return 1;
+			break;
 		}
 	}
+
+	return 0;
+}
+
+/*
+ * x86_next_reachable:
+ * Find the first statement from `g` onwards which can be reached
+ * after a jump, i.e. one which contains a case label.
+ */
+static struct graph_node *x86_next_reachable(struct graph_node *g)
+{
+	while (g && !asg_has_case(g, 0))
+		g = g->next;
+
+	return g;
 }
 
 /*
@@ -1185,7 +4567,6 @@ void x86_translate(struct x86_sequence *seq, struct graph_node *g)
 	struct ir_sequence ir;
 
 	ir_init(&ir);
-	memset(seq->gprs, 0, sizeof seq->gprs);
 
 	while (g) {
 		ir_clear(&ir);
@@ -1209,13 +4590,32 @@ void x86_translate(struct x86_sequence *seq, struct graph_node *g)
 			x86_translate_while(seq, &ir, g->type,
 			                    (struct asg_node_while *)g);
 			break;
+		case ASG_NODE_SWITCH:
+			x86_translate_switch(seq, &ir,
+			                     (struct asg_node_switch *)g);
+			break;
+		case ASG_NODE_CASE:
+			x86_translate_case(seq, (struct asg_node_case *)g);
+			break;
+		case ASG_NODE_BREAK:
+			if (seq->break_label == -1) {
+				error_break_outside();
+				exit(1);
+			}
+			x86_add_jump(seq, X86_JMP, seq->break_label);
+			seq->break_used = 1;
+			g = x86_next_reachable(g->next);
+			continue;
 		case ASG_NODE_RETURN:
 			x86_translate_ret(seq, &ir, (struct asg_node_return *)g);
-			break;
+			g = x86_next_reachable(g->next);
+			continue;
 		}
 		g = g->next;
 	}
 
+	if (ir.depth > seq->temp_depth)
+		seq->temp_depth = ir.depth;
 	ir_destroy(&ir);
 }
 
@@ -1226,6 +4626,8 @@ static char *x86_instructions[] = {
 	[X86_LEA]       = "lea",
 	[X86_ADD]       = "add",
 	[X86_SUB]       = "sub",
+	[X86_ADC]       = "adc",
+	[X86_SBB]       = "sbb",
 	[X86_OR]        = "or",
 	[X86_XOR]       = "xor",
 	[X86_AND]       = "and",
@@ -1236,12 +4638,20 @@ static char *x86_instructions[] = {
 	[X86_DIV]       = "div",
 	[X86_NOT]       = "not",
 	[X86_NEG]       = "neg",
+	[X86_INC]       = "inc",
+	[X86_DEC]       = "dec",
 	[X86_SETE]      = "sete",
 	[X86_SETG]      = "setg",
 	[X86_SETGE]     = "setge",
 	[X86_SETL]      = "setl",
 	[X86_SETLE]     = "setle",
 	[X86_SETNE]     = "setne",
+	[X86_CMOVE]     = "cmove",
+	[X86_CMOVG]     = "cmovg",
+	[X86_CMOVGE]    = "cmovge",
+	[X86_CMOVL]     = "cmovl",
+	[X86_CMOVLE]    = "cmovle",
+	[X86_CMOVNE]    = "cmovne",
 	[X86_JMP]       = "jmp",
 	[X86_JE]        = "je",
 	[X86_JG]        = "jg",
@@ -1251,36 +4661,104 @@ static char *x86_instructions[] = {
 	[X86_JNE]       = "jne",
 	[X86_JZ]        = "jz",
 	[X86_JNZ]       = "jnz",
+	[X86_JA]        = "ja",
+	[X86_JAE]       = "jae",
+	[X86_JB]        = "jb",
+	[X86_JBE]       = "jbe",
+	[X86_JC]        = "jc",
 	[X86_MOVZB]     = "movzb",
+	[X86_MOVSB]     = "movsb",
+	[X86_MOVSLQ]    = "movslq",
 	[X86_CMP]       = "cmp",
 	[X86_TEST]      = "test",
+	[X86_BT]        = "bt",
 	[X86_CDQ]       = "cdq",
+	[X86_RDTSC]     = "rdtsc",
+	[X86_MOVS]      = "movs",
+	[X86_STOS]      = "stos",
+	[X86_REP_MOVS]  = "rep movs",
+	[X86_REP_STOS]  = "rep stos",
 	[X86_RET]       = "ret",
-	[X86_CALL]      = "call"
+	[X86_CALL]      = "call",
+	[X86_MOVD]      = "movd",
+	[X86_MOVDQA]    = "movdqa",
+	[X86_MOVDQU]    = "movdqu",
+	[X86_PSHUFD]    = "pshufd",
+	[X86_PUNPCKLBW] = "punpcklbw",
+	[X86_PUNPCKLWD] = "punpcklwd",
+	[X86_PADDB]     = "paddb",
+	[X86_PADDD]     = "paddd",
+	[X86_PSUBB]     = "psubb",
+	[X86_PSUBD]     = "psubd",
+	[X86_PAND]      = "pand",
+	[X86_POR]       = "por",
+	[X86_PXOR]      = "pxor",
+	[X86_PCMPEQB]   = "pcmpeqb",
+	[X86_PCMPEQD]   = "pcmpeqd",
+	[X86_PSLLD]     = "pslld",
+	[X86_PSRLD]     = "psrld",
+	[X86_PSRAD]     = "psrad"
 };
 
 static char *x86_size_suffix[] = {
 	[0]     = "",
 	[1]     = "b",
 	[2]     = "w",
-	[4]     = "l"
+	[4]     = "l",
+	[8]     = "q"
+};
+
+static char *x86_gprs64[X86_NUM_GPRS] = {
+	"rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rsp", "rbp",
+	"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+
+static char *x86_gprs32[X86_NUM_GPRS] = {
+	"eax", "ebx", "ecx", "edx", "esi", "edi", "esp", "ebp",
+	"r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
 };
 
-static char *x86_gprs[] = {
-	[X86_GPR_AL] = "al",
-	[X86_GPR_AH] = "ah",
-	[X86_GPR_AX] = "eax",
-	[X86_GPR_BX] = "ebx",
-	[X86_GPR_CL] = "cl",
-	[X86_GPR_CH] = "ch",
-	[X86_GPR_CX] = "ecx",
-	[X86_GPR_DX] = "edx",
-	[X86_GPR_SI] = "esi",
-	[X86_GPR_DI] = "edi",
-	[X86_GPR_SP] = "esp",
-	[X86_GPR_BP] = "ebp"
+static char *x86_gprs16[X86_NUM_GPRS] = {
+	"ax", "bx", "cx", "dx", "si", "di", "sp", "bp",
+	"r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"
 };
 
+static char *x86_gprs8[X86_NUM_GPRS] = {
+	"al", "bl", "cl", "dl", "sil", "dil", "spl", "bpl",
+	"r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"
+};
+
+static char *x86_byte_gprs[] = {
+	[X86_GPR_AL - X86_GPR_AL] = "al",
+	[X86_GPR_AH - X86_GPR_AL] = "ah",
+	[X86_GPR_CH - X86_GPR_AL] = "ch",
+	[X86_GPR_CL - X86_GPR_AL] = "cl"
+};
+
+/*
+ * x86_gpr_name:
+ * Return the name of register `gpr` when accessed as `size` bytes,
+ * or as a full machine word if `size` is 0.
+ */
+static const char *x86_gpr_name(int gpr, int size)
+{
+	if (gpr >= X86_GPR_AL)
+		return x86_byte_gprs[gpr - X86_GPR_AL];
+
+	switch (size) {
+	case 1:
+		return x86_gprs8[gpr];
+	case 2:
+		return x86_gprs16[gpr];
+	case 4:
+		return x86_gprs32[gpr];
+	case 8:
+		return x86_gprs64[gpr];
+	default:
+		return fcc_m64 ? x86_gprs64[gpr] : x86_gprs32[gpr];
+	}
+}
+
 static int x86_num_operands(int instruction)
 {
 	switch (instruction) {
@@ -1289,6 +4767,8 @@ static int x86_num_operands(int instruction)
 	case X86_DIV:
 	case X86_NOT:
 	case X86_NEG:
+	case X86_INC:
+	case X86_DEC:
 	case X86_SETE:
 	case X86_SETG:
 	case X86_SETGE:
@@ -1304,12 +4784,19 @@ static int x86_num_operands(int instruction)
 	case X86_JNE:
 	case X86_JZ:
 	case X86_JNZ:
+	case X86_JA:
+	case X86_JAE:
+	case X86_JB:
+	case X86_JBE:
+	case X86_JC:
 	case X86_CALL:
 		return 1;
 	case X86_MOV:
 	case X86_LEA:
 	case X86_ADD:
 	case X86_SUB:
+	case X86_ADC:
+	case X86_SBB:
 	case X86_OR:
 	case X86_XOR:
 	case X86_AND:
@@ -1317,23 +4804,206 @@ static int x86_num_operands(int instruction)
 	case X86_SHR:
 	case X86_SAR:
 	case X86_MOVZB:
+	case X86_MOVSB:
+	case X86_MOVSLQ:
+	case X86_CMOVE:
+	case X86_CMOVG:
+	case X86_CMOVGE:
+	case X86_CMOVL:
+	case X86_CMOVLE:
+	case X86_CMOVNE:
 	case X86_CMP:
 	case X86_TEST:
+	case X86_BT:
+	case X86_MOVD:
+	case X86_MOVDQA:
+	case X86_MOVDQU:
+	case X86_PUNPCKLBW:
+	case X86_PUNPCKLWD:
+	case X86_PADDB:
+	case X86_PADDD:
+	case X86_PSUBB:
+	case X86_PSUBD:
+	case X86_PAND:
+	case X86_POR:
+	case X86_PXOR:
+	case X86_PCMPEQB:
+	case X86_PCMPEQD:
+	case X86_PSLLD:
+	case X86_PSRLD:
+	case X86_PSRAD:
 		return 2;
 	case X86_IMUL:
+	case X86_PSHUFD:
 		return 3;
 	default:
 		return 0;
 	};
 }
 
-static int x86_write_operand(struct x86_operand *op, char *out)
+/* x86_is_cond_jump: check if `instruction` is a conditional jump */
+int x86_is_cond_jump(int instruction)
+{
+	switch (instruction) {
+	case X86_JE:
+	case X86_JG:
+	case X86_JGE:
+	case X86_JL:
+	case X86_JLE:
+	case X86_JNE:
+	case X86_JZ:
+	case X86_JNZ:
+	case X86_JA:
+	case X86_JAE:
+	case X86_JB:
+	case X86_JBE:
+	case X86_JC:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* x86_is_jump: check if `instruction` is a jump, conditional or not */
+int x86_is_jump(int instruction)
+{
+	return instruction == X86_JMP || x86_is_cond_jump(instruction);
+}
+
+/* x86_operand_count: return the number of operands `inst` is written with */
+int x86_operand_count(struct x86_instruction *inst)
+{
+	/* The three operand form of imul requires an immediate multiplier. */
+	if (inst->instruction == X86_IMUL &&
+	    inst->op1.type != X86_OPERAND_CONSTANT &&
+	    inst->op1.type != X86_OPERAND_UCONSTANT)
+		return 2;
+
+	return x86_num_operands(inst->instruction);
+}
+
+/* x86_access_width: return the number of bytes of memory accessed by `inst` */
+int x86_access_width(struct x86_instruction *inst)
+{
+	switch (inst->instruction) {
+	case X86_MOVZB:
+	case X86_MOVSB:
+		return 1;
+	case X86_MOVSLQ:
+	case X86_MOVD:
+		return 4;
+	case X86_MOVDQA:
+	case X86_MOVDQU:
+	case X86_PSHUFD:
+	case X86_PUNPCKLBW:
+	case X86_PUNPCKLWD:
+	case X86_PADDB:
+	case X86_PADDD:
+	case X86_PSUBB:
+	case X86_PSUBD:
+	case X86_PAND:
+	case X86_POR:
+	case X86_PXOR:
+	case X86_PCMPEQB:
+	case X86_PCMPEQD:
+	case X86_PSLLD:
+	case X86_PSRLD:
+	case X86_PSRAD:
+		return 16;
+	default:
+		return inst->size ? inst->size : FCC_WORD_SIZE;
+	}
+}
+
+/*
+ * x86_dest_operand:
+ * Return the operand written by `inst`, or NULL if it has none. `rmw` is
+ * set if the operand is also read.
+ */
+struct x86_operand *x86_dest_operand(struct x86_instruction *inst, int *rmw)
+{
+	*rmw = 0;
+	switch (inst->instruction) {
+	case X86_MOV:
+	case X86_LEA:
+	case X86_MOVZB:
+	case X86_MOVSB:
+	case X86_MOVSLQ:
+	case X86_MOVD:
+	case X86_MOVDQA:
+	case X86_MOVDQU:
+		return &inst->op2;
+	case X86_POP:
+	case X86_SETE:
+	case X86_SETG:
+	case X86_SETGE:
+	case X86_SETL:
+	case X86_SETLE:
+	case X86_SETNE:
+		return &inst->op1;
+	case X86_PSHUFD:
+		return &inst->op3;
+	case X86_IMUL:
+		if (x86_operand_count(inst) == 3)
+			return &inst->op3;
+		*rmw = 1;
+		return &inst->op2;
+	case X86_NOT:
+	case X86_NEG:
+	case X86_INC:
+	case X86_DEC:
+		*rmw = 1;
+		return &inst->op1;
+	/* A conditional move may leave its destination unchanged. */
+	case X86_CMOVE:
+	case X86_CMOVG:
+	case X86_CMOVGE:
+	case X86_CMOVL:
+	case X86_CMOVLE:
+	case X86_CMOVNE:
+	case X86_ADD:
+	case X86_SUB:
+	case X86_ADC:
+	case X86_SBB:
+	case X86_OR:
+	case X86_XOR:
+	case X86_AND:
+	case X86_SHL:
+	case X86_SHR:
+	case X86_SAR:
+	case X86_PUNPCKLBW:
+	case X86_PUNPCKLWD:
+	case X86_PADDB:
+	case X86_PADDD:
+	case X86_PSUBB:
+	case X86_PSUBD:
+	case X86_PAND:
+	case X86_POR:
+	case X86_PXOR:
+	case X86_PCMPEQB:
+	case X86_PCMPEQD:
+	case X86_PSLLD:
+	case X86_PSRLD:
+	case X86_PSRAD:
+		*rmw = 1;
+		return &inst->op2;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * x86_write_operand:
+ * Write operand `op` of an instruction with operands of `size` bytes.
+ * Memory addresses always use full word registers.
+ */
+static int x86_write_operand(struct x86_operand *op, int size, char *out)
 {
 	int n;
 
 	switch (op->type) {
 	case X86_OPERAND_GPR:
-		n = sprintf(out, "%%%s", x86_gprs[op->gpr]);
+		n = sprintf(out, "%%%s", x86_gpr_name(op->gpr, size));
 		break;
 	case X86_OPERAND_CONSTANT:
 		n = sprintf(out, "$%d", op->constant);
@@ -1350,7 +5020,37 @@ static int x86_write_operand(struct x86_operand *op, char *out)
 	case X86_OPERAND_OFFSET:
 		n = sprintf(out, "%d(%%%s)",
 		            op->offset.off,
-		            x86_gprs[op->offset.gpr]);
+		            x86_gpr_name(op->offset.gpr, 0));
+		break;
+	case X86_OPERAND_JUMP_TABLE:
+		n = sprintf(out, "*.L%d(,%%%s,4)", op->table.label,
+		            x86_gpr_name(op->table.gpr, 0));
+		break;
+	case X86_OPERAND_RIP_LABEL:
+		n = sprintf(out, ".L%d(%%rip)", op->label);
+		break;
+	case X86_OPERAND_COUNTER:
+		n = sprintf(out, fcc_m64 ? ".Lprof+%d(%%rip)" : ".Lprof+%d",
+		            x86_counter_offset(op->counter));
+		break;
+	case X86_OPERAND_SYMBOL:
+		n = sprintf(out, fcc_m64 ? "%s+%d(%%rip)" : "%s+%d",
+		            op->sym.name, op->sym.off);
+		break;
+	case X86_OPERAND_STRING:
+		/* 64-bit strings are only addressed by lea. */
+		n = sprintf(out, fcc_m64 ? ".Lstr%d(%%rip)" : "$.Lstr%d",
+		            op->label);
+		break;
+	case X86_OPERAND_XMM:
+		n = sprintf(out, "%%xmm%d", op->xmm);
+		break;
+	case X86_OPERAND_INDEX:
+		n = op->index.disp ? sprintf(out, "%d", op->index.disp) : 0;
+		n += sprintf(out + n, "(%%%s,%%%s,%d)",
+		             x86_gpr_name(op->index.base, 0),
+		             x86_gpr_name(op->index.index, 0),
+		             op->index.scale);
 		break;
 	default:
 		n = 0;
@@ -1363,11 +5063,12 @@ static int x86_write_operand(struct x86_operand *op, char *out)
 /*
  * x86_write_instruction:
  * Write a single x86 instruction to buffer `out`.
- * `out` is assumed to be at least 64 bytes long.
+ * `out` is assumed to be at least 64 bytes longer than any symbol
+ * names used by the instruction.
  */
 int x86_write_instruction(struct x86_instruction *inst, char *out)
 {
-	int operands;
+	int operands, size;
 	const char *start;
 
 	if (inst->instruction == X86_LABEL)
@@ -1375,22 +5076,33 @@ int x86_write_instruction(struct x86_instruction *inst, char *out)
 	else if (inst->instruction == X86_NAMED_LABEL)
 		return sprintf(out, "%s:\n", inst->lname);
 
-	operands = x86_num_operands(inst->instruction);
+	operands = x86_operand_count(inst);
 	start = out;
 
 	out += sprintf(out, "\t%s%s",
 	               x86_instructions[inst->instruction],
 	               x86_size_suffix[inst->size]);
 
+	/* movslq extends a 32-bit source into a 64-bit register. */
+	size = inst->instruction == X86_MOVSLQ || inst->instruction == X86_MOVD
+	       ? 4 : inst->size;
+
 	if (operands >= 1) {
 		*out++ = ' ';
-		out += x86_write_operand(&inst->op1, out);
+		/* Indirect jumps and calls through a register. */
+		if ((inst->instruction == X86_JMP ||
+		     inst->instruction == X86_CALL) &&
+		    inst->op1.type == X86_OPERAND_GPR)
+			*out++ = '*';
+		out += x86_write_operand(&inst->op1, size, out);
 		if (operands >= 2) {
+			size = inst->instruction == X86_MOVSLQ ? 8 : inst->size;
 			out += sprintf(out, ", ");
-			out += x86_write_operand(&inst->op2, out);
+			out += x86_write_operand(&inst->op2, size, out);
 			if (operands == 3) {
 				out += sprintf(out, ", ");
-				out += x86_write_operand(&inst->op3, out);
+				out += x86_write_operand(&inst->op3, size,
+				                         out);
 			}
 		}
 	}
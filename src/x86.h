@@ -32,6 +32,8 @@ enum {
 	X86_LEA,
 	X86_ADD,
 	X86_SUB,
+	X86_ADC,
+	X86_SBB,
 	X86_OR,
 	X86_XOR,
 	X86_AND,
@@ -42,12 +44,20 @@ enum {
 	X86_DIV,
 	X86_NOT,
 	X86_NEG,
+	X86_INC,
+	X86_DEC,
 	X86_SETE,
 	X86_SETG,
 	X86_SETGE,
 	X86_SETL,
 	X86_SETLE,
 	X86_SETNE,
+	X86_CMOVE,
+	X86_CMOVG,
+	X86_CMOVGE,
+	X86_CMOVL,
+	X86_CMOVLE,
+	X86_CMOVNE,
 	X86_JMP,
 	X86_JE,
 	X86_JG,
@@ -57,12 +67,43 @@ enum {
 	X86_JNE,
 	X86_JZ,
 	X86_JNZ,
+	X86_JA,
+	X86_JAE,
+	X86_JB,
+	X86_JBE,
+	X86_JC,
 	X86_MOVZB,
+	X86_MOVSB,
+	X86_MOVSLQ,
 	X86_CMP,
 	X86_TEST,
+	X86_BT,
 	X86_CDQ,
+	X86_RDTSC,
+	X86_MOVS,
+	X86_STOS,
+	X86_REP_MOVS,
+	X86_REP_STOS,
 	X86_RET,
 	X86_CALL,
+	X86_MOVD,
+	X86_MOVDQA,
+	X86_MOVDQU,
+	X86_PSHUFD,
+	X86_PUNPCKLBW,
+	X86_PUNPCKLWD,
+	X86_PADDB,
+	X86_PADDD,
+	X86_PSUBB,
+	X86_PSUBD,
+	X86_PAND,
+	X86_POR,
+	X86_PXOR,
+	X86_PCMPEQB,
+	X86_PCMPEQD,
+	X86_PSLLD,
+	X86_PSRLD,
+	X86_PSRAD,
 	X86_LABEL,
 	X86_NAMED_LABEL
 };
@@ -76,6 +117,14 @@ enum {
 	X86_GPR_DI,
 	X86_GPR_SP,
 	X86_GPR_BP,
+	X86_GPR_R8,
+	X86_GPR_R9,
+	X86_GPR_R10,
+	X86_GPR_R11,
+	X86_GPR_R12,
+	X86_GPR_R13,
+	X86_GPR_R14,
+	X86_GPR_R15,
 	X86_GPR_AL,
 	X86_GPR_AH,
 	X86_GPR_CH,
@@ -89,20 +138,44 @@ enum {
 	X86_OPERAND_UCONSTANT,
 	X86_OPERAND_LABEL,
 	X86_OPERAND_FUNC,
-	X86_OPERAND_OFFSET
+	X86_OPERAND_OFFSET,
+	X86_OPERAND_JUMP_TABLE,
+	X86_OPERAND_RIP_LABEL,
+	X86_OPERAND_INDEX,
+	X86_OPERAND_XMM,
+	X86_OPERAND_COUNTER,
+	X86_OPERAND_SYMBOL,
+	X86_OPERAND_STRING
 };
 
 struct x86_operand {
 	int type;
 	union {
 		int gpr;
+		int xmm;
 		int constant;
-		int label;
+		int label;      /* also the label of a pooled string */
+		int counter;    /* profile counter */
 		char *func;
 		struct {
-			int16_t off;
-			int16_t gpr;
+			int off;
+			int gpr;
 		} offset;
+		struct {
+			int label;
+			int gpr;
+		} table;
+		/* disp(base, index, scale), with a scale of 1, 2, 4 or 8 */
+		struct {
+			int16_t base;
+			int16_t index;
+			int scale;
+			int disp;
+		} index;
+		struct {
+			const char *name;
+			int off;
+		} sym;
 	};
 };
 
@@ -133,26 +206,66 @@ struct x86_gprval {
 	};
 };
 
+/* Number of general purpose registers available on the target. */
+#define X86_NUM_GPRS (X86_GPR_R15 + 1)
+
+/* Jump table for a switch statement, emitted to the read-only data section. */
+struct x86_jump_table {
+	int label;
+	int ntargets;
+	int *targets;
+};
+
 struct x86_sequence {
 	struct vector seq;
+	struct vector cold;     /* rarely run code, placed after the function */
+	int in_cold;            /* instructions are being placed in `cold` */
+	char *tsc_record;       /* label of the function's timing record */
+	int tsc_slot;           /* frame offset of the entry timestamp */
 	struct local_vars *locals;
-	struct x86_gprval gprs[8];
+	struct x86_gprval gprs[X86_NUM_GPRS];
 	struct {
 		int size;
 		int *regs;
+		struct type_information *types;
 	} tmp_reg;
 	int label;
+	const char *fname;      /* function being translated */
+	int nparams;
+	int nstack;             /* words of parameters passed on the stack */
+	size_t frame;           /* bytes reserved for local variables */
+	size_t body;            /* index of the function body label */
+	int body_label;         /* target of self-recursive tail calls */
+	int body_used;
+	int exit_label;         /* target of return statements */
+	int exit_used;
+	int ir_labels;          /* label corresponding to IR label 0 */
+	int cond_target;        /* label corresponding to IR_COND_TARGET */
+	int break_label;        /* target of break statements, or -1 */
+	int break_used;
+	struct vector *cases;   /* labels of the innermost switch statement */
+	int default_label;
+	struct vector tables;   /* jump tables used by the function */
+	int pushed;             /* arguments pushed for calls not yet made */
+	unsigned int pads;      /* stack alignment padding of pending calls */
+	int temp_depth;         /* most IR temporaries live in an expression */
 };
 
 void x86_seq_init(struct x86_sequence *seq, struct local_vars *locals);
 void x86_seq_destroy(struct x86_sequence *seq);
 
-void x86_begin_function(struct x86_sequence *seq, const char *fname);
+void x86_begin_function(struct x86_sequence *seq, const char *fname,
+                        struct ast_node *params, int nreg, size_t bytes);
 void x86_end_function(struct x86_sequence *seq);
 void x86_grow_stack(struct x86_sequence *seq, size_t bytes);
 void x86_shrink_stack(struct x86_sequence *seq, size_t bytes);
 void x86_translate(struct x86_sequence *seq, struct graph_node *g);
 
+int x86_is_jump(int instruction);
+int x86_is_cond_jump(int instruction);
+int x86_operand_count(struct x86_instruction *inst);
+int x86_access_width(struct x86_instruction *inst);
+struct x86_operand *x86_dest_operand(struct x86_instruction *inst, int *rmw);
 int x86_write_instruction(struct x86_instruction *inst, char *out);
 
 #endif /* FCC_X86_H */